@@ -25,6 +25,10 @@
 #endif
 #ifdef STDC_HEADERS
 # include <ctype.h>
+# include <stdlib.h>
+#endif
+#ifdef HAVE_ERRNO_H
+# include <errno.h>
 #endif
 #ifdef HAVE_STRING_H
 # include <string.h>
@@ -36,6 +40,13 @@
 #include "db_driver.h"
 #include "sb_list.h"
 #include "sb_percentile.h"
+#include "sb_metrics.h"
+#include "sb_outliers.h"
+#include "sb_watchdog.h"
+#include "sb_trace.h"
+#include "sb_perf.h"
+#include "sb_profile.h"
+#include "sb_sysstat.h"
 
 /* Query length limit for bulk insert queries */
 #define BULK_PACKET_SIZE (512*1024)
@@ -43,6 +54,15 @@
 /* How many rows to insert before COMMITs (used in bulk insert) */
 #define ROWS_BEFORE_COMMIT 1000
 
+/* Maximum length of a non-string value in bulk insert rows */
+#define BULK_MAX_VALUE_LENGTH 64
+
+/* Longest query text eligible for the statement cache */
+#define STMT_CACHE_MAX_QUERY 4096
+
+/* Maximum number of literals replaced with parameters in a cached query */
+#define STMT_CACHE_MAX_PARAMS 64
+
 typedef struct {
   unsigned long   read_ops;
   unsigned long   write_ops;
@@ -50,14 +70,68 @@ typedef struct {
   unsigned long   transactions;
   unsigned long   errors;
   unsigned long   reconnects;
+  unsigned long   stmt_cache_hits;
+  unsigned long   stmt_cache_misses;
+  unsigned long   async_queries;
+  unsigned long long async_ns;       /* total time from send to result */
+  unsigned long long async_max_ns;
   pthread_mutex_t stat_mutex;
 } db_thread_stat_t;
 
+/* Query sent with db_send_query() or db_send_execute() */
+
+typedef struct db_pending
+{
+  struct timespec    start;   /* when the query was sent */
+  db_query_type_t    type;
+  db_stmt_t          *stmt;   /* NULL for queries sent as text */
+  char               *query;  /* copy of the query text for outlier reports */
+  int                rc;      /* result of synchronous execution */
+  unsigned long long nrows;   /* rows returned by synchronous execution */
+} db_pending_t;
+
+/* Statement cache entry */
+
+typedef struct db_stmt_cache_entry
+{
+  char                       *key;     /* normalized query and param types */
+  unsigned int               keylen;
+  unsigned int               hash;
+  db_stmt_t                  *stmt;    /* NULL if the query cannot be prepared */
+  struct db_stmt_cache_entry *hnext;   /* next entry in the hash chain */
+  sb_list_item_t             listitem; /* position in the LRU list */
+} db_stmt_cache_entry_t;
+
+/*
+  Per-connection cache of statements prepared from the text passed to
+  db_query(), with literals replaced by parameter markers
+*/
+
+typedef struct db_stmt_cache
+{
+  db_stmt_cache_entry_t **buckets;
+  unsigned int          nbuckets;      /* always a power of 2 */
+  unsigned int          count;
+  sb_list_t             lru;           /* most recently used first */
+
+  /* Literals extracted from the last query */
+  unsigned int          nparams;
+  db_bind_t             binds[STMT_CACHE_MAX_PARAMS];
+  long long             ints[STMT_CACHE_MAX_PARAMS];
+  double                doubles[STMT_CACHE_MAX_PARAMS];
+  unsigned long         lens[STMT_CACHE_MAX_PARAMS];
+  char                  key[STMT_CACHE_MAX_QUERY + STMT_CACHE_MAX_PARAMS + 1];
+  char                  strings[STMT_CACHE_MAX_QUERY];
+} db_stmt_cache_t;
+
 /* Global variables */
 db_globals_t db_globals;
 
 sb_percentile_t local_percentile;
 
+/* Sliding windows over intermediate percentiles */
+static sb_percentile_windows_t local_windows;
+
 /* Used in intermediate reports */
 static unsigned long last_transactions;
 static unsigned long last_read_ops;
@@ -78,9 +152,16 @@ static sb_timer_t *fetch_timers;
 static int db_parse_arguments(void);
 static void db_free_row(db_row_t *);
 static int db_bulk_do_insert(db_conn_t *, int);
-static db_query_type_t db_get_query_type(const char *);
+static int db_bulk_make_room(db_conn_t *, unsigned int);
 static void db_update_thread_stats(int, db_query_type_t);
 static void db_reset_stats(void);
+static void db_check_outlier(db_conn_t *, struct timespec *, const char *,
+                             db_bind_t *, unsigned int);
+static db_stmt_cache_t *db_stmt_cache_create(void);
+static void db_stmt_cache_free(db_stmt_cache_t *);
+static db_stmt_t *db_stmt_cache_get(db_conn_t *, const char *);
+static int db_check_pending(db_conn_t *, const char *);
+static void db_count_error(db_conn_t *);
 
 /* DB layer arguments */
 
@@ -99,6 +180,16 @@ static sb_arg_t db_args[] =
     "db-debug", "print database-specific debug information",
     SB_ARG_TYPE_FLAG, "off"
   },
+  {
+    "db-stmt-cache", "number of statements per connection to prepare "
+    "automatically from db_query() text, with literals replaced by "
+    "parameters (0 to execute all queries as text)", SB_ARG_TYPE_INT, "0"
+  },
+  {
+    "db-sessions", "number of database sessions multiplexed by each thread "
+    "with an event loop (0 to use one blocking connection per thread)",
+    SB_ARG_TYPE_INT, "0"
+  },
   {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
 };
 
@@ -131,6 +222,11 @@ int db_register(void)
 #ifdef USE_PGSQL
   register_driver_pgsql(&drivers);
 #endif
+#ifdef USE_SQLITE
+  register_driver_sqlite(&drivers);
+#endif
+  /* Always available, must be the last one */
+  register_driver_mock(&drivers);
 
   /* Register command line options for each driver */
   SB_LIST_FOR_EACH(pos, &drivers)
@@ -185,6 +281,7 @@ db_driver_t *db_init(const char *name)
 {
   db_driver_t    *drv = NULL;
   sb_list_item_t *pos;
+  sb_list_item_t *next;
   unsigned int   i;
   
   if (SB_LIST_IS_EMPTY(&drivers))
@@ -199,9 +296,11 @@ db_driver_t *db_init(const char *name)
   if (name == NULL && db_globals.driver == NULL)
   {
     drv = SB_LIST_ENTRY(SB_LIST_ITEM_NEXT(&drivers), db_driver_t, listitem);
-    /* Is it the only driver available? */
-    if (SB_LIST_ITEM_NEXT(&(drv->listitem)) ==
-        SB_LIST_ITEM_PREV(&(drv->listitem)))
+    /* Is it the only driver available? The mock driver does not count */
+    next = SB_LIST_ITEM_NEXT(&(drv->listitem));
+    if (next == &drivers ||
+        (SB_LIST_ITEM_NEXT(next) == &drivers &&
+         !strcmp(SB_LIST_ENTRY(next, db_driver_t, listitem)->sname, "mock")))
       log_text(LOG_INFO, "No DB drivers specified, using %s", drv->sname);
     else
     {
@@ -232,6 +331,20 @@ db_driver_t *db_init(const char *name)
   if (drv->ops.init())
     return NULL;
 
+  if (db_globals.stmt_cache_size > 0)
+  {
+    drv_caps_t caps;
+
+    if (db_describe(drv, &caps))
+      return NULL;
+    if (!caps.prepared_statements || db_globals.ps_mode == DB_PS_MODE_DISABLE)
+    {
+      log_text(LOG_WARNING, "prepared statements are not available, "
+               "--db-stmt-cache is ignored");
+      db_globals.stmt_cache_size = 0;
+    }
+  }
+
   /* Initialize per-thread stats */
   thread_stats = (db_thread_stat_t *)malloc(sb_globals.num_threads *
                                             sizeof(db_thread_stat_t));
@@ -255,6 +368,12 @@ db_driver_t *db_init(const char *name)
   if (sb_percentile_init(&local_percentile, 100000, 1.0, 1e13))
     return NULL;
 
+  if (sb_percentile_windows_init(&local_windows, &local_percentile,
+                                 sb_globals.report_windows,
+                                 sb_globals.n_report_windows,
+                                 sb_globals.report_interval))
+    return NULL;
+
   return drv;
 }
 
@@ -289,6 +408,14 @@ db_conn_t *db_connect(db_driver_t *drv)
     return NULL;
   }
 
+  if (db_globals.stmt_cache_size > 0 &&
+      (con->stmt_cache = db_stmt_cache_create()) == NULL)
+  {
+    drv->ops.disconnect(con);
+    free(con);
+    return NULL;
+  }
+
   return con;
 }
 
@@ -313,6 +440,24 @@ int db_disconnect(db_conn_t *con)
   if (drv == NULL)
     return 1;
 
+  if (con->stmt_cache != NULL)
+  {
+    db_stmt_cache_free(con->stmt_cache);
+    con->stmt_cache = NULL;
+  }
+
+  if (con->pending != NULL)
+  {
+    for (; con->pending_cnt > 0; con->pending_cnt--)
+    {
+      free(con->pending[con->pending_first].query);
+      con->pending_first = (con->pending_first + 1) % con->pending_size;
+    }
+    free(con->pending);
+    con->pending = NULL;
+    con->pending_size = 0;
+  }
+
   rc = drv->ops.disconnect(con);
   free(con);
 
@@ -355,6 +500,16 @@ int db_bind_param(db_stmt_t *stmt, db_bind_t *params, unsigned int len)
   if (con == NULL || con->driver == NULL)
     return 1;
 
+  /* Keep a copy of parameters to print them for outliers */
+  if (sb_outliers_enabled)
+  {
+    free(stmt->params);
+    stmt->params = (db_bind_t *)malloc(len * sizeof(db_bind_t));
+    if (stmt->params != NULL)
+      memcpy(stmt->params, params, len * sizeof(db_bind_t));
+    stmt->params_len = stmt->params != NULL ? len : 0;
+  }
+
   return con->driver->ops.bind_param(stmt, params, len);
 }
 
@@ -380,6 +535,7 @@ db_result_set_t *db_execute(db_stmt_t *stmt)
 {
   db_conn_t       *con = stmt->connection;
   db_result_set_t *rs = &con->rs;
+  struct timespec start;
 
   if (con == NULL || con->driver == NULL)
   {
@@ -387,12 +543,32 @@ db_result_set_t *db_execute(db_stmt_t *stmt)
     return NULL;
   }
 
+  if (db_check_pending(con, "db_execute"))
+    return NULL;
+
   memset(rs, 0, sizeof(db_result_set_t));
 
   rs->statement = stmt;
   rs->connection = con;
 
+  if (sb_outliers_enabled)
+    SB_GETTIME(&start);
+
+  if (sb_watchdog_enabled)
+    sb_watchdog_driver_enter(con->thread_id, stmt->query);
+  if (sb_profile_enabled)
+    sb_profile_enter(con->thread_id, SB_PROF_DRIVER);
+
   con->db_errno = con->driver->ops.execute(stmt, rs);
+
+  if (sb_profile_enabled)
+    sb_profile_exit(con->thread_id);
+  if (sb_watchdog_enabled)
+    sb_watchdog_driver_exit(con->thread_id);
+
+  if (sb_outliers_enabled)
+    db_check_outlier(con, &start, stmt->query, stmt->params,
+                     stmt->params_len);
   if (con->db_errno != SB_DB_ERROR_NONE)
   {
     log_text(LOG_DEBUG, "ERROR: exiting db_execute(), driver's execute method failed");
@@ -400,10 +576,14 @@ db_result_set_t *db_execute(db_stmt_t *stmt)
     if (con->db_errno == SB_DB_ERROR_RECONNECTED)
     {
       thread_stats[con->thread_id].reconnects++;
+      sb_metrics_inc(con->thread_id, SB_CNT_RECONNECT);
       con->db_errno = SB_DB_ERROR_RESTART_TRANSACTION;
     }
     else if (con->db_errno == SB_DB_ERROR_RESTART_TRANSACTION)
+    {
       thread_stats[con->thread_id].errors++;
+      sb_metrics_inc(con->thread_id, SB_CNT_ERROR);
+    }
 
     return NULL;
   }
@@ -414,6 +594,432 @@ db_result_set_t *db_execute(db_stmt_t *stmt)
 }
 
 
+/* Execute prepared statement for a single row of a batch, discarding results */
+
+
+static int db_execute_batch_row(db_stmt_t *stmt, db_bind_t *params,
+                                unsigned int nparams, db_result_set_t *rs)
+{
+  db_driver_t *drv = stmt->connection->driver;
+  int         rc;
+
+  if (nparams > 0 && drv->ops.bind_param(stmt, params, nparams))
+    return SB_DB_ERROR_FAILED;
+
+  rc = drv->ops.execute(stmt, rs);
+  if (rc != SB_DB_ERROR_NONE)
+    return rc;
+
+  rc = drv->ops.store_results(rs);
+  drv->ops.free_results(rs);
+
+  return rc;
+}
+
+
+/*
+  Execute prepared statement once for each of nrows parameter sets stored
+  one after another in params, nparams values per set. Uses the bulk
+  execution mechanism of the driver if it has one, and executes the sets one
+  by one otherwise. Result sets are discarded. Parameters bound with
+  db_bind_param() have to be bound again before the next db_execute().
+*/
+
+
+int db_execute_batch(db_stmt_t *stmt, db_bind_t *params, unsigned int nparams,
+                     unsigned int nrows)
+{
+  db_conn_t       *con = stmt->connection;
+  db_result_set_t *rs;
+  struct timespec start;
+  unsigned int    i;
+
+  if (con == NULL || con->driver == NULL)
+  {
+    log_text(LOG_DEBUG, "ERROR: exiting db_execute_batch(), uninitialized connection");
+    return SB_DB_ERROR_FAILED;
+  }
+
+  if (db_check_pending(con, "db_execute_batch"))
+    return SB_DB_ERROR_FAILED;
+
+  if (nrows == 0)
+    return SB_DB_ERROR_NONE;
+
+  rs = &con->rs;
+  memset(rs, 0, sizeof(db_result_set_t));
+
+  rs->statement = stmt;
+  rs->connection = con;
+
+  if (sb_outliers_enabled)
+    SB_GETTIME(&start);
+
+  if (sb_watchdog_enabled)
+    sb_watchdog_driver_enter(con->thread_id, stmt->query);
+  if (sb_profile_enabled)
+    sb_profile_enter(con->thread_id, SB_PROF_DRIVER);
+
+  if (con->driver->ops.execute_batch != NULL)
+    con->db_errno = con->driver->ops.execute_batch(stmt, params, nparams,
+                                                   nrows);
+  else
+  {
+    con->db_errno = SB_DB_ERROR_NONE;
+    for (i = 0; i < nrows && con->db_errno == SB_DB_ERROR_NONE; i++)
+      con->db_errno = db_execute_batch_row(stmt, params + i * nparams,
+                                           nparams, rs);
+  }
+
+  if (sb_profile_enabled)
+    sb_profile_exit(con->thread_id);
+  if (sb_watchdog_enabled)
+    sb_watchdog_driver_exit(con->thread_id);
+
+  if (sb_outliers_enabled)
+    db_check_outlier(con, &start, stmt->query, NULL, 0);
+
+  if (con->db_errno != SB_DB_ERROR_NONE)
+  {
+    log_text(LOG_DEBUG, "ERROR: exiting db_execute_batch(), driver's execute method failed");
+    db_count_error(con);
+
+    return con->db_errno;
+  }
+
+  for (i = 0; i < nrows; i++)
+    db_update_thread_stats(con->thread_id, stmt->type);
+
+  return SB_DB_ERROR_NONE;
+}
+
+
+/* Update error counters after a failed query */
+
+
+static void db_count_error(db_conn_t *con)
+{
+  if (con->db_errno == SB_DB_ERROR_RECONNECTED)
+  {
+    thread_stats[con->thread_id].reconnects++;
+    sb_metrics_inc(con->thread_id, SB_CNT_RECONNECT);
+    con->db_errno = SB_DB_ERROR_RESTART_TRANSACTION;
+  }
+  else if (con->db_errno == SB_DB_ERROR_RESTART_TRANSACTION)
+  {
+    thread_stats[con->thread_id].errors++;
+    sb_metrics_inc(con->thread_id, SB_CNT_ERROR);
+  }
+}
+
+
+/* Refuse synchronous execution until asynchronous results are collected */
+
+
+static int db_check_pending(db_conn_t *con, const char *func)
+{
+  if (con->pending_cnt == 0)
+    return 0;
+
+  log_text(LOG_ALERT, "%s() called with %u results of db_send_*() calls "
+           "not collected", func, con->pending_cnt);
+  con->db_errno = SB_DB_ERROR_FAILED;
+
+  return 1;
+}
+
+
+/*
+  Double the pending array, moving entries so that the oldest one is first.
+  Scripts decide how many queries to send before collecting results, so
+  there is no fixed limit.
+*/
+
+
+static int db_grow_pending(db_conn_t *con)
+{
+  db_pending_t *tmp;
+  unsigned int size;
+  unsigned int i;
+
+  size = con->pending_size > 0 ? con->pending_size * 2 : DB_PENDING_INIT;
+  tmp = (db_pending_t *)calloc(size, sizeof(db_pending_t));
+  if (tmp == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure");
+    return 1;
+  }
+
+  for (i = 0; i < con->pending_cnt; i++)
+    tmp[i] = con->pending[(con->pending_first + i) % con->pending_size];
+
+  free(con->pending);
+  con->pending = tmp;
+  con->pending_first = 0;
+  con->pending_size = size;
+
+  return 0;
+}
+
+
+/*
+  Send a query (stmt == NULL) or prepared statement execution without
+  waiting for the result. Drivers without asynchronous execution run it
+  synchronously and discard the result, so that scripts work with any driver.
+*/
+
+
+static int db_send(db_conn_t *con, db_stmt_t *stmt, const char *query)
+{
+  db_driver_t     *drv = con->driver;
+  db_result_set_t *rs = &con->rs;
+  db_pending_t    *p;
+
+  if (con->pending_cnt == con->pending_size && db_grow_pending(con))
+    return con->db_errno = SB_DB_ERROR_FAILED;
+
+  p = con->pending +
+    (con->pending_first + con->pending_cnt) % con->pending_size;
+  p->stmt = stmt;
+  p->type = stmt != NULL ? stmt->type : db_get_query_type(query);
+  p->query = (sb_outliers_enabled && stmt == NULL) ? strdup(query) : NULL;
+  p->rc = SB_DB_ERROR_NONE;
+  p->nrows = 0;
+
+  SB_GETTIME(&p->start);
+
+  if (sb_watchdog_enabled)
+    sb_watchdog_driver_enter(con->thread_id, query);
+  if (sb_profile_enabled)
+    sb_profile_enter(con->thread_id, SB_PROF_DRIVER);
+
+  if (stmt != NULL && drv->ops.send_execute != NULL)
+    con->db_errno = drv->ops.send_execute(stmt);
+  else if (stmt == NULL && drv->ops.send_query != NULL)
+    con->db_errno = drv->ops.send_query(con, query);
+  else
+  {
+    memset(rs, 0, sizeof(db_result_set_t));
+    rs->statement = stmt;
+    rs->connection = con;
+
+    if (stmt != NULL)
+      p->rc = drv->ops.execute(stmt, rs);
+    else
+      p->rc = drv->ops.query(con, query, rs);
+    if (p->rc == SB_DB_ERROR_NONE)
+    {
+      drv->ops.store_results(rs);
+      p->nrows = rs->nrows;
+      drv->ops.free_results(rs);
+    }
+    con->db_errno = SB_DB_ERROR_NONE;
+  }
+
+  if (sb_profile_enabled)
+    sb_profile_exit(con->thread_id);
+  if (sb_watchdog_enabled)
+    sb_watchdog_driver_exit(con->thread_id);
+
+  if (con->db_errno != SB_DB_ERROR_NONE)
+  {
+    free(p->query);
+    p->query = NULL;
+    db_count_error(con);
+
+    return con->db_errno;
+  }
+
+  con->pending_cnt++;
+
+  return SB_DB_ERROR_NONE;
+}
+
+
+/* Send a query without waiting for the result */
+
+
+int db_send_query(db_conn_t *con, const char *query)
+{
+  if (con->driver == NULL)
+    return SB_DB_ERROR_FAILED;
+
+  return db_send(con, NULL, query);
+}
+
+
+/* Send prepared statement execution without waiting for the result */
+
+
+int db_send_execute(db_stmt_t *stmt)
+{
+  db_conn_t *con = stmt->connection;
+
+  if (con == NULL || con->driver == NULL)
+    return SB_DB_ERROR_FAILED;
+
+  return db_send(con, stmt, stmt->query);
+}
+
+
+/*
+  Wait for the result of the oldest query sent with db_send_query() or
+  db_send_execute(). Query latency is measured from sending the query to
+  collecting its result. The result set is empty for drivers without
+  asynchronous execution.
+*/
+
+
+db_result_set_t *db_get_result(db_conn_t *con)
+{
+  db_result_set_t    *rs = &con->rs;
+  db_pending_t       *p;
+  db_thread_stat_t   *stat;
+  struct timespec    now;
+  unsigned long long ns;
+  const char         *query;
+
+  if (con->driver == NULL)
+    return NULL;
+
+  if (con->pending_cnt == 0)
+  {
+    log_text(LOG_ALERT, "db_get_result() called without pending queries");
+    con->db_errno = SB_DB_ERROR_FAILED;
+    return NULL;
+  }
+
+  p = con->pending + con->pending_first;
+  con->pending_first = (con->pending_first + 1) % con->pending_size;
+  con->pending_cnt--;
+
+  query = p->stmt != NULL ? p->stmt->query : p->query;
+
+  memset(rs, 0, sizeof(db_result_set_t));
+  rs->connection = con;
+
+  if (con->driver->ops.get_result != NULL)
+  {
+    rs->statement = p->stmt;
+
+    if (sb_watchdog_enabled)
+      sb_watchdog_driver_enter(con->thread_id, query);
+    if (sb_profile_enabled)
+      sb_profile_enter(con->thread_id, SB_PROF_DRIVER);
+
+    con->db_errno = con->driver->ops.get_result(con, rs);
+
+    if (sb_profile_enabled)
+      sb_profile_exit(con->thread_id);
+    if (sb_watchdog_enabled)
+      sb_watchdog_driver_exit(con->thread_id);
+  }
+  else
+  {
+    con->db_errno = p->rc;
+    rs->nrows = p->nrows;
+  }
+
+  SB_GETTIME(&now);
+  ns = TIMESPEC_DIFF(now, p->start);
+
+  stat = thread_stats + con->thread_id;
+  pthread_mutex_lock(&stat->stat_mutex);
+  stat->async_queries++;
+  stat->async_ns += ns;
+  if (ns > stat->async_max_ns)
+    stat->async_max_ns = ns;
+  pthread_mutex_unlock(&stat->stat_mutex);
+
+  if (sb_outliers_enabled)
+    db_check_outlier(con, &p->start, query,
+                     p->stmt != NULL ? p->stmt->params : NULL,
+                     p->stmt != NULL ? p->stmt->params_len : 0);
+
+  free(p->query);
+  p->query = NULL;
+
+  if (con->db_errno != SB_DB_ERROR_NONE)
+  {
+    log_text(LOG_DEBUG, "ERROR: exiting db_get_result(), query failed");
+    db_count_error(con);
+
+    return NULL;
+  }
+
+  db_update_thread_stats(con->thread_id, p->type);
+
+  return rs;
+}
+
+
+/*
+  Discard results of all queries sent with db_send_*(), e.g. when restarting
+  a transaction after an error. Statistics are not updated.
+*/
+
+
+void db_discard_results(db_conn_t *con)
+{
+  db_result_set_t *rs = &con->rs;
+  db_pending_t    *p;
+
+  for (; con->pending_cnt > 0; con->pending_cnt--)
+  {
+    p = con->pending + con->pending_first;
+    con->pending_first = (con->pending_first + 1) % con->pending_size;
+
+    if (con->driver->ops.get_result != NULL)
+    {
+      memset(rs, 0, sizeof(db_result_set_t));
+      rs->connection = con;
+      rs->statement = p->stmt;
+      if (con->driver->ops.get_result(con, rs) == SB_DB_ERROR_NONE)
+        con->driver->ops.free_results(rs);
+    }
+
+    free(p->query);
+    p->query = NULL;
+  }
+}
+
+
+/*
+  Switch the connection to non-blocking mode and return the descriptor to
+  wait on before calling db_poll(). Returns -1 if the driver cannot send
+  queries and collect their results without blocking.
+*/
+
+
+int db_socket(db_conn_t *con)
+{
+  db_driver_t *drv = con->driver;
+
+  if (drv == NULL || drv->ops.socket == NULL || drv->ops.poll == NULL ||
+      drv->ops.send_query == NULL || drv->ops.get_result == NULL)
+    return -1;
+
+  return drv->ops.socket(con);
+}
+
+
+/*
+  Consume input available on a non-blocking connection and tell whether the
+  result of the oldest query sent with db_send_*() can be collected without
+  blocking, or which event to wait for on the db_socket() descriptor
+*/
+
+
+db_poll_t db_poll(db_conn_t *con)
+{
+  if (con->driver == NULL || con->driver->ops.poll == NULL ||
+      con->pending_cnt == 0)
+    return DB_POLL_READY;
+
+  return con->driver->ops.poll(con);
+}
+
+
 /* Return the number of rows in a result set */
 
 
@@ -434,6 +1040,7 @@ unsigned long long db_num_rows(db_result_set_t *rs)
 db_row_t *db_fetch_row(db_result_set_t *rs)
 {
   db_conn_t *con = rs->connection;
+  int       rc;
 
   /* Is this a result set of a non-prepared statement? */
   if (rs->statement != NULL)
@@ -448,7 +1055,15 @@ db_row_t *db_fetch_row(db_result_set_t *rs)
   if (rs->row == NULL)
     return NULL;
   
-  if (con->driver->ops.fetch_row(rs, rs->row))
+  if (sb_profile_enabled)
+    sb_profile_enter(con->thread_id, SB_PROF_DRIVER);
+
+  rc = con->driver->ops.fetch_row(rs, rs->row);
+
+  if (sb_profile_enabled)
+    sb_profile_exit(con->thread_id);
+
+  if (rc)
   {
     db_free_row(rs->row);
     return NULL;
@@ -464,16 +1079,40 @@ db_row_t *db_fetch_row(db_result_set_t *rs)
 db_result_set_t *db_query(db_conn_t *con, const char *query)
 {
   db_result_set_t *rs = &con->rs;
+  db_stmt_t       *stmt;
+  struct timespec start;
   
   if (con->driver == NULL)
     return NULL;
 
+  if (db_check_pending(con, "db_query"))
+    return NULL;
+
+  if (con->stmt_cache != NULL && (stmt = db_stmt_cache_get(con, query)) != NULL)
+    return db_execute(stmt);
+
   memset(rs, 0, sizeof(db_result_set_t));
   
   rs->connection = con;
 
+  if (sb_outliers_enabled)
+    SB_GETTIME(&start);
+
+  if (sb_watchdog_enabled)
+    sb_watchdog_driver_enter(con->thread_id, query);
+  if (sb_profile_enabled)
+    sb_profile_enter(con->thread_id, SB_PROF_DRIVER);
+
   con->db_errno = con->driver->ops.query(con, query, rs);
 
+  if (sb_profile_enabled)
+    sb_profile_exit(con->thread_id);
+  if (sb_watchdog_enabled)
+    sb_watchdog_driver_exit(con->thread_id);
+
+  if (sb_outliers_enabled)
+    db_check_outlier(con, &start, query, NULL, 0);
+
   if (con->db_errno == SB_DB_ERROR_NONE)
     db_update_thread_stats(con->thread_id, db_get_query_type(query));
   else
@@ -481,10 +1120,14 @@ db_result_set_t *db_query(db_conn_t *con, const char *query)
     if (con->db_errno == SB_DB_ERROR_RECONNECTED)
     {
       thread_stats[con->thread_id].reconnects++;
+      sb_metrics_inc(con->thread_id, SB_CNT_RECONNECT);
       con->db_errno = SB_DB_ERROR_RESTART_TRANSACTION;
     }
     else if (con->db_errno == SB_DB_ERROR_RESTART_TRANSACTION)
+    {
       thread_stats[con->thread_id].errors++;
+      sb_metrics_inc(con->thread_id, SB_CNT_ERROR);
+    }
 
     return NULL;
   }
@@ -541,6 +1184,7 @@ int db_close(db_stmt_t *stmt)
     free(stmt->bound_param);
     stmt->bound_param = NULL;
   }
+  free(stmt->params);
   free(stmt);
 
   return rc;
@@ -553,11 +1197,24 @@ int db_close(db_stmt_t *stmt)
 int db_store_results(db_result_set_t *rs)
 {
   db_conn_t *con = rs->connection;
+  int       rc;
 
   if (con == NULL || con->driver == NULL)
     return SB_DB_ERROR_FAILED;
 
-  return con->driver->ops.store_results(rs);
+  if (sb_watchdog_enabled)
+    sb_watchdog_driver_enter(con->thread_id, NULL);
+  if (sb_profile_enabled)
+    sb_profile_enter(con->thread_id, SB_PROF_DRIVER);
+
+  rc = con->driver->ops.store_results(rs);
+
+  if (sb_profile_enabled)
+    sb_profile_exit(con->thread_id);
+  if (sb_watchdog_enabled)
+    sb_watchdog_driver_exit(con->thread_id);
+
+  return rc;
 }
 
 
@@ -580,6 +1237,7 @@ int db_done(db_driver_t *drv)
     free(thread_stats);
   }
 
+  sb_percentile_windows_done(&local_windows);
   sb_percentile_done(&local_percentile);
 
   return drv->ops.done();
@@ -601,6 +1259,7 @@ db_error_t db_errno(db_conn_t *con)
 int db_parse_arguments(void)
 {
   char *s;
+  int  n;
 
   s = sb_get_value_string("db-ps-mode");
 
@@ -617,7 +1276,36 @@ int db_parse_arguments(void)
   db_globals.driver = sb_get_value_string("db-driver");
 
   db_globals.debug = sb_get_value_flag("db-debug");
-  
+
+  n = sb_get_value_int("db-stmt-cache");
+  if (n < 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for db-stmt-cache: %d", n);
+    return 1;
+  }
+  db_globals.stmt_cache_size = n;
+
+  n = sb_get_value_int("db-sessions");
+  if (n < 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for db-sessions: %d", n);
+    return 1;
+  }
+  db_globals.sessions = n;
+
+  /*
+    A thread with sessions interleaves many events, so per-event hooks that
+    wrap a single request in the worker loop do not measure events
+  */
+  if (db_globals.sessions > 0 && sb_globals.command == SB_COMMAND_RUN &&
+      (sb_trace_enabled || sb_watchdog_event_stalls() ||
+       sb_perf_mode == SB_PERF_EVENT))
+  {
+    log_text(LOG_FATAL, "--db-sessions cannot be used with --trace-file, "
+             "--stall-threshold or --perf-counters=event");
+    return 1;
+  }
+
   return 0;
 }
 
@@ -725,30 +1413,31 @@ int db_bulk_insert_init(db_conn_t *con, const char *query)
     return 1;
   
   con->bulk_supported = driver_caps.multi_rows_insert;
+  con->bulk_escapes = driver_caps.backslash_escapes;
   con->bulk_commit_max = driver_caps.needs_commit ? ROWS_BEFORE_COMMIT : 0;
   con->bulk_commit_cnt = 0;
   strcpy(con->bulk_buffer, query);
   con->bulk_ptr = query_len;
   con->bulk_ptr_orig = query_len;
   con->bulk_cnt = 0;
+  con->bulk_mode = DB_BULK_AUTO;
 
   return 0;
 }
 
-/* Add row to multi-row insert operation */
+/*
+  Make sure a row of the given length fits into the bulk insert buffer,
+  inserting buffered rows if necessary. Space is reserved for '\0' and ','
+  (if not the first row in a bulk insert).
+*/
 
-int db_bulk_insert_next(db_conn_t *con, const char *query)
+int db_bulk_make_room(db_conn_t *con, unsigned int len)
 {
-  unsigned int query_len = strlen(query);
-
-  /*
-    Reserve space for '\0' and ',' (if not the first chunk in
-    a bulk insert
-  */
-  if (con->bulk_ptr + query_len + 1 + (con->bulk_cnt>0) > con->bulk_buflen)
+  if (con->bulk_ptr + len + 1 + (con->bulk_cnt>0) > con->bulk_buflen)
   {
     /* Is this a first row? */
-    if (!con->bulk_cnt)
+    if (!con->bulk_cnt ||
+        con->bulk_ptr_orig + len + 1 > con->bulk_buflen)
     {
       log_text(LOG_FATAL,
                "Query length exceeds the maximum value (%u), aborting",
@@ -759,6 +1448,26 @@ int db_bulk_insert_next(db_conn_t *con, const char *query)
       return 1;
   }
 
+  return 0;
+}
+
+/* Add row to multi-row insert operation */
+
+int db_bulk_insert_next(db_conn_t *con, const char *query)
+{
+  unsigned int query_len = strlen(query);
+
+  if (con->bulk_mode == DB_BULK_DRIVER)
+  {
+    log_text(LOG_FATAL, "db_bulk_insert_next() cannot be used after "
+             "db_bulk_insert_row() in the same bulk insert");
+    return 1;
+  }
+  con->bulk_mode = DB_BULK_TEXT;
+
+  if (db_bulk_make_room(con, query_len))
+    return 1;
+
   if (con->bulk_cnt > 0)
   {
     con->bulk_buffer[con->bulk_ptr] = ',';
@@ -773,11 +1482,237 @@ int db_bulk_insert_next(db_conn_t *con, const char *query)
   return 0;
 }
 
+/*
+  Add row of typed values to multi-row insert operation. Drivers that can
+  stream rows (e.g. with COPY) get them as is, otherwise the row is encoded
+  as SQL text. String values are quoted by doubling single quotes, and
+  backslashes are doubled for databases that treat them as escapes.
+*/
+
+int db_bulk_insert_row(db_conn_t *con, db_bind_t *values,
+                       unsigned int nvalues)
+{
+  db_driver_t   *drv = con->driver;
+  unsigned long len;
+  unsigned int  row_len;
+  unsigned int  i;
+  char          *p;
+  char          *s;
+  char          *end;
+  int           n;
+
+  if (con->bulk_mode == DB_BULK_AUTO)
+  {
+    con->bulk_mode = DB_BULK_TEXT;
+    if (drv->ops.bulk_insert_init != NULL)
+    {
+      /* The query prefix passed to db_bulk_insert_init() */
+      con->bulk_buffer[con->bulk_ptr_orig] = '\0';
+      if (!drv->ops.bulk_insert_init(con, con->bulk_buffer))
+        con->bulk_mode = DB_BULK_DRIVER;
+    }
+  }
+
+  if (con->bulk_mode == DB_BULK_DRIVER)
+  {
+    if (drv->ops.bulk_insert_row(con, values, nvalues))
+      return 1;
+    con->bulk_cnt++;
+    return 0;
+  }
+
+  /* Upper bound of the row length: parentheses, commas and values */
+  row_len = 2 + nvalues;
+  for (i = 0; i < nvalues; i++)
+  {
+    if (values[i].is_null != NULL && *values[i].is_null)
+      row_len += 4;
+    else if (values[i].type == DB_TYPE_CHAR ||
+             values[i].type == DB_TYPE_VARCHAR)
+    {
+      len = values[i].data_len != NULL ? *values[i].data_len :
+        strlen((char *)values[i].buffer);
+      row_len += 2 * len + 2;
+    }
+    else
+      row_len += BULK_MAX_VALUE_LENGTH;
+  }
+
+  if (db_bulk_make_room(con, row_len))
+    return 1;
+
+  p = con->bulk_buffer + con->bulk_ptr;
+  end = con->bulk_buffer + con->bulk_buflen;
+  if (con->bulk_cnt > 0)
+    *p++ = ',';
+  *p++ = '(';
+  for (i = 0; i < nvalues; i++)
+  {
+    if (i > 0)
+      *p++ = ',';
+    if ((values[i].is_null == NULL || !*values[i].is_null) &&
+        (values[i].type == DB_TYPE_CHAR || values[i].type == DB_TYPE_VARCHAR))
+    {
+      s = (char *)values[i].buffer;
+      len = values[i].data_len != NULL ? *values[i].data_len : strlen(s);
+      *p++ = '\'';
+      for (; len > 0; len--, s++)
+      {
+        if (*s == '\'' || (*s == '\\' && con->bulk_escapes))
+          *p++ = *s;
+        *p++ = *s;
+      }
+      *p++ = '\'';
+    }
+    else
+    {
+      n = db_print_value(values + i, p, end - p);
+      if (n < 0)
+        return 1;
+      p += n;
+    }
+  }
+  *p++ = ')';
+  *p = '\0';
+
+  con->bulk_ptr = p - con->bulk_buffer;
+  con->bulk_cnt++;
+
+  return 0;
+}
+
+/*
+  Extract the "table (columns)" part of an "INSERT INTO table (columns)
+  VALUES" prefix passed to db_bulk_insert_init(), so that drivers can build
+  their bulk load statement. Returns NULL if the prefix has another form.
+*/
+
+const char *db_bulk_insert_target(const char *query, unsigned int *len)
+{
+  const char *start = query;
+  const char *end;
+
+  while (isspace((unsigned char)*start))
+    start++;
+  if (strncasecmp(start, "INSERT", 6) || !isspace((unsigned char)start[6]))
+    return NULL;
+  for (start += 6; isspace((unsigned char)*start); start++)
+    ;
+  if (strncasecmp(start, "INTO", 4) || !isspace((unsigned char)start[4]))
+    return NULL;
+  for (start += 4; isspace((unsigned char)*start); start++)
+    ;
+
+  end = start + strlen(start);
+  while (end > start && isspace((unsigned char)end[-1]))
+    end--;
+  if (end - start < 8 || strncasecmp(end - 6, "VALUES", 6) ||
+      (!isspace((unsigned char)end[-7]) && end[-7] != ')'))
+    return NULL;
+  for (end -= 6; isspace((unsigned char)end[-1]); end--)
+    ;
+
+  *len = end - start;
+
+  return start;
+}
+
+/* Upper bound of the length of a row encoded by db_bulk_encode_row() */
+
+unsigned int db_bulk_row_length(db_bind_t *values, unsigned int nvalues)
+{
+  unsigned int len;
+  unsigned int i;
+
+  /* Separators and the line end */
+  len = nvalues;
+  for (i = 0; i < nvalues; i++)
+  {
+    if (values[i].is_null != NULL && *values[i].is_null)
+      len += 2;
+    else if (values[i].type == DB_TYPE_CHAR ||
+             values[i].type == DB_TYPE_VARCHAR)
+      len += 2 * (values[i].data_len != NULL ? *values[i].data_len :
+                  strlen((char *)values[i].buffer));
+    else
+      len += BULK_MAX_VALUE_LENGTH;
+  }
+
+  return len;
+}
+
+/*
+  Encode row of typed values in the text format shared by PostgreSQL COPY
+  and MySQL LOAD DATA with default options: tab-separated values, newline
+  terminated, \N for NULL and backslash escapes. The buffer must have room
+  for db_bulk_row_length() bytes. Returns the end of the encoded row.
+*/
+
+char *db_bulk_encode_row(char *buf, db_bind_t *values, unsigned int nvalues)
+{
+  unsigned long len;
+  unsigned int  i;
+  char          *p = buf;
+  char          *s;
+  int           n;
+
+  for (i = 0; i < nvalues; i++)
+  {
+    if (i > 0)
+      *p++ = '\t';
+
+    if (values[i].is_null != NULL && *values[i].is_null)
+    {
+      *p++ = '\\';
+      *p++ = 'N';
+      continue;
+    }
+
+    switch (values[i].type) {
+      case DB_TYPE_CHAR:
+      case DB_TYPE_VARCHAR:
+        s = (char *)values[i].buffer;
+        len = values[i].data_len != NULL ? *values[i].data_len : strlen(s);
+        for (; len > 0; len--, s++)
+        {
+          switch (*s) {
+            case '\\': *p++ = '\\'; *p++ = '\\'; break;
+            case '\t': *p++ = '\\'; *p++ = 't'; break;
+            case '\n': *p++ = '\\'; *p++ = 'n'; break;
+            case '\r': *p++ = '\\'; *p++ = 'r'; break;
+            default: *p++ = *s; break;
+          }
+        }
+        break;
+      case DB_TYPE_DATE:
+      case DB_TYPE_TIME:
+      case DB_TYPE_DATETIME:
+      case DB_TYPE_TIMESTAMP:
+        /* Strip the quotes added for SQL text */
+        n = db_print_value(values + i, p, BULK_MAX_VALUE_LENGTH);
+        if (n < 2)
+          return NULL;
+        memmove(p, p + 1, n - 2);
+        p += n - 2;
+        break;
+      default:
+        n = db_print_value(values + i, p, BULK_MAX_VALUE_LENGTH);
+        if (n < 0)
+          return NULL;
+        p += n;
+        break;
+    }
+  }
+  *p++ = '\n';
+
+  return p;
+}
+
 /* Do the actual INSERT (and COMMIT, if necessary) */
 
 int db_bulk_do_insert(db_conn_t *con, int is_last)
 {
-  if (!con->bulk_cnt)
+  if (!con->bulk_cnt || con->bulk_mode == DB_BULK_DRIVER)
     return 0;
       
   if (db_query(con, con->bulk_buffer) == NULL)
@@ -804,16 +1739,25 @@ int db_bulk_do_insert(db_conn_t *con, int is_last)
 
 /* Finish multi-row insert operation */
 
-void db_bulk_insert_done(db_conn_t *con)
+int db_bulk_insert_done(db_conn_t *con)
 {
+  int rc;
+
   /* Flush remaining data in buffer, if any */
-  db_bulk_do_insert(con, 1);
+  if (con->bulk_mode == DB_BULK_DRIVER)
+    rc = con->driver->ops.bulk_insert_done(con);
+  else
+    rc = db_bulk_do_insert(con, 1);
+  con->bulk_mode = DB_BULK_AUTO;
+  con->bulk_cnt = 0;
   
   if (con->bulk_buffer != NULL)
   {
     free(con->bulk_buffer);
     con->bulk_buffer = NULL;
   }
+
+  return rc;
 }
 
 /* Print database-specific test stats */
@@ -822,6 +1766,8 @@ void db_print_stats(sb_stat_t type)
 {
   double        seconds;
   unsigned int  i;
+  char          windows[256];
+  char          sysstat[SB_SYSSTAT_MAX_LINE];
   sb_timer_t    exec_timer;
   sb_timer_t    fetch_timer;
   unsigned long read_ops;
@@ -830,9 +1776,17 @@ void db_print_stats(sb_stat_t type)
   unsigned long transactions;
   unsigned long errors;
   unsigned long reconnects;
+  unsigned long cache_hits;
+  unsigned long cache_misses;
+  unsigned long async_queries;
+  unsigned long long async_ns;
+  unsigned long long async_max_ns;
 
   /* Summarize per-thread counters */
   read_ops = write_ops = other_ops = transactions = errors = reconnects = 0;
+  cache_hits = cache_misses = 0;
+  async_queries = 0;
+  async_ns = async_max_ns = 0;
   for (i = 0; i < sb_globals.num_threads; i++)
   {
     pthread_mutex_lock(&thread_stats[i].stat_mutex);
@@ -842,6 +1796,12 @@ void db_print_stats(sb_stat_t type)
     transactions += thread_stats[i].transactions;
     errors += thread_stats[i].errors;
     reconnects += thread_stats[i].reconnects;
+    cache_hits += thread_stats[i].stmt_cache_hits;
+    cache_misses += thread_stats[i].stmt_cache_misses;
+    async_queries += thread_stats[i].async_queries;
+    async_ns += thread_stats[i].async_ns;
+    if (thread_stats[i].async_max_ns > async_max_ns)
+      async_max_ns = thread_stats[i].async_max_ns;
     pthread_mutex_unlock(&thread_stats[i].stat_mutex);
   }
 
@@ -849,19 +1809,24 @@ void db_print_stats(sb_stat_t type)
   {
     seconds = NS2SEC(sb_timer_split(&sb_globals.exec_timer));
 
+    sb_percentile_windows_update(&local_windows, &local_percentile);
+    sb_percentile_windows_format(&local_windows, sb_globals.percentile_rank,
+                                 2, windows, sizeof(windows));
+    sb_sysstat_format(sysstat, sizeof(sysstat));
+
     log_timestamp(LOG_NOTICE, &sb_globals.exec_timer,
                   "threads: %d, tps: %4.2f, reads: %4.2f, writes: %4.2f, "
-                  "response time: %4.2fms (%u%%), errors: %4.2f, "
-                  "reconnects: %5.2f",
+                  "response time: %4.2fms (%u%%)%s, errors: %4.2f, "
+                  "reconnects: %5.2f%s",
                   sb_globals.num_running,
                   (transactions - last_transactions) / seconds,
                   (read_ops - last_read_ops) / seconds,
                   (write_ops - last_write_ops) / seconds,
                   NS2MS(sb_percentile_calculate(&local_percentile,
                                                 sb_globals.percentile_rank)),
-                  sb_globals.percentile_rank,
+                  sb_globals.percentile_rank, windows,
                   (errors - last_errors) / seconds,
-                  (reconnects - last_reconnects) / seconds);
+                  (reconnects - last_reconnects) / seconds, sysstat);
     if (sb_globals.tx_rate > 0)
     {
       pthread_mutex_lock(&event_queue_mutex);
@@ -911,6 +1876,13 @@ void db_print_stats(sb_stat_t type)
            " (%.2f per sec.)", errors, errors / seconds);
   log_text(LOG_NOTICE, "    reconnects:                          %-6d"
            " (%.2f per sec.)", reconnects, reconnects / seconds);
+  if (db_globals.stmt_cache_size > 0)
+    log_text(LOG_NOTICE, "    statement cache hits/misses:         %lu/%lu",
+             cache_hits, cache_misses);
+  if (async_queries > 0)
+    log_text(LOG_NOTICE, "    async queries:                       %-6lu"
+             " (avg: %.2fms, max: %.2fms)", async_queries,
+             NS2MS((double) async_ns / async_queries), NS2MS(async_max_ns));
 
   if (db_globals.debug)
   {
@@ -984,16 +1956,21 @@ void db_update_thread_stats(int id, db_query_type_t type)
   {
     case DB_QUERY_TYPE_READ:
       thread_stats[id].read_ops++;
+      sb_metrics_inc(id, SB_CNT_READ);
       break;
     case DB_QUERY_TYPE_WRITE:
       thread_stats[id].write_ops++;
+      sb_metrics_inc(id, SB_CNT_WRITE);
       break;
     case DB_QUERY_TYPE_COMMIT:
       thread_stats[id].other_ops++;
       thread_stats[id].transactions++;
+      sb_metrics_inc(id, SB_CNT_OTHER);
+      sb_metrics_inc(id, SB_CNT_TRANSACTION);
       break;
     case DB_QUERY_TYPE_OTHER:
       thread_stats[id].other_ops++;
+      sb_metrics_inc(id, SB_CNT_OTHER);
       break;
     default:
       log_text(LOG_WARNING, "Unknown query type: %d", type);
@@ -1002,6 +1979,63 @@ void db_update_thread_stats(int id, db_query_type_t type)
   pthread_mutex_unlock(&thread_stats[id].stat_mutex);
 }
 
+/*
+  Pass a query to the outliers module if it is slow enough. The query text
+  and bound parameters are only formatted when the query may be reported.
+*/
+
+static void db_check_outlier(db_conn_t *con, struct timespec *start,
+                             const char *query, db_bind_t *params,
+                             unsigned int nparams)
+{
+  struct timespec    now;
+  unsigned long long ns;
+  char               buf[SB_OUTLIER_TEXT_LEN];
+  unsigned int       i;
+  int                len;
+  int                n;
+
+  SB_GETTIME(&now);
+  ns = TIMESPEC_DIFF(now, (*start));
+
+  if (!sb_outliers_query_wanted(con->thread_id, ns))
+    return;
+
+  len = snprintf(buf, sizeof(buf), "%s",
+                 query != NULL ? query : "<prepared statement>");
+  if (len >= (int) sizeof(buf))
+    len = sizeof(buf) - 1;
+
+  for (i = 0; i < nparams && len < (int) sizeof(buf) - 1; i++)
+  {
+    n = snprintf(buf + len, sizeof(buf) - len, i == 0 ? " -- (" : ", ");
+    if (n < 0 || n >= (int) sizeof(buf) - len)
+      break;
+    len += n;
+
+    /* Lua string parameters are not null-terminated */
+    if ((params[i].type == DB_TYPE_CHAR || params[i].type == DB_TYPE_VARCHAR)
+        && params[i].data_len != NULL &&
+        (params[i].is_null == NULL || !*params[i].is_null))
+      n = snprintf(buf + len, sizeof(buf) - len, "'%.*s'",
+                   (int) *params[i].data_len, (char *) params[i].buffer);
+    else
+      n = db_print_value(params + i, buf + len, sizeof(buf) - len);
+    if (n < 0 || n >= (int) sizeof(buf) - len)
+      break;
+    len += n;
+
+    if (i + 1 == nparams)
+      snprintf(buf + len, sizeof(buf) - len, ")");
+  }
+
+  sb_outliers_add_query(con->thread_id,
+                        TIMESPEC_DIFF((*start),
+                                      sb_globals.exec_timer.time_start),
+                        ns, buf);
+}
+
+
 static void db_reset_stats(void)
 {
   unsigned int i;
@@ -1014,6 +2048,11 @@ static void db_reset_stats(void)
     thread_stats[i].transactions = 0;
     thread_stats[i].errors = 0;
     thread_stats[i].reconnects = 0;
+    thread_stats[i].stmt_cache_hits = 0;
+    thread_stats[i].stmt_cache_misses = 0;
+    thread_stats[i].async_queries = 0;
+    thread_stats[i].async_ns = 0;
+    thread_stats[i].async_max_ns = 0;
   }
 
   last_transactions = 0;
@@ -1037,3 +2076,333 @@ static void db_reset_stats(void)
     }
   }
 }
+
+
+/* Allocate an empty statement cache */
+
+
+db_stmt_cache_t *db_stmt_cache_create(void)
+{
+  db_stmt_cache_t *cache;
+
+  cache = (db_stmt_cache_t *)calloc(1, sizeof(db_stmt_cache_t));
+  if (cache == NULL)
+    return NULL;
+
+  /* Keep hash chains short */
+  for (cache->nbuckets = 16; cache->nbuckets < db_globals.stmt_cache_size * 2;
+       cache->nbuckets <<= 1)
+    /* nothing */ ;
+
+  cache->buckets = (db_stmt_cache_entry_t **)
+    calloc(cache->nbuckets, sizeof(db_stmt_cache_entry_t *));
+  if (cache->buckets == NULL)
+  {
+    free(cache);
+    return NULL;
+  }
+
+  SB_LIST_INIT(&cache->lru);
+
+  return cache;
+}
+
+
+/* Remove an entry from the cache and close its statement */
+
+
+static void db_stmt_cache_remove(db_stmt_cache_t *cache,
+                                 db_stmt_cache_entry_t *entry)
+{
+  db_stmt_cache_entry_t **pos;
+
+  for (pos = &cache->buckets[entry->hash & (cache->nbuckets - 1)];
+       *pos != entry; pos = &(*pos)->hnext)
+    /* nothing */ ;
+  *pos = entry->hnext;
+
+  SB_LIST_DELETE(&entry->listitem);
+  cache->count--;
+
+  if (entry->stmt != NULL)
+    db_close(entry->stmt);
+  free(entry->key);
+  free(entry);
+}
+
+
+/* Close all cached statements and free the cache */
+
+
+void db_stmt_cache_free(db_stmt_cache_t *cache)
+{
+  while (!SB_LIST_IS_EMPTY(&cache->lru))
+    db_stmt_cache_remove(cache,
+                         SB_LIST_ENTRY(SB_LIST_ITEM_NEXT(&cache->lru),
+                                       db_stmt_cache_entry_t, listitem));
+
+  free(cache->buckets);
+  free(cache);
+}
+
+
+#define IS_IDENT_CHAR(c) (isalnum((unsigned char)(c)) || (c) == '_' || \
+                          (c) == '$')
+
+/*
+  Replace numeric and string literals in a query with parameter markers.
+  Stores the resulting text followed by one character per parameter type in
+  cache->key and binds the literal values to cache->binds. Returns the key
+  length, or 0 if the query cannot be parameterized safely.
+*/
+
+
+static unsigned int db_stmt_cache_normalize(db_stmt_cache_t *cache,
+                                            const char *query)
+{
+  const char    *p = query;
+  const char    *q;
+  char          *out = cache->key;
+  char          *out_end = cache->key + STMT_CACHE_MAX_QUERY;
+  char          *str = cache->strings;
+  char          *str_end = cache->strings + sizeof(cache->strings);
+  char          *end;
+  db_bind_t     *bind;
+  char          types[STMT_CACHE_MAX_PARAMS];
+  unsigned int  n = 0;
+  int           in_by = 0;  /* numbers after ORDER/GROUP BY are positions */
+  int           is_double;
+
+  while (*p != '\0')
+  {
+    if (out + 1 >= out_end)
+      return 0;
+
+    if (*p == '\'')
+    {
+      /* Prefixed strings like x'...' or N'...' are not plain literals */
+      if (p > query && IS_IDENT_CHAR(p[-1]))
+        return 0;
+      if (n == STMT_CACHE_MAX_PARAMS)
+        return 0;
+
+      bind = cache->binds + n;
+      bind->buffer = str;
+      for (p++; ; p++)
+      {
+        if (*p == '\0' || *p == '\\')
+          return 0;  /* unterminated or escapes are dialect-specific */
+        if (str + 1 >= str_end)
+          return 0;  /* literals do not fit, leave the query uncached */
+        if (*p == '\'')
+        {
+          if (p[1] != '\'')
+            break;
+          p++;
+        }
+        *str++ = *p;
+      }
+      p++;
+      *str++ = '\0';
+
+      cache->lens[n] = str - (char *)bind->buffer - 1;
+      bind->type = DB_TYPE_VARCHAR;
+      bind->data_len = cache->lens + n;
+      bind->max_len = cache->lens[n] + 1;
+      types[n++] = 's';
+      *out++ = '?';
+    }
+    else if (isdigit((unsigned char)*p) &&
+             (p == query || !IS_IDENT_CHAR(p[-1])))
+    {
+      is_double = 0;
+      for (q = p; isdigit((unsigned char)*q) || *q == '.'; q++)
+        is_double |= (*q == '.');
+
+      if (in_by || IS_IDENT_CHAR(*q))
+      {
+        /* Column positions, hex or exponent notation are kept as is */
+        while (IS_IDENT_CHAR(*p) || *p == '.')
+        {
+          if (out + 1 >= out_end)
+            return 0;
+          *out++ = *p++;
+        }
+        continue;
+      }
+
+      if (n == STMT_CACHE_MAX_PARAMS)
+        return 0;
+
+      bind = cache->binds + n;
+      if (is_double)
+      {
+        cache->doubles[n] = strtod(p, &end);
+        bind->type = DB_TYPE_DOUBLE;
+        bind->buffer = cache->doubles + n;
+        types[n] = 'd';
+      }
+      else
+      {
+        errno = 0;
+        cache->ints[n] = strtoll(p, &end, 10);
+        if (errno != 0)
+          return 0;
+        bind->type = DB_TYPE_BIGINT;
+        bind->buffer = cache->ints + n;
+        types[n] = 'i';
+      }
+      if (end != q)
+        return 0;
+
+      bind->data_len = NULL;
+      bind->max_len = 0;
+      n++;
+      p = q;
+      *out++ = '?';
+    }
+    else if (IS_IDENT_CHAR(*p))
+    {
+      q = p;
+      while (IS_IDENT_CHAR(*p))
+      {
+        if (out + 1 >= out_end)
+          return 0;
+        *out++ = *p++;
+      }
+      if (p - q == 2 && !strncasecmp(q, "BY", 2))
+        in_by = 1;
+      else if (!(p - q == 3 && !strncasecmp(q, "ASC", 3)) &&
+               !(p - q == 4 && !strncasecmp(q, "DESC", 4)))
+        in_by = 0;
+    }
+    else if (*p == '"' || *p == '`')
+    {
+      /* Quoted identifiers are copied verbatim */
+      q = strchr(p + 1, *p);
+      if (q == NULL || out + (q - p) + 1 >= out_end)
+        return 0;
+      memcpy(out, p, q - p + 1);
+      out += q - p + 1;
+      p = q + 1;
+    }
+    else if (*p == '?' || *p == ';' || *p == '#' ||
+             (*p == '-' && p[1] == '-') || (*p == '/' && p[1] == '*'))
+    {
+      /* Placeholders, multiple statements and comments */
+      return 0;
+    }
+    else
+      *out++ = *p++;
+  }
+
+  *out++ = '\0';
+  memcpy(out, types, n);
+  out += n;
+
+  cache->nparams = n;
+
+  return out - cache->key;
+}
+
+
+/*
+  Return a prepared statement with parameters bound for a query passed to
+  db_query(), preparing it on a cache miss. Returns NULL if the query should
+  be executed as text.
+*/
+
+
+db_stmt_t *db_stmt_cache_get(db_conn_t *con, const char *query)
+{
+  db_stmt_cache_t       *cache = con->stmt_cache;
+  db_stmt_cache_entry_t *entry;
+  db_stmt_cache_entry_t **bucket;
+  db_query_type_t       type;
+  unsigned int          keylen;
+  unsigned int          hash;
+  unsigned int          i;
+  int                   hit;
+
+  /* Only reads and writes are worth preparing */
+  type = db_get_query_type(query);
+  if (type != DB_QUERY_TYPE_READ && type != DB_QUERY_TYPE_WRITE)
+    return NULL;
+
+  keylen = db_stmt_cache_normalize(cache, query);
+  if (keylen == 0)
+    return NULL;
+
+  /* FNV-1a */
+  hash = 2166136261U;
+  for (i = 0; i < keylen; i++)
+    hash = (hash ^ (unsigned char)cache->key[i]) * 16777619U;
+
+  bucket = &cache->buckets[hash & (cache->nbuckets - 1)];
+  for (entry = *bucket; entry != NULL; entry = entry->hnext)
+    if (entry->hash == hash && entry->keylen == keylen &&
+        !memcmp(entry->key, cache->key, keylen))
+      break;
+
+  hit = entry != NULL;
+  if (hit)
+  {
+    /* Move to the head of the LRU list */
+    SB_LIST_DELETE(&entry->listitem);
+    SB_LIST_ADD(&entry->listitem, &cache->lru);
+  }
+  else
+  {
+    if (cache->count >= db_globals.stmt_cache_size)
+      db_stmt_cache_remove(cache,
+                           SB_LIST_ENTRY(SB_LIST_ITEM_PREV(&cache->lru),
+                                         db_stmt_cache_entry_t, listitem));
+
+    entry = (db_stmt_cache_entry_t *)calloc(1, sizeof(db_stmt_cache_entry_t));
+    if (entry == NULL)
+      return NULL;
+    entry->key = (char *)malloc(keylen);
+    if (entry->key == NULL)
+    {
+      free(entry);
+      return NULL;
+    }
+    memcpy(entry->key, cache->key, keylen);
+    entry->keylen = keylen;
+    entry->hash = hash;
+
+    /* Remember queries that cannot be prepared so we don't retry them */
+    entry->stmt = db_prepare(con, cache->key);
+    if (entry->stmt == NULL)
+      log_text(LOG_DEBUG, "cannot prepare '%s', executing it as text",
+               cache->key);
+
+    entry->hnext = *bucket;
+    *bucket = entry;
+    SB_LIST_ADD(&entry->listitem, &cache->lru);
+    cache->count++;
+  }
+
+  if (con->thread_id >= 0)
+  {
+    pthread_mutex_lock(&thread_stats[con->thread_id].stat_mutex);
+    if (hit)
+      thread_stats[con->thread_id].stmt_cache_hits++;
+    else
+      thread_stats[con->thread_id].stmt_cache_misses++;
+    pthread_mutex_unlock(&thread_stats[con->thread_id].stat_mutex);
+  }
+
+  if (entry->stmt == NULL)
+    return NULL;
+
+  /* Statements without literals are bound once when prepared */
+  if (cache->nparams > 0 &&
+      db_bind_param(entry->stmt, cache->binds, cache->nparams))
+  {
+    db_stmt_cache_remove(cache, entry);
+    return NULL;
+  }
+
+  return entry->stmt;
+}
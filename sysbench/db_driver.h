@@ -43,6 +43,8 @@ typedef struct
   db_ps_mode_t  ps_mode;   /* Requested prepared statements usage mode */
   char          *driver;   /* Requested database driver */
   unsigned char debug;     /* debug flag */
+  unsigned int  stmt_cache_size; /* Max. statements cached per connection */
+  unsigned int  sessions;  /* Sessions multiplexed by each thread */
 } db_globals_t;
 
 extern db_globals_t db_globals;
@@ -59,6 +61,7 @@ typedef struct
   char     needs_commit;        /* 1 if database needs explicit commit after INSERTs */
   char     serial;              /* 1 if database supports SERIAL clause */
   char     unsigned_int;        /* 1 if database supports UNSIGNED INTEGER types */
+  char     backslash_escapes;   /* 1 if backslashes in string literals are escapes */
 } drv_caps_t;
 
 /* Database errors definition */
@@ -71,6 +74,15 @@ typedef enum
   SB_DB_ERROR_FAILED
 } db_error_t;
 
+/* State of a connection with queries sent by db_send_*() */
+
+typedef enum
+{
+  DB_POLL_READY,    /* result of the oldest query can be collected */
+  DB_POLL_READ,     /* wait until the socket is readable */
+  DB_POLL_WRITE,    /* wait until the socket is writable */
+  DB_POLL_ERROR     /* connection failed, db_get_result() reports the error */
+} db_poll_t;
 
 /* Available buffer types (for parameters binding) */
 
@@ -116,12 +128,29 @@ typedef struct
   char             *is_null;
 } db_bind_t;
 
+/*
+  Initial number of queries sent with db_send_*() that may wait for their
+  results, the pending array grows as needed
+*/
+#define DB_PENDING_INIT 64
+
+/* How rows of a bulk insert are sent to the server */
+
+typedef enum
+{
+  DB_BULK_AUTO,     /* decided by the first row */
+  DB_BULK_TEXT,     /* multi-row INSERT statements */
+  DB_BULK_DRIVER    /* streamed by the driver, e.g. with COPY */
+} db_bulk_mode_t;
+
 /* Forward declarations */
 
 struct db_conn;
 struct db_stmt;
 struct db_result_set;
 struct db_row;
+struct db_stmt_cache;
+struct db_pending;
 
 /* Driver operations definition */
 
@@ -142,6 +171,17 @@ typedef int drv_op_free_results(struct db_result_set *);
 typedef int drv_op_close(struct db_stmt *);
 typedef int drv_op_store_results(struct db_result_set *);
 typedef int drv_op_done(void);
+typedef int drv_op_execute_batch(struct db_stmt *, db_bind_t *, unsigned int,
+                                 unsigned int);
+typedef int drv_op_send_query(struct db_conn *, const char *);
+typedef int drv_op_send_execute(struct db_stmt *);
+typedef int drv_op_get_result(struct db_conn *, struct db_result_set *);
+typedef int drv_op_socket(struct db_conn *);
+typedef db_poll_t drv_op_poll(struct db_conn *);
+typedef int drv_op_bulk_insert_init(struct db_conn *, const char *);
+typedef int drv_op_bulk_insert_row(struct db_conn *, db_bind_t *,
+                                   unsigned int);
+typedef int drv_op_bulk_insert_done(struct db_conn *);
 
 typedef struct
 {
@@ -161,6 +201,15 @@ typedef struct
   drv_op_query           *query;          /* execute non-prepared statement */
   drv_op_store_results   *store_results;  /* store results from last query */
   drv_op_done            *done;           /* uninitialize driver */
+  drv_op_execute_batch   *execute_batch;  /* execute for many param sets (optional) */
+  drv_op_send_query      *send_query;     /* send query asynchronously (optional) */
+  drv_op_send_execute    *send_execute;   /* send PS execution asynchronously (optional) */
+  drv_op_get_result      *get_result;     /* wait for async result (optional) */
+  drv_op_socket          *socket;         /* switch to non-blocking mode (optional) */
+  drv_op_poll            *poll;           /* consume input without blocking (optional) */
+  drv_op_bulk_insert_init *bulk_insert_init; /* start streaming rows (optional) */
+  drv_op_bulk_insert_row *bulk_insert_row; /* stream row of typed values (optional) */
+  drv_op_bulk_insert_done *bulk_insert_done; /* finish streaming rows (optional) */
 } drv_ops_t;
 
 /* Database driver definition */
@@ -205,6 +254,7 @@ typedef struct db_conn
 
   /* Internal fields */
   char            bulk_supported;    /* 1, if multi-row inserts are supported by the driver */
+  char            bulk_escapes;      /* 1, if backslashes in strings must be escaped */
   unsigned int    bulk_cnt;          /* Current number of rows in bulk insert buffer */
   char *          bulk_buffer;       /* Bulk insert query buffer */
   unsigned int    bulk_buflen;       /* Current length of bulk_buffer */
@@ -212,8 +262,14 @@ typedef struct db_conn
   unsigned int    bulk_ptr_orig;     /* Save value of bulk_ptr */
   unsigned int    bulk_commit_cnt;   /* Current value of uncommitted rows */
   unsigned int    bulk_commit_max;   /* Maximum value of uncommitted rows */
+  db_bulk_mode_t  bulk_mode;         /* How bulk insert rows are sent */
   int             thread_id;         /* Assiciated thread id (required to collect per-thread stats */
   db_result_set_t rs;                /* Result set */
+  struct db_stmt_cache *stmt_cache;  /* Statements prepared from db_query() text */
+  struct db_pending *pending;        /* Queries sent with db_send_*() */
+  unsigned int    pending_first;     /* Oldest entry in the pending array */
+  unsigned int    pending_cnt;       /* Number of results not collected yet */
+  unsigned int    pending_size;      /* Allocated entries in the pending array */
 } db_conn_t;
 
 typedef enum {
@@ -236,6 +292,8 @@ typedef struct db_stmt
   char            emulated;        /* Should this statement be emulated? */
   db_query_type_t type;            /* Query type */
   void            *ptr;            /* Pointer to driver-specific data structure */
+  db_bind_t       *params;         /* Copy of last bound parameters for outliers */
+  unsigned int    params_len;      /* Length of the params array */
 } db_stmt_t;
 
 /* Result set row definition */
@@ -268,6 +326,20 @@ int db_bind_result(db_stmt_t *, db_bind_t *, unsigned int);
 
 db_result_set_t *db_execute(db_stmt_t *);
 
+int db_execute_batch(db_stmt_t *, db_bind_t *, unsigned int, unsigned int);
+
+int db_send_query(db_conn_t *, const char *);
+
+int db_send_execute(db_stmt_t *);
+
+db_result_set_t *db_get_result(db_conn_t *);
+
+void db_discard_results(db_conn_t *);
+
+int db_socket(db_conn_t *);
+
+db_poll_t db_poll(db_conn_t *);
+
 db_row_t *db_fetch_row(db_result_set_t *);
 
 unsigned long long db_num_rows(db_result_set_t *);
@@ -286,14 +358,29 @@ db_error_t db_errno(db_conn_t *);
 
 int db_print_value(db_bind_t *, char *, int);
 
+/* Classify a query as read, write, commit or other */
+db_query_type_t db_get_query_type(const char *);
+
 /* Initialize multi-row insert operation */
 int db_bulk_insert_init(db_conn_t *, const char *);
 
 /* Add row to multi-row insert operation */
 int db_bulk_insert_next(db_conn_t *, const char *);
 
+/* Add row of typed values to multi-row insert operation */
+int db_bulk_insert_row(db_conn_t *, db_bind_t *, unsigned int);
+
 /* Finish multi-row insert operation */
-void db_bulk_insert_done(db_conn_t *);
+int db_bulk_insert_done(db_conn_t *);
+
+/* Extract "table (columns)" from an "INSERT INTO ... VALUES" prefix */
+const char *db_bulk_insert_target(const char *, unsigned int *);
+
+/* Upper bound of the length of a row encoded by db_bulk_encode_row() */
+unsigned int db_bulk_row_length(db_bind_t *, unsigned int);
+
+/* Encode row in the tab-separated text format of COPY and LOAD DATA */
+char *db_bulk_encode_row(char *, db_bind_t *, unsigned int);
 
 /* Print database-specific test stats */
 void db_print_stats(sb_stat_t type);
@@ -327,4 +414,10 @@ int register_driver_oracle(sb_list_t *);
 int register_driver_pgsql(sb_list_t *);
 #endif
 
+#ifdef USE_SQLITE
+int register_driver_sqlite(sb_list_t *);
+#endif
+
+int register_driver_mock(sb_list_t *);
+
 #endif /* DB_DRIVER_H */
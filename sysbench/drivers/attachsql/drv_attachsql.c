@@ -72,6 +72,7 @@ static drv_caps_t attachsql_drv_caps =
   .auto_increment = 1,
   .serial = 0,
   .unsigned_int = 0,
+  .backslash_escapes = 1,
 };
 
 static attachsql_drv_args_t args;          /* driver args */
@@ -0,0 +1,896 @@
+/* Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Mock driver emulating a database server inside the sysbench process. No
+  query is ever parsed beyond its class (read, write, commit or other). Each
+  class gets its own response time distribution, reads return synthetic
+  result sets, and errors and reconnects are injected at configurable rates.
+  With zero latency it measures the throughput of the harness itself.
+
+  Queries sent asynchronously are queued and executed one after another by
+  the emulated server, each completing at a precomputed time. Where timerfd
+  is available, a timer armed for the completion time serves as the socket
+  of a non-blocking connection.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_STRINGS_H
+# include <strings.h>
+#endif
+#include <stdlib.h>
+#include <math.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SYS_TIMERFD_H
+# include <sys/timerfd.h>
+#endif
+
+#include "sb_options.h"
+#include "db_driver.h"
+
+#ifndef M_PI
+# define M_PI 3.14159265358979323846
+#endif
+
+/* Mock driver arguments */
+
+static sb_arg_t mock_drv_args[] =
+{
+  {"mock-read-latency", "response time distribution of SELECT queries "
+   "in microseconds: none, const:T, uniform:MIN:MAX, exp:MEAN, "
+   "normal:MEAN:STDDEV or pareto:MIN:ALPHA", SB_ARG_TYPE_STRING, "none"},
+  {"mock-write-latency", "response time distribution of INSERT, UPDATE "
+   "and DELETE queries", SB_ARG_TYPE_STRING, "none"},
+  {"mock-commit-latency", "response time distribution of COMMIT queries",
+   SB_ARG_TYPE_STRING, "none"},
+  {"mock-other-latency", "response time distribution of other queries",
+   SB_ARG_TYPE_STRING, "none"},
+  {"mock-connect-latency", "time distribution of connects and reconnects",
+   SB_ARG_TYPE_STRING, "none"},
+  {"mock-wait", "how to wait for emulated response times {sleep,spin}",
+   SB_ARG_TYPE_STRING, "sleep"},
+  {"mock-rows", "number of rows returned by SELECT queries",
+   SB_ARG_TYPE_INT, "1"},
+  {"mock-columns", "number of columns in returned rows", SB_ARG_TYPE_INT,
+   "1"},
+  {"mock-column-width", "width of each returned column in bytes",
+   SB_ARG_TYPE_INT, "120"},
+  {"mock-error-rate", "percentage of queries failing with a deadlock error",
+   SB_ARG_TYPE_FLOAT, "0"},
+  {"mock-reconnect-rate", "percentage of queries failing with a lost "
+   "connection followed by a reconnect", SB_ARG_TYPE_FLOAT, "0"},
+
+  {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
+};
+
+/* Response time distributions */
+
+typedef enum
+{
+  MOCK_DIST_NONE,
+  MOCK_DIST_CONST,
+  MOCK_DIST_UNIFORM,
+  MOCK_DIST_EXP,
+  MOCK_DIST_NORMAL,
+  MOCK_DIST_PARETO
+} mock_dist_type_t;
+
+typedef struct
+{
+  mock_dist_type_t   type;
+  double             a;
+  double             b;
+} mock_dist_t;
+
+typedef struct
+{
+  mock_dist_t        latency[DB_QUERY_TYPE_OTHER + 1]; /* per query class */
+  mock_dist_t        connect;
+  int                spin;
+  unsigned int       rows;
+  unsigned int       columns;
+  unsigned int       column_width;
+  double             error_rate;
+  double             reconnect_rate;
+} mock_drv_args_t;
+
+/* Query sent asynchronously */
+
+typedef struct
+{
+  struct timespec    done;        /* when the emulated server completes it */
+  db_query_type_t    type;
+} mock_pending_t;
+
+/* Per-connection data */
+
+typedef struct
+{
+  char               *row;        /* buffer the current row is received to */
+  unsigned int       nrows;       /* rows in the current result set */
+  unsigned int       fetched;     /* rows fetched so far */
+  mock_pending_t     *pending;    /* queries sent asynchronously */
+  unsigned int       first;       /* oldest entry in the pending array */
+  unsigned int       cnt;         /* number of entries in the pending array */
+  unsigned int       size;        /* allocated entries in the pending array */
+  int                fd;          /* timer expiring when a result is ready */
+} mock_conn_t;
+
+/* Mock driver capabilities */
+
+static drv_caps_t mock_drv_caps =
+{
+  1,    /* multi_rows_insert */
+  1,    /* prepared_statements */
+  1,    /* auto_increment */
+  0,    /* needs_commit */
+  0,    /* serial */
+  1,    /* unsigned int */
+  0,    /* backslash_escapes */
+};
+
+static mock_drv_args_t args;          /* driver args */
+
+/* Row data sent by the emulated server */
+static char *mock_row_data;
+
+/* Mock driver operations */
+
+static int mock_drv_init(void);
+static int mock_drv_describe(drv_caps_t *);
+static int mock_drv_connect(db_conn_t *);
+static int mock_drv_disconnect(db_conn_t *);
+static int mock_drv_prepare(db_stmt_t *, const char *);
+static int mock_drv_bind_param(db_stmt_t *, db_bind_t *, unsigned int);
+static int mock_drv_bind_result(db_stmt_t *, db_bind_t *, unsigned int);
+static int mock_drv_execute(db_stmt_t *, db_result_set_t *);
+static int mock_drv_fetch(db_result_set_t *);
+static int mock_drv_fetch_row(db_result_set_t *, db_row_t *);
+static unsigned long long mock_drv_num_rows(db_result_set_t *);
+static int mock_drv_query(db_conn_t *, const char *, db_result_set_t *);
+static int mock_drv_free_results(db_result_set_t *);
+static int mock_drv_close(db_stmt_t *);
+static int mock_drv_store_results(db_result_set_t *);
+static int mock_drv_done(void);
+static int mock_drv_send_query(db_conn_t *, const char *);
+static int mock_drv_send_execute(db_stmt_t *);
+static int mock_drv_get_result(db_conn_t *, db_result_set_t *);
+#ifdef HAVE_SYS_TIMERFD_H
+static int mock_drv_socket(db_conn_t *);
+static db_poll_t mock_drv_poll(db_conn_t *);
+#endif
+
+/* Mock driver definition */
+
+static db_driver_t mock_driver =
+{
+  .sname = "mock",
+  .lname = "Mock driver emulating a database server",
+  .args = mock_drv_args,
+  .ops =
+  {
+    mock_drv_init,
+    mock_drv_describe,
+    mock_drv_connect,
+    mock_drv_disconnect,
+    mock_drv_prepare,
+    mock_drv_bind_param,
+    mock_drv_bind_result,
+    mock_drv_execute,
+    mock_drv_fetch,
+    mock_drv_fetch_row,
+    mock_drv_num_rows,
+    mock_drv_free_results,
+    mock_drv_close,
+    mock_drv_query,
+    mock_drv_store_results,
+    mock_drv_done,
+    NULL,
+    mock_drv_send_query,
+    mock_drv_send_execute,
+    mock_drv_get_result,
+#ifdef HAVE_SYS_TIMERFD_H
+    mock_drv_socket,
+    mock_drv_poll
+#endif
+  },
+  .listitem = {NULL, NULL}
+};
+
+
+/* Local functions */
+
+static int parse_dist(const char *, mock_dist_t *);
+static double dist_value(mock_dist_t *);
+static unsigned long long dist_ns(mock_dist_t *);
+static void mock_wait(mock_dist_t *);
+static void mock_wait_until(struct timespec *);
+static int mock_run(db_conn_t *, db_query_type_t, db_result_set_t *);
+static int mock_finish(db_conn_t *, db_query_type_t, db_result_set_t *);
+static int mock_send(db_conn_t *, db_query_type_t);
+
+/* Register mock driver */
+
+
+int register_driver_mock(sb_list_t *drivers)
+{
+  SB_LIST_ADD_TAIL(&mock_driver.listitem, drivers);
+
+  return 0;
+}
+
+
+/* Mock driver initialization */
+
+
+int mock_drv_init(void)
+{
+  static const char * const latency_opts[] =
+  {
+    "mock-read-latency",       /* DB_QUERY_TYPE_READ */
+    "mock-write-latency",      /* DB_QUERY_TYPE_WRITE */
+    "mock-commit-latency",     /* DB_QUERY_TYPE_COMMIT */
+    "mock-other-latency"       /* DB_QUERY_TYPE_OTHER */
+  };
+  unsigned int i;
+  size_t       len;
+  char         *s;
+  int          n;
+
+  for (i = 0; i <= DB_QUERY_TYPE_OTHER; i++)
+  {
+    s = sb_get_value_string(latency_opts[i]);
+    if (parse_dist(s, &args.latency[i]))
+    {
+      log_text(LOG_FATAL, "Invalid value for --%s: '%s'", latency_opts[i], s);
+      return 1;
+    }
+  }
+
+  s = sb_get_value_string("mock-connect-latency");
+  if (parse_dist(s, &args.connect))
+  {
+    log_text(LOG_FATAL, "Invalid value for --mock-connect-latency: '%s'", s);
+    return 1;
+  }
+
+  s = sb_get_value_string("mock-wait");
+  if (!strcmp(s, "spin"))
+    args.spin = 1;
+  else if (!strcmp(s, "sleep"))
+    args.spin = 0;
+  else
+  {
+    log_text(LOG_FATAL, "Invalid value for --mock-wait: '%s'", s);
+    return 1;
+  }
+
+  n = sb_get_value_int("mock-rows");
+  if (n < 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for --mock-rows: %d", n);
+    return 1;
+  }
+  args.rows = n;
+
+  n = sb_get_value_int("mock-columns");
+  if (n < 1)
+  {
+    log_text(LOG_FATAL, "Invalid value for --mock-columns: %d", n);
+    return 1;
+  }
+  args.columns = n;
+
+  n = sb_get_value_int("mock-column-width");
+  if (n < 1)
+  {
+    log_text(LOG_FATAL, "Invalid value for --mock-column-width: %d", n);
+    return 1;
+  }
+  args.column_width = n;
+
+  args.error_rate = sb_get_value_float("mock-error-rate") / 100;
+  args.reconnect_rate = sb_get_value_float("mock-reconnect-rate") / 100;
+  if (args.error_rate < 0 || args.reconnect_rate < 0 ||
+      args.error_rate + args.reconnect_rate > 1)
+  {
+    log_text(LOG_FATAL, "Invalid values for --mock-error-rate and "
+             "--mock-reconnect-rate: percentages must be in [0, 100] "
+             "and add up to at most 100");
+    return 1;
+  }
+
+  /* Each column is a zero-terminated string of random letters */
+  len = (size_t)args.columns * (args.column_width + 1);
+  mock_row_data = (char *)malloc(len);
+  if (mock_row_data == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure");
+    return 1;
+  }
+  for (i = 0; i < len; i++)
+    mock_row_data[i] = 'a' + sb_rnd() % 26;
+  for (i = 0; i < args.columns; i++)
+    mock_row_data[i * (args.column_width + 1) + args.column_width] = '\0';
+
+  return 0;
+}
+
+
+/* Describe database capabilities */
+
+
+int mock_drv_describe(drv_caps_t *caps)
+{
+  *caps = mock_drv_caps;
+
+  return 0;
+}
+
+
+/* Connect to database */
+
+
+int mock_drv_connect(db_conn_t *sb_conn)
+{
+  mock_conn_t *con;
+
+  con = (mock_conn_t *)calloc(1, sizeof(mock_conn_t));
+  if (con == NULL)
+    return 1;
+
+  con->row = (char *)malloc((size_t)args.columns * (args.column_width + 1));
+  if (con->row == NULL)
+  {
+    free(con);
+    return 1;
+  }
+  con->fd = -1;
+
+  mock_wait(&args.connect);
+
+  sb_conn->ptr = con;
+
+  return 0;
+}
+
+
+/* Disconnect from database */
+
+
+int mock_drv_disconnect(db_conn_t *sb_conn)
+{
+  mock_conn_t *con = (mock_conn_t *)sb_conn->ptr;
+
+  if (con != NULL)
+  {
+    if (con->fd >= 0)
+      close(con->fd);
+    free(con->pending);
+    free(con->row);
+    free(con);
+    sb_conn->ptr = NULL;
+  }
+
+  return 0;
+}
+
+
+/* Prepare statement */
+
+
+int mock_drv_prepare(db_stmt_t *stmt, const char *query)
+{
+  if (stmt->connection->ptr == NULL)
+    return 1;
+
+  stmt->query = strdup(query);
+
+  return 0;
+}
+
+
+/* Bind parameters for prepared statement */
+
+
+int mock_drv_bind_param(db_stmt_t *stmt, db_bind_t *params, unsigned int len)
+{
+  if (stmt->bound_param != NULL)
+    free(stmt->bound_param);
+  stmt->bound_param = (db_bind_t *)malloc(len * sizeof(db_bind_t));
+  if (stmt->bound_param == NULL)
+    return 1;
+  memcpy(stmt->bound_param, params, len * sizeof(db_bind_t));
+  stmt->bound_param_len = len;
+
+  return 0;
+}
+
+
+/* Bind results for prepared statement */
+
+
+int mock_drv_bind_result(db_stmt_t *stmt, db_bind_t *params, unsigned int len)
+{
+  /* unused */
+  (void)stmt;
+  (void)params;
+  (void)len;
+
+  return 0;
+}
+
+
+/* Execute prepared statement */
+
+
+int mock_drv_execute(db_stmt_t *stmt, db_result_set_t *rs)
+{
+  return mock_run(stmt->connection, db_get_query_type(stmt->query), rs);
+}
+
+
+/* Execute SQL query */
+
+
+int mock_drv_query(db_conn_t *sb_conn, const char *query,
+                   db_result_set_t *rs)
+{
+  return mock_run(sb_conn, db_get_query_type(query), rs);
+}
+
+
+/* Send SQL query without waiting for its result */
+
+
+int mock_drv_send_query(db_conn_t *sb_conn, const char *query)
+{
+  return mock_send(sb_conn, db_get_query_type(query));
+}
+
+
+/* Send prepared statement execution without waiting for its result */
+
+
+int mock_drv_send_execute(db_stmt_t *stmt)
+{
+  return mock_send(stmt->connection, db_get_query_type(stmt->query));
+}
+
+
+/* Wait for the result of the oldest query sent asynchronously */
+
+
+int mock_drv_get_result(db_conn_t *sb_conn, db_result_set_t *rs)
+{
+  mock_conn_t    *con = (mock_conn_t *)sb_conn->ptr;
+  mock_pending_t *p;
+
+  if (con == NULL || con->cnt == 0)
+    return SB_DB_ERROR_FAILED;
+
+  p = con->pending + con->first;
+  con->first = (con->first + 1) % con->size;
+  con->cnt--;
+
+  mock_wait_until(&p->done);
+
+  return mock_finish(sb_conn, p->type, rs);
+}
+
+
+#ifdef HAVE_SYS_TIMERFD_H
+
+/* Create the timer used as the socket of a non-blocking connection */
+
+
+int mock_drv_socket(db_conn_t *sb_conn)
+{
+  mock_conn_t *con = (mock_conn_t *)sb_conn->ptr;
+
+  if (con == NULL)
+    return -1;
+
+  if (con->fd < 0)
+    con->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+
+  return con->fd;
+}
+
+
+/*
+  Tell whether the oldest query is complete, otherwise arm the timer for its
+  completion time. Arming the timer also resets a previous expiration.
+*/
+
+
+db_poll_t mock_drv_poll(db_conn_t *sb_conn)
+{
+  mock_conn_t       *con = (mock_conn_t *)sb_conn->ptr;
+  struct itimerspec its;
+  struct timespec   now;
+  mock_pending_t    *p;
+
+  if (con == NULL || con->fd < 0)
+    return DB_POLL_ERROR;
+
+  if (con->cnt == 0)
+    return DB_POLL_READY;
+
+  p = con->pending + con->first;
+  SB_GETTIME(&now);
+  if (now.tv_sec > p->done.tv_sec ||
+      (now.tv_sec == p->done.tv_sec && now.tv_nsec >= p->done.tv_nsec))
+    return DB_POLL_READY;
+
+  memset(&its, 0, sizeof(its));
+  its.it_value = p->done;
+  if (timerfd_settime(con->fd, TFD_TIMER_ABSTIME, &its, NULL))
+    return DB_POLL_ERROR;
+
+  return DB_POLL_READ;
+}
+
+#endif /* HAVE_SYS_TIMERFD_H */
+
+
+/* Fetch row from result set of a prepared statement */
+
+
+int mock_drv_fetch(db_result_set_t *rs)
+{
+  db_row_t row;
+
+  return mock_drv_fetch_row(rs, &row);
+}
+
+
+/* Fetch row from result set of a query */
+
+
+int mock_drv_fetch_row(db_result_set_t *rs, db_row_t *row)
+{
+  mock_conn_t *con = (mock_conn_t *)rs->connection->ptr;
+
+  if (con == NULL || con->fetched >= con->nrows)
+    return 1;
+
+  /* Receive the row into the connection buffer */
+  memcpy(con->row, mock_row_data,
+         (size_t)args.columns * (args.column_width + 1));
+  con->fetched++;
+
+  row->result_set = rs;
+  row->ptr = con->row;
+
+  return 0;
+}
+
+
+/* Return the number of rows in a result set */
+
+
+unsigned long long mock_drv_num_rows(db_result_set_t *rs)
+{
+  return rs->nrows;
+}
+
+
+/* Store results from the last query */
+
+
+int mock_drv_store_results(db_result_set_t *rs)
+{
+  mock_conn_t  *con = (mock_conn_t *)rs->connection->ptr;
+  db_row_t     row;
+  unsigned int i;
+  size_t       len;
+
+  if (con == NULL)
+    return 1;
+
+  /* Walk every column of every row, as a real driver would */
+  while (!mock_drv_fetch_row(rs, &row))
+  {
+    for (i = 0; i < args.columns; i++)
+    {
+      len = strlen(con->row + i * (args.column_width + 1));
+      if (len != args.column_width)
+        return 1;
+    }
+  }
+  rs->nrows = con->nrows;
+
+  return 0;
+}
+
+
+/* Free result set */
+
+
+int mock_drv_free_results(db_result_set_t *rs)
+{
+  mock_conn_t *con = (mock_conn_t *)rs->connection->ptr;
+
+  if (con == NULL)
+    return 1;
+
+  con->nrows = 0;
+  con->fetched = 0;
+
+  return 0;
+}
+
+
+/* Close prepared statement */
+
+
+int mock_drv_close(db_stmt_t *stmt)
+{
+  (void)stmt; /* unused */
+
+  return 0;
+}
+
+
+/* Uninitialize driver */
+
+
+int mock_drv_done(void)
+{
+  free(mock_row_data);
+  mock_row_data = NULL;
+
+  return 0;
+}
+
+
+/*
+  Parse a distribution specification: none, const:T, uniform:MIN:MAX,
+  exp:MEAN, normal:MEAN:STDDEV or pareto:MIN:ALPHA
+*/
+
+
+int parse_dist(const char *spec, mock_dist_t *dist)
+{
+  char name[16];
+  int  n;
+
+  memset(dist, 0, sizeof(*dist));
+
+  if (!strcmp(spec, "none"))
+    return 0;
+
+  n = sscanf(spec, "%15[a-z]:%lf:%lf", name, &dist->a, &dist->b);
+  if (n < 2 || dist->a < 0 || dist->b < 0)
+    return 1;
+
+  if (!strcmp(name, "const") && n == 2)
+    dist->type = MOCK_DIST_CONST;
+  else if (!strcmp(name, "uniform") && n == 3 && dist->a <= dist->b)
+    dist->type = MOCK_DIST_UNIFORM;
+  else if (!strcmp(name, "exp") && n == 2)
+    dist->type = MOCK_DIST_EXP;
+  else if (!strcmp(name, "normal") && n == 3)
+    dist->type = MOCK_DIST_NORMAL;
+  else if (!strcmp(name, "pareto") && n == 3 && dist->b > 0)
+    dist->type = MOCK_DIST_PARETO;
+  else
+    return 1;
+
+  return 0;
+}
+
+
+/* Draw a value in microseconds from a distribution */
+
+
+double dist_value(mock_dist_t *dist)
+{
+  double u, v;
+
+  switch (dist->type) {
+    case MOCK_DIST_CONST:
+      return dist->a;
+    case MOCK_DIST_UNIFORM:
+      return dist->a + (dist->b - dist->a) * sb_rnd_double();
+    case MOCK_DIST_EXP:
+      return -dist->a * log(1 - sb_rnd_double());
+    case MOCK_DIST_NORMAL:
+      /* Box-Muller transform, negative values are clipped to zero */
+      u = 1 - sb_rnd_double();
+      v = sb_rnd_double();
+      v = dist->a + dist->b * sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+      return v > 0 ? v : 0;
+    case MOCK_DIST_PARETO:
+      return dist->a / pow(1 - sb_rnd_double(), 1 / dist->b);
+    default:
+      return 0;
+  }
+}
+
+
+/* Draw a time in nanoseconds from a distribution */
+
+
+unsigned long long dist_ns(mock_dist_t *dist)
+{
+  if (dist->type == MOCK_DIST_NONE)
+    return 0;
+
+  return (unsigned long long)(dist_value(dist) * 1000);
+}
+
+
+/* Wait for a time drawn from a distribution */
+
+
+void mock_wait(mock_dist_t *dist)
+{
+  struct timespec    start;
+  struct timespec    now;
+  unsigned long long ns;
+
+  ns = dist_ns(dist);
+  if (ns == 0)
+    return;
+
+  if (!args.spin)
+  {
+    usleep((ns + 999) / 1000);
+    return;
+  }
+
+  SB_GETTIME(&start);
+  do
+  {
+    SB_GETTIME(&now);
+  } while (TIMESPEC_DIFF(now, start) < ns);
+}
+
+
+/* Wait until the given time */
+
+
+void mock_wait_until(struct timespec *until)
+{
+  struct timespec now;
+
+  for (;;)
+  {
+    SB_GETTIME(&now);
+    if (now.tv_sec > until->tv_sec ||
+        (now.tv_sec == until->tv_sec && now.tv_nsec >= until->tv_nsec))
+      return;
+    if (!args.spin)
+      usleep((TIMESPEC_DIFF((*until), now) + 999) / 1000);
+  }
+}
+
+
+/* Emulate execution of a query of the given class */
+
+
+int mock_run(db_conn_t *sb_conn, db_query_type_t type, db_result_set_t *rs)
+{
+  if (sb_conn->ptr == NULL)
+    return SB_DB_ERROR_FAILED;
+
+  mock_wait(&args.latency[type]);
+
+  return mock_finish(sb_conn, type, rs);
+}
+
+
+/* Produce the result of a query once the emulated server has executed it */
+
+
+int mock_finish(db_conn_t *sb_conn, db_query_type_t type, db_result_set_t *rs)
+{
+  mock_conn_t *con = (mock_conn_t *)sb_conn->ptr;
+  double      r;
+
+  if (con == NULL)
+    return SB_DB_ERROR_FAILED;
+
+  con->nrows = 0;
+  con->fetched = 0;
+
+  if (args.error_rate > 0 || args.reconnect_rate > 0)
+  {
+    r = sb_rnd_double();
+    if (r < args.error_rate)
+      return SB_DB_ERROR_RESTART_TRANSACTION;
+    if (r < args.error_rate + args.reconnect_rate)
+    {
+      mock_wait(&args.connect);
+      return SB_DB_ERROR_RECONNECTED;
+    }
+  }
+
+  if (type == DB_QUERY_TYPE_READ)
+    con->nrows = args.rows;
+
+  rs->ptr = con;
+
+  return SB_DB_ERROR_NONE;
+}
+
+
+/*
+  Queue a query sent asynchronously. The emulated server executes queries of
+  a connection one after another, so a query starts when it arrives or when
+  the previous one completes, whichever is later.
+*/
+
+
+int mock_send(db_conn_t *sb_conn, db_query_type_t type)
+{
+  mock_conn_t        *con = (mock_conn_t *)sb_conn->ptr;
+  mock_pending_t     *p;
+  mock_pending_t     *last;
+  struct timespec    start;
+  unsigned long long ns;
+
+  if (con == NULL)
+    return SB_DB_ERROR_FAILED;
+
+  if (con->cnt == con->size)
+  {
+    mock_pending_t *tmp;
+    unsigned int   size = con->size > 0 ? con->size * 2 : DB_PENDING_INIT;
+    unsigned int   i;
+
+    tmp = (mock_pending_t *)calloc(size, sizeof(mock_pending_t));
+    if (tmp == NULL)
+      return SB_DB_ERROR_FAILED;
+    for (i = 0; i < con->cnt; i++)
+      tmp[i] = con->pending[(con->first + i) % con->size];
+    free(con->pending);
+    con->pending = tmp;
+    con->first = 0;
+    con->size = size;
+  }
+
+  SB_GETTIME(&start);
+  if (con->cnt > 0)
+  {
+    last = con->pending + (con->first + con->cnt - 1) % con->size;
+    if (last->done.tv_sec > start.tv_sec ||
+        (last->done.tv_sec == start.tv_sec &&
+         last->done.tv_nsec > start.tv_nsec))
+      start = last->done;
+  }
+
+  ns = dist_ns(&args.latency[type]) + start.tv_nsec;
+
+  p = con->pending + (con->first + con->cnt) % con->size;
+  p->type = type;
+  p->done.tv_sec = start.tv_sec + ns / 1000000000ULL;
+  p->done.tv_nsec = ns % 1000000000ULL;
+  con->cnt++;
+
+  return SB_DB_ERROR_NONE;
+}
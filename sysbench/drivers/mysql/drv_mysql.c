@@ -46,6 +46,19 @@
 # define HAVE_PS
 #endif
 
+/* Check if multi-statement queries can be used (see mysql_drv_real_connect()) */
+#if MYSQL_VERSION_ID >= 50000
+# define HAVE_MULTI_STATEMENTS
+#endif
+
+/* Check if LOAD DATA LOCAL INFILE data can be generated by the client */
+#if MYSQL_VERSION_ID >= 40100
+# define HAVE_LOCAL_INFILE_HANDLER
+#endif
+
+/* Size of the buffer LOAD DATA rows are encoded to */
+#define LOAD_BUFFER_SIZE (4*1024*1024)
+
 /* Check if we should use the TYPE= (for 3.23) or ENGINE= syntax */
 #if MYSQL_VERSION_ID >= 40000
 # define ENGINE_CLAUSE "ENGINE"
@@ -82,6 +95,8 @@ static sb_arg_t mysql_drv_args[] =
    SB_ARG_TYPE_LIST, "1213,1020,1205"},
   {"mysql-dry-run", "Dry run, pretent that all MySQL client API calls are successful without executing them",
    SB_ARG_TYPE_FLAG, "off"},
+  {"mysql-load-data", "load bulk insert rows with LOAD DATA LOCAL INFILE "
+   "(requires local_infile on the server)", SB_ARG_TYPE_FLAG, "off"},
 
   {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
 };
@@ -99,8 +114,24 @@ typedef struct
   unsigned char      debug;
   sb_list_t          *ignored_errors;
   unsigned int       dry_run;
+  unsigned char      load_data;
 } mysql_drv_args_t;
 
+/*
+  LOAD DATA LOCAL INFILE state of a bulk insert. Rows are encoded to a
+  buffer, and each full buffer is loaded with one LOAD DATA statement whose
+  file data the client library reads through the local infile handler.
+*/
+
+typedef struct
+{
+  char            *query;
+  char            *buf;
+  unsigned int    len;
+  unsigned int    size;
+  unsigned int    pos;        /* read position of the local infile handler */
+} mysql_load_t;
+
 typedef struct
 {
   MYSQL        *mysql;
@@ -110,6 +141,7 @@ typedef struct
   char         *db;
   unsigned int port;
   char         *socket;
+  mysql_load_t *load;         /* LOAD DATA in progress, if any */
 } db_mysql_conn_t;
 
 #ifdef HAVE_PS
@@ -148,6 +180,7 @@ static drv_caps_t mysql_drv_caps =
   1,
   0,
   0,
+  1,
   1
 };
 
@@ -181,6 +214,15 @@ static int mysql_drv_free_results(db_result_set_t *);
 static int mysql_drv_close(db_stmt_t *);
 static int mysql_drv_store_results(db_result_set_t *);
 static int mysql_drv_done(void);
+#ifdef HAVE_LOCAL_INFILE_HANDLER
+static int mysql_drv_bulk_insert_init(db_conn_t *, const char *);
+static int mysql_drv_bulk_insert_row(db_conn_t *, db_bind_t *, unsigned int);
+static int mysql_drv_bulk_insert_done(db_conn_t *);
+#endif
+#ifdef HAVE_MULTI_STATEMENTS
+static int mysql_drv_execute_batch(db_stmt_t *, db_bind_t *, unsigned int,
+                                   unsigned int);
+#endif
 
 /* MySQL driver definition */
 
@@ -205,7 +247,22 @@ static db_driver_t mysql_driver =
     mysql_drv_close,
     mysql_drv_query,
     mysql_drv_store_results,
-    mysql_drv_done
+    mysql_drv_done,
+#ifdef HAVE_MULTI_STATEMENTS
+    mysql_drv_execute_batch,
+#else
+    NULL,
+#endif
+    NULL,                       /* send_query */
+    NULL,                       /* send_execute */
+    NULL,                       /* get_result */
+    NULL,                       /* socket */
+    NULL,                       /* poll */
+#ifdef HAVE_LOCAL_INFILE_HANDLER
+    mysql_drv_bulk_insert_init,
+    mysql_drv_bulk_insert_row,
+    mysql_drv_bulk_insert_done
+#endif
   },
   {0,0}
 };
@@ -216,6 +273,9 @@ static db_driver_t mysql_driver =
 #ifdef HAVE_PS
 static int get_mysql_bind_type(db_bind_type_t);
 #endif
+#ifdef HAVE_LOCAL_INFILE_HANDLER
+static void mysql_load_free(MYSQL *, mysql_load_t *);
+#endif
 
 /* Register MySQL driver */
 
@@ -259,6 +319,8 @@ int mysql_drv_init(void)
 
   args.dry_run = sb_get_value_flag("mysql-dry-run");
 
+  args.load_data = sb_get_value_flag("mysql-load-data");
+
   use_ps = 0;
 #ifdef HAVE_PS
   mysql_drv_caps.prepared_statements = 1;
@@ -307,6 +369,16 @@ static int mysql_drv_real_connect(db_mysql_conn_t *db_mysql_con)
 		mysql_options(con,MYSQL_OPT_COMPRESS,NULL);
 	}
 
+#ifdef HAVE_LOCAL_INFILE_HANDLER
+  if (args.load_data)
+  {
+    unsigned int local_infile = 1;
+
+    DEBUG("mysql_options(%p, MYSQL_OPT_LOCAL_INFILE, 1)", con);
+    mysql_options(con, MYSQL_OPT_LOCAL_INFILE, &local_infile);
+  }
+#endif
+
   DEBUG("mysql_real_connect(%p, \"%s\", \"%s\", \"%s\", \"%s\", %u, \"%s\", %s)",
         con,
         SAFESTR(db_mysql_con->host),
@@ -411,6 +483,11 @@ int mysql_drv_disconnect(db_conn_t *sb_conn)
     return 0;
   if (db_mysql_con != NULL && db_mysql_con->mysql != NULL)
   {
+#ifdef HAVE_LOCAL_INFILE_HANDLER
+    /* Bulk insert was abandoned, e.g. on error */
+    if (db_mysql_con->load != NULL)
+      mysql_load_free(db_mysql_con->mysql, db_mysql_con->load);
+#endif
     DEBUG("mysql_close(%p)", db_mysql_con->mysql);
     mysql_close(db_mysql_con->mysql);
     free(db_mysql_con->mysql);
@@ -690,6 +767,13 @@ static int check_error(db_conn_t *sb_con, const char *func, const char *query)
         break;
       }
 
+      /*
+        Errors like a lock wait timeout only roll back the failed statement.
+        Roll back the rest of the transaction like other drivers do, so the
+        restarted BEGIN does not commit a partial transaction.
+      */
+      mysql_rollback(con);
+
       return SB_DB_ERROR_RESTART_TRANSACTION;
     }
   }
@@ -704,6 +788,58 @@ static int check_error(db_conn_t *sb_con, const char *func, const char *query)
   return SB_DB_ERROR_FAILED;
 }
 
+/*
+  Append query with placeholders replaced by parameter values to a buffer,
+  growing it as needed.
+*/
+
+
+static int mysql_print_query(const char *query, db_bind_t *params, char **buf,
+                             unsigned int *buflen, unsigned int *pos)
+{
+  unsigned int    i, j, vcnt;
+  char            need_realloc;
+  int             n;
+
+  need_realloc = (*buf == NULL);
+  vcnt = 0;
+  for (i = 0, j = *pos; query[i] != '\0'; i++)
+  {
+  again:
+    if (j+1 >= *buflen || need_realloc)
+    {
+      *buflen = (*buflen > 0) ? *buflen * 2 : 256;
+      *buf = realloc(*buf, *buflen);
+      if (*buf == NULL)
+      {
+        log_text(LOG_DEBUG, "ERROR: exiting mysql_print_query(), memory allocation failure");
+        return 1;
+      }
+      need_realloc = 0;
+    }
+
+    if (query[i] != '?')
+    {
+      (*buf)[j++] = query[i];
+      continue;
+    }
+
+    n = db_print_value(params + vcnt, *buf + j, (int)(*buflen - j));
+    if (n < 0)
+    {
+      need_realloc = 1;
+      goto again;
+    }
+    j += (unsigned int)n;
+    vcnt++;
+  }
+  (*buf)[j] = '\0';
+  *pos = j;
+
+  return 0;
+}
+
+
 /* Execute prepared statement */
 
 
@@ -712,9 +848,7 @@ int mysql_drv_execute(db_stmt_t *stmt, db_result_set_t *rs)
   db_conn_t       *con = stmt->connection;
   char            *buf = NULL;
   unsigned int    buflen = 0;
-  unsigned int    i, j, vcnt;
-  char            need_realloc;
-  int             n;
+  unsigned int    pos = 0;
   unsigned int    rc;
 
   if (args.dry_run)
@@ -744,51 +878,93 @@ int mysql_drv_execute(db_stmt_t *stmt, db_result_set_t *rs)
 
   /* Use emulation */
   /* Build the actual query string from parameters list */
-  need_realloc = 1;
-  vcnt = 0;
-  for (i = 0, j = 0; stmt->query[i] != '\0'; i++)
+  if (mysql_print_query(stmt->query, stmt->bound_param, &buf, &buflen, &pos))
+    return SB_DB_ERROR_FAILED;
+
+  con->db_errno = mysql_drv_query(con, buf, rs);
+  free(buf);
+  if (con->db_errno != SB_DB_ERROR_NONE)
   {
-  again:
-    if (j+1 >= buflen || need_realloc)
-    {
-      buflen = (buflen > 0) ? buflen * 2 : 256;
-      buf = realloc(buf, buflen);
-      if (buf == NULL)
-      {
-        log_text(LOG_DEBUG, "ERROR: exiting mysql_drv_execute(), memory allocation failure");
-        return SB_DB_ERROR_FAILED;
-      }
-      need_realloc = 0;
-    }
+    log_text(LOG_DEBUG, "ERROR: exiting mysql_drv_execute(), database error");
+    return con->db_errno;
+  }
 
-    if (stmt->query[i] != '?')
-    {
-      buf[j++] = stmt->query[i];
-      continue;
-    }
+  return SB_DB_ERROR_NONE;
+}
 
-    n = db_print_value(stmt->bound_param + vcnt, buf + j, (int)(buflen - j));
-    if (n < 0)
+
+#ifdef HAVE_MULTI_STATEMENTS
+
+/*
+  Execute prepared statement for multiple parameter sets by sending them as a
+  single multi-statement query, so the whole batch takes one round trip. The
+  binary protocol has no array binding, so the query text is used for both
+  server-side and emulated prepared statements.
+*/
+
+
+int mysql_drv_execute_batch(db_stmt_t *stmt, db_bind_t *params,
+                            unsigned int nparams, unsigned int nrows)
+{
+  db_conn_t       *sb_con = stmt->connection;
+  db_mysql_conn_t *db_mysql_con = (db_mysql_conn_t *) sb_con->ptr;
+  MYSQL           *con;
+  MYSQL_RES       *res;
+  char            *buf = NULL;
+  unsigned int    buflen = 0;
+  unsigned int    pos = 0;
+  unsigned int    i;
+  int             rc;
+
+  if (args.dry_run)
+    return 0;
+
+  con = db_mysql_con->mysql;
+
+  for (i = 0; i < nrows; i++)
+  {
+    if (i > 0)
+      buf[pos++] = ';';
+    if (mysql_print_query(stmt->query, params + i * nparams, &buf, &buflen,
+                          &pos))
     {
-      need_realloc = 1;
-      goto again;
+      free(buf);
+      return SB_DB_ERROR_FAILED;
     }
-    j += (unsigned int)n;
-    vcnt++;
   }
-  buf[j] = '\0';
 
-  con->db_errno = mysql_drv_query(con, buf, rs);
-  free(buf);
-  if (con->db_errno != SB_DB_ERROR_NONE)
+  rc = mysql_real_query(con, buf, pos);
+  DEBUG("mysql_real_query(%p, \"%s\", %u) = %d", con, buf, pos, rc);
+  if (rc)
   {
-    log_text(LOG_DEBUG, "ERROR: exiting mysql_drv_execute(), database error");
-    return con->db_errno;
+    rc = check_error(sb_con, "mysql_drv_execute_batch()", stmt->query);
+    free(buf);
+    return rc;
   }
+  free(buf);
+
+  /* Consume results of all statements, execution stops at the first error */
+  do
+  {
+    res = mysql_store_result(con);
+    DEBUG("mysql_store_result(%p) = %p", con, res);
+    if (res != NULL)
+      mysql_free_result(res);
+    else if (mysql_field_count(con) != 0)
+      return check_error(sb_con, "mysql_store_result()", NULL);
+
+    rc = mysql_next_result(con);
+    DEBUG("mysql_next_result(%p) = %d", con, rc);
+  } while (rc == 0);
+
+  if (rc > 0)
+    return check_error(sb_con, "mysql_next_result()", stmt->query);
 
   return SB_DB_ERROR_NONE;
 }
 
+#endif /* HAVE_MULTI_STATEMENTS */
+
 
 /* Execute SQL query */
 
@@ -981,6 +1157,224 @@ int mysql_drv_close(db_stmt_t *stmt)
 }
 
 
+#ifdef HAVE_LOCAL_INFILE_HANDLER
+
+/* Local infile handler: the server requested the file */
+
+
+static int mysql_load_init(void **ptr, const char *filename, void *userdata)
+{
+  mysql_load_t *load = (mysql_load_t *)userdata;
+
+  (void)filename; /* unused */
+
+  load->pos = 0;
+  *ptr = load;
+
+  return 0;
+}
+
+
+/* Local infile handler: send the rows encoded to the buffer */
+
+
+static int mysql_load_read(void *ptr, char *buf, unsigned int buf_len)
+{
+  mysql_load_t *load = (mysql_load_t *)ptr;
+  unsigned int n;
+
+  n = load->len - load->pos;
+  if (n > buf_len)
+    n = buf_len;
+  memcpy(buf, load->buf + load->pos, n);
+  load->pos += n;
+
+  return (int)n;
+}
+
+
+/* Local infile handler: the file is closed */
+
+
+static void mysql_load_end(void *ptr)
+{
+  (void)ptr; /* unused */
+}
+
+
+/* Local infile handler: report an error */
+
+
+static int mysql_load_error(void *ptr, char *buf, unsigned int buf_len)
+{
+  (void)ptr; /* unused */
+
+  snprintf(buf, buf_len, "sysbench bulk insert failed");
+
+  return CR_UNKNOWN_ERROR;
+}
+
+
+/* Load the rows encoded so far with one LOAD DATA statement */
+
+
+static int mysql_load_send(MYSQL *con, mysql_load_t *load)
+{
+  int rc;
+
+  DEBUG("mysql_real_query(%p, \"%s\", %u)", con, load->query,
+        (unsigned int) strlen(load->query));
+  rc = mysql_real_query(con, load->query, strlen(load->query));
+  load->len = 0;
+
+  return rc;
+}
+
+
+/* Restore the default local infile handler and free the load state */
+
+
+static void mysql_load_free(MYSQL *con, mysql_load_t *load)
+{
+  mysql_set_local_infile_default(con);
+
+  free(load->buf);
+  free(load->query);
+  free(load);
+}
+
+
+/*
+  Start LOAD DATA LOCAL INFILE for a bulk insert, if enabled with
+  --mysql-load-data. Rows are loaded in the default format of LOAD DATA.
+  Returns non-zero to fall back to multi-row INSERT statements.
+*/
+
+
+int mysql_drv_bulk_insert_init(db_conn_t *sb_conn, const char *query)
+{
+  db_mysql_conn_t *db_mysql_con = (db_mysql_conn_t *) sb_conn->ptr;
+  mysql_load_t    *load;
+  const char      *target;
+  unsigned int    len;
+
+  if (!args.load_data || args.dry_run)
+    return 1;
+
+  target = db_bulk_insert_target(query, &len);
+  if (target == NULL)
+    return 1;
+
+  load = (mysql_load_t *)calloc(1, sizeof(mysql_load_t));
+  if (load == NULL)
+    return 1;
+  load->buf = (char *)malloc(LOAD_BUFFER_SIZE);
+  load->size = LOAD_BUFFER_SIZE;
+  load->query = (char *)malloc(len +
+                               sizeof("LOAD DATA LOCAL INFILE 'sysbench' "
+                                      "INTO TABLE "));
+  if (load->buf == NULL || load->query == NULL)
+  {
+    free(load->buf);
+    free(load->query);
+    free(load);
+    return 1;
+  }
+  sprintf(load->query, "LOAD DATA LOCAL INFILE 'sysbench' INTO TABLE %.*s",
+          (int)len, target);
+
+  mysql_set_local_infile_handler(db_mysql_con->mysql, mysql_load_init,
+                                 mysql_load_read, mysql_load_end,
+                                 mysql_load_error, load);
+
+  /*
+    Load an empty file first, the server refuses the query if local_infile
+    is disabled and rows can still be sent with INSERT then
+  */
+  if (mysql_load_send(db_mysql_con->mysql, load))
+  {
+    log_text(LOG_WARNING, "LOAD DATA LOCAL INFILE failed, using INSERT: "
+             "error %u (%s)", mysql_errno(db_mysql_con->mysql),
+             mysql_error(db_mysql_con->mysql));
+    mysql_load_free(db_mysql_con->mysql, load);
+    return 1;
+  }
+
+  db_mysql_con->load = load;
+
+  return 0;
+}
+
+
+/* Encode row of typed values for LOAD DATA */
+
+
+int mysql_drv_bulk_insert_row(db_conn_t *sb_conn, db_bind_t *values,
+                              unsigned int nvalues)
+{
+  db_mysql_conn_t *db_mysql_con = (db_mysql_conn_t *) sb_conn->ptr;
+  mysql_load_t    *load = db_mysql_con->load;
+  unsigned int    need;
+  char            *p;
+  char            *tmp;
+
+  need = db_bulk_row_length(values, nvalues);
+  if (load->len + need > load->size)
+  {
+    if (load->len > 0 && mysql_load_send(db_mysql_con->mysql, load))
+    {
+      log_text(LOG_FATAL, "LOAD DATA LOCAL INFILE returned error %u (%s)",
+               mysql_errno(db_mysql_con->mysql),
+               mysql_error(db_mysql_con->mysql));
+      return SB_DB_ERROR_FAILED;
+    }
+    if (need > load->size)
+    {
+      tmp = (char *)realloc(load->buf, need);
+      if (tmp == NULL)
+        return SB_DB_ERROR_FAILED;
+      load->buf = tmp;
+      load->size = need;
+    }
+  }
+
+  p = db_bulk_encode_row(load->buf + load->len, values, nvalues);
+  if (p == NULL)
+    return SB_DB_ERROR_FAILED;
+  load->len = p - load->buf;
+
+  return SB_DB_ERROR_NONE;
+}
+
+
+/* Load the remaining rows */
+
+
+int mysql_drv_bulk_insert_done(db_conn_t *sb_conn)
+{
+  db_mysql_conn_t *db_mysql_con = (db_mysql_conn_t *) sb_conn->ptr;
+  mysql_load_t    *load = db_mysql_con->load;
+  int             rc = 0;
+
+  db_mysql_con->load = NULL;
+  if (load->len > 0)
+    rc = mysql_load_send(db_mysql_con->mysql, load);
+  mysql_load_free(db_mysql_con->mysql, load);
+
+  if (rc)
+  {
+    log_text(LOG_FATAL, "LOAD DATA LOCAL INFILE returned error %u (%s)",
+             mysql_errno(db_mysql_con->mysql),
+             mysql_error(db_mysql_con->mysql));
+    return SB_DB_ERROR_FAILED;
+  }
+
+  return SB_DB_ERROR_NONE;
+}
+
+#endif /* HAVE_LOCAL_INFILE_HANDLER */
+
+
 /* Uninitialize driver */
 int mysql_drv_done(void)
 {
@@ -20,6 +20,9 @@
 # include "config.h"
 #endif
 
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+#endif
 #ifdef HAVE_STRING_H
 # include <string.h>
 #endif
@@ -35,6 +38,9 @@
 /* Maximum length of text representation of bind parameters */
 #define MAX_PARAM_LENGTH 256
 
+/* Size of the buffer bulk insert rows are encoded to for COPY */
+#define COPY_BUFFER_SIZE (64*1024)
+
 /* PostgreSQL driver arguments */
 
 static sb_arg_t pgsql_drv_args[] =
@@ -91,8 +97,22 @@ static drv_caps_t pgsql_drv_caps =
   0,    /* needs_commit */
   1,    /* serial */
   0,    /* unsigned int */
+  0,    /* backslash_escapes */
 };
 
+/* PostgreSQL connection */
+typedef struct
+{
+  PGconn       *con;
+  unsigned int inflight;  /* queries sent in pipeline mode */
+  char         rollback;  /* ROLLBACK when the pipeline is drained */
+  char         *copy_buf; /* COPY data not sent yet */
+  unsigned int copy_len;
+  unsigned int copy_size;
+} pg_conn_t;
+
+#define PG_CONN(sb_conn) (((pg_conn_t *)(sb_conn)->ptr)->con)
+
 /* Describes the PostgreSQL prepared statement */
 typedef struct pg_stmt
 {
@@ -101,6 +121,7 @@ typedef struct pg_stmt
   int      nparams;
   Oid      *ptypes;
   char     **pvalues;
+  char     **pparams;  /* pvalues with NULLs for NULL parameters */
 } pg_stmt_t;
 
 static pgsql_drv_args_t args;          /* driver args */
@@ -125,6 +146,18 @@ static int pgsql_drv_free_results(db_result_set_t *);
 static int pgsql_drv_close(db_stmt_t *);
 static int pgsql_drv_store_results(db_result_set_t *);
 static int pgsql_drv_done(void);
+#ifdef LIBPQ_HAS_PIPELINING
+static int pgsql_drv_execute_batch(db_stmt_t *, db_bind_t *, unsigned int,
+                                   unsigned int);
+static int pgsql_drv_send_query(db_conn_t *, const char *);
+static int pgsql_drv_send_execute(db_stmt_t *);
+static int pgsql_drv_get_result(db_conn_t *, db_result_set_t *);
+static int pgsql_drv_socket(db_conn_t *);
+static db_poll_t pgsql_drv_poll(db_conn_t *);
+#endif
+static int pgsql_drv_bulk_insert_init(db_conn_t *, const char *);
+static int pgsql_drv_bulk_insert_row(db_conn_t *, db_bind_t *, unsigned int);
+static int pgsql_drv_bulk_insert_done(db_conn_t *);
 
 /* PgSQL driver definition */
 
@@ -150,7 +183,18 @@ static db_driver_t pgsql_driver =
     pgsql_drv_close,
     pgsql_drv_query,
     pgsql_drv_store_results,
-    pgsql_drv_done
+    pgsql_drv_done,
+#ifdef LIBPQ_HAS_PIPELINING
+    pgsql_drv_execute_batch,
+    pgsql_drv_send_query,
+    pgsql_drv_send_execute,
+    pgsql_drv_get_result,
+    pgsql_drv_socket,
+    pgsql_drv_poll,
+#endif
+    .bulk_insert_init = pgsql_drv_bulk_insert_init,
+    .bulk_insert_row = pgsql_drv_bulk_insert_row,
+    .bulk_insert_done = pgsql_drv_bulk_insert_done
   },
   .listitem = {NULL, NULL}
 };
@@ -232,7 +276,8 @@ int pgsql_drv_describe(drv_caps_t *caps)
 
 int pgsql_drv_connect(db_conn_t *sb_conn)
 {
-  PGconn *con;
+  PGconn    *con;
+  pg_conn_t *pgconn;
 
   con = PQsetdbLogin(args.host,
                      args.port,
@@ -249,7 +294,15 @@ int pgsql_drv_connect(db_conn_t *sb_conn)
     return 1;
   }
   
-  sb_conn->ptr = con;
+  pgconn = (pg_conn_t *)calloc(1, sizeof(pg_conn_t));
+  if (pgconn == NULL)
+  {
+    PQfinish(con);
+    return 1;
+  }
+  pgconn->con = con;
+
+  sb_conn->ptr = pgconn;
   
   return 0;
 }
@@ -260,10 +313,14 @@ int pgsql_drv_connect(db_conn_t *sb_conn)
 
 int pgsql_drv_disconnect(db_conn_t *sb_conn)
 {
-  PGconn *con = (PGconn *)sb_conn->ptr;
+  pg_conn_t *pgconn = (pg_conn_t *)sb_conn->ptr;
 
-  if (con != NULL)
-    PQfinish(con);
+  if (pgconn != NULL)
+  {
+    PQfinish(pgconn->con);
+    free(pgconn->copy_buf);
+    free(pgconn);
+  }
   
   return 0;
 }
@@ -274,7 +331,7 @@ int pgsql_drv_disconnect(db_conn_t *sb_conn)
 
 int pgsql_drv_prepare(db_stmt_t *stmt, const char *query)
 {
-  PGconn       *con = (PGconn *)stmt->connection->ptr;
+  PGconn       *con = PG_CONN(stmt->connection);
   PGresult     *pgres;
   pg_stmt_t    *pgstmt;
   char         *buf = NULL;
@@ -376,7 +433,7 @@ int pgsql_drv_prepare(db_stmt_t *stmt, const char *query)
 
 int pgsql_drv_bind_param(db_stmt_t *stmt, db_bind_t *params, unsigned int len)
 {
-  PGconn       *con = (PGconn *)stmt->connection->ptr;
+  PGconn       *con = PG_CONN(stmt->connection);
   PGresult     *pgres;
   pg_stmt_t    *pgstmt;
   unsigned int i;
@@ -428,7 +485,8 @@ int pgsql_drv_bind_param(db_stmt_t *stmt, db_bind_t *params, unsigned int len)
   }
     
   pgstmt->pvalues = (char **)calloc(len, sizeof(char *));
-  if (pgstmt->pvalues == NULL)
+  pgstmt->pparams = (char **)calloc(len, sizeof(char *));
+  if (pgstmt->pvalues == NULL || pgstmt->pparams == NULL)
     return 1;
       
   /* Allocate buffers for bind parameters */
@@ -464,6 +522,16 @@ int pgsql_drv_bind_result(db_stmt_t *stmt, db_bind_t *params, unsigned int len)
 }
 
 
+/* Check if an error should restart the transaction rather than abort */
+
+
+static int pgsql_is_restartable(const char *errmsg)
+{
+  return strstr(errmsg, "deadlock detected") != NULL ||
+    strstr(errmsg, "duplicate key value violates unique constraint") != NULL;
+}
+
+
 /* Check query execution status */
 
 
@@ -477,8 +545,7 @@ static int pgsql_check_status(PGconn *pgcon, PGresult *pgres,
   {
     const char * const errmsg = PQerrorMessage(pgcon);
 
-    if (strstr(errmsg, "deadlock detected") ||
-        strstr(errmsg, "duplicate key value violates unique constraint"))
+    if (pgsql_is_restartable(errmsg))
     {
       PQexec(pgcon, "ROLLBACK");
       return SB_DB_ERROR_RESTART_TRANSACTION;
@@ -492,63 +559,48 @@ static int pgsql_check_status(PGconn *pgcon, PGresult *pgres,
 }
 
 
-/* Execute prepared statement */
+/* Convert SysBench bind structures to PgSQL data */
 
 
-int pgsql_drv_execute(db_stmt_t *stmt, db_result_set_t *rs)
+static void pgsql_convert_params(pg_stmt_t *pgstmt, db_bind_t *params)
 {
-  db_conn_t       *con = stmt->connection;
-  PGconn          *pgcon = (PGconn *)con->ptr;
-  PGresult        *pgres;
-  pg_stmt_t       *pgstmt;
-  char            *buf = NULL;
-  unsigned int    buflen = 0;
-  unsigned int    i, j, vcnt;
-  char            need_realloc;
-  int             n;
-  int             rc;
+  int i;
 
-  if (!stmt->emulated)
+  for (i = 0; i < pgstmt->nparams; i++)
   {
-    pgstmt = stmt->ptr;
-    if (pgstmt == NULL)
-      return SB_DB_ERROR_FAILED;
-
-  
-    /* Convert SysBench bind structures to PgSQL data */
-    for (i = 0; i < (unsigned)pgstmt->nparams; i++)
+    if (params[i].is_null != NULL && *params[i].is_null)
     {
-      if (stmt->bound_param[i].is_null)
-        continue;
-
-      switch (stmt->bound_param[i].type) {
-        case DB_TYPE_CHAR:
-        case DB_TYPE_VARCHAR:
-          strncpy(pgstmt->pvalues[i], stmt->bound_param[i].buffer,
-                  MAX_PARAM_LENGTH);
-          break;
-        default:
-          db_print_value(stmt->bound_param + i, pgstmt->pvalues[i],
-                         MAX_PARAM_LENGTH);
-      }
+      pgstmt->pparams[i] = NULL;
+      continue;
     }
 
-    pgres = PQexecPrepared(pgcon, pgstmt->name, pgstmt->nparams,
-                           (const char **)pgstmt->pvalues, NULL, NULL, 1);
+    switch (params[i].type) {
+      case DB_TYPE_CHAR:
+      case DB_TYPE_VARCHAR:
+        strncpy(pgstmt->pvalues[i], params[i].buffer, MAX_PARAM_LENGTH);
+        break;
+      default:
+        db_print_value(params + i, pgstmt->pvalues[i], MAX_PARAM_LENGTH);
+    }
+    pgstmt->pparams[i] = pgstmt->pvalues[i];
+  }
+}
 
-    rc = pgsql_check_status(pgcon, pgres, "PQexecPrepared");
 
-    if (rc == SB_DB_ERROR_NONE)
-      rs->ptr = (void *)pgres;
+/* Build the actual query string for emulated PS from parameters list */
 
-    return rc;
-  }
 
-  /* Use emulation */
-  /* Build the actual query string from parameters list */
+static char *pgsql_build_query(const char *query, db_bind_t *params)
+{
+  char            *buf = NULL;
+  unsigned int    buflen = 0;
+  unsigned int    i, j, vcnt;
+  char            need_realloc;
+  int             n;
+
   need_realloc = 1;
   vcnt = 0;
-  for (i = 0, j = 0; stmt->query[i] != '\0'; i++)
+  for (i = 0, j = 0; query[i] != '\0'; i++)
   {
   again:
     if (j+1 >= buflen || need_realloc)
@@ -556,17 +608,17 @@ int pgsql_drv_execute(db_stmt_t *stmt, db_result_set_t *rs)
       buflen = (buflen > 0) ? buflen * 2 : 256;
       buf = realloc(buf, buflen);
       if (buf == NULL)
-        return SB_DB_ERROR_FAILED;
+        return NULL;
       need_realloc = 0;
     }
 
-    if (stmt->query[i] != '?')
+    if (query[i] != '?')
     {
-      buf[j++] = stmt->query[i];
+      buf[j++] = query[i];
       continue;
     }
 
-    n = db_print_value(stmt->bound_param + vcnt, buf + j, buflen - j);
+    n = db_print_value(params + vcnt, buf + j, buflen - j);
     if (n < 0)
     {
       need_realloc = 1;
@@ -576,6 +628,46 @@ int pgsql_drv_execute(db_stmt_t *stmt, db_result_set_t *rs)
     vcnt++;
   }
   buf[j] = '\0';
+
+  return buf;
+}
+
+
+/* Execute prepared statement */
+
+
+int pgsql_drv_execute(db_stmt_t *stmt, db_result_set_t *rs)
+{
+  db_conn_t       *con = stmt->connection;
+  PGconn          *pgcon = PG_CONN(con);
+  PGresult        *pgres;
+  pg_stmt_t       *pgstmt;
+  char            *buf;
+  int             rc;
+
+  if (!stmt->emulated)
+  {
+    pgstmt = stmt->ptr;
+    if (pgstmt == NULL)
+      return SB_DB_ERROR_FAILED;
+
+    pgsql_convert_params(pgstmt, stmt->bound_param);
+
+    pgres = PQexecPrepared(pgcon, pgstmt->name, pgstmt->nparams,
+                           (const char **)pgstmt->pparams, NULL, NULL, 1);
+
+    rc = pgsql_check_status(pgcon, pgres, "PQexecPrepared");
+
+    if (rc == SB_DB_ERROR_NONE)
+      rs->ptr = (void *)pgres;
+
+    return rc;
+  }
+
+  /* Use emulation */
+  buf = pgsql_build_query(stmt->query, stmt->bound_param);
+  if (buf == NULL)
+    return SB_DB_ERROR_FAILED;
   
   con->db_errno = pgsql_drv_query(con, buf, rs);
   free(buf);
@@ -588,13 +680,495 @@ int pgsql_drv_execute(db_stmt_t *stmt, db_result_set_t *rs)
 }
 
 
+#ifdef LIBPQ_HAS_PIPELINING
+
+/*
+  Execute prepared statement for multiple parameter sets in pipeline mode, so
+  the whole batch takes a single round trip. Queries are sent before any
+  results are read, so batches should be small enough for their results to
+  fit into socket buffers.
+*/
+
+
+int pgsql_drv_execute_batch(db_stmt_t *stmt, db_bind_t *params,
+                            unsigned int nparams, unsigned int nrows)
+{
+  PGconn          *pgcon = PG_CONN(stmt->connection);
+  PGresult        *pgres;
+  PGresult        *errres = NULL;
+  pg_stmt_t       *pgstmt = stmt->ptr;
+  db_bind_t       *row;
+  char            *buf;
+  unsigned int    i, sent;
+  int             ok;
+  int             rc;
+
+  if (pgcon == NULL)
+    return SB_DB_ERROR_FAILED;
+
+  if (!stmt->emulated && (pgstmt == NULL ||
+                          (unsigned)pgstmt->nparams != nparams))
+  {
+    log_text(LOG_ALERT, "wrong number of parameters in prepared statement");
+    return SB_DB_ERROR_FAILED;
+  }
+
+  /* Prepare the statement if it has not been bound yet */
+  if (nparams > 0 && pgsql_drv_bind_param(stmt, params, nparams))
+    return SB_DB_ERROR_FAILED;
+
+  if (!PQenterPipelineMode(pgcon))
+  {
+    log_text(LOG_FATAL, "PQenterPipelineMode() failed: %s",
+             PQerrorMessage(pgcon));
+    return SB_DB_ERROR_FAILED;
+  }
+
+  rc = SB_DB_ERROR_NONE;
+  for (sent = 0; sent < nrows; sent++)
+  {
+    row = params + sent * nparams;
+
+    if (stmt->emulated)
+    {
+      /* Simple query protocol is not allowed in pipeline mode */
+      buf = pgsql_build_query(stmt->query, row);
+      if (buf == NULL)
+      {
+        rc = SB_DB_ERROR_FAILED;
+        break;
+      }
+      ok = PQsendQueryParams(pgcon, buf, 0, NULL, NULL, NULL, NULL, 0);
+      free(buf);
+    }
+    else
+    {
+      pgsql_convert_params(pgstmt, row);
+      ok = PQsendQueryPrepared(pgcon, pgstmt->name, pgstmt->nparams,
+                               (const char **)pgstmt->pparams, NULL, NULL, 1);
+    }
+
+    if (!ok)
+    {
+      log_text(LOG_FATAL, "sending batched query failed: %s",
+               PQerrorMessage(pgcon));
+      rc = SB_DB_ERROR_FAILED;
+      break;
+    }
+  }
+
+  if (!PQpipelineSync(pgcon))
+  {
+    log_text(LOG_FATAL, "PQpipelineSync() failed: %s", PQerrorMessage(pgcon));
+    return SB_DB_ERROR_FAILED;
+  }
+
+  /*
+    Each query is followed by a NULL result. Once a query fails, the remaining
+    ones are reported as PGRES_PIPELINE_ABORTED up to the sync point.
+  */
+  for (i = 0; i < sent; i++)
+  {
+    while ((pgres = PQgetResult(pgcon)) != NULL)
+    {
+      if (errres == NULL && PQresultStatus(pgres) != PGRES_TUPLES_OK &&
+          PQresultStatus(pgres) != PGRES_COMMAND_OK &&
+          PQresultStatus(pgres) != PGRES_PIPELINE_ABORTED)
+        errres = pgres;
+      else
+        PQclear(pgres);
+    }
+  }
+
+  pgres = PQgetResult(pgcon);
+  if (PQresultStatus(pgres) != PGRES_PIPELINE_SYNC)
+    log_text(LOG_DEBUG, "unexpected result status at pipeline end: %d",
+             PQresultStatus(pgres));
+  PQclear(pgres);
+
+  if (!PQexitPipelineMode(pgcon))
+  {
+    log_text(LOG_FATAL, "PQexitPipelineMode() failed: %s",
+             PQerrorMessage(pgcon));
+    rc = SB_DB_ERROR_FAILED;
+  }
+
+  if (errres != NULL)
+  {
+    if (rc == SB_DB_ERROR_NONE)
+      rc = pgsql_check_status(pgcon, errres, "PQsendQueryPrepared");
+    PQclear(errres);
+  }
+
+  return rc;
+}
+
+
+/*
+  Queries sent asynchronously are pipelined, each followed by its own sync
+  point. This keeps the autocommit semantics of synchronous execution and
+  lets the server process a query as soon as it arrives.
+*/
+
+
+static int pgsql_pipeline_send(pg_conn_t *pgconn, int ok, const char *funcname)
+{
+  if (!ok || !PQpipelineSync(pgconn->con))
+  {
+    log_text(LOG_FATAL, "%s() failed: %s", funcname,
+             PQerrorMessage(pgconn->con));
+    return SB_DB_ERROR_FAILED;
+  }
+
+  pgconn->inflight++;
+
+  return SB_DB_ERROR_NONE;
+}
+
+
+/* Send SQL query without waiting for its result */
+
+
+int pgsql_drv_send_query(db_conn_t *sb_conn, const char *query)
+{
+  pg_conn_t *pgconn = (pg_conn_t *)sb_conn->ptr;
+
+  if (pgconn->inflight == 0 && !PQenterPipelineMode(pgconn->con))
+  {
+    log_text(LOG_FATAL, "PQenterPipelineMode() failed: %s",
+             PQerrorMessage(pgconn->con));
+    return SB_DB_ERROR_FAILED;
+  }
+
+  /* Simple query protocol is not allowed in pipeline mode */
+  return pgsql_pipeline_send(pgconn,
+                             PQsendQueryParams(pgconn->con, query, 0, NULL,
+                                               NULL, NULL, NULL, 0),
+                             "PQsendQueryParams");
+}
+
+
+/* Send prepared statement execution without waiting for its result */
+
+
+int pgsql_drv_send_execute(db_stmt_t *stmt)
+{
+  pg_conn_t *pgconn = (pg_conn_t *)stmt->connection->ptr;
+  pg_stmt_t *pgstmt = stmt->ptr;
+  char      *buf;
+  int       rc;
+
+  if (stmt->emulated)
+  {
+    buf = pgsql_build_query(stmt->query, stmt->bound_param);
+    if (buf == NULL)
+      return SB_DB_ERROR_FAILED;
+    rc = pgsql_drv_send_query(stmt->connection, buf);
+    free(buf);
+
+    return rc;
+  }
+
+  /* Preparing requires a round trip, so it must be done by bind_param() */
+  if (pgstmt == NULL || !pgstmt->prepared)
+  {
+    log_text(LOG_ALERT, "prepared statement must be bound before being "
+             "executed asynchronously");
+    return SB_DB_ERROR_FAILED;
+  }
+
+  if (pgconn->inflight == 0 && !PQenterPipelineMode(pgconn->con))
+  {
+    log_text(LOG_FATAL, "PQenterPipelineMode() failed: %s",
+             PQerrorMessage(pgconn->con));
+    return SB_DB_ERROR_FAILED;
+  }
+
+  pgsql_convert_params(pgstmt, stmt->bound_param);
+
+  return pgsql_pipeline_send(pgconn,
+                             PQsendQueryPrepared(pgconn->con, pgstmt->name,
+                                                 pgstmt->nparams,
+                                                 (const char **)pgstmt->pparams,
+                                                 NULL, NULL, 1),
+                             "PQsendQueryPrepared");
+}
+
+
+/* Wait for the result of the oldest query sent asynchronously */
+
+
+int pgsql_drv_get_result(db_conn_t *sb_conn, db_result_set_t *rs)
+{
+  pg_conn_t      *pgconn = (pg_conn_t *)sb_conn->ptr;
+  PGconn         *pgcon = pgconn->con;
+  PGresult       *pgres;
+  PGresult       *res = NULL;
+  ExecStatusType status;
+  int            rc = SB_DB_ERROR_NONE;
+
+  if (pgconn->inflight == 0)
+    return SB_DB_ERROR_FAILED;
+
+  /* The query result is followed by NULL and then by the sync point */
+  while ((pgres = PQgetResult(pgcon)) != NULL)
+  {
+    if (res == NULL)
+      res = pgres;
+    else
+      PQclear(pgres);
+  }
+  pgres = PQgetResult(pgcon);
+  if (PQresultStatus(pgres) != PGRES_PIPELINE_SYNC)
+    log_text(LOG_DEBUG, "unexpected result status at sync point: %d",
+             PQresultStatus(pgres));
+  PQclear(pgres);
+
+  status = PQresultStatus(res);
+  if (status == PGRES_TUPLES_OK || status == PGRES_COMMAND_OK)
+    rs->ptr = res;
+  else
+  {
+    /*
+      ROLLBACK cannot be sent while other queries are in the pipeline. Those
+      queries fail in the aborted transaction and are restarted as well.
+    */
+    if (pgconn->rollback || pgsql_is_restartable(PQresultErrorMessage(res)))
+    {
+      pgconn->rollback = 1;
+      rc = SB_DB_ERROR_RESTART_TRANSACTION;
+    }
+    else
+    {
+      log_text(LOG_FATAL, "PQgetResult() failed: %d %s", status,
+               PQresultErrorMessage(res));
+      rc = SB_DB_ERROR_FAILED;
+    }
+    PQclear(res);
+  }
+
+  if (--pgconn->inflight == 0)
+  {
+    if (!PQexitPipelineMode(pgcon))
+    {
+      log_text(LOG_FATAL, "PQexitPipelineMode() failed: %s",
+               PQerrorMessage(pgcon));
+      rc = SB_DB_ERROR_FAILED;
+    }
+    if (pgconn->rollback)
+    {
+      PQclear(PQexec(pgcon, "ROLLBACK"));
+      pgconn->rollback = 0;
+    }
+  }
+
+  return rc;
+}
+
+
+
+/*
+  Switch connection to non-blocking mode, so that queries are sent without
+  waiting for the socket to become writable
+*/
+
+
+int pgsql_drv_socket(db_conn_t *sb_conn)
+{
+  PGconn *pgcon = PG_CONN(sb_conn);
+
+  if (PQsetnonblocking(pgcon, 1))
+  {
+    log_text(LOG_FATAL, "PQsetnonblocking() failed: %s",
+             PQerrorMessage(pgcon));
+    return -1;
+  }
+
+  return PQsocket(pgcon);
+}
+
+
+/*
+  Flush queued queries and consume available input. Once PQisBusy() is false
+  the result is complete, and the sync point following it normally arrives
+  in the same packet.
+*/
+
+
+db_poll_t pgsql_drv_poll(db_conn_t *sb_conn)
+{
+  PGconn *pgcon = PG_CONN(sb_conn);
+  int    rc;
+
+  rc = PQflush(pgcon);
+  if (rc < 0)
+  {
+    log_text(LOG_FATAL, "PQflush() failed: %s", PQerrorMessage(pgcon));
+    return DB_POLL_ERROR;
+  }
+
+  if (!PQconsumeInput(pgcon))
+  {
+    log_text(LOG_FATAL, "PQconsumeInput() failed: %s",
+             PQerrorMessage(pgcon));
+    return DB_POLL_ERROR;
+  }
+
+  if (!PQisBusy(pgcon))
+    return DB_POLL_READY;
+
+  /* Results may not arrive before the server receives all queries */
+  return rc > 0 ? DB_POLL_WRITE : DB_POLL_READ;
+}
+
+#endif /* LIBPQ_HAS_PIPELINING */
+
+
+/*
+  Start loading bulk insert rows with COPY. The "INSERT INTO table (columns)
+  VALUES" prefix is turned into "COPY table (columns) FROM STDIN". Returns
+  non-zero to fall back to multi-row INSERT statements.
+*/
+
+
+int pgsql_drv_bulk_insert_init(db_conn_t *sb_conn, const char *query)
+{
+  pg_conn_t    *pgconn = (pg_conn_t *)sb_conn->ptr;
+  const char   *target;
+  unsigned int len;
+  char         *copy;
+  PGresult     *pgres;
+  int          ok;
+
+  target = db_bulk_insert_target(query, &len);
+  if (target == NULL)
+    return 1;
+
+  copy = (char *)malloc(len + sizeof("COPY  FROM STDIN"));
+  if (copy == NULL)
+    return 1;
+  sprintf(copy, "COPY %.*s FROM STDIN", (int)len, target);
+
+  pgres = PQexec(pgconn->con, copy);
+  ok = PQresultStatus(pgres) == PGRES_COPY_IN;
+  if (!ok)
+    log_text(LOG_DEBUG, "%s failed, using INSERT: %s", copy,
+             PQerrorMessage(pgconn->con));
+  PQclear(pgres);
+  free(copy);
+  if (!ok)
+    return 1;
+
+  pgconn->copy_buf = (char *)malloc(COPY_BUFFER_SIZE);
+  if (pgconn->copy_buf == NULL)
+  {
+    PQputCopyEnd(pgconn->con, "out of memory");
+    PQclear(PQgetResult(pgconn->con));
+    return 1;
+  }
+  pgconn->copy_size = COPY_BUFFER_SIZE;
+  pgconn->copy_len = 0;
+
+  return 0;
+}
+
+
+/* Send COPY data encoded so far */
+
+
+static int pgsql_copy_flush(pg_conn_t *pgconn)
+{
+  if (pgconn->copy_len > 0 &&
+      PQputCopyData(pgconn->con, pgconn->copy_buf, pgconn->copy_len) != 1)
+  {
+    log_text(LOG_FATAL, "PQputCopyData() failed: %s",
+             PQerrorMessage(pgconn->con));
+    return 1;
+  }
+  pgconn->copy_len = 0;
+
+  return 0;
+}
+
+
+/* Encode row of typed values in COPY text format */
+
+
+int pgsql_drv_bulk_insert_row(db_conn_t *sb_conn, db_bind_t *values,
+                              unsigned int nvalues)
+{
+  pg_conn_t    *pgconn = (pg_conn_t *)sb_conn->ptr;
+  unsigned int need;
+  char         *p;
+  char         *tmp;
+
+  need = db_bulk_row_length(values, nvalues);
+  if (pgconn->copy_len + need > pgconn->copy_size)
+  {
+    if (pgsql_copy_flush(pgconn))
+      return SB_DB_ERROR_FAILED;
+    if (need > pgconn->copy_size)
+    {
+      tmp = (char *)realloc(pgconn->copy_buf, need);
+      if (tmp == NULL)
+        return SB_DB_ERROR_FAILED;
+      pgconn->copy_buf = tmp;
+      pgconn->copy_size = need;
+    }
+  }
+
+  p = db_bulk_encode_row(pgconn->copy_buf + pgconn->copy_len, values, nvalues);
+  if (p == NULL)
+    return SB_DB_ERROR_FAILED;
+  pgconn->copy_len = p - pgconn->copy_buf;
+
+  return SB_DB_ERROR_NONE;
+}
+
+
+/* Finish COPY and check its result */
+
+
+int pgsql_drv_bulk_insert_done(db_conn_t *sb_conn)
+{
+  pg_conn_t *pgconn = (pg_conn_t *)sb_conn->ptr;
+  PGresult  *pgres;
+  int       rc;
+
+  rc = pgsql_copy_flush(pgconn);
+  if (PQputCopyEnd(pgconn->con, rc ? "bulk insert failed" : NULL) != 1)
+  {
+    log_text(LOG_FATAL, "PQputCopyEnd() failed: %s",
+             PQerrorMessage(pgconn->con));
+    rc = 1;
+  }
+
+  while ((pgres = PQgetResult(pgconn->con)) != NULL)
+  {
+    if (PQresultStatus(pgres) != PGRES_COMMAND_OK)
+    {
+      log_text(LOG_FATAL, "COPY failed: %s", PQresultErrorMessage(pgres));
+      rc = 1;
+    }
+    PQclear(pgres);
+  }
+
+  free(pgconn->copy_buf);
+  pgconn->copy_buf = NULL;
+  pgconn->copy_len = 0;
+  pgconn->copy_size = 0;
+
+  return rc ? SB_DB_ERROR_FAILED : SB_DB_ERROR_NONE;
+}
+
+
 /* Execute SQL query */
 
 
 int pgsql_drv_query(db_conn_t *sb_conn, const char *query,
                       db_result_set_t *rs)
 {
-  PGconn         *con = sb_conn->ptr;
+  PGconn         *con = PG_CONN(sb_conn);
   PGresult       *pgres;
   int            rc;
 
@@ -706,6 +1280,8 @@ int pgsql_drv_close(db_stmt_t *stmt)
         free(pgstmt->pvalues[i]);
     free(pgstmt->pvalues);
   }
+  if (pgstmt->pparams != NULL)
+    free(pgstmt->pparams);
   
   return 0;
 }
@@ -0,0 +1,1046 @@
+/* Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Embedded SQLite driver. Every sysbench connection opens its own database
+  handle, either with a private page cache or attached to the shared cache of
+  the process. Statements are stepped lazily: execute() and query() stop at
+  the first row, the rest of a result set is consumed by store_results() or
+  fetched row by row.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_STRINGS_H
+# include <strings.h>
+#endif
+#include <stdlib.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include <sqlite3.h>
+
+#include "sb_options.h"
+#include "db_driver.h"
+
+/* Maximum length of text representation of bind parameters */
+#define MAX_PARAM_LENGTH 256
+
+/* Poll interval for shared cache locks without sqlite3_unlock_notify() */
+#define LOCK_POLL_INTERVAL 1000
+
+/* SQLite driver arguments */
+
+static sb_arg_t sqlite_drv_args[] =
+{
+  {"sqlite-db", "SQLite database file name", SB_ARG_TYPE_STRING, "sbtest.db"},
+  {"sqlite-journal-mode", "SQLite journal mode "
+   "{delete,truncate,persist,memory,wal,off}", SB_ARG_TYPE_STRING, "wal"},
+  {"sqlite-synchronous", "SQLite synchronous mode {off,normal,full,extra}",
+   SB_ARG_TYPE_STRING, "normal"},
+  {"sqlite-cache", "page cache used by connections: private cache per "
+   "connection or a cache shared by all connections {private,shared}",
+   SB_ARG_TYPE_STRING, "private"},
+  {"sqlite-busy-timeout", "time in milliseconds to wait for a locked "
+   "database before failing with SQLITE_BUSY", SB_ARG_TYPE_INT, "10000"},
+  {"sqlite-transaction-mode", "locking mode used for transactions started "
+   "with BEGIN {deferred,immediate,exclusive}", SB_ARG_TYPE_STRING,
+   "deferred"},
+
+  {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
+};
+
+typedef struct
+{
+  char               *db;
+  char               *journal_mode;
+  char               *synchronous;
+  int                shared_cache;
+  int                busy_timeout;
+  char               *begin_query;
+} sqlite_drv_args_t;
+
+/* Per-connection data */
+
+typedef struct
+{
+  sqlite3            *db;
+  sqlite3_stmt       *res;         /* statement of the current result set */
+  char               res_owned;    /* 1 if res must be finalized when freed */
+  char               res_row;      /* 1 if res has a row not fetched yet */
+} sqlite_conn_t;
+
+/* Describes the SQLite prepared statement */
+
+typedef struct
+{
+  sqlite3_stmt       *stmt;
+  int                nparams;
+  db_bind_t          *results;     /* buffers bound with bind_result() */
+  unsigned int       nresults;
+} sqlite_stmt_t;
+
+#ifdef HAVE_SQLITE3_UNLOCK_NOTIFY
+/* Waits for a shared cache lock to be released */
+
+typedef struct
+{
+  int                fired;
+  pthread_mutex_t    mutex;
+  pthread_cond_t     cond;
+} unlock_wait_t;
+#endif
+
+/* SQLite driver capabilities */
+
+static drv_caps_t sqlite_drv_caps =
+{
+  1,    /* multi_rows_insert */
+  1,    /* prepared_statements */
+  0,    /* auto_increment */
+  0,    /* needs_commit */
+  0,    /* serial */
+  0,    /* unsigned int */
+  0,    /* backslash_escapes */
+};
+
+static sqlite_drv_args_t args;          /* driver args */
+
+/* SQLite driver operations */
+
+static int sqlite_drv_init(void);
+static int sqlite_drv_describe(drv_caps_t *);
+static int sqlite_drv_connect(db_conn_t *);
+static int sqlite_drv_disconnect(db_conn_t *);
+static int sqlite_drv_prepare(db_stmt_t *, const char *);
+static int sqlite_drv_bind_param(db_stmt_t *, db_bind_t *, unsigned int);
+static int sqlite_drv_bind_result(db_stmt_t *, db_bind_t *, unsigned int);
+static int sqlite_drv_execute(db_stmt_t *, db_result_set_t *);
+static int sqlite_drv_fetch(db_result_set_t *);
+static int sqlite_drv_fetch_row(db_result_set_t *, db_row_t *);
+static unsigned long long sqlite_drv_num_rows(db_result_set_t *);
+static int sqlite_drv_query(db_conn_t *, const char *, db_result_set_t *);
+static int sqlite_drv_free_results(db_result_set_t *);
+static int sqlite_drv_close(db_stmt_t *);
+static int sqlite_drv_store_results(db_result_set_t *);
+static int sqlite_drv_done(void);
+
+/* SQLite driver definition */
+
+static db_driver_t sqlite_driver =
+{
+  .sname = "sqlite",
+  .lname = "SQLite driver",
+  .args = sqlite_drv_args,
+  .ops =
+  {
+    sqlite_drv_init,
+    sqlite_drv_describe,
+    sqlite_drv_connect,
+    sqlite_drv_disconnect,
+    sqlite_drv_prepare,
+    sqlite_drv_bind_param,
+    sqlite_drv_bind_result,
+    sqlite_drv_execute,
+    sqlite_drv_fetch,
+    sqlite_drv_fetch_row,
+    sqlite_drv_num_rows,
+    sqlite_drv_free_results,
+    sqlite_drv_close,
+    sqlite_drv_query,
+    sqlite_drv_store_results,
+    sqlite_drv_done
+  },
+  .listitem = {NULL, NULL}
+};
+
+
+/* Local functions */
+
+static int check_option(const char *, const char *, const char * const *);
+static void release_result(sqlite_conn_t *);
+static int check_error(sqlite_conn_t *, int, const char *, const char *);
+static int wait_for_unlock(sqlite_conn_t *, unsigned int *);
+static int prepare_query(sqlite_conn_t *, const char *, sqlite3_stmt **,
+                         const char **);
+static int step_locked(sqlite_conn_t *, sqlite3_stmt *);
+static int step_first(sqlite_conn_t *, sqlite3_stmt *, char,
+                      db_result_set_t *, const char *);
+
+/* Register SQLite driver */
+
+
+int register_driver_sqlite(sb_list_t *drivers)
+{
+  SB_LIST_ADD_TAIL(&sqlite_driver.listitem, drivers);
+
+  return 0;
+}
+
+
+/* SQLite driver initialization */
+
+
+int sqlite_drv_init(void)
+{
+  static const char * const journal_modes[] =
+    {"delete", "truncate", "persist", "memory", "wal", "off", NULL};
+  static const char * const sync_modes[] =
+    {"off", "normal", "full", "extra", NULL};
+  static const char * const cache_modes[] =
+    {"private", "shared", NULL};
+  static const char * const trx_modes[] =
+    {"deferred", "immediate", "exclusive", NULL};
+  char *s;
+
+  args.db = sb_get_value_string("sqlite-db");
+  args.journal_mode = sb_get_value_string("sqlite-journal-mode");
+  args.synchronous = sb_get_value_string("sqlite-synchronous");
+  args.busy_timeout = sb_get_value_int("sqlite-busy-timeout");
+
+  if (check_option("sqlite-journal-mode", args.journal_mode, journal_modes) ||
+      check_option("sqlite-synchronous", args.synchronous, sync_modes))
+    return 1;
+
+  s = sb_get_value_string("sqlite-cache");
+  if (check_option("sqlite-cache", s, cache_modes))
+    return 1;
+  args.shared_cache = !strcmp(s, "shared");
+
+  s = sb_get_value_string("sqlite-transaction-mode");
+  if (check_option("sqlite-transaction-mode", s, trx_modes))
+    return 1;
+  if (!strcmp(s, "immediate"))
+    args.begin_query = "BEGIN IMMEDIATE";
+  else if (!strcmp(s, "exclusive"))
+    args.begin_query = "BEGIN EXCLUSIVE";
+  else
+    args.begin_query = NULL;
+
+  if (args.busy_timeout < 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for --sqlite-busy-timeout: %d",
+             args.busy_timeout);
+    return 1;
+  }
+
+  if (!sqlite3_threadsafe() && sb_globals.num_threads > 1)
+  {
+    log_text(LOG_FATAL, "SQLite library was compiled without thread "
+             "support, use --num-threads=1");
+    return 1;
+  }
+
+  return 0;
+}
+
+
+/* Describe database capabilities */
+
+
+int sqlite_drv_describe(drv_caps_t *caps)
+{
+  *caps = sqlite_drv_caps;
+
+  /* Multi-row VALUES lists are not available before 3.7.11 */
+  if (sqlite3_libversion_number() < 3007011)
+    caps->multi_rows_insert = 0;
+
+  return 0;
+}
+
+
+/* Connect to database */
+
+
+int sqlite_drv_connect(db_conn_t *sb_conn)
+{
+  sqlite_conn_t *con;
+  char          query[64];
+  int           flags;
+
+  con = (sqlite_conn_t *)calloc(1, sizeof(sqlite_conn_t));
+  if (con == NULL)
+    return 1;
+
+  /* Each connection is only ever used by one thread at a time */
+  flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX;
+  flags |= args.shared_cache ? SQLITE_OPEN_SHAREDCACHE :
+    SQLITE_OPEN_PRIVATECACHE;
+
+  if (sqlite3_open_v2(args.db, &con->db, flags, NULL) != SQLITE_OK)
+  {
+    log_text(LOG_FATAL, "Cannot open database '%s': %s", args.db,
+             con->db != NULL ? sqlite3_errmsg(con->db) : "out of memory");
+    goto error;
+  }
+
+  sqlite3_busy_timeout(con->db, args.busy_timeout);
+
+  snprintf(query, sizeof(query), "PRAGMA journal_mode=%s", args.journal_mode);
+  if (sqlite3_exec(con->db, query, NULL, NULL, NULL) != SQLITE_OK)
+    goto pragma_error;
+
+  snprintf(query, sizeof(query), "PRAGMA synchronous=%s", args.synchronous);
+  if (sqlite3_exec(con->db, query, NULL, NULL, NULL) != SQLITE_OK)
+    goto pragma_error;
+
+  sb_conn->ptr = con;
+
+  return 0;
+
+ pragma_error:
+  log_text(LOG_FATAL, "%s failed: %s", query, sqlite3_errmsg(con->db));
+
+ error:
+  sqlite3_close(con->db);
+  free(con);
+
+  return 1;
+}
+
+
+/* Disconnect from database */
+
+
+int sqlite_drv_disconnect(db_conn_t *sb_conn)
+{
+  sqlite_conn_t *con = (sqlite_conn_t *)sb_conn->ptr;
+
+  if (con == NULL)
+    return 0;
+
+  release_result(con);
+  if (sqlite3_close(con->db) != SQLITE_OK)
+    log_text(LOG_ALERT, "sqlite3_close() failed: %s", sqlite3_errmsg(con->db));
+  free(con);
+  sb_conn->ptr = NULL;
+
+  return 0;
+}
+
+
+/* Prepare statement */
+
+
+int sqlite_drv_prepare(db_stmt_t *stmt, const char *query)
+{
+  sqlite_conn_t *con = (sqlite_conn_t *)stmt->connection->ptr;
+  sqlite_stmt_t *sqstmt;
+
+  if (con == NULL)
+    return 1;
+
+  if (db_globals.ps_mode == DB_PS_MODE_DISABLE)
+  {
+    /* Statement is compiled on each execution */
+    stmt->emulated = 1;
+    stmt->query = strdup(query);
+
+    return 0;
+  }
+
+  sqstmt = (sqlite_stmt_t *)calloc(1, sizeof(sqlite_stmt_t));
+  if (sqstmt == NULL)
+    return 1;
+
+  if (sqlite3_prepare_v2(con->db, query, -1, &sqstmt->stmt, NULL) !=
+      SQLITE_OK)
+  {
+    log_text(LOG_FATAL, "sqlite3_prepare_v2() failed: %s",
+             sqlite3_errmsg(con->db));
+    log_text(LOG_FATAL, "failed query: %s", query);
+    free(sqstmt);
+    return 1;
+  }
+
+  sqstmt->nparams = sqlite3_bind_parameter_count(sqstmt->stmt);
+  stmt->query = strdup(query);
+  stmt->ptr = sqstmt;
+
+  return 0;
+}
+
+
+/* Bind parameters for prepared statement */
+
+
+int sqlite_drv_bind_param(db_stmt_t *stmt, db_bind_t *params, unsigned int len)
+{
+  sqlite_stmt_t *sqstmt = (sqlite_stmt_t *)stmt->ptr;
+
+  if (stmt->connection->ptr == NULL)
+    return 1;
+
+  if (!stmt->emulated && (unsigned)sqstmt->nparams != len)
+  {
+    log_text(LOG_ALERT, "wrong number of parameters in prepared statement");
+    log_text(LOG_DEBUG, "counted: %d, passed to bind_param(): %d",
+             sqstmt->nparams, len);
+    return 1;
+  }
+
+  /*
+    Buffers are only read when the statement is executed, so callers can
+    update values in place between executions.
+  */
+  if (stmt->bound_param != NULL)
+    free(stmt->bound_param);
+  stmt->bound_param = (db_bind_t *)malloc(len * sizeof(db_bind_t));
+  if (stmt->bound_param == NULL)
+    return 1;
+  memcpy(stmt->bound_param, params, len * sizeof(db_bind_t));
+  stmt->bound_param_len = len;
+
+  return 0;
+}
+
+
+/* Bind results for prepared statement */
+
+
+int sqlite_drv_bind_result(db_stmt_t *stmt, db_bind_t *params,
+                           unsigned int len)
+{
+  sqlite_stmt_t *sqstmt = (sqlite_stmt_t *)stmt->ptr;
+
+  if (sqstmt == NULL)
+    return 1;
+
+  free(sqstmt->results);
+  sqstmt->results = (db_bind_t *)malloc(len * sizeof(db_bind_t));
+  if (sqstmt->results == NULL)
+    return 1;
+  memcpy(sqstmt->results, params, len * sizeof(db_bind_t));
+  sqstmt->nresults = len;
+
+  return 0;
+}
+
+
+/* Bind a single parameter value to a statement */
+
+
+static int bind_value(sqlite3_stmt *st, int i, db_bind_t *param)
+{
+  char buf[MAX_PARAM_LENGTH];
+  int  n;
+
+  if (param->is_null != NULL && *param->is_null)
+    return sqlite3_bind_null(st, i);
+
+  switch (param->type) {
+    case DB_TYPE_TINYINT:
+      return sqlite3_bind_int(st, i, *(char *)param->buffer);
+    case DB_TYPE_SMALLINT:
+      return sqlite3_bind_int(st, i, *(short *)param->buffer);
+    case DB_TYPE_INT:
+      return sqlite3_bind_int(st, i, *(int *)param->buffer);
+    case DB_TYPE_BIGINT:
+      return sqlite3_bind_int64(st, i, *(long long *)param->buffer);
+    case DB_TYPE_FLOAT:
+      return sqlite3_bind_double(st, i, *(float *)param->buffer);
+    case DB_TYPE_DOUBLE:
+      return sqlite3_bind_double(st, i, *(double *)param->buffer);
+    case DB_TYPE_CHAR:
+    case DB_TYPE_VARCHAR:
+      /* Buffers are not necessarily zero-terminated if data_len is set */
+      return sqlite3_bind_text(st, i, (const char *)param->buffer,
+                               param->data_len != NULL ?
+                               (int)*param->data_len : -1,
+                               SQLITE_TRANSIENT);
+    case DB_TYPE_DATE:
+    case DB_TYPE_TIME:
+    case DB_TYPE_DATETIME:
+    case DB_TYPE_TIMESTAMP:
+      /* SQLite has no temporal types, store them as quote-stripped text */
+      n = db_print_value(param, buf, sizeof(buf));
+      if (n < 2)
+        return SQLITE_RANGE;
+      return sqlite3_bind_text(st, i, buf + 1, n - 2, SQLITE_TRANSIENT);
+    default:
+      return SQLITE_MISUSE;
+  }
+}
+
+
+/* Bind all parameters of a statement from its bound buffers */
+
+
+static int bind_params(sqlite_conn_t *con, db_stmt_t *stmt, sqlite3_stmt *st)
+{
+  unsigned int i;
+  unsigned int n;
+
+  n = (unsigned)sqlite3_bind_parameter_count(st);
+  if (n > stmt->bound_param_len)
+  {
+    log_text(LOG_ALERT, "wrong number of parameters in prepared statement");
+    log_text(LOG_DEBUG, "counted: %u, passed to bind_param(): %u", n,
+             stmt->bound_param_len);
+    return SB_DB_ERROR_FAILED;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    if (bind_value(st, i + 1, stmt->bound_param + i) != SQLITE_OK)
+    {
+      log_text(LOG_FATAL, "sqlite3_bind() failed for parameter %u: %s", i + 1,
+               sqlite3_errmsg(con->db));
+      return SB_DB_ERROR_FAILED;
+    }
+  }
+
+  return SB_DB_ERROR_NONE;
+}
+
+
+/* Execute prepared statement */
+
+
+int sqlite_drv_execute(db_stmt_t *stmt, db_result_set_t *rs)
+{
+  sqlite_conn_t *con = (sqlite_conn_t *)stmt->connection->ptr;
+  sqlite_stmt_t *sqstmt = (sqlite_stmt_t *)stmt->ptr;
+  sqlite3_stmt  *st;
+  char          owned;
+  int           rc;
+
+  if (con == NULL)
+    return SB_DB_ERROR_FAILED;
+
+  /* Results not freed by the caller would keep the read transaction open */
+  release_result(con);
+
+  if (stmt->emulated)
+  {
+    rc = prepare_query(con, stmt->query, &st, NULL);
+    if (rc != SQLITE_OK)
+      return check_error(con, rc, "sqlite3_prepare_v2", stmt->query);
+    if (st == NULL)
+      return SB_DB_ERROR_NONE;
+    owned = 1;
+  }
+  else
+  {
+    if (sqstmt == NULL)
+      return SB_DB_ERROR_FAILED;
+    st = sqstmt->stmt;
+    owned = 0;
+  }
+
+  rc = bind_params(con, stmt, st);
+  if (rc != SB_DB_ERROR_NONE)
+  {
+    if (owned)
+      sqlite3_finalize(st);
+    return rc;
+  }
+
+  return step_first(con, st, owned, rs, stmt->query);
+}
+
+
+/* Execute SQL query */
+
+
+int sqlite_drv_query(db_conn_t *sb_conn, const char *query,
+                     db_result_set_t *rs)
+{
+  sqlite_conn_t *con = (sqlite_conn_t *)sb_conn->ptr;
+  sqlite3_stmt  *st;
+  const char    *tail;
+  int           rc;
+
+  if (con == NULL)
+    return SB_DB_ERROR_FAILED;
+
+  release_result(con);
+
+  if (args.begin_query != NULL && !strcasecmp(query, "BEGIN"))
+    query = args.begin_query;
+
+  /* Only the last statement of a multi-statement query returns results */
+  for (;;)
+  {
+    rc = prepare_query(con, query, &st, &tail);
+    if (rc != SQLITE_OK)
+      return check_error(con, rc, "sqlite3_prepare_v2", query);
+
+    while (*tail == ' ' || *tail == '\t' || *tail == '\n' || *tail == '\r')
+      tail++;
+
+    if (*tail == '\0')
+      break;
+
+    if (st != NULL)
+    {
+      rc = step_locked(con, st);
+      if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+      {
+        rc = check_error(con, rc, "sqlite3_step", query);
+        sqlite3_finalize(st);
+        return rc;
+      }
+      sqlite3_finalize(st);
+    }
+
+    query = tail;
+  }
+
+  /* Empty statement or a comment */
+  if (st == NULL)
+    return SB_DB_ERROR_NONE;
+
+  return step_first(con, st, 1, rs, query);
+}
+
+
+/* Fetch row from result set of a prepared statement */
+
+
+int sqlite_drv_fetch(db_result_set_t *rs)
+{
+  sqlite_conn_t *con = (sqlite_conn_t *)rs->connection->ptr;
+  sqlite_stmt_t *sqstmt;
+  sqlite3_stmt  *st = (sqlite3_stmt *)rs->ptr;
+  db_bind_t     *res;
+  unsigned int  i;
+  int           n;
+  int           rc;
+
+  if (con == NULL || st == NULL || st != con->res || rs->statement == NULL)
+    return 1;
+
+  if (con->res_row)
+    con->res_row = 0;
+  else if ((rc = sqlite3_step(st)) != SQLITE_ROW)
+  {
+    if (rc != SQLITE_DONE)
+      check_error(con, rc, "sqlite3_step", NULL);
+    return 1;
+  }
+
+  sqstmt = (sqlite_stmt_t *)rs->statement->ptr;
+  if (sqstmt == NULL)
+    return 0;
+
+  /* Copy column values to the buffers passed to bind_result() */
+  for (i = 0; i < sqstmt->nresults && (int)i < sqlite3_column_count(st); i++)
+  {
+    res = sqstmt->results + i;
+    if (res->is_null != NULL)
+      *res->is_null = sqlite3_column_type(st, i) == SQLITE_NULL;
+
+    switch (res->type) {
+      case DB_TYPE_TINYINT:
+        *(char *)res->buffer = (char)sqlite3_column_int(st, i);
+        break;
+      case DB_TYPE_SMALLINT:
+        *(short *)res->buffer = (short)sqlite3_column_int(st, i);
+        break;
+      case DB_TYPE_INT:
+        *(int *)res->buffer = sqlite3_column_int(st, i);
+        break;
+      case DB_TYPE_BIGINT:
+        *(long long *)res->buffer = sqlite3_column_int64(st, i);
+        break;
+      case DB_TYPE_FLOAT:
+        *(float *)res->buffer = (float)sqlite3_column_double(st, i);
+        break;
+      case DB_TYPE_DOUBLE:
+        *(double *)res->buffer = sqlite3_column_double(st, i);
+        break;
+      case DB_TYPE_CHAR:
+      case DB_TYPE_VARCHAR:
+        if (res->buffer == NULL || res->max_len == 0)
+          break;
+        n = sqlite3_column_bytes(st, i);
+        if ((unsigned long)n >= res->max_len)
+          n = res->max_len - 1;
+        memcpy(res->buffer, sqlite3_column_text(st, i), n);
+        ((char *)res->buffer)[n] = '\0';
+        if (res->data_len != NULL)
+          *res->data_len = n;
+        break;
+      default:
+        break;
+    }
+  }
+
+  return 0;
+}
+
+
+/* Fetch row from result set of a query */
+
+
+int sqlite_drv_fetch_row(db_result_set_t *rs, db_row_t *row)
+{
+  sqlite_conn_t *con = (sqlite_conn_t *)rs->connection->ptr;
+  sqlite3_stmt  *st = (sqlite3_stmt *)rs->ptr;
+  int           rc;
+
+  if (con == NULL || st == NULL || st != con->res)
+    return 1;
+
+  if (con->res_row)
+    con->res_row = 0;
+  else if ((rc = sqlite3_step(st)) != SQLITE_ROW)
+  {
+    if (rc != SQLITE_DONE)
+      check_error(con, rc, "sqlite3_step", NULL);
+    return 1;
+  }
+
+  row->result_set = rs;
+  row->ptr = st;
+
+  return 0;
+}
+
+
+/* Return the number of rows in a result set */
+
+
+unsigned long long sqlite_drv_num_rows(db_result_set_t *rs)
+{
+  return rs->nrows;
+}
+
+
+/* Store results from the last query */
+
+
+int sqlite_drv_store_results(db_result_set_t *rs)
+{
+  sqlite_conn_t      *con = (sqlite_conn_t *)rs->connection->ptr;
+  sqlite3_stmt       *st = (sqlite3_stmt *)rs->ptr;
+  unsigned long long nrows;
+  int                ncolumns;
+  int                i;
+  int                rc;
+
+  rs->nrows = 0;
+
+  /* Statements without a result set */
+  if (st == NULL)
+    return 0;
+
+  if (con == NULL || st != con->res)
+    return 1;
+
+  ncolumns = sqlite3_column_count(st);
+  nrows = 0;
+  rc = con->res_row ? SQLITE_ROW : SQLITE_DONE;
+
+  while (rc == SQLITE_ROW)
+  {
+    /* Read all values, as a client-server driver would receive them */
+    for (i = 0; i < ncolumns; i++)
+    {
+      switch (sqlite3_column_type(st, i)) {
+        case SQLITE_INTEGER:
+          sqlite3_column_int64(st, i);
+          break;
+        case SQLITE_FLOAT:
+          sqlite3_column_double(st, i);
+          break;
+        case SQLITE_NULL:
+          break;
+        default:
+          sqlite3_column_blob(st, i);
+          sqlite3_column_bytes(st, i);
+          break;
+      }
+    }
+    nrows++;
+
+    rc = sqlite3_step(st);
+  }
+
+  con->res_row = 0;
+  rs->nrows = nrows;
+
+  if (rc != SQLITE_DONE)
+    return check_error(con, rc, "sqlite3_step", NULL);
+
+  return 0;
+}
+
+
+/* Free result set */
+
+
+int sqlite_drv_free_results(db_result_set_t *rs)
+{
+  sqlite_conn_t *con = (sqlite_conn_t *)rs->connection->ptr;
+
+  if (con == NULL || rs->ptr == NULL)
+    return 1;
+
+  if (rs->ptr == con->res)
+    release_result(con);
+  rs->ptr = NULL;
+
+  return 0;
+}
+
+
+/* Close prepared statement */
+
+
+int sqlite_drv_close(db_stmt_t *stmt)
+{
+  sqlite_conn_t *con = (sqlite_conn_t *)stmt->connection->ptr;
+  sqlite_stmt_t *sqstmt = (sqlite_stmt_t *)stmt->ptr;
+
+  if (sqstmt == NULL)
+    return stmt->emulated ? 0 : 1;
+
+  if (con != NULL && con->res == sqstmt->stmt)
+  {
+    con->res = NULL;
+    con->res_row = 0;
+  }
+
+  sqlite3_finalize(sqstmt->stmt);
+  free(sqstmt->results);
+  free(sqstmt);
+  stmt->ptr = NULL;
+
+  return 0;
+}
+
+
+/* Uninitialize driver */
+
+
+int sqlite_drv_done(void)
+{
+  return 0;
+}
+
+
+/* Check that an option value is one of the allowed values */
+
+
+int check_option(const char *name, const char *value,
+                 const char * const *allowed)
+{
+  unsigned int i;
+
+  for (i = 0; allowed[i] != NULL; i++)
+    if (!strcmp(value, allowed[i]))
+      return 0;
+
+  log_text(LOG_FATAL, "Invalid value for --%s: '%s'", name, value);
+
+  return 1;
+}
+
+
+/*
+  Release the statement of the current result set: prepared statements are
+  reset so they can be executed again, query statements are finalized.
+*/
+
+
+void release_result(sqlite_conn_t *con)
+{
+  if (con->res == NULL)
+    return;
+
+  if (con->res_owned)
+    sqlite3_finalize(con->res);
+  else
+    sqlite3_reset(con->res);
+
+  con->res = NULL;
+  con->res_owned = 0;
+  con->res_row = 0;
+}
+
+
+/* Map SQLite error to a sysbench one */
+
+
+int check_error(sqlite_conn_t *con, int rc, const char *funcname,
+                const char *query)
+{
+  int errcode = rc & 0xff;
+
+  /*
+    Lock conflicts between writers and constraint violations caused by
+    concurrent inserts are resolved by restarting the transaction.
+  */
+  if (errcode == SQLITE_BUSY || errcode == SQLITE_LOCKED ||
+      errcode == SQLITE_CONSTRAINT)
+  {
+    release_result(con);
+    if (!sqlite3_get_autocommit(con->db))
+      sqlite3_exec(con->db, "ROLLBACK", NULL, NULL, NULL);
+    return SB_DB_ERROR_RESTART_TRANSACTION;
+  }
+
+  log_text(LOG_FATAL, "%s() failed: %d %s", funcname, rc,
+           sqlite3_errmsg(con->db));
+  if (query != NULL)
+    log_text(LOG_FATAL, "failed query: %s", query);
+
+  return SB_DB_ERROR_FAILED;
+}
+
+
+/*
+  Step a statement to its first row. The statement becomes the current
+  result set of the connection and the row is left for the caller.
+*/
+
+
+int step_first(sqlite_conn_t *con, sqlite3_stmt *st, char owned,
+               db_result_set_t *rs, const char *query)
+{
+  int rc;
+
+  con->res = st;
+  con->res_owned = owned;
+  con->res_row = 0;
+
+  rc = step_locked(con, st);
+  if (rc == SQLITE_ROW)
+    con->res_row = 1;
+  else if (rc != SQLITE_DONE)
+    return check_error(con, rc, "sqlite3_step", query);
+
+  rs->ptr = st;
+
+  return SB_DB_ERROR_NONE;
+}
+
+
+#ifdef HAVE_SQLITE3_UNLOCK_NOTIFY
+/* Called by SQLite when the blocking connection releases its locks */
+
+
+static void unlock_notify_cb(void **args, int nargs)
+{
+  unlock_wait_t *w;
+  int           i;
+
+  for (i = 0; i < nargs; i++)
+  {
+    w = (unlock_wait_t *)args[i];
+    pthread_mutex_lock(&w->mutex);
+    w->fired = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+  }
+}
+#endif
+
+
+/*
+  Wait until a table lock held by another connection to the shared cache is
+  released. Unlike file locks these are not covered by the busy timeout.
+  Returns SQLITE_LOCKED if waiting would deadlock or takes too long.
+*/
+
+
+int wait_for_unlock(sqlite_conn_t *con, unsigned int *waited)
+{
+#ifdef HAVE_SQLITE3_UNLOCK_NOTIFY
+  unlock_wait_t w;
+  int           rc;
+
+  (void)waited; /* unused */
+
+  w.fired = 0;
+  pthread_mutex_init(&w.mutex, NULL);
+  pthread_cond_init(&w.cond, NULL);
+
+  rc = sqlite3_unlock_notify(con->db, unlock_notify_cb, &w);
+  if (rc == SQLITE_OK)
+  {
+    pthread_mutex_lock(&w.mutex);
+    while (!w.fired)
+      pthread_cond_wait(&w.cond, &w.mutex);
+    pthread_mutex_unlock(&w.mutex);
+  }
+
+  pthread_cond_destroy(&w.cond);
+  pthread_mutex_destroy(&w.mutex);
+
+  return rc;
+#else
+  (void)con; /* unused */
+
+  if (*waited >= (unsigned)args.busy_timeout * 1000)
+    return SQLITE_LOCKED;
+
+  usleep(LOCK_POLL_INTERVAL);
+  *waited += LOCK_POLL_INTERVAL;
+
+  return SQLITE_OK;
+#endif
+}
+
+
+/* Compile a statement, waiting for shared cache schema locks */
+
+
+int prepare_query(sqlite_conn_t *con, const char *query, sqlite3_stmt **st,
+                  const char **tail)
+{
+  unsigned int waited = 0;
+  int          rc;
+
+  while ((rc = sqlite3_prepare_v2(con->db, query, -1, st, tail)) != SQLITE_OK)
+  {
+    if (sqlite3_extended_errcode(con->db) != SQLITE_LOCKED_SHAREDCACHE ||
+        wait_for_unlock(con, &waited) != SQLITE_OK)
+      break;
+  }
+
+  return rc;
+}
+
+
+/* Step a statement that has not returned rows yet, waiting for table locks */
+
+
+int step_locked(sqlite_conn_t *con, sqlite3_stmt *st)
+{
+  unsigned int waited = 0;
+  int          rc;
+
+  while ((rc = sqlite3_step(st)) != SQLITE_ROW && rc != SQLITE_DONE)
+  {
+    if (sqlite3_extended_errcode(con->db) != SQLITE_LOCKED_SHAREDCACHE ||
+        wait_for_unlock(con, &waited) != SQLITE_OK)
+      break;
+    sqlite3_reset(st);
+  }
+
+  return rc;
+}
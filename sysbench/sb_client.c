@@ -0,0 +1,369 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Worker CPU time is sampled once when a worker thread starts executing
+  events and once when it stops, so accounting adds nothing to the event
+  path. With getrusage(RUSAGE_THREAD) user and system time as well as context
+  switches are reported separately, otherwise only the total from
+  CLOCK_THREAD_CPUTIME_ID is available. Process-wide CPU time and RSS are
+  taken before worker threads start and when the report is printed.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#ifdef _WIN32
+# include "sb_win.h"
+#endif
+
+#ifdef STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SYS_RESOURCE_H
+# include <sys/resource.h>
+#endif
+
+#include "sysbench.h"
+#include "sb_metrics.h"
+#include "sb_client.h"
+
+#if defined(HAVE_GETRUSAGE) && defined(RUSAGE_THREAD)
+# define HAVE_THREAD_RUSAGE 1
+#endif
+
+#define KB 1024.0
+#define MB (1024.0 * 1024.0)
+
+/* Per-thread counters */
+
+typedef struct
+{
+  unsigned long long user_ns;      /* user CPU time */
+  unsigned long long sys_ns;       /* system CPU time */
+  unsigned long long total_ns;     /* user + system CPU time */
+  unsigned long long vcsw;         /* voluntary context switches */
+  unsigned long long ivcsw;        /* involuntary context switches */
+  unsigned long long events;       /* events at the thread start */
+  unsigned long long heap;         /* scripting heap size in bytes */
+  int                started;
+  char               pad[64];      /* avoid false sharing */
+} client_thread_t;
+
+/* Process-wide usage */
+
+typedef struct
+{
+  unsigned long long cpu_ns;       /* user + system CPU time */
+  unsigned long long rss;          /* resident set size in bytes */
+} client_process_t;
+
+/* Client accounting options */
+
+static sb_arg_t client_args[] =
+{
+  {"client-stats", "report CPU time and memory used by sysbench itself: "
+   "worker CPU time per event, client cores needed per 10000 events/sec, "
+   "RSS growth and scripting heap",
+   SB_ARG_TYPE_FLAG, "off"},
+  {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
+};
+
+int sb_client_enabled;
+
+static client_thread_t  *client_threads;
+static client_process_t process_start;
+
+
+/* Register command line options */
+
+
+int sb_client_register(void)
+{
+  return sb_register_arg_set(client_args);
+}
+
+
+/* Print command line options */
+
+
+void sb_client_print_help(void)
+{
+  printf("Client resource usage options:\n");
+  sb_print_options(client_args);
+}
+
+
+/* Parse options and allocate per-thread counters */
+
+
+int sb_client_init(void)
+{
+  if (!sb_get_value_flag("client-stats") ||
+      sb_globals.command != SB_COMMAND_RUN)
+    return 0;
+
+  client_threads = (client_thread_t *) calloc(sb_globals.num_threads,
+                                              sizeof(client_thread_t));
+  if (client_threads == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure");
+    return 1;
+  }
+
+  sb_client_enabled = 1;
+
+  return 0;
+}
+
+
+#ifdef HAVE_GETRUSAGE
+static unsigned long long timeval_ns(const struct timeval *tv)
+{
+  return SEC2NS((unsigned long long) tv->tv_sec) + tv->tv_usec * 1000ULL;
+}
+#endif
+
+
+/* Sample CPU usage of the calling thread */
+
+
+static void get_thread_usage(client_thread_t *u)
+{
+#ifdef HAVE_THREAD_RUSAGE
+  struct rusage ru;
+
+  memset(u, 0, sizeof(*u));
+  if (getrusage(RUSAGE_THREAD, &ru))
+    return;
+
+  u->user_ns = timeval_ns(&ru.ru_utime);
+  u->sys_ns = timeval_ns(&ru.ru_stime);
+  u->total_ns = u->user_ns + u->sys_ns;
+  u->vcsw = ru.ru_nvcsw;
+  u->ivcsw = ru.ru_nivcsw;
+#elif defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_THREAD_CPUTIME_ID)
+  struct timespec ts;
+
+  memset(u, 0, sizeof(*u));
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+    return;
+
+  u->total_ns = SEC2NS((unsigned long long) ts.tv_sec) + ts.tv_nsec;
+#else
+  memset(u, 0, sizeof(*u));
+#endif
+}
+
+
+/* Sample CPU usage and RSS of the whole process */
+
+
+static void get_process_usage(client_process_t *p)
+{
+  FILE               *fp;
+  unsigned long long pages;
+#ifdef HAVE_GETRUSAGE
+  struct rusage      ru;
+#endif
+
+  memset(p, 0, sizeof(*p));
+
+#ifdef HAVE_GETRUSAGE
+  if (!getrusage(RUSAGE_SELF, &ru))
+  {
+    p->cpu_ns = timeval_ns(&ru.ru_utime) + timeval_ns(&ru.ru_stime);
+    /* Peak RSS in kilobytes, used if the current one is not available */
+    p->rss = (unsigned long long) ru.ru_maxrss * 1024;
+  }
+#endif
+
+  if ((fp = fopen("/proc/self/statm", "r")) != NULL)
+  {
+    if (fscanf(fp, "%*u %llu", &pages) == 1)
+      p->rss = pages * (unsigned long long) sysconf(_SC_PAGESIZE);
+    fclose(fp);
+  }
+}
+
+
+/* Take the process-wide baseline before worker threads start */
+
+
+int sb_client_start(void)
+{
+  if (!sb_client_enabled)
+    return 0;
+
+  get_process_usage(&process_start);
+
+  return 0;
+}
+
+
+/* Called by a worker thread before executing the first event */
+
+
+void sb_client_thread_start(int thread_id)
+{
+  client_thread_t *t;
+
+  if (!sb_client_enabled)
+    return;
+
+  t = &client_threads[thread_id];
+  get_thread_usage(t);
+  t->events = sb_thread_metrics[thread_id].events;
+  t->started = 1;
+}
+
+
+/* Called by a worker thread after executing the last event */
+
+
+void sb_client_thread_stop(int thread_id)
+{
+  client_thread_t *t;
+  client_thread_t now;
+
+  if (!sb_client_enabled || !client_threads[thread_id].started)
+    return;
+
+  t = &client_threads[thread_id];
+  get_thread_usage(&now);
+
+  t->user_ns = now.user_ns - t->user_ns;
+  t->sys_ns = now.sys_ns - t->sys_ns;
+  t->total_ns = now.total_ns - t->total_ns;
+  t->vcsw = now.vcsw - t->vcsw;
+  t->ivcsw = now.ivcsw - t->ivcsw;
+  t->events = sb_thread_metrics[thread_id].events - t->events;
+  t->started = 0;
+}
+
+
+/* Record the heap size of the scripting state of a worker thread */
+
+
+void sb_client_script_heap(int thread_id, unsigned long long bytes)
+{
+  if (!sb_client_enabled)
+    return;
+
+  client_threads[thread_id].heap = bytes;
+}
+
+
+/* Print CPU and memory usage */
+
+
+void sb_client_print_stats(void)
+{
+  client_process_t   now;
+  client_thread_t    sum;
+  unsigned int       i;
+  unsigned int       nheaps;
+  double             seconds;
+  double             cpu_per_event;
+
+  if (!sb_client_enabled)
+    return;
+
+  get_process_usage(&now);
+
+  memset(&sum, 0, sizeof(sum));
+  nheaps = 0;
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    sum.user_ns += client_threads[i].user_ns;
+    sum.sys_ns += client_threads[i].sys_ns;
+    sum.total_ns += client_threads[i].total_ns;
+    sum.vcsw += client_threads[i].vcsw;
+    sum.ivcsw += client_threads[i].ivcsw;
+    sum.events += client_threads[i].events;
+    if (client_threads[i].heap > 0)
+    {
+      sum.heap += client_threads[i].heap;
+      nheaps++;
+    }
+  }
+
+  seconds = NS2SEC(sb_timer_value(&sb_globals.exec_timer));
+
+  log_text(LOG_NOTICE, "Client resource usage:");
+#ifdef HAVE_THREAD_RUSAGE
+  log_text(LOG_NOTICE, "    worker CPU time:                     %.2fs "
+           "(user %.2fs, sys %.2fs)", NS2SEC(sum.total_ns),
+           NS2SEC(sum.user_ns), NS2SEC(sum.sys_ns));
+#else
+  log_text(LOG_NOTICE, "    worker CPU time:                     %.2fs",
+           NS2SEC(sum.total_ns));
+#endif
+  log_text(LOG_NOTICE, "    process CPU time:                    %.2fs",
+           NS2SEC(now.cpu_ns - process_start.cpu_ns));
+  if (seconds > 0)
+    log_text(LOG_NOTICE, "    client cores busy:                   %.2f",
+             NS2SEC(now.cpu_ns - process_start.cpu_ns) / seconds);
+
+  if (sum.events > 0)
+  {
+    cpu_per_event = (double) sum.total_ns / sum.events;
+    log_text(LOG_NOTICE, "    worker CPU per event:                %.2fus",
+             cpu_per_event / 1000);
+    /* 10000 events/sec need 10000 * CPU-seconds per event of CPU capacity */
+    log_text(LOG_NOTICE, "    client cores per 10000 events/sec:   %.2f",
+             NS2SEC(cpu_per_event) * 10000);
+  }
+
+#ifdef HAVE_THREAD_RUSAGE
+  log_text(LOG_NOTICE, "    context switches (vol/invol):        "
+           "%llu/%llu", sum.vcsw, sum.ivcsw);
+#endif
+
+  if (nheaps > 0)
+    log_text(LOG_NOTICE, "    script heap:                         %.2fMiB "
+             "(%.2fKiB per thread)", sum.heap / MB, sum.heap / KB / nheaps);
+
+  /*
+    Database client libraries allocate result and network buffers
+    internally, the RSS growth includes them
+  */
+  log_text(LOG_NOTICE, "    RSS:                                 %.2fMiB "
+           "(%+.2fMiB during the test)\n", now.rss / MB,
+           ((double) now.rss - (double) process_start.rss) / MB);
+}
+
+
+/* Free per-thread counters */
+
+
+void sb_client_done(void)
+{
+  if (!sb_client_enabled)
+    return;
+
+  free(client_threads);
+  client_threads = NULL;
+
+  sb_client_enabled = 0;
+}
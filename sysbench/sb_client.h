@@ -0,0 +1,58 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Client resource usage: CPU time and memory consumed by sysbench itself.
+*/
+
+#ifndef SB_CLIENT_H
+#define SB_CLIENT_H
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+/* Non-zero when client resource usage is accounted */
+extern int sb_client_enabled;
+
+/* Register command line options */
+int sb_client_register(void);
+
+/* Print command line options */
+void sb_client_print_help(void);
+
+/* Parse options and allocate per-thread counters */
+int sb_client_init(void);
+
+/* Take the process-wide baseline before worker threads start */
+int sb_client_start(void);
+
+/* Start and stop CPU accounting for a worker thread */
+void sb_client_thread_start(int thread_id);
+void sb_client_thread_stop(int thread_id);
+
+/* Record the heap size of the scripting state of a worker thread */
+void sb_client_script_heap(int thread_id, unsigned long long bytes);
+
+/* Print CPU and memory usage */
+void sb_client_print_stats(void);
+
+/* Free per-thread counters */
+void sb_client_done(void);
+
+#endif /* SB_CLIENT_H */
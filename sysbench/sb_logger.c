@@ -26,26 +26,83 @@
 #ifdef STDC_HEADERS
 # include <stdio.h>
 # include <stdarg.h>
+# include <stdlib.h>
 # include <string.h>
 #endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
 #ifdef HAVE_ERRNO_H
 # include <errno.h>
 #endif
 #ifdef HAVE_MATH_H
 # include <math.h>
 #endif
+#ifdef HAVE_SCHED_H
+# include <sched.h>
+#endif
 
 #include "sysbench.h"
 #include "sb_list.h"
 #include "sb_logger.h"
 #include "sb_percentile.h"
+#include "sb_metrics.h"
+#include "sb_outliers.h"
+#include "sb_profile.h"
+#include "sb_result.h"
 
 #define TEXT_BUFFER_SIZE 4096
 #define ERROR_BUFFER_SIZE 256
 
-#define OPER_LOG_GRANULARITY 100000
-#define OPER_LOG_MIN_VALUE   1
-#define OPER_LOG_MAX_VALUE   1E13
+/* Interval between asynchronous log drains in microseconds */
+#define LOG_FLUSH_INTERVAL 1000
+
+/* Minimum size of a per-thread log ring, must fit a few maximum messages */
+#define LOG_MIN_BUFFER_SIZE 16384
+
+/* Record length marking the unused end of a ring before wrapping */
+#define LOG_RECORD_WRAP 0xFFFFFFFFU
+
+#define LOG_RECORD_ALIGN(n) (((n) + 7) & ~7U)
+
+/* Full memory barrier to order ring buffer and epoch accesses */
+#if defined(__GNUC__)
+# define log_barrier() __sync_synchronize()
+#elif defined(_WIN32)
+# define log_barrier() MemoryBarrier()
+#else
+# define log_barrier() do { } while (0)
+#endif
+
+/*
+  Text message record in an asynchronous log ring, followed by the
+  NUL-terminated message text and padded to a multiple of 8 bytes.
+*/
+
+typedef struct
+{
+  unsigned int        len;       /* record length including the header */
+  unsigned int        priority;
+  unsigned int        flags;
+  unsigned int        pad;
+  unsigned long long  time;      /* SB_GETTIME() in ns, used for ordering */
+} log_record_t;
+
+/*
+  Per-thread single-producer/single-consumer ring of text messages. Rings are
+  created on the first message from a thread and are only freed in
+  log_done().
+*/
+
+typedef struct log_ring
+{
+  char                  *buf;
+  volatile unsigned int head;     /* bytes written, producer-owned */
+  volatile unsigned int tail;     /* bytes consumed, writer-owned */
+  unsigned long long    dropped;  /* messages dropped on full ring */
+  struct log_ring       *next;
+  char                  pad[64];  /* avoid false sharing */
+} log_ring_t;
 
 /* per-thread timers for response time stats */
 sb_timer_t *timers;
@@ -57,23 +114,67 @@ static sb_list_t handlers[LOG_MSG_TYPE_MAX];
 /* set after logger initialization */
 static unsigned char initialized; 
 
-static sb_percentile_t percentile;
+/*
+  Response time stats and histograms are per-thread and double-buffered by
+  epoch. Workers add every event to the buffers of the current epoch.
+  print_global_stats() flips the epoch, waits until no worker is still
+  updating the previous buffers, then merges and resets them. Workers never
+  wait for the reporter or for each other. A worker that does not finish its
+  update in time, e.g. because it was descheduled, keeps its buffers, which
+  are then reported with a later epoch.
+*/
+
+/* Busy-wait iterations before oper_stats_flip() starts yielding the CPU */
+#define OPER_FLIP_SPINS 100
+
+/* Maximum time oper_stats_flip() waits for a worker, in nanoseconds */
+#define OPER_FLIP_TIMEOUT 10000000ULL
+
+typedef struct
+{
+  sb_timer_t            stats[2];  /* stats for even and odd epochs */
+  sb_percentile_local_t hist[2];   /* histograms for even and odd epochs */
+  volatile unsigned int busy;      /* epoch + 1 while updating, or 0 */
+  int                   late;      /* still updating the flipped epoch */
+  char                  pad[64];   /* avoid false sharing */
+} oper_stats_t;
+
+static oper_stats_t          *oper_stats;
+static volatile unsigned int oper_epoch;
+
+/* Histogram of the last completed epoch, merged from all threads */
+static sb_percentile_t       percentile;
 
+/* Buffer merged by oper_handler_merge_percentile() during a checkpoint */
+static sb_percentile_t       *checkpoint_percentile;
+
+/*
+  Protects duplicate suppression state. With asynchronous logging it is also
+  held while draining rings, so there is only one consumer at a time.
+*/
 static pthread_mutex_t text_mutex;
 static unsigned int    text_cnt;
 static char            text_buf[TEXT_BUFFER_SIZE];
 
-/* Temporary copy of timers */
+/* Asynchronous logging state */
+static int                   log_async;
+static unsigned int          log_ring_size;
+static log_ring_t * volatile log_rings;
+static pthread_mutex_t       log_rings_mutex;
+static pthread_key_t         log_ring_key;
+static pthread_t             log_writer_thread;
+static volatile int          log_writer_stop;
+
+/* Per-thread stats of the last completed epoch */
 static sb_timer_t *timers_copy;
 
-/*
-  Mutex protecting timers.
-  TODO: replace with an rwlock (and implement pthread rwlocks for Windows).
-*/
+/* Serializes reporters, never taken by workers */
 static pthread_mutex_t timers_mutex;
 
 static int text_handler_init(void);
 static int text_handler_process(log_msg_t *msg);
+static int text_handler_done(void);
+static void log_async_drain(void);
 
 static int oper_handler_init(void);
 static int oper_handler_process(log_msg_t *msg);
@@ -87,6 +188,12 @@ static sb_arg_t text_handler_args[] =
 {
   {"verbosity", "verbosity level {5 - debug, 0 - only critical messages}",
    SB_ARG_TYPE_INT, "3"},
+  {"log-async", "queue text messages in per-thread buffers and print them "
+   "from a background thread, so that logging never blocks the caller. "
+   "Messages that do not fit into a full buffer are dropped and counted",
+   SB_ARG_TYPE_FLAG, "off"},
+  {"log-buffer-size", "size of each per-thread buffer with --log-async",
+   SB_ARG_TYPE_SIZE, "64K"},
   {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
 };
   
@@ -95,7 +202,7 @@ static log_handler_t text_handler = {
   {
     &text_handler_init,
     &text_handler_process,
-    NULL,
+    &text_handler_done,
   },
   text_handler_args,
   {0,0}
@@ -235,13 +342,23 @@ void log_msg(log_msg_t *msg)
 {
   sb_list_item_t  *pos;
   log_handler_t   *handler;
-  
+  int             thread_id = -1;
+
+  if (sb_profile_enabled && msg->type == LOG_MSG_TYPE_OPER)
+  {
+    thread_id = ((log_msg_oper_t *)msg->data)->thread_id;
+    sb_profile_enter(thread_id, SB_PROF_STATS);
+  }
+
   SB_LIST_FOR_EACH(pos, handlers + msg->type)
   {
     handler = SB_LIST_ENTRY(pos, log_handler_t, listitem);
     if (handler->ops.process != NULL)
       handler->ops.process(msg);
   }
+
+  if (thread_id >= 0)
+    sb_profile_exit(thread_id);
 }
 
 
@@ -395,16 +512,52 @@ void log_errno(log_msg_priority_t priority, const char *fmt, ...)
 
 
 
+/* Drain asynchronous log rings on exit() */
+
+
+static void log_async_atexit(void)
+{
+  if (!log_async)
+    return;
+
+  pthread_mutex_lock(&text_mutex);
+  log_async_drain();
+  pthread_mutex_unlock(&text_mutex);
+}
+
+
+/* Background writer thread for asynchronous logging */
+
+
+static void *log_writer_proc(void *arg)
+{
+  (void) arg; /* unused */
+
+  while (!log_writer_stop)
+  {
+    pthread_mutex_lock(&text_mutex);
+    log_async_drain();
+    pthread_mutex_unlock(&text_mutex);
+
+    usleep(LOG_FLUSH_INTERVAL);
+  }
+
+  return NULL;
+}
+
+
 /* Initialize text handler */
 
 
 int text_handler_init(void)
 {
+  unsigned long long size;
+
 #ifdef HAVE_SETVBUF
   /* Set stdout to unbuffered mode */
   setvbuf(stdout, NULL, _IONBF, 0);
 #endif
-  
+
   sb_globals.verbosity = sb_get_value_int("verbosity");
 
   if (sb_globals.verbosity > LOG_DEBUG)
@@ -416,44 +569,70 @@ int text_handler_init(void)
   pthread_mutex_init(&text_mutex, NULL);
   text_cnt = 0;
   text_buf[0] = '\0';
-  
+
+  if (!sb_get_value_flag("log-async"))
+    return 0;
+
+  size = sb_get_value_size("log-buffer-size");
+  if (size < LOG_MIN_BUFFER_SIZE || size > (1U << 30))
+  {
+    printf("Invalid value for log-buffer-size: %llu\n", size);
+    return 1;
+  }
+  /* Round up to a power of 2 so we can use a mask for indexing */
+  for (log_ring_size = LOG_MIN_BUFFER_SIZE; log_ring_size < size;
+       log_ring_size <<= 1)
+    /* nothing */ ;
+
+  if (pthread_key_create(&log_ring_key, NULL) != 0)
+  {
+    printf("pthread_key_create() failed\n");
+    return 1;
+  }
+  pthread_mutex_init(&log_rings_mutex, NULL);
+  log_rings = NULL;
+  log_writer_stop = 0;
+
+  if (pthread_create(&log_writer_thread, NULL, &log_writer_proc, NULL) != 0)
+  {
+    printf("pthread_create() for the log writer failed\n");
+    pthread_key_delete(log_ring_key);
+    pthread_mutex_destroy(&log_rings_mutex);
+    return 1;
+  }
+
+  log_async = 1;
+  atexit(log_async_atexit);
+
   return 0;
 }
 
 
-/* Print text message to the log */
+/* Print text message to the log. Must be called with text_mutex locked */
 
 
-int text_handler_process(log_msg_t *msg)
+static void text_output(unsigned int priority, unsigned int flags,
+                        const char *text)
 {
-  char *prefix;
-  log_msg_text_t *text_msg = (log_msg_text_t *)msg->data;
-
-  if (text_msg->priority > sb_globals.verbosity)
-    return 0;
+  const char *prefix;
 
-  if (!text_msg->flags & LOG_MSG_TEXT_ALLOW_DUPLICATES)
+  if (!(flags & LOG_MSG_TEXT_ALLOW_DUPLICATES))
   {
-    pthread_mutex_lock(&text_mutex);
-    if (!strcmp(text_buf, text_msg->text))
+    if (!strcmp(text_buf, text))
     {
       text_cnt++;
-      pthread_mutex_unlock(&text_mutex);
-
-      return 0;
+      return;
     }
-    else
-    {
-      if (text_cnt > 0)
-        printf("(last message repeated %u times)\n", text_cnt);
 
-      text_cnt = 0;
-      strncpy(text_buf, text_msg->text, TEXT_BUFFER_SIZE);
-    }
-    pthread_mutex_unlock(&text_mutex);
+    if (text_cnt > 0)
+      printf("(last message repeated %u times)\n", text_cnt);
+
+    text_cnt = 0;
+    strncpy(text_buf, text, TEXT_BUFFER_SIZE - 1);
+    text_buf[TEXT_BUFFER_SIZE - 1] = '\0';
   }
 
-  switch (text_msg->priority) {
+  switch (priority) {
     case LOG_FATAL:
       prefix = "FATAL: ";
       break;
@@ -470,9 +649,235 @@ int text_handler_process(log_msg_t *msg)
       prefix = "";
       break;
   }
-  
-  printf("%s%s", prefix, text_msg->text);
-  
+
+  printf("%s%s", prefix, text);
+}
+
+
+/* Get the log ring of the current thread, creating it if necessary */
+
+
+static log_ring_t *log_get_ring(void)
+{
+  log_ring_t *ring;
+
+  ring = (log_ring_t *) pthread_getspecific(log_ring_key);
+  if (ring != NULL)
+    return ring;
+
+  ring = (log_ring_t *) calloc(1, sizeof(log_ring_t));
+  if (ring == NULL)
+    return NULL;
+  ring->buf = (char *) malloc(log_ring_size);
+  if (ring->buf == NULL)
+  {
+    free(ring);
+    return NULL;
+  }
+
+  /* Rings are only ever added to the list head, so readers need no lock */
+  pthread_mutex_lock(&log_rings_mutex);
+  ring->next = log_rings;
+  log_barrier();
+  log_rings = ring;
+  pthread_mutex_unlock(&log_rings_mutex);
+
+  pthread_setspecific(log_ring_key, ring);
+
+  return ring;
+}
+
+
+/*
+  Append a message to the current thread's ring without blocking. Returns 1
+  if the ring could not be allocated, in which case the message should be
+  printed directly.
+*/
+
+
+static int log_async_put(log_msg_text_t *text_msg)
+{
+  log_ring_t      *ring;
+  log_record_t    *rec;
+  struct timespec ts;
+  unsigned int    len, size, need, room, pos, head, tail;
+
+  ring = log_get_ring();
+  if (ring == NULL)
+    return 1;
+
+  len = strlen(text_msg->text);
+  size = LOG_RECORD_ALIGN(sizeof(log_record_t) + len + 1);
+
+  head = ring->head;
+  tail = ring->tail;
+  log_barrier();
+
+  pos = head & (log_ring_size - 1);
+  room = log_ring_size - pos;
+  need = (size <= room) ? size : room + size;
+
+  if (log_ring_size - (head - tail) < need)
+  {
+    ring->dropped++;
+    return 0;
+  }
+
+  if (size > room)
+  {
+    ((log_record_t *) (ring->buf + pos))->len = LOG_RECORD_WRAP;
+    head += room;
+    pos = 0;
+  }
+
+  SB_GETTIME(&ts);
+
+  rec = (log_record_t *) (ring->buf + pos);
+  rec->len = size;
+  rec->priority = text_msg->priority;
+  rec->flags = text_msg->flags;
+  rec->time = SEC2NS((unsigned long long) ts.tv_sec) + ts.tv_nsec;
+  memcpy(rec + 1, text_msg->text, len + 1);
+
+  log_barrier();
+  ring->head = head + size;
+
+  return 0;
+}
+
+
+/* Return the oldest unread record of a ring, or NULL if it is empty */
+
+
+static log_record_t *log_ring_peek(log_ring_t *ring)
+{
+  log_record_t *rec;
+  unsigned int head;
+  unsigned int pos;
+
+  head = ring->head;
+  log_barrier();
+
+  while (ring->tail != head)
+  {
+    pos = ring->tail & (log_ring_size - 1);
+    rec = (log_record_t *) (ring->buf + pos);
+    if (rec->len != LOG_RECORD_WRAP)
+      return rec;
+
+    ring->tail += log_ring_size - pos;
+  }
+
+  return NULL;
+}
+
+
+/*
+  Print all queued messages in timestamp order. Must be called with
+  text_mutex locked.
+*/
+
+
+static void log_async_drain(void)
+{
+  log_ring_t   *ring;
+  log_ring_t   *oldest_ring;
+  log_record_t *rec;
+  log_record_t *oldest;
+
+  for (;;)
+  {
+    oldest = NULL;
+    oldest_ring = NULL;
+
+    for (ring = log_rings; ring != NULL; ring = ring->next)
+    {
+      rec = log_ring_peek(ring);
+      if (rec != NULL && (oldest == NULL || rec->time < oldest->time))
+      {
+        oldest = rec;
+        oldest_ring = ring;
+      }
+    }
+
+    if (oldest == NULL)
+      break;
+
+    text_output(oldest->priority, oldest->flags, (char *) (oldest + 1));
+
+    log_barrier();
+    oldest_ring->tail += oldest->len;
+  }
+}
+
+
+/* Print or queue text message */
+
+
+int text_handler_process(log_msg_t *msg)
+{
+  log_msg_text_t *text_msg = (log_msg_text_t *)msg->data;
+
+  if (text_msg->priority > sb_globals.verbosity)
+    return 0;
+
+  /*
+    Critical messages are often followed by exit(), so they are printed
+    synchronously after everything queued so far.
+  */
+  if (log_async && text_msg->priority > LOG_ALERT &&
+      !log_async_put(text_msg))
+    return 0;
+
+  pthread_mutex_lock(&text_mutex);
+  if (log_async)
+    log_async_drain();
+  text_output(text_msg->priority, text_msg->flags, text_msg->text);
+  pthread_mutex_unlock(&text_mutex);
+
+  return 0;
+}
+
+
+/* Stop the writer thread and print remaining messages */
+
+
+int text_handler_done(void)
+{
+  log_ring_t         *ring;
+  log_ring_t         *next;
+  unsigned long long dropped;
+
+  if (!log_async)
+    return 0;
+
+  log_writer_stop = 1;
+  pthread_join(log_writer_thread, NULL);
+
+  pthread_mutex_lock(&text_mutex);
+
+  log_async_drain();
+  log_async = 0;
+
+  dropped = 0;
+  for (ring = log_rings; ring != NULL; ring = next)
+  {
+    next = ring->next;
+    dropped += ring->dropped;
+    free(ring->buf);
+    free(ring);
+  }
+  log_rings = NULL;
+
+  if (dropped > 0)
+    printf("WARNING: %llu log messages dropped on full buffers, consider "
+           "increasing --log-buffer-size\n", dropped);
+
+  pthread_mutex_unlock(&text_mutex);
+
+  pthread_key_delete(log_ring_key);
+  pthread_mutex_destroy(&log_rings_mutex);
+
   return 0;
 }
 
@@ -493,29 +898,129 @@ int oper_handler_init(void)
   }
   sb_globals.percentile_rank = tmp;
 
-  if (sb_percentile_init(&percentile, OPER_LOG_GRANULARITY, OPER_LOG_MIN_VALUE,
-                         OPER_LOG_MAX_VALUE))
+  if (sb_percentile_init(&percentile, OPER_LOG_GRANULARITY,
+                         OPER_LOG_MIN_VALUE, OPER_LOG_MAX_VALUE))
     return 1;
 
   timers = (sb_timer_t *)malloc(sb_globals.num_threads * sizeof(sb_timer_t));
   timers_copy = (sb_timer_t *)malloc(sb_globals.num_threads *
                                      sizeof(sb_timer_t));
-  if (timers == NULL || timers_copy == NULL)
+  oper_stats = (oper_stats_t *)calloc(sb_globals.num_threads,
+                                      sizeof(oper_stats_t));
+  if (timers == NULL || timers_copy == NULL || oper_stats == NULL)
   {
     log_text(LOG_FATAL, "Memory allocation failure");
     return 1;
   }
 
   for (i = 0; i < sb_globals.num_threads; i++)
+  {
     sb_timer_init(&timers[i]);
+    sb_timer_init(&oper_stats[i].stats[0]);
+    sb_timer_init(&oper_stats[i].stats[1]);
+    if (sb_percentile_local_init(&oper_stats[i].hist[0], &percentile) ||
+        sb_percentile_local_init(&oper_stats[i].hist[1], &percentile))
+      return 1;
+  }
 
-  if (sb_globals.n_checkpoints > 0)
-    pthread_mutex_init(&timers_mutex, NULL);
+  oper_epoch = 0;
+  pthread_mutex_init(&timers_mutex, NULL);
 
   return 0;
 }
 
 
+/* Add an event time to accumulated stats */
+
+
+static void oper_stats_update(sb_timer_t *t, unsigned long long value)
+{
+  t->events++;
+  t->sum_time += value;
+  if (value < t->min_time)
+    t->min_time = value;
+  if (value > t->max_time)
+    t->max_time = value;
+}
+
+
+/* Add an event time to the current epoch buffers of a thread */
+
+
+static void oper_stats_add(oper_stats_t *s, unsigned long long value)
+{
+  unsigned int epoch;
+
+  /* Announce the epoch being updated, retry if it has just been flipped */
+  do
+  {
+    epoch = oper_epoch;
+    s->busy = epoch + 1;
+    log_barrier();
+  } while (epoch != oper_epoch);
+
+  oper_stats_update(&s->stats[epoch & 1], value);
+  sb_percentile_local_update(&s->hist[epoch & 1], &percentile, value);
+
+  log_barrier();
+  s->busy = 0;
+}
+
+
+/*
+  Start a new epoch and wait until workers have finished updating the
+  previous one. Returns the index of the buffers of the previous epoch.
+  Workers still updating them after OPER_FLIP_TIMEOUT are marked as late.
+*/
+
+
+static unsigned int oper_stats_flip(void)
+{
+  unsigned int    old;
+  unsigned int    i;
+  unsigned int    n;
+  struct timespec start;
+  struct timespec now;
+
+  old = oper_epoch;
+  oper_epoch = old + 1;
+  log_barrier();
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    oper_stats[i].late = 0;
+
+    for (n = 0; oper_stats[i].busy == old + 1 &&
+           !sb_globals.forced_shutdown_in_progress; n++)
+    {
+      /* Updates are short, so spin first and only then let the worker run */
+      if (n < OPER_FLIP_SPINS)
+      {
+        log_barrier();
+        continue;
+      }
+
+      if (n == OPER_FLIP_SPINS)
+        SB_GETTIME(&start);
+      else
+      {
+        SB_GETTIME(&now);
+        if (TIMESPEC_DIFF(now, start) > OPER_FLIP_TIMEOUT)
+        {
+          oper_stats[i].late = 1;
+          break;
+        }
+      }
+#ifdef HAVE_SCHED_H
+      sched_yield();
+#endif
+    }
+  }
+
+  return old & 1;
+}
+
+
 /* Process operation start/stop messages */
 
 
@@ -527,30 +1032,47 @@ int oper_handler_process(log_msg_t *msg)
 
   if (oper_msg->action == LOG_MSG_OPER_START)
   {
-    if (sb_globals.n_checkpoints > 0)
-      pthread_mutex_lock(&timers_mutex);
     sb_timer_start(timer);
-    if (sb_globals.n_checkpoints > 0)
-      pthread_mutex_unlock(&timers_mutex);
 
     return 0;
   }
 
-  if (sb_globals.n_checkpoints > 0)
-    pthread_mutex_lock(&timers_mutex);
+  /* Events that do not run one at a time per thread report their start */
+  if (oper_msg->action == LOG_MSG_OPER_DONE)
+    sb_timer_start_at(timer, &oper_msg->start);
 
-  sb_timer_stop(timer);
+  sb_timer_stop_event(timer);
 
   value = sb_timer_value(timer);
 
-  if (sb_globals.n_checkpoints > 0)
-    pthread_mutex_unlock(&timers_mutex);
+  oper_stats_add(&oper_stats[oper_msg->thread_id], value);
+  sb_metrics_event(oper_msg->thread_id, value);
 
-  sb_percentile_update(&percentile, value);
+  if (sb_outliers_enabled)
+    sb_outliers_event(oper_msg->thread_id,
+                      TIMESPEC_DIFF(timer->time_start,
+                                    sb_globals.exec_timer.time_start),
+                      value);
 
   return 0;
 }
 
+/*
+  Add response times collected since the last checkpoint (if used) or the
+  test start to a histogram.
+*/
+
+void oper_handler_merge_percentile(sb_percentile_t *dst)
+{
+  unsigned int i;
+
+  if (checkpoint_percentile != NULL)
+    sb_percentile_merge(dst, checkpoint_percentile);
+  else
+    for (i = 0; i < sb_globals.num_threads; i++)
+      sb_percentile_local_merge(dst, &oper_stats[i].hist[oper_epoch & 1], 0);
+}
+
 /*
   Print global stats either from the last checkpoint (if used) or
   from the test start.
@@ -569,26 +1091,40 @@ int print_global_stats(void)
   double       time_stddev;
   double       percentile_val;
   unsigned long long total_time_ns;
+  unsigned int idx;
 
   sb_timer_init(&t);
   nthreads = sb_globals.num_threads;
 
-  /* Create a temporary copy of timers and reset them */
-  if (sb_globals.n_checkpoints > 0)
+  /* Forced shutdown runs from a signal handler and must not block */
+  if (!sb_globals.forced_shutdown_in_progress)
     pthread_mutex_lock(&timers_mutex);
 
-  memcpy(timers_copy, timers, sb_globals.num_threads * sizeof(sb_timer_t));
-  for (i = 0; i < sb_globals.num_threads; i++)
-    sb_timer_reset(&timers[i]);
+  /* Take the stats of the finished epoch and reset them for reuse */
+  idx = oper_stats_flip();
+  sb_percentile_reset(&percentile);
+  for (i = 0; i < nthreads; i++)
+  {
+    if (oper_stats[i].late)
+    {
+      sb_timer_init(&timers_copy[i]);
+      continue;
+    }
+    timers_copy[i] = oper_stats[i].stats[idx];
+    sb_timer_reset(&oper_stats[i].stats[idx]);
+    sb_percentile_local_merge(&percentile, &oper_stats[i].hist[idx], 1);
+  }
 
   total_time_ns = sb_timer_split(&sb_globals.cumulative_timer2);
 
   percentile_val = sb_percentile_calculate(&percentile,
                                            sb_globals.percentile_rank);
-  sb_percentile_reset(&percentile);
-
-  if (sb_globals.n_checkpoints > 0)
-    pthread_mutex_unlock(&timers_mutex);
+  if (sb_result_enabled)
+  {
+    checkpoint_percentile = &percentile;
+    sb_result_checkpoint();
+    checkpoint_percentile = NULL;
+  }
 
   if (sb_globals.forced_shutdown_in_progress)
   {
@@ -601,13 +1137,16 @@ int print_global_stats(void)
       a counter of still running transactions.
     */
     unsigned int unfinished = 0;
+    sb_timer_t   tmp;
 
     for (i = 0; i < nthreads; i++)
     {
-      if (sb_timer_running(&timers_copy[i]))
+      tmp = timers[i];
+      if (sb_timer_running(&tmp))
       {
         unfinished++;
-        sb_timer_stop(&timers_copy[i]);
+        sb_timer_stop_event(&tmp);
+        oper_stats_update(&timers_copy[i], tmp.elapsed);
       };
     }
 
@@ -695,6 +1234,9 @@ int print_global_stats(void)
     log_text(LOG_NOTICE, "");
   }
 
+  if (!sb_globals.forced_shutdown_in_progress)
+    pthread_mutex_unlock(&timers_mutex);
+
   return 0;
 }
 
@@ -702,13 +1244,23 @@ int print_global_stats(void)
 
 int oper_handler_done(void)
 {
+  unsigned int i;
+
   print_global_stats();
 
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    sb_percentile_local_done(&oper_stats[i].hist[0]);
+    sb_percentile_local_done(&oper_stats[i].hist[1]);
+  }
+
   free(timers);
   free(timers_copy);
+  free(oper_stats);
+
+  sb_percentile_done(&percentile);
 
-  if (sb_globals.n_checkpoints > 0)
-    pthread_mutex_destroy(&timers_mutex);
+  pthread_mutex_destroy(&timers_mutex);
 
   return 0;
 }
@@ -25,6 +25,7 @@
 
 #include "sb_options.h"
 #include "sb_timer.h"
+#include "sb_percentile.h"
 
 /* Text message flags (used in the 'flags' field of log_text_msg_t) */
 
@@ -48,6 +49,17 @@
     log_msg(&(msg)); \
   } while (0);
 
+/* Report a completed event that was started at 'start_ts' */
+
+#define LOG_EVENT_DONE(msg, thread_id, start_ts) \
+  do \
+  { \
+    ((log_msg_oper_t *)(msg).data)->thread_id = thread_id; \
+    ((log_msg_oper_t *)(msg).data)->action = LOG_MSG_OPER_DONE; \
+    ((log_msg_oper_t *)(msg).data)->start = start_ts; \
+    log_msg(&(msg)); \
+  } while (0);
+
 /* Message types definition */
 
 typedef enum {
@@ -81,12 +93,14 @@ typedef struct {
 
 typedef enum {
   LOG_MSG_OPER_START,
-  LOG_MSG_OPER_STOP
+  LOG_MSG_OPER_STOP,
+  LOG_MSG_OPER_DONE           /* start and stop with an explicit start time */
 } log_msg_oper_action_t;
 
 typedef struct {
   log_msg_oper_action_t action;
   int                   thread_id;
+  struct timespec       start;      /* event start for LOG_MSG_OPER_DONE */
 } log_msg_oper_t;
 
 /* General log message definition */
@@ -119,6 +133,11 @@ typedef struct {
   sb_list_item_t       listitem;  /* can be linked in a list */
 } log_handler_t;
 
+/* Geometry of response time histograms */
+#define OPER_LOG_GRANULARITY 100000
+#define OPER_LOG_MIN_VALUE   1
+#define OPER_LOG_MAX_VALUE   1E13
+
 /* per-thread timers for response time stats */
 extern sb_timer_t *timers;
 
@@ -162,6 +181,13 @@ void log_errno(log_msg_priority_t priority, const char *fmt, ...);
 
 void log_done(void);
 
+/*
+  Add response times collected since the last checkpoint (if used) or the
+  test start to a histogram.
+*/
+
+void oper_handler_merge_percentile(sb_percentile_t *dst);
+
 /*
   Print global stats either from the last checkpoint (if used) or
   from the test start.
@@ -0,0 +1,732 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Cumulative per-thread counters and a minimal HTTP server exporting them in
+  the Prometheus text exposition format, so that long runs can be scraped
+  while they are in progress.
+
+  Worker threads only ever increment their own counters, and the listener
+  thread reads them without any locking. Counters are never reset, so the
+  listener never interferes with intermediate or checkpoint reports.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#ifdef _WIN32
+# include "sb_win.h"
+#endif
+
+#ifdef STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdarg.h>
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_ERRNO_H
+# include <errno.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+#ifdef HAVE_SYS_UN_H
+# include <sys/un.h>
+#endif
+#ifdef HAVE_NETDB_H
+# include <netdb.h>
+#endif
+
+#include "sysbench.h"
+#include "sb_metrics.h"
+
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_NETDB_H)
+# define SB_METRICS_HAVE_SOCKETS 1
+#endif
+
+/* Maximum size of an HTTP request we are willing to read */
+#define REQUEST_BUFFER_SIZE 4096
+
+/* Time in seconds a client may take to send a request or read a response */
+#define CLIENT_TIMEOUT 5
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+/* Default host to listen on when only a port is specified */
+#define DEFAULT_LISTEN_HOST "127.0.0.1"
+
+/* Upper bounds of histogram buckets in nanoseconds */
+static const unsigned long long bucket_bounds[SB_METRICS_NBUCKETS] =
+{
+  50000ULL, 100000ULL, 250000ULL, 500000ULL,
+  1000000ULL, 2500000ULL, 5000000ULL, 10000000ULL,
+  25000000ULL, 50000000ULL, 100000000ULL, 250000000ULL,
+  500000000ULL, 1000000000ULL, 2500000000ULL, 5000000000ULL,
+  10000000000ULL, 25000000000ULL, 50000000000ULL, 100000000000ULL
+};
+
+/* Metrics options */
+
+static sb_arg_t metrics_args[] =
+{
+  {"metrics-listen", "serve current statistics in the Prometheus text format "
+   "over HTTP. The argument is either [host:]port (host defaults to "
+   DEFAULT_LISTEN_HOST ") or unix:path for a Unix domain socket. Empty value "
+   "disables the listener", SB_ARG_TYPE_STRING, NULL},
+  {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
+};
+
+sb_thread_metrics_t *sb_thread_metrics;
+
+/* Growable text buffer used to render responses */
+typedef struct
+{
+  char   *data;
+  size_t len;
+  size_t size;
+} metrics_buf_t;
+
+#ifdef SB_METRICS_HAVE_SOCKETS
+
+static int             listen_fd = -1;
+static char            *unix_path;
+static pthread_t       metrics_thread;
+static int             metrics_thread_created;
+
+/* Values at the time of the previous scrape, used to calculate rates */
+static struct timespec     last_scrape;
+static unsigned long long  last_events;
+static unsigned long long  last_transactions;
+
+#endif /* SB_METRICS_HAVE_SOCKETS */
+
+
+/* Register command line options */
+
+
+int sb_metrics_register(void)
+{
+  return sb_register_arg_set(metrics_args);
+}
+
+
+/* Print command line options */
+
+
+void sb_metrics_print_help(void)
+{
+  printf("Metrics options:\n");
+  sb_print_options(metrics_args);
+}
+
+
+/* Allocate per-thread counters */
+
+
+int sb_metrics_init(void)
+{
+  sb_thread_metrics = (sb_thread_metrics_t *)
+    calloc(sb_globals.num_threads, sizeof(sb_thread_metrics_t));
+  if (sb_thread_metrics == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure");
+    return 1;
+  }
+
+  return 0;
+}
+
+
+/* Account a finished event for a given thread */
+
+
+void sb_metrics_event(int thread_id, unsigned long long ns)
+{
+  sb_thread_metrics_t *m;
+  unsigned int        i;
+
+  if (sb_thread_metrics == NULL || thread_id < 0)
+    return;
+
+  m = &sb_thread_metrics[thread_id];
+
+  m->events++;
+  m->event_time += ns;
+
+  for (i = 0; i < SB_METRICS_NBUCKETS && ns > bucket_bounds[i]; i++)
+    /* nothing */ ;
+  m->buckets[i]++;
+}
+
+
+/* Sum of events over all threads */
+
+
+unsigned long long sb_metrics_total_events(void)
+{
+  unsigned long long events = 0;
+  unsigned int       i;
+
+  if (sb_thread_metrics == NULL)
+    return 0;
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+    events += sb_thread_metrics[i].events;
+
+  return events;
+}
+
+
+/* Free per-thread counters */
+
+
+void sb_metrics_done(void)
+{
+  free(sb_thread_metrics);
+  sb_thread_metrics = NULL;
+}
+
+
+#ifdef SB_METRICS_HAVE_SOCKETS
+
+/* printf-like append to a response buffer */
+
+
+static int buf_printf(metrics_buf_t *buf, const char *fmt, ...)
+{
+  va_list ap;
+  int     n;
+
+  for (;;)
+  {
+    if (buf->size - buf->len < 256)
+    {
+      size_t size = buf->size > 0 ? buf->size * 2 : 8192;
+      char   *tmp = (char *)realloc(buf->data, size);
+
+      if (tmp == NULL)
+        return 1;
+      buf->data = tmp;
+      buf->size = size;
+    }
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0)
+      return 1;
+    if ((size_t)n < buf->size - buf->len)
+    {
+      buf->len += n;
+      return 0;
+    }
+
+    /* Not enough space, force buffer growth and retry */
+    {
+      char *tmp = (char *)realloc(buf->data, buf->size + n);
+
+      if (tmp == NULL)
+        return 1;
+      buf->data = tmp;
+      buf->size += n;
+    }
+  }
+}
+
+
+/* Print HELP and TYPE lines for a metric */
+
+
+static void buf_header(metrics_buf_t *buf, const char *name, const char *type,
+                       const char *help)
+{
+  buf_printf(buf, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+
+/* Render all metrics in the Prometheus text format */
+
+
+static void render_metrics(metrics_buf_t *buf)
+{
+  sb_thread_metrics_t total;
+  sb_thread_metrics_t *m;
+  struct timespec     now;
+  unsigned int        i, j;
+  unsigned long long  cumulative;
+  double              seconds;
+  double              events_rate;
+  double              tx_rate;
+
+  memset(&total, 0, sizeof(total));
+
+  /*
+    Read counters without locking. Each value is updated by a single writer,
+    so we may only observe a slightly stale value.
+  */
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    m = (sb_thread_metrics_t *)&sb_thread_metrics[i];
+
+    total.events += m->events;
+    total.event_time += m->event_time;
+    for (j = 0; j < SB_CNT_MAX; j++)
+      total.counters[j] += m->counters[j];
+    for (j = 0; j <= SB_METRICS_NBUCKETS; j++)
+      total.buckets[j] += m->buckets[j];
+  }
+
+  SB_GETTIME(&now);
+  seconds = NS2SEC(TIMESPEC_DIFF(now, last_scrape));
+  if (last_scrape.tv_sec != 0 && seconds > 0)
+  {
+    events_rate = (total.events - last_events) / seconds;
+    tx_rate = (total.counters[SB_CNT_TRANSACTION] - last_transactions) /
+      seconds;
+  }
+  else
+    events_rate = tx_rate = 0;
+
+  last_scrape = now;
+  last_events = total.events;
+  last_transactions = total.counters[SB_CNT_TRANSACTION];
+
+  buf_header(buf, "sysbench_threads_running", "gauge",
+             "Number of worker threads currently running.");
+  buf_printf(buf, "sysbench_threads_running %u\n", sb_globals.num_running);
+
+  buf_header(buf, "sysbench_events_total", "counter",
+             "Total number of events executed.");
+  buf_printf(buf, "sysbench_events_total %llu\n", total.events);
+
+  buf_header(buf, "sysbench_thread_events_total", "counter",
+             "Number of events executed by each worker thread.");
+  for (i = 0; i < sb_globals.num_threads; i++)
+    buf_printf(buf, "sysbench_thread_events_total{thread=\"%u\"} %llu\n", i,
+               sb_thread_metrics[i].events);
+
+  buf_header(buf, "sysbench_events_per_second", "gauge",
+             "Event rate since the previous scrape.");
+  buf_printf(buf, "sysbench_events_per_second %.2f\n", events_rate);
+
+  buf_header(buf, "sysbench_queries_total", "counter",
+             "Total number of queries executed.");
+  buf_printf(buf, "sysbench_queries_total{type=\"read\"} %llu\n",
+             total.counters[SB_CNT_READ]);
+  buf_printf(buf, "sysbench_queries_total{type=\"write\"} %llu\n",
+             total.counters[SB_CNT_WRITE]);
+  buf_printf(buf, "sysbench_queries_total{type=\"other\"} %llu\n",
+             total.counters[SB_CNT_OTHER]);
+
+  buf_header(buf, "sysbench_transactions_total", "counter",
+             "Total number of transactions.");
+  buf_printf(buf, "sysbench_transactions_total %llu\n",
+             total.counters[SB_CNT_TRANSACTION]);
+
+  buf_header(buf, "sysbench_transactions_per_second", "gauge",
+             "Transaction rate since the previous scrape.");
+  buf_printf(buf, "sysbench_transactions_per_second %.2f\n", tx_rate);
+
+  buf_header(buf, "sysbench_errors_total", "counter",
+             "Total number of ignored errors.");
+  buf_printf(buf, "sysbench_errors_total %llu\n",
+             total.counters[SB_CNT_ERROR]);
+
+  buf_header(buf, "sysbench_reconnects_total", "counter",
+             "Total number of reconnects.");
+  buf_printf(buf, "sysbench_reconnects_total %llu\n",
+             total.counters[SB_CNT_RECONNECT]);
+
+  buf_header(buf, "sysbench_event_latency_seconds", "histogram",
+             "Event execution time.");
+  for (i = 0, cumulative = 0; i < SB_METRICS_NBUCKETS; i++)
+  {
+    cumulative += total.buckets[i];
+    buf_printf(buf, "sysbench_event_latency_seconds_bucket{le=\"%g\"} %llu\n",
+               NS2SEC(bucket_bounds[i]), cumulative);
+  }
+  cumulative += total.buckets[SB_METRICS_NBUCKETS];
+  buf_printf(buf, "sysbench_event_latency_seconds_bucket{le=\"+Inf\"} %llu\n",
+             cumulative);
+  buf_printf(buf, "sysbench_event_latency_seconds_sum %.9f\n",
+             NS2SEC(total.event_time));
+  buf_printf(buf, "sysbench_event_latency_seconds_count %llu\n", cumulative);
+}
+
+
+/*
+  Write the whole buffer to a socket. A client that has disconnected must
+  not kill the process with SIGPIPE.
+*/
+
+
+static int write_all(int fd, const char *data, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0)
+  {
+    n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return 1;
+    }
+    data += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+
+/* Read an HTTP request and send a response */
+
+
+static void handle_client(int fd)
+{
+  char          req[REQUEST_BUFFER_SIZE];
+  size_t        len = 0;
+  ssize_t       n;
+  char          header[256];
+  metrics_buf_t body;
+  const char    *status;
+  int           hlen;
+  int           old_state;
+
+  /* Read the request headers, the thread may be cancelled while waiting */
+  while (len < sizeof(req) - 1)
+  {
+    n = read(fd, req + len, sizeof(req) - 1 - len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    len += n;
+    req[len] = '\0';
+    if (strstr(req, "\r\n\r\n") != NULL || strstr(req, "\n\n") != NULL)
+      break;
+  }
+  req[len] = '\0';
+
+  /* Do not let cancellation interrupt memory allocation */
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_state);
+
+  memset(&body, 0, sizeof(body));
+
+  if (strncmp(req, "GET ", 4))
+  {
+    status = "405 Method Not Allowed";
+    buf_printf(&body, "Only GET requests are supported\n");
+  }
+  else if (strncmp(req + 4, "/metrics", 8) && strncmp(req + 4, "/ ", 2))
+  {
+    status = "404 Not Found";
+    buf_printf(&body, "Metrics are available at /metrics\n");
+  }
+  else
+  {
+    status = "200 OK";
+    render_metrics(&body);
+  }
+
+  if (body.data == NULL)
+  {
+    pthread_setcancelstate(old_state, NULL);
+    return;
+  }
+
+  hlen = snprintf(header, sizeof(header),
+                  "HTTP/1.0 %s\r\n"
+                  "Content-Type: text/plain; version=0.0.4\r\n"
+                  "Content-Length: %lu\r\n"
+                  "Connection: close\r\n\r\n",
+                  status, (unsigned long) body.len);
+
+  if (!write_all(fd, header, hlen))
+    write_all(fd, body.data, body.len);
+
+  free(body.data);
+
+  pthread_setcancelstate(old_state, NULL);
+}
+
+
+/* Cleanup handler closing the client socket of a cancelled listener */
+
+
+static void close_client(void *arg)
+{
+  close(*(int *)arg);
+}
+
+
+/* Listener thread */
+
+
+static void *metrics_thread_proc(void *arg)
+{
+  int            fd;
+  struct timeval tv;
+
+  (void)arg; /* unused */
+
+  log_text(LOG_DEBUG, "Metrics listener thread started");
+
+  for (;;)
+  {
+    fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+    {
+      if (errno != EINTR)
+        log_errno(LOG_WARNING, "accept() failed on the metrics socket");
+      continue;
+    }
+
+    /* Do not let an idle or slow client block the listener */
+    tv.tv_sec = CLIENT_TIMEOUT;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    /* Do not leak the client socket if we are cancelled in the middle */
+    pthread_cleanup_push(close_client, &fd);
+    handle_client(fd);
+    pthread_cleanup_pop(1);
+  }
+
+  return NULL;
+}
+
+
+/* Create a listening Unix domain socket */
+
+
+static int listen_unix(const char *path)
+{
+  struct sockaddr_un addr;
+  struct stat        st;
+  int                fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    log_text(LOG_FATAL, "Unix socket path is too long: '%s'", path);
+    return -1;
+  }
+
+  /* Remove a stale socket left by a previous run */
+  if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    log_errno(LOG_FATAL, "socket() failed");
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(fd, 16))
+  {
+    log_errno(LOG_FATAL, "Cannot listen on '%s'", path);
+    close(fd);
+    return -1;
+  }
+
+  unix_path = strdup(path);
+
+  return fd;
+}
+
+
+/* Create a listening TCP socket from a [host:]port specification */
+
+
+static int listen_tcp(const char *spec)
+{
+  struct addrinfo hints;
+  struct addrinfo *res, *ai;
+  char            *host;
+  char            *port;
+  char            *tmp;
+  int             fd = -1;
+  int             rc;
+  int             on = 1;
+
+  host = strdup(spec);
+  if (host == NULL)
+    return -1;
+
+  tmp = strrchr(host, ':');
+  if (tmp != NULL)
+  {
+    *tmp = '\0';
+    port = tmp + 1;
+    /* Strip brackets around IPv6 addresses */
+    if (host[0] == '[' && tmp > host && tmp[-1] == ']')
+    {
+      tmp[-1] = '\0';
+      memmove(host, host + 1, strlen(host));
+    }
+  }
+  else
+  {
+    port = host;
+    host = NULL;
+  }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  rc = getaddrinfo(host != NULL ? host : DEFAULT_LISTEN_HOST, port, &hints,
+                   &res);
+  if (rc != 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for --metrics-listen: '%s' (%s)", spec,
+             gai_strerror(rc));
+    free(host != NULL ? host : port);
+    return -1;
+  }
+
+  for (ai = res; ai != NULL; ai = ai->ai_next)
+  {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    if (!bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, 16))
+      break;
+
+    close(fd);
+    fd = -1;
+  }
+
+  if (fd < 0)
+    log_errno(LOG_FATAL, "Cannot listen on '%s'", spec);
+
+  freeaddrinfo(res);
+  free(host != NULL ? host : port);
+
+  return fd;
+}
+
+
+/* Start the metrics listener thread */
+
+
+int sb_metrics_start(void)
+{
+  char *spec;
+  int  err;
+
+  spec = sb_get_value_string("metrics-listen");
+  if (spec == NULL || spec[0] == '\0')
+    return 0;
+
+  if (!strncmp(spec, "unix:", 5))
+    listen_fd = listen_unix(spec + 5);
+  else
+    listen_fd = listen_tcp(spec);
+
+  if (listen_fd < 0)
+    return 1;
+
+  memset(&last_scrape, 0, sizeof(last_scrape));
+  last_events = 0;
+  last_transactions = 0;
+
+  if ((err = pthread_create(&metrics_thread, NULL, &metrics_thread_proc,
+                            NULL)) != 0)
+  {
+    log_errno(LOG_FATAL, "pthread_create() for the metrics thread failed.");
+    close(listen_fd);
+    listen_fd = -1;
+    return 1;
+  }
+  metrics_thread_created = 1;
+
+  log_text(LOG_NOTICE, "Serving metrics on %s\n", spec);
+
+  return 0;
+}
+
+
+/* Stop the listener thread */
+
+
+void sb_metrics_stop(void)
+{
+  if (metrics_thread_created)
+  {
+    if (pthread_cancel(metrics_thread) || pthread_join(metrics_thread, NULL))
+      log_errno(LOG_FATAL, "Terminating the metrics thread failed.");
+    metrics_thread_created = 0;
+  }
+
+  if (listen_fd >= 0)
+  {
+    close(listen_fd);
+    listen_fd = -1;
+  }
+
+  if (unix_path != NULL)
+  {
+    unlink(unix_path);
+    free(unix_path);
+    unix_path = NULL;
+  }
+}
+
+#else /* !SB_METRICS_HAVE_SOCKETS */
+
+int sb_metrics_start(void)
+{
+  char *spec = sb_get_value_string("metrics-listen");
+
+  if (spec == NULL || spec[0] == '\0')
+    return 0;
+
+  log_text(LOG_FATAL, "--metrics-listen is not supported on this platform");
+
+  return 1;
+}
+
+
+void sb_metrics_stop(void)
+{
+}
+
+#endif /* SB_METRICS_HAVE_SOCKETS */
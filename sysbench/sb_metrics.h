@@ -0,0 +1,97 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Cumulative per-thread counters and a built-in HTTP listener exporting them
+  in the Prometheus text exposition format.
+*/
+
+#ifndef SB_METRICS_H
+#define SB_METRICS_H
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "sb_options.h"
+
+/* Number of finite buckets in the event latency histogram */
+#define SB_METRICS_NBUCKETS 20
+
+/* Cumulative counter types */
+
+typedef enum
+{
+  SB_CNT_READ,         /* read queries */
+  SB_CNT_WRITE,        /* write queries */
+  SB_CNT_OTHER,        /* other queries */
+  SB_CNT_TRANSACTION,  /* transactions */
+  SB_CNT_ERROR,        /* ignored errors */
+  SB_CNT_RECONNECT,    /* reconnects */
+  SB_CNT_MAX
+} sb_counter_t;
+
+/*
+  Per-thread counters. They are never reset and are only modified by the
+  owning thread, so they can be read by other threads without locking.
+*/
+
+typedef struct
+{
+  unsigned long long events;      /* number of events */
+  unsigned long long event_time;  /* total event execution time in ns */
+  unsigned long long counters[SB_CNT_MAX];
+  /* event latency histogram, the last bucket is +Inf */
+  unsigned long long buckets[SB_METRICS_NBUCKETS + 1];
+  char               pad[64];     /* avoid false sharing between threads */
+} sb_thread_metrics_t;
+
+extern sb_thread_metrics_t *sb_thread_metrics;
+
+/* Register command line options */
+int sb_metrics_register(void);
+
+/* Print command line options */
+void sb_metrics_print_help(void);
+
+/* Allocate per-thread counters, must be called after num_threads is known */
+int sb_metrics_init(void);
+
+/* Account a finished event of 'ns' nanoseconds for a given thread */
+void sb_metrics_event(int thread_id, unsigned long long ns);
+
+/* Increment a cumulative counter for a given thread */
+#define sb_metrics_inc(thread_id, cnt)                           \
+  do {                                                           \
+    if (sb_thread_metrics != NULL && (thread_id) >= 0)           \
+      sb_thread_metrics[thread_id].counters[cnt]++;              \
+  } while (0)
+
+/* Sum of events over all threads */
+unsigned long long sb_metrics_total_events(void);
+
+/* Start the metrics listener thread, if requested on the command line */
+int sb_metrics_start(void);
+
+/* Stop the listener thread */
+void sb_metrics_stop(void);
+
+/* Free per-thread counters */
+void sb_metrics_done(void);
+
+#endif /* SB_METRICS_H */
@@ -0,0 +1,498 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Every worker thread keeps two pairs of min-heaps holding its K slowest
+  events and queries. Workers only update the pair selected by the global
+  'active' index. The reporting side flips the index, waits until no worker
+  is in the middle of an update, and then merges and clears the inactive
+  pair, so workers never take locks.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#ifdef _WIN32
+# include "sb_win.h"
+#endif
+
+#ifdef STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+#endif
+#ifdef HAVE_SCHED_H
+# include <sched.h>
+#endif
+
+#include "sysbench.h"
+#include "sb_outliers.h"
+
+/* Full memory barrier */
+#if defined(__GNUC__)
+# define outliers_barrier() __sync_synchronize()
+#elif defined(_WIN32)
+# define outliers_barrier() MemoryBarrier()
+#else
+# define outliers_barrier() do { } while (0)
+#endif
+
+/* Captured outlier */
+
+typedef struct
+{
+  unsigned long long duration;  /* execution time in ns */
+  unsigned long long start;     /* ns since the test start */
+  int                thread_id;
+  char               text[SB_OUTLIER_TEXT_LEN];
+} outlier_t;
+
+/* Min-heap of the K slowest entries */
+
+typedef struct
+{
+  outlier_t    *entries;
+  unsigned int n;
+} outlier_heap_t;
+
+/* Per-thread state */
+
+typedef struct
+{
+  outlier_heap_t      events[2];
+  outlier_heap_t      queries[2];
+  volatile int        busy;          /* set while updating the heaps */
+  /* slowest query of the current event */
+  unsigned long long  cur_query_time;
+  char                cur_query[SB_OUTLIER_TEXT_LEN];
+  char                pad[64];       /* avoid false sharing */
+} outliers_thread_t;
+
+/* Outliers options */
+
+static sb_arg_t outliers_args[] =
+{
+  {"outliers", "number of slowest events and queries to capture and print "
+   "with each intermediate report and at the end of the test. 0 disables "
+   "outlier capture", SB_ARG_TYPE_INT, "0"},
+  {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
+};
+
+int sb_outliers_enabled;
+
+static outliers_thread_t *outliers_threads;
+static unsigned int      outliers_k;
+static volatile int      active;
+
+/* Outliers accumulated over the whole test, owned by the reporting side */
+static outlier_heap_t    total_events;
+static outlier_heap_t    total_queries;
+static pthread_mutex_t   report_mutex;
+
+/* Heap operations */
+
+static void heap_swap(outlier_t *a, outlier_t *b)
+{
+  outlier_t tmp;
+
+  memcpy(&tmp, a, sizeof(outlier_t));
+  memcpy(a, b, sizeof(outlier_t));
+  memcpy(b, &tmp, sizeof(outlier_t));
+}
+
+
+static void heap_sift_up(outlier_heap_t *heap, unsigned int i)
+{
+  unsigned int parent;
+
+  while (i > 0)
+  {
+    parent = (i - 1) / 2;
+    if (heap->entries[parent].duration <= heap->entries[i].duration)
+      break;
+    heap_swap(heap->entries + parent, heap->entries + i);
+    i = parent;
+  }
+}
+
+
+static void heap_sift_down(outlier_heap_t *heap, unsigned int i)
+{
+  unsigned int child;
+
+  for (;;)
+  {
+    child = 2 * i + 1;
+    if (child >= heap->n)
+      break;
+    if (child + 1 < heap->n &&
+        heap->entries[child + 1].duration < heap->entries[child].duration)
+      child++;
+    if (heap->entries[i].duration <= heap->entries[child].duration)
+      break;
+    heap_swap(heap->entries + i, heap->entries + child);
+    i = child;
+  }
+}
+
+
+/* Check if an entry with the given duration would get into the heap */
+
+
+static int heap_accepts(outlier_heap_t *heap, unsigned long long ns)
+{
+  return heap->n < outliers_k || ns > heap->entries[0].duration;
+}
+
+
+/* Insert an entry into the heap, replacing the fastest one if full */
+
+
+static void heap_insert(outlier_heap_t *heap, unsigned long long start,
+                        unsigned long long ns, int thread_id,
+                        const char *text)
+{
+  outlier_t *e;
+
+  if (heap->n < outliers_k)
+    e = heap->entries + heap->n++;
+  else if (ns > heap->entries[0].duration)
+    e = heap->entries;
+  else
+    return;
+
+  e->duration = ns;
+  e->start = start;
+  e->thread_id = thread_id;
+  strncpy(e->text, text, sizeof(e->text) - 1);
+  e->text[sizeof(e->text) - 1] = '\0';
+
+  if (e == heap->entries)
+    heap_sift_down(heap, 0);
+  else
+    heap_sift_up(heap, heap->n - 1);
+}
+
+
+static int heap_alloc(outlier_heap_t *heap)
+{
+  heap->entries = (outlier_t *) calloc(outliers_k, sizeof(outlier_t));
+  heap->n = 0;
+
+  return heap->entries == NULL;
+}
+
+
+static int cmp_duration_desc(const void *a, const void *b)
+{
+  const outlier_t *e1 = (const outlier_t *) a;
+  const outlier_t *e2 = (const outlier_t *) b;
+
+  if (e1->duration > e2->duration)
+    return -1;
+  return e1->duration < e2->duration;
+}
+
+
+/* Register command line options */
+
+
+int sb_outliers_register(void)
+{
+  return sb_register_arg_set(outliers_args);
+}
+
+
+/* Print command line options */
+
+
+void sb_outliers_print_help(void)
+{
+  printf("Outliers options:\n");
+  sb_print_options(outliers_args);
+}
+
+
+/* Parse options and allocate per-thread heaps */
+
+
+int sb_outliers_init(void)
+{
+  unsigned int i, j;
+  int          k;
+
+  k = sb_get_value_int("outliers");
+  if (k < 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for --outliers: %d", k);
+    return 1;
+  }
+  if (k == 0 || sb_globals.command != SB_COMMAND_RUN)
+    return 0;
+
+  outliers_k = (unsigned int) k;
+
+  outliers_threads = (outliers_thread_t *)
+    calloc(sb_globals.num_threads, sizeof(outliers_thread_t));
+  if (outliers_threads == NULL)
+    goto error;
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+    for (j = 0; j < 2; j++)
+      if (heap_alloc(&outliers_threads[i].events[j]) ||
+          heap_alloc(&outliers_threads[i].queries[j]))
+        goto error;
+
+  if (heap_alloc(&total_events) || heap_alloc(&total_queries))
+    goto error;
+
+  pthread_mutex_init(&report_mutex, NULL);
+
+  active = 0;
+  sb_outliers_enabled = 1;
+
+  return 0;
+
+ error:
+  log_text(LOG_FATAL, "Memory allocation failure");
+  sb_outliers_done();
+
+  return 1;
+}
+
+
+/* Check whether a query may be an outlier */
+
+
+int sb_outliers_query_wanted(int thread_id, unsigned long long ns)
+{
+  outliers_thread_t *t;
+  int               idx;
+
+  if (!sb_outliers_enabled || thread_id < 0)
+    return 0;
+
+  t = &outliers_threads[thread_id];
+  idx = active;
+
+  /*
+    This is just a hint read without synchronization, the final decision is
+    made in sb_outliers_add_query().
+  */
+  return heap_accepts(&t->queries[idx], ns) ||
+    (ns > t->cur_query_time && heap_accepts(&t->events[idx], ns));
+}
+
+
+/* Account a slow query */
+
+
+void sb_outliers_add_query(int thread_id, unsigned long long start,
+                           unsigned long long ns, const char *text)
+{
+  outliers_thread_t *t;
+  int               idx;
+
+  if (!sb_outliers_enabled || thread_id < 0)
+    return;
+
+  t = &outliers_threads[thread_id];
+
+  /* Remember the slowest query to annotate the current event */
+  if (ns > t->cur_query_time)
+  {
+    t->cur_query_time = ns;
+    strncpy(t->cur_query, text, sizeof(t->cur_query) - 1);
+    t->cur_query[sizeof(t->cur_query) - 1] = '\0';
+  }
+
+  t->busy = 1;
+  outliers_barrier();
+  idx = active;
+
+  heap_insert(&t->queries[idx], start, ns, thread_id, text);
+
+  outliers_barrier();
+  t->busy = 0;
+}
+
+
+/* Account a finished event */
+
+
+void sb_outliers_event(int thread_id, unsigned long long start,
+                       unsigned long long ns)
+{
+  outliers_thread_t *t;
+  int               idx;
+
+  if (!sb_outliers_enabled || thread_id < 0)
+    return;
+
+  t = &outliers_threads[thread_id];
+
+  t->busy = 1;
+  outliers_barrier();
+  idx = active;
+
+  if (heap_accepts(&t->events[idx], ns))
+    heap_insert(&t->events[idx], start, ns, thread_id, t->cur_query);
+
+  outliers_barrier();
+  t->busy = 0;
+
+  t->cur_query_time = 0;
+  t->cur_query[0] = '\0';
+}
+
+
+/* Print entries of a heap in the descending order of duration */
+
+
+static void print_heap(outlier_heap_t *heap, const char *what)
+{
+  unsigned int i;
+
+  qsort(heap->entries, heap->n, sizeof(outlier_t), cmp_duration_desc);
+
+  log_text(LOG_NOTICE, "    slowest %s:", what);
+  for (i = 0; i < heap->n; i++)
+  {
+    outlier_t *e = heap->entries + i;
+
+    log_text(LOG_NOTICE, "        %10.2fms  thread %d  at %.4fs  %s",
+             NS2MS(e->duration), e->thread_id, NS2SEC(e->start),
+             e->text[0] != '\0' ? e->text : "-");
+  }
+
+  /* Restore the heap property broken by sorting */
+  for (i = heap->n / 2; i > 0; i--)
+    heap_sift_down(heap, i - 1);
+}
+
+
+/* Collect outliers from all threads and print them */
+
+
+void sb_outliers_print(sb_stat_t type)
+{
+  outlier_heap_t events;
+  outlier_heap_t queries;
+  unsigned int   i, j;
+  int            old;
+
+  if (!sb_outliers_enabled)
+    return;
+
+  pthread_mutex_lock(&report_mutex);
+
+  if (heap_alloc(&events) || heap_alloc(&queries))
+  {
+    free(events.entries);
+    log_text(LOG_FATAL, "Memory allocation failure");
+    pthread_mutex_unlock(&report_mutex);
+    return;
+  }
+
+  /* Switch workers to the other set of heaps */
+  old = active;
+  active = !old;
+  outliers_barrier();
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    outliers_thread_t *t = &outliers_threads[i];
+
+    /* Wait for an update that may still be using the old heaps */
+    while (t->busy)
+    {
+#ifdef HAVE_SCHED_H
+      sched_yield();
+#endif
+    }
+    outliers_barrier();
+
+    for (j = 0; j < t->events[old].n; j++)
+    {
+      outlier_t *e = t->events[old].entries + j;
+      heap_insert(&events, e->start, e->duration, e->thread_id, e->text);
+      heap_insert(&total_events, e->start, e->duration, e->thread_id,
+                  e->text);
+    }
+    for (j = 0; j < t->queries[old].n; j++)
+    {
+      outlier_t *e = t->queries[old].entries + j;
+      heap_insert(&queries, e->start, e->duration, e->thread_id, e->text);
+      heap_insert(&total_queries, e->start, e->duration, e->thread_id,
+                  e->text);
+    }
+
+    t->events[old].n = 0;
+    t->queries[old].n = 0;
+  }
+
+  if (type == SB_STAT_INTERMEDIATE)
+  {
+    log_timestamp(LOG_NOTICE, &sb_globals.exec_timer, "outliers:");
+    print_heap(&events, "events");
+    if (queries.n > 0)
+      print_heap(&queries, "queries");
+  }
+  else
+  {
+    log_text(LOG_NOTICE, "Outliers:");
+    print_heap(&total_events, "events");
+    if (total_queries.n > 0)
+      print_heap(&total_queries, "queries");
+  }
+
+  free(events.entries);
+  free(queries.entries);
+
+  pthread_mutex_unlock(&report_mutex);
+}
+
+
+/* Free per-thread heaps */
+
+
+void sb_outliers_done(void)
+{
+  unsigned int i, j;
+
+  if (outliers_threads != NULL)
+  {
+    for (i = 0; i < sb_globals.num_threads; i++)
+      for (j = 0; j < 2; j++)
+      {
+        free(outliers_threads[i].events[j].entries);
+        free(outliers_threads[i].queries[j].entries);
+      }
+    free(outliers_threads);
+    outliers_threads = NULL;
+  }
+
+  free(total_events.entries);
+  free(total_queries.entries);
+  total_events.entries = total_queries.entries = NULL;
+
+  if (sb_outliers_enabled)
+    pthread_mutex_destroy(&report_mutex);
+
+  sb_outliers_enabled = 0;
+}
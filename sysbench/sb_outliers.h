@@ -0,0 +1,68 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Capture of the slowest events and queries (latency outliers) with their
+  text, thread and start time.
+*/
+
+#ifndef SB_OUTLIERS_H
+#define SB_OUTLIERS_H
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "sysbench.h"
+
+/* Maximum length of a captured query text, including bound parameters */
+#define SB_OUTLIER_TEXT_LEN 512
+
+/* Non-zero when outlier capture is enabled for the current run */
+extern int sb_outliers_enabled;
+
+/* Register command line options */
+int sb_outliers_register(void);
+
+/* Print command line options */
+void sb_outliers_print_help(void);
+
+/* Parse options and allocate per-thread heaps */
+int sb_outliers_init(void);
+
+/*
+  Check whether a query of 'ns' nanoseconds may be an outlier, i.e. whether
+  its text should be formatted and passed to sb_outliers_add_query()
+*/
+int sb_outliers_query_wanted(int thread_id, unsigned long long ns);
+
+/* Account a slow query */
+void sb_outliers_add_query(int thread_id, unsigned long long start,
+                           unsigned long long ns, const char *text);
+
+/* Account a finished event */
+void sb_outliers_event(int thread_id, unsigned long long start,
+                       unsigned long long ns);
+
+/* Collect outliers from all threads and print them */
+void sb_outliers_print(sb_stat_t type);
+
+/* Free per-thread heaps */
+void sb_outliers_done(void);
+
+#endif /* SB_OUTLIERS_H */
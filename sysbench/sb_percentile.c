@@ -23,6 +23,7 @@
 #endif
 
 #ifdef STDC_HEADERS
+# include <stdio.h>
 # include <stdlib.h>
 #endif
 #ifdef HAVE_STRING_H
@@ -61,17 +62,21 @@ int sb_percentile_init(sb_percentile_t *percentile,
   return 0;
 }
 
-void sb_percentile_update(sb_percentile_t *percentile, double value)
+static unsigned int percentile_bucket(sb_percentile_t *percentile,
+                                      double value)
 {
-  unsigned int n;
-
   if (value < percentile->range_min)
     value= percentile->range_min;
   else if (value > percentile->range_max)
     value= percentile->range_max;
 
-  n = floor((log(value) - percentile->range_deduct) * percentile->range_mult
-            + 0.5);
+  return floor((log(value) - percentile->range_deduct) *
+               percentile->range_mult + 0.5);
+}
+
+void sb_percentile_update(sb_percentile_t *percentile, double value)
+{
+  unsigned int n = percentile_bucket(percentile, value);
 
   pthread_mutex_lock(&percentile->mutex);
   percentile->total++;
@@ -109,6 +114,28 @@ double sb_percentile_calculate(sb_percentile_t *percentile, double percent)
   return exp((i) / percentile->range_mult + percentile->range_deduct);
 }
 
+void sb_percentile_merge(sb_percentile_t *dst, sb_percentile_t *src)
+{
+  unsigned int i;
+
+  pthread_mutex_lock(&src->mutex);
+  memcpy(src->tmp, src->values, src->size * sizeof(unsigned long long));
+  pthread_mutex_unlock(&src->mutex);
+
+  pthread_mutex_lock(&dst->mutex);
+  for (i = 0; i < dst->size && i < src->size; i++)
+  {
+    dst->values[i] += src->tmp[i];
+    dst->total += src->tmp[i];
+  }
+  pthread_mutex_unlock(&dst->mutex);
+}
+
+double sb_percentile_bucket_value(sb_percentile_t *percentile, unsigned int n)
+{
+  return exp(n / percentile->range_mult + percentile->range_deduct);
+}
+
 void sb_percentile_reset(sb_percentile_t *percentile)
 {
   pthread_mutex_lock(&percentile->mutex);
@@ -123,3 +150,261 @@ void sb_percentile_done(sb_percentile_t *percentile)
   free(percentile->values);
   free(percentile->tmp);
 }
+
+int sb_percentile_local_init(sb_percentile_local_t *local,
+                             sb_percentile_t *percentile)
+{
+  local->values = (unsigned long long *)
+    calloc(percentile->size, sizeof(unsigned long long));
+  if (local->values == NULL)
+  {
+    log_text(LOG_FATAL, "Cannot allocate values array, size = %u",
+             percentile->size);
+    return 1;
+  }
+
+  local->lo = percentile->size;
+  local->hi = 0;
+
+  return 0;
+}
+
+void sb_percentile_local_update(sb_percentile_local_t *local,
+                                sb_percentile_t *percentile, double value)
+{
+  unsigned int n = percentile_bucket(percentile, value);
+
+  local->values[n]++;
+  if (n < local->lo)
+    local->lo = n;
+  if (n >= local->hi)
+    local->hi = n + 1;
+}
+
+void sb_percentile_local_merge(sb_percentile_t *dst,
+                               sb_percentile_local_t *local, int reset)
+{
+  unsigned int i;
+  unsigned int lo = local->lo;
+  unsigned int hi = local->hi;
+
+  if (hi > dst->size)
+    hi = dst->size;
+
+  pthread_mutex_lock(&dst->mutex);
+  for (i = lo; i < hi; i++)
+  {
+    dst->values[i] += local->values[i];
+    dst->total += local->values[i];
+  }
+  pthread_mutex_unlock(&dst->mutex);
+
+  if (reset && lo < hi)
+  {
+    memset(local->values + lo, 0, (hi - lo) * sizeof(unsigned long long));
+    local->lo = dst->size;
+    local->hi = 0;
+  }
+}
+
+void sb_percentile_local_done(sb_percentile_local_t *local)
+{
+  free(local->values);
+  local->values = NULL;
+}
+
+int sb_percentile_windows_init(sb_percentile_windows_t *w,
+                               sb_percentile_t *percentile,
+                               const unsigned int *seconds,
+                               unsigned int nwindows, unsigned int interval)
+{
+  unsigned int i;
+
+  memset(w, 0, sizeof(sb_percentile_windows_t));
+
+  if (nwindows == 0 || interval == 0)
+    return 0;
+
+  if (nwindows > SB_PERCENTILE_MAX_WINDOWS)
+    nwindows = SB_PERCENTILE_MAX_WINDOWS;
+
+  w->size = percentile->size;
+  w->range_deduct = percentile->range_deduct;
+  w->range_mult = percentile->range_mult;
+
+  w->tmp = (unsigned long long *) calloc(w->size, sizeof(unsigned long long));
+  if (w->tmp == NULL)
+    goto error;
+
+  for (i = 0; i < nwindows; i++)
+  {
+    w->seconds[i] = seconds[i];
+    w->length[i] = (seconds[i] + interval - 1) / interval;
+    if (w->length[i] == 0)
+      w->length[i] = 1;
+    if (w->length[i] > w->ring_size)
+      w->ring_size = w->length[i];
+
+    w->sums[i] = (unsigned long long *)
+      calloc(w->size, sizeof(unsigned long long));
+    if (w->sums[i] == NULL)
+      goto error;
+    w->nwindows++;
+  }
+
+  w->ring = (sb_percentile_slot_t *)
+    calloc(w->ring_size, sizeof(sb_percentile_slot_t));
+  if (w->ring == NULL)
+    goto error;
+
+  return 0;
+
+ error:
+  log_text(LOG_FATAL, "Cannot allocate sliding window histograms");
+  sb_percentile_windows_done(w);
+
+  return 1;
+}
+
+static void slot_apply(sb_percentile_windows_t *w, unsigned int n,
+                       sb_percentile_slot_t *slot, int add)
+{
+  unsigned int i;
+
+  for (i = 0; i < slot->n; i++)
+  {
+    if (add)
+    {
+      w->sums[n][slot->idx[i]] += slot->cnt[i];
+      w->totals[n] += slot->cnt[i];
+    }
+    else
+    {
+      w->sums[n][slot->idx[i]] -= slot->cnt[i];
+      w->totals[n] -= slot->cnt[i];
+    }
+  }
+}
+
+void sb_percentile_windows_update(sb_percentile_windows_t *w,
+                                  sb_percentile_t *percentile)
+{
+  sb_percentile_slot_t *slot;
+  unsigned int         i, n;
+
+  if (w->nwindows == 0)
+    return;
+
+  pthread_mutex_lock(&percentile->mutex);
+  memcpy(w->tmp, percentile->values, w->size * sizeof(unsigned long long));
+  pthread_mutex_unlock(&percentile->mutex);
+
+  /* Remove intervals that fall out of each window */
+  for (i = 0; i < w->nwindows; i++)
+    if (w->nintervals >= w->length[i])
+      slot_apply(w, i, &w->ring[(w->nintervals - w->length[i]) % w->ring_size],
+                 0);
+
+  /* Store the new interval in sparse form */
+  slot = &w->ring[w->nintervals % w->ring_size];
+
+  for (i = 0, n = 0; i < w->size; i++)
+    if (w->tmp[i] > 0)
+      n++;
+
+  if (n > slot->size)
+  {
+    unsigned int       *idx;
+    unsigned long long *cnt;
+
+    idx = (unsigned int *) realloc(slot->idx, n * sizeof(unsigned int));
+    if (idx != NULL)
+      slot->idx = idx;
+    cnt = (unsigned long long *) realloc(slot->cnt,
+                                         n * sizeof(unsigned long long));
+    if (cnt != NULL)
+      slot->cnt = cnt;
+    if (idx == NULL || cnt == NULL)
+    {
+      /* Keep the ring consistent by storing an empty interval */
+      slot->n = 0;
+      w->nintervals++;
+      return;
+    }
+    slot->size = n;
+  }
+
+  for (i = 0, slot->n = 0; i < w->size; i++)
+    if (w->tmp[i] > 0)
+    {
+      slot->idx[slot->n] = i;
+      slot->cnt[slot->n] = w->tmp[i];
+      slot->n++;
+    }
+
+  for (i = 0; i < w->nwindows; i++)
+    slot_apply(w, i, slot, 1);
+
+  w->nintervals++;
+}
+
+double sb_percentile_windows_calculate(sb_percentile_windows_t *w,
+                                       unsigned int n, double percent)
+{
+  unsigned long long ncur, nmax;
+  unsigned int       i;
+
+  if (n >= w->nwindows || w->totals[n] == 0)
+    return 0.0;
+
+  nmax = floor(w->totals[n] * percent / 100 + 0.5);
+
+  ncur = w->sums[n][0];
+  for (i = 1; i < w->size; i++)
+  {
+    ncur += w->sums[n][i];
+    if (ncur >= nmax)
+      break;
+  }
+
+  return exp((i) / w->range_mult + w->range_deduct);
+}
+
+void sb_percentile_windows_format(sb_percentile_windows_t *w, double percent,
+                                  int precision, char *buf, size_t size)
+{
+  unsigned int i;
+  size_t       len = 0;
+
+  if (size == 0)
+    return;
+  buf[0] = '\0';
+
+  for (i = 0; i < w->nwindows && len < size; i++)
+    len += snprintf(buf + len, size - len, "%s%us: %.*fms",
+                    i == 0 ? " [" : ", ", w->seconds[i], precision,
+                    NS2MS(sb_percentile_windows_calculate(w, i, percent)));
+
+  if (w->nwindows > 0 && len < size)
+    snprintf(buf + len, size - len, "]");
+}
+
+void sb_percentile_windows_done(sb_percentile_windows_t *w)
+{
+  unsigned int i;
+
+  for (i = 0; i < w->nwindows; i++)
+    free(w->sums[i]);
+
+  if (w->ring != NULL)
+    for (i = 0; i < w->ring_size; i++)
+    {
+      free(w->ring[i].idx);
+      free(w->ring[i].cnt);
+    }
+
+  free(w->ring);
+  free(w->tmp);
+
+  memset(w, 0, sizeof(sb_percentile_windows_t));
+}
@@ -18,6 +18,9 @@
 #ifndef SB_PERCENTILE_H
 #define SB_PERCENTILE_H
 
+#ifdef STDC_HEADERS
+# include <stddef.h>
+#endif
 #ifdef HAVE_PTHREAD_H
 # include <pthread.h>
 #endif
@@ -34,6 +37,53 @@ typedef struct {
   pthread_mutex_t     mutex;
 } sb_percentile_t;
 
+/*
+  Histogram updated by a single thread without locking, using the geometry
+  of a shared histogram. Buckets are allocated with calloc() and only the
+  touched range is merged and cleared, so pages that are never touched are
+  not backed by memory.
+*/
+
+typedef struct {
+  unsigned long long  *values;
+  unsigned int        lo;       /* lowest touched bucket */
+  unsigned int        hi;       /* highest touched bucket + 1, 0 if empty */
+} sb_percentile_local_t;
+
+/* Maximum number of sliding windows */
+#define SB_PERCENTILE_MAX_WINDOWS 8
+
+/* Non-zero buckets of a single interval histogram */
+
+typedef struct {
+  unsigned int        *idx;
+  unsigned long long  *cnt;
+  unsigned int        n;
+  unsigned int        size;
+} sb_percentile_slot_t;
+
+/*
+  Sliding windows over a sequence of interval histograms. Each interval is
+  kept in a ring in sparse form, and each window keeps running sums which are
+  updated once per interval, so workers only ever update the interval
+  histogram.
+*/
+
+typedef struct {
+  unsigned int          nwindows;
+  unsigned int          seconds[SB_PERCENTILE_MAX_WINDOWS];
+  unsigned int          length[SB_PERCENTILE_MAX_WINDOWS]; /* in intervals */
+  unsigned long long    *sums[SB_PERCENTILE_MAX_WINDOWS];
+  unsigned long long    totals[SB_PERCENTILE_MAX_WINDOWS];
+  sb_percentile_slot_t  *ring;
+  unsigned int          ring_size;
+  unsigned long long    nintervals;
+  unsigned long long    *tmp;
+  unsigned int          size;
+  double                range_deduct;
+  double                range_mult;
+} sb_percentile_windows_t;
+
 int sb_percentile_init(sb_percentile_t *percentile,
                        unsigned int size, double range_min, double range_max);
 
@@ -41,8 +91,60 @@ void sb_percentile_update(sb_percentile_t *percentile, double value);
 
 double sb_percentile_calculate(sb_percentile_t *percentile, double percent);
 
+/* Add values from 'src' to 'dst', both must have the same geometry */
+void sb_percentile_merge(sb_percentile_t *dst, sb_percentile_t *src);
+
+/* Value corresponding to the n-th histogram bucket */
+double sb_percentile_bucket_value(sb_percentile_t *percentile, unsigned int n);
+
 void sb_percentile_reset(sb_percentile_t *percentile);
 
 void sb_percentile_done(sb_percentile_t *percentile);
 
+/* Initialize a thread-local histogram with the geometry of 'percentile' */
+int sb_percentile_local_init(sb_percentile_local_t *local,
+                             sb_percentile_t *percentile);
+
+/* Add a value to a thread-local histogram, 'percentile' is only read */
+void sb_percentile_local_update(sb_percentile_local_t *local,
+                                sb_percentile_t *percentile, double value);
+
+/*
+  Add values from a thread-local histogram to 'dst'. If 'reset' is non-zero
+  the local histogram is cleared, which requires that its thread is not
+  updating it.
+*/
+void sb_percentile_local_merge(sb_percentile_t *dst,
+                               sb_percentile_local_t *local, int reset);
+
+void sb_percentile_local_done(sb_percentile_local_t *local);
+
+/*
+  Initialize sliding windows of the specified lengths in seconds for interval
+  histograms with the same geometry as 'percentile', collected every
+  'interval' seconds.
+*/
+int sb_percentile_windows_init(sb_percentile_windows_t *w,
+                               sb_percentile_t *percentile,
+                               const unsigned int *seconds,
+                               unsigned int nwindows, unsigned int interval);
+
+/* Add the current contents of an interval histogram to the windows */
+void sb_percentile_windows_update(sb_percentile_windows_t *w,
+                                  sb_percentile_t *percentile);
+
+/* Calculate a percentile over the n-th window */
+double sb_percentile_windows_calculate(sb_percentile_windows_t *w,
+                                       unsigned int n, double percent);
+
+/*
+  Format percentiles over all windows as " [10s: 1.23ms, 60s: 1.45ms]"
+  with the given number of decimal places, or as an empty string when no
+  windows are defined.
+*/
+void sb_percentile_windows_format(sb_percentile_windows_t *w, double percent,
+                                  int precision, char *buf, size_t size);
+
+void sb_percentile_windows_done(sb_percentile_windows_t *w);
+
 #endif
@@ -0,0 +1,522 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Every worker thread opens a perf_event group counting only itself. In
+  'event' mode the thread reads the group before and after each event and
+  accumulates the difference, so harness overhead is excluded. In 'interval'
+  mode counters are only read by the reporting side, which adds no overhead
+  to workers. Counter file descriptors stay readable after a thread exits,
+  so they are only closed in sb_perf_done().
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#ifdef _WIN32
+# include "sb_win.h"
+#endif
+
+#ifdef STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_ERRNO_H
+# include <errno.h>
+#endif
+#ifdef HAVE_LINUX_PERF_EVENT_H
+# include <linux/perf_event.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+
+#include "sysbench.h"
+#include "sb_perf.h"
+#include "sb_metrics.h"
+
+#if defined(HAVE_LINUX_PERF_EVENT_H) && defined(__NR_perf_event_open)
+# define SB_HAVE_PERF 1
+#endif
+
+/* Maximum number of counters in a group */
+#define PERF_MAX_COUNTERS 8
+
+/* Perf options */
+
+static sb_arg_t perf_args[] =
+{
+  {"perf-counters", "collect per-thread performance counters (cycles, "
+   "instructions, LLC misses, branch misses, context switches) "
+   "{off,event,interval}. 'event' reads counters around each event and "
+   "excludes sysbench overhead, 'interval' only reads them for reports. "
+   "Software events are used when hardware counters are not available",
+   SB_ARG_TYPE_STRING, "off"},
+  {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
+};
+
+sb_perf_mode_t sb_perf_mode;
+
+#ifdef SB_HAVE_PERF
+
+/* Counter definition */
+
+typedef struct
+{
+  const char         *name;
+  unsigned int       type;
+  unsigned long long config;
+} perf_counter_def_t;
+
+/* The first counter in each set is the group leader */
+
+static perf_counter_def_t hw_counters[] =
+{
+  {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {"LLC-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+  {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+  {NULL, 0, 0}
+};
+
+static perf_counter_def_t sw_counters[] =
+{
+  {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+  {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+  {"cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+  {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+  {NULL, 0, 0}
+};
+
+/* Per-thread state */
+
+typedef struct
+{
+  int                fds[PERF_MAX_COUNTERS];  /* -1 if not opened */
+  int                pos[PERF_MAX_COUNTERS];  /* position in a group read */
+  unsigned int       nopen;                   /* number of opened counters */
+  unsigned long long start[PERF_MAX_COUNTERS];
+  unsigned long long totals[PERF_MAX_COUNTERS];
+  char               pad[64];                 /* avoid false sharing */
+} perf_thread_t;
+
+/* Group read buffer, see PERF_FORMAT_GROUP in perf_event_open(2) */
+
+typedef struct
+{
+  unsigned long long nr;
+  unsigned long long time_enabled;
+  unsigned long long time_running;
+  unsigned long long values[PERF_MAX_COUNTERS];
+} perf_read_t;
+
+static perf_counter_def_t *counters;
+static unsigned int       ncounters;
+static int                exclude_kernel;
+static perf_thread_t      *perf_threads;
+static int                multiplexed;
+
+/* Values at the time of the previous intermediate report */
+static unsigned long long prev_values[PERF_MAX_COUNTERS];
+static unsigned long long prev_events;
+
+
+static int perf_open(perf_counter_def_t *def, int group_fd)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = def->type;
+  attr.config = def->config;
+  attr.exclude_kernel = exclude_kernel;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+    PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  return (int) syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+
+/* Check whether a counter set can be used by opening its group leader */
+
+
+static int perf_probe(perf_counter_def_t *set)
+{
+  int fd;
+
+  exclude_kernel = 0;
+  fd = perf_open(set, -1);
+  if (fd < 0 && (errno == EACCES || errno == EPERM))
+  {
+    /* Unprivileged users may only count user space events */
+    exclude_kernel = 1;
+    fd = perf_open(set, -1);
+  }
+
+  if (fd < 0)
+    return 1;
+
+  close(fd);
+
+  return 0;
+}
+
+
+/* Read a counter group, optionally scaling values for multiplexing */
+
+
+static int perf_read(perf_thread_t *t, unsigned long long *values, int scale)
+{
+  perf_read_t  buf;
+  unsigned int i;
+  double       ratio = 1;
+
+  if (t->nopen == 0)
+    return 1;
+
+  if (read(t->fds[0], &buf, sizeof(buf)) <
+      (ssize_t) (3 + t->nopen) * (ssize_t) sizeof(unsigned long long))
+    return 1;
+
+  if (buf.time_running > 0 && buf.time_running < buf.time_enabled)
+  {
+    multiplexed = 1;
+    if (scale)
+      ratio = (double) buf.time_enabled / buf.time_running;
+  }
+
+  for (i = 0; i < ncounters; i++)
+    values[i] = t->pos[i] >= 0 ?
+      (unsigned long long) (buf.values[t->pos[i]] * ratio) : 0;
+
+  return 0;
+}
+
+#endif /* SB_HAVE_PERF */
+
+
+/* Register command line options */
+
+
+int sb_perf_register(void)
+{
+  return sb_register_arg_set(perf_args);
+}
+
+
+/* Print command line options */
+
+
+void sb_perf_print_help(void)
+{
+  printf("Performance counters options:\n");
+  sb_print_options(perf_args);
+}
+
+
+/* Parse options and check that counters are available */
+
+
+int sb_perf_init(void)
+{
+  char *mode = sb_get_value_string("perf-counters");
+
+  if (!strcmp(mode, "off"))
+    sb_perf_mode = SB_PERF_OFF;
+  else if (!strcmp(mode, "event"))
+    sb_perf_mode = SB_PERF_EVENT;
+  else if (!strcmp(mode, "interval"))
+    sb_perf_mode = SB_PERF_INTERVAL;
+  else
+  {
+    log_text(LOG_FATAL, "Invalid value for --perf-counters: '%s'", mode);
+    return 1;
+  }
+
+  if (sb_perf_mode == SB_PERF_OFF || sb_globals.command != SB_COMMAND_RUN)
+  {
+    sb_perf_mode = SB_PERF_OFF;
+    return 0;
+  }
+
+#ifdef SB_HAVE_PERF
+  {
+    unsigned int i, j;
+
+    if (perf_probe(hw_counters) == 0)
+      counters = hw_counters;
+    else
+    {
+      log_text(LOG_WARNING, "Hardware performance counters are not "
+               "available (%s), using software events", strerror(errno));
+      if (perf_probe(sw_counters))
+      {
+        log_errno(LOG_FATAL, "perf_event_open() failed, check "
+                  "/proc/sys/kernel/perf_event_paranoid");
+        sb_perf_mode = SB_PERF_OFF;
+        return 1;
+      }
+      counters = sw_counters;
+    }
+
+    for (ncounters = 0; counters[ncounters].name != NULL; ncounters++)
+      /* nothing */ ;
+
+    perf_threads = (perf_thread_t *) calloc(sb_globals.num_threads,
+                                            sizeof(perf_thread_t));
+    if (perf_threads == NULL)
+    {
+      log_text(LOG_FATAL, "Memory allocation failure");
+      sb_perf_mode = SB_PERF_OFF;
+      return 1;
+    }
+
+    for (i = 0; i < sb_globals.num_threads; i++)
+      for (j = 0; j < PERF_MAX_COUNTERS; j++)
+      {
+        perf_threads[i].fds[j] = -1;
+        perf_threads[i].pos[j] = -1;
+      }
+  }
+
+  return 0;
+#else
+  log_text(LOG_FATAL, "--perf-counters is not supported on this platform");
+  sb_perf_mode = SB_PERF_OFF;
+
+  return 1;
+#endif
+}
+
+
+/* Open counters for the calling worker thread */
+
+
+void sb_perf_thread_start(int thread_id)
+{
+#ifdef SB_HAVE_PERF
+  perf_thread_t *t = &perf_threads[thread_id];
+  unsigned int  i;
+  int           fd;
+
+  for (i = 0; i < ncounters; i++)
+  {
+    fd = perf_open(counters + i, i == 0 ? -1 : t->fds[0]);
+    if (fd < 0)
+    {
+      /* Without the leader there is no group */
+      if (i == 0)
+      {
+        log_errno(LOG_WARNING, "perf_event_open() failed for thread %d",
+                  thread_id);
+        return;
+      }
+      log_text(LOG_DEBUG, "Counter '%s' is not available for thread %d",
+               counters[i].name, thread_id);
+      continue;
+    }
+    t->fds[i] = fd;
+    t->pos[i] = (int) t->nopen++;
+  }
+#else
+  (void) thread_id; /* unused */
+#endif
+}
+
+
+/* Called by a worker thread before executing a request */
+
+
+void sb_perf_event_start(int thread_id)
+{
+#ifdef SB_HAVE_PERF
+  perf_thread_t *t = &perf_threads[thread_id];
+
+  if (perf_read(t, t->start, 0))
+    t->nopen = 0;
+#else
+  (void) thread_id; /* unused */
+#endif
+}
+
+
+/* Called by a worker thread after executing a request */
+
+
+void sb_perf_event_stop(int thread_id)
+{
+#ifdef SB_HAVE_PERF
+  perf_thread_t      *t = &perf_threads[thread_id];
+  unsigned long long values[PERF_MAX_COUNTERS];
+  unsigned int       i;
+
+  if (perf_read(t, values, 0))
+    return;
+
+  for (i = 0; i < ncounters; i++)
+    t->totals[i] += values[i] - t->start[i];
+#else
+  (void) thread_id; /* unused */
+#endif
+}
+
+
+#ifdef SB_HAVE_PERF
+
+/* Sum counter values over all threads */
+
+
+static void perf_collect(unsigned long long *values)
+{
+  unsigned long long tmp[PERF_MAX_COUNTERS];
+  unsigned int       i, j;
+
+  memset(values, 0, ncounters * sizeof(unsigned long long));
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    perf_thread_t *t = &perf_threads[i];
+
+    if (sb_perf_mode == SB_PERF_EVENT)
+    {
+      for (j = 0; j < ncounters; j++)
+        values[j] += t->totals[j];
+    }
+    else if (!perf_read(t, tmp, 1))
+    {
+      for (j = 0; j < ncounters; j++)
+        values[j] += tmp[j];
+    }
+  }
+}
+
+
+/* Find a counter by name */
+
+
+static int perf_find(const char *name)
+{
+  unsigned int i;
+
+  for (i = 0; i < ncounters; i++)
+    if (!strcmp(counters[i].name, name))
+      return (int) i;
+
+  return -1;
+}
+
+#endif /* SB_HAVE_PERF */
+
+
+/* Print counters, per interval or for the whole test */
+
+
+void sb_perf_print(sb_stat_t type)
+{
+#ifdef SB_HAVE_PERF
+  unsigned long long values[PERF_MAX_COUNTERS];
+  unsigned long long events;
+  unsigned long long tmp;
+  unsigned int       i;
+  int                cycles;
+  int                instructions;
+  char               buf[512];
+  int                len;
+
+  if (sb_perf_mode == SB_PERF_OFF)
+    return;
+
+  perf_collect(values);
+  events = sb_metrics_total_events();
+
+  cycles = perf_find("cycles");
+  instructions = perf_find("instructions");
+
+  if (type == SB_STAT_INTERMEDIATE)
+  {
+    for (i = 0; i < ncounters; i++)
+    {
+      tmp = values[i];
+      values[i] -= prev_values[i];
+      prev_values[i] = tmp;
+    }
+    tmp = events;
+    events -= prev_events;
+    prev_events = tmp;
+
+    len = 0;
+    if (cycles >= 0 && instructions >= 0 && values[cycles] > 0)
+      len += snprintf(buf + len, sizeof(buf) - len, " IPC: %.2f,",
+                      (double) values[instructions] / values[cycles]);
+    for (i = 0; i < ncounters && len < (int) sizeof(buf); i++)
+      len += snprintf(buf + len, sizeof(buf) - len, " %s/event: %.2f%s",
+                      counters[i].name,
+                      events > 0 ? (double) values[i] / events : 0,
+                      i + 1 < ncounters ? "," : "");
+
+    log_timestamp(LOG_NOTICE, &sb_globals.exec_timer, "perf:%s", buf);
+
+    return;
+  }
+
+  log_text(LOG_NOTICE, "Performance counters (%s events, %s%s):",
+           counters == hw_counters ? "hardware" : "software",
+           sb_perf_mode == SB_PERF_EVENT ? "within events" : "whole threads",
+           !multiplexed ? "" : sb_perf_mode == SB_PERF_INTERVAL ?
+           ", multiplexed and scaled" : ", multiplexed");
+  log_text(LOG_NOTICE, "    %-20s %18s %14s", "counter", "total", "per event");
+  if (cycles >= 0 && instructions >= 0 && values[cycles] > 0)
+    log_text(LOG_NOTICE, "    %-20s %18.2f", "IPC",
+             (double) values[instructions] / values[cycles]);
+  for (i = 0; i < ncounters; i++)
+    log_text(LOG_NOTICE, "    %-20s %18llu %14.2f%s", counters[i].name,
+             values[i], events > 0 ? (double) values[i] / events : 0,
+             i + 1 < ncounters ? "" : "\n");
+#else
+  (void) type; /* unused */
+#endif
+}
+
+
+/* Close counters and free per-thread state */
+
+
+void sb_perf_done(void)
+{
+#ifdef SB_HAVE_PERF
+  unsigned int i, j;
+
+  if (perf_threads != NULL)
+  {
+    for (i = 0; i < sb_globals.num_threads; i++)
+      for (j = 0; j < PERF_MAX_COUNTERS; j++)
+        if (perf_threads[i].fds[j] >= 0)
+          close(perf_threads[i].fds[j]);
+    free(perf_threads);
+    perf_threads = NULL;
+  }
+#endif
+
+  sb_perf_mode = SB_PERF_OFF;
+}
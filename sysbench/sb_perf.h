@@ -0,0 +1,67 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Per-thread hardware (or software, as a fallback) performance counters
+  collected with perf_event_open().
+*/
+
+#ifndef SB_PERF_H
+#define SB_PERF_H
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "sysbench.h"
+
+/* Counter collection modes */
+
+typedef enum
+{
+  SB_PERF_OFF,
+  SB_PERF_EVENT,     /* read counters around each event */
+  SB_PERF_INTERVAL   /* read counters at report intervals only */
+} sb_perf_mode_t;
+
+/* Current collection mode */
+extern sb_perf_mode_t sb_perf_mode;
+
+/* Register command line options */
+int sb_perf_register(void);
+
+/* Print command line options */
+void sb_perf_print_help(void);
+
+/* Parse options and check that counters are available */
+int sb_perf_init(void);
+
+/* Open counters for the calling worker thread */
+void sb_perf_thread_start(int thread_id);
+
+/* Called by a worker thread around request execution in event mode */
+void sb_perf_event_start(int thread_id);
+void sb_perf_event_stop(int thread_id);
+
+/* Print counters, per interval or for the whole test */
+void sb_perf_print(sb_stat_t type);
+
+/* Close counters and free per-thread state */
+void sb_perf_done(void);
+
+#endif /* SB_PERF_H */
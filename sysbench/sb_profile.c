@@ -0,0 +1,355 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Time is accounted exclusively: on every section change the time elapsed
+  since the previous change is charged to the innermost active section. So
+  driver calls made from a Lua event() are charged to the driver, and the
+  rest of event() to the event section. Outside sections only CPU time is
+  charged (to "other"), wall clock time there is mostly spent waiting for
+  events and is reported separately. All counters are per-thread and only
+  read after worker threads have finished.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#ifdef _WIN32
+# include "sb_win.h"
+#endif
+
+#ifdef STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+#endif
+
+#include "sysbench.h"
+#include "sb_profile.h"
+
+/* Maximum depth of nested sections */
+#define PROFILE_MAX_DEPTH 8
+
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_THREAD_CPUTIME_ID)
+# define SB_GETCPUTIME(tsp) clock_gettime(CLOCK_THREAD_CPUTIME_ID, tsp)
+# define HAVE_THREAD_CPUTIME 1
+#else
+# define SB_GETCPUTIME(tsp) memset(tsp, 0, sizeof(struct timespec))
+#endif
+
+/* Per-thread counters */
+
+typedef struct
+{
+  unsigned long long wall[SB_PROF_MAX];   /* wall clock time per section */
+  unsigned long long cpu[SB_PROF_MAX];    /* CPU time per section */
+  unsigned long long calls[SB_PROF_MAX];  /* number of section entries */
+  unsigned long long idle;                /* wall clock time outside sections */
+  sb_prof_section_t  stack[PROFILE_MAX_DEPTH];
+  unsigned int       depth;
+  struct timespec    wall_mark;           /* time of the last change */
+  struct timespec    cpu_mark;
+  int                started;             /* between start and stop */
+  char               pad[64];             /* avoid false sharing */
+} profile_thread_t;
+
+/* Profiling options */
+
+static sb_arg_t profile_args[] =
+{
+  {"profile", "measure wall clock and CPU time spent by sysbench itself in "
+   "request generation, test/script code, database driver calls and "
+   "statistics, and print the breakdown at the end of the test",
+   SB_ARG_TYPE_FLAG, "off"},
+  {"profile-cpu-threshold", "with --profile, warn when worker threads "
+   "spend more than the specified percentage of wall clock time on CPU "
+   "outside driver calls", SB_ARG_TYPE_INT, "80"},
+  {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
+};
+
+int sb_profile_enabled;
+
+static profile_thread_t *profile_threads;
+static unsigned int     cpu_threshold;
+
+static const char *section_names[SB_PROF_MAX] =
+{
+  "get_request", "event", "driver", "stats", "other"
+};
+
+
+/* Register command line options */
+
+
+int sb_profile_register(void)
+{
+  return sb_register_arg_set(profile_args);
+}
+
+
+/* Print command line options */
+
+
+void sb_profile_print_help(void)
+{
+  printf("Profiling options:\n");
+  sb_print_options(profile_args);
+}
+
+
+/* Parse options and allocate per-thread counters */
+
+
+int sb_profile_init(void)
+{
+  int threshold;
+
+  if (!sb_get_value_flag("profile") || sb_globals.command != SB_COMMAND_RUN)
+    return 0;
+
+  threshold = sb_get_value_int("profile-cpu-threshold");
+  if (threshold < 0 || threshold > 100)
+  {
+    log_text(LOG_FATAL, "Invalid value for --profile-cpu-threshold: %d",
+             threshold);
+    return 1;
+  }
+  cpu_threshold = (unsigned int) threshold;
+
+  profile_threads = (profile_thread_t *)
+    calloc(sb_globals.num_threads, sizeof(profile_thread_t));
+  if (profile_threads == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure");
+    return 1;
+  }
+
+#ifndef HAVE_THREAD_CPUTIME
+  log_text(LOG_WARNING, "Per-thread CPU time is not supported on this "
+           "platform, only wall clock time will be profiled");
+#endif
+
+  sb_profile_enabled = 1;
+
+  return 0;
+}
+
+
+/* Charge time elapsed since the last change to the current section */
+
+
+static void profile_charge(profile_thread_t *t)
+{
+  struct timespec   wall;
+  struct timespec   cpu;
+  sb_prof_section_t section;
+
+  SB_GETTIME(&wall);
+  SB_GETCPUTIME(&cpu);
+
+  if (t->depth == 0)
+    section = SB_PROF_OTHER;
+  else if (t->depth <= PROFILE_MAX_DEPTH)
+    section = t->stack[t->depth - 1];
+  else
+    section = t->stack[PROFILE_MAX_DEPTH - 1];
+
+  /* Only time between an explicit enter and exit belongs to a section */
+  if (t->depth == 0)
+    t->idle += TIMESPEC_DIFF(wall, t->wall_mark);
+  else
+    t->wall[section] += TIMESPEC_DIFF(wall, t->wall_mark);
+  t->cpu[section] += TIMESPEC_DIFF(cpu, t->cpu_mark);
+
+  t->wall_mark = wall;
+  t->cpu_mark = cpu;
+}
+
+
+/* Start accounting for a worker thread */
+
+
+void sb_profile_thread_start(int thread_id)
+{
+  profile_thread_t *t = &profile_threads[thread_id];
+
+  t->depth = 0;
+  SB_GETTIME(&t->wall_mark);
+  SB_GETCPUTIME(&t->cpu_mark);
+  t->started = 1;
+}
+
+
+/* Stop accounting for a worker thread */
+
+
+void sb_profile_thread_stop(int thread_id)
+{
+  profile_thread_t *t = &profile_threads[thread_id];
+
+  if (!t->started)
+    return;
+
+  profile_charge(t);
+  t->started = 0;
+}
+
+
+/* Enter a section */
+
+
+void sb_profile_enter(int thread_id, sb_prof_section_t section)
+{
+  profile_thread_t *t;
+
+  if (thread_id < 0)
+    return;
+
+  t = &profile_threads[thread_id];
+
+  /* Not accounted outside events, e.g. in thread_init() or thread_done() */
+  if (!t->started)
+    return;
+
+  profile_charge(t);
+
+  if (t->depth < PROFILE_MAX_DEPTH)
+    t->stack[t->depth] = section;
+  t->depth++;
+  t->calls[section]++;
+}
+
+
+/* Leave the current section */
+
+
+void sb_profile_exit(int thread_id)
+{
+  profile_thread_t *t;
+
+  if (thread_id < 0)
+    return;
+
+  t = &profile_threads[thread_id];
+
+  if (!t->started)
+    return;
+
+  profile_charge(t);
+
+  if (t->depth > 0)
+    t->depth--;
+}
+
+
+/* Print the time breakdown */
+
+
+void sb_profile_print_stats(void)
+{
+  unsigned long long wall[SB_PROF_MAX];
+  unsigned long long cpu[SB_PROF_MAX];
+  unsigned long long calls[SB_PROF_MAX];
+  unsigned long long wall_total = 0;
+  unsigned long long cpu_total = 0;
+  unsigned long long idle = 0;
+  unsigned long long offcpu = 0;
+  double             cpu_share;
+  unsigned int       i, j;
+
+  if (!sb_profile_enabled)
+    return;
+
+  memset(wall, 0, sizeof(wall));
+  memset(cpu, 0, sizeof(cpu));
+  memset(calls, 0, sizeof(calls));
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    for (j = 0; j < SB_PROF_MAX; j++)
+    {
+      wall[j] += profile_threads[i].wall[j];
+      cpu[j] += profile_threads[i].cpu[j];
+      calls[j] += profile_threads[i].calls[j];
+    }
+    idle += profile_threads[i].idle;
+  }
+
+  for (j = 0; j < SB_PROF_MAX; j++)
+  {
+    wall_total += wall[j];
+    cpu_total += cpu[j];
+
+    /*
+      Sections other than the driver do not block, so the time they are off
+      CPU is spent preempted by the scheduler or on page faults
+    */
+    if (j != SB_PROF_DRIVER && j != SB_PROF_OTHER && wall[j] > cpu[j])
+      offcpu += wall[j] - cpu[j];
+  }
+
+  if (wall_total + idle == 0)
+    return;
+
+  log_text(LOG_NOTICE, "Client time breakdown (all threads):");
+  log_text(LOG_NOTICE, "    %-12s %12s %7s %12s %7s %12s", "section",
+           "wall", "%wall", "CPU", "%CPU", "calls");
+  for (j = 0; j < SB_PROF_OTHER; j++)
+    log_text(LOG_NOTICE, "    %-12s %11.4fs %6.2f%% %11.4fs %6.2f%% %12llu",
+             section_names[j], NS2SEC(wall[j]),
+             wall_total > 0 ? wall[j] * 100.0 / wall_total : 0,
+             NS2SEC(cpu[j]), cpu_total > 0 ? cpu[j] * 100.0 / cpu_total : 0,
+             calls[j]);
+  log_text(LOG_NOTICE, "    %-12s %12s %7s %11.4fs %6.2f%%",
+           section_names[SB_PROF_OTHER], "-", "", NS2SEC(cpu[SB_PROF_OTHER]),
+           cpu_total > 0 ? cpu[SB_PROF_OTHER] * 100.0 / cpu_total : 0);
+  log_text(LOG_NOTICE, "    %-12s %11.4fs %7s %11.4fs",
+           "total", NS2SEC(wall_total), "", NS2SEC(cpu_total));
+
+  log_text(LOG_NOTICE, "    off-CPU in sections outside driver: %.4fs "
+           "(%.2f%% of section wall time)", NS2SEC(offcpu),
+           wall_total > 0 ? offcpu * 100.0 / wall_total : 0);
+  log_text(LOG_NOTICE, "    wall time outside sections: %.4fs, e.g. waiting "
+           "for events", NS2SEC(idle));
+
+  cpu_share = (cpu_total - cpu[SB_PROF_DRIVER]) * 100.0 /
+    (wall_total + idle);
+  log_text(LOG_NOTICE, "    client CPU outside driver: %.2f%% of wall time\n",
+           cpu_share);
+
+  /*
+    Only warn when the test talks to a database, otherwise the test itself is
+    the workload and is expected to be CPU-bound.
+  */
+  if (calls[SB_PROF_DRIVER] > 0 && cpu_share > cpu_threshold)
+    log_text(LOG_WARNING, "Worker threads spent %.2f%% of wall time on CPU "
+             "outside the database driver, the benchmark may be limited by "
+             "sysbench rather than the server\n", cpu_share);
+}
+
+
+/* Free per-thread counters */
+
+
+void sb_profile_done(void)
+{
+  free(profile_threads);
+  profile_threads = NULL;
+
+  sb_profile_enabled = 0;
+}
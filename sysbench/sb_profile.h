@@ -0,0 +1,69 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Self-profiling: per-thread wall clock and CPU time spent in different parts
+  of the benchmark harness.
+*/
+
+#ifndef SB_PROFILE_H
+#define SB_PROFILE_H
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+/* Profiled sections */
+
+typedef enum
+{
+  SB_PROF_REQUEST,    /* request generation (get_request) */
+  SB_PROF_EVENT,      /* test or script code outside other sections */
+  SB_PROF_DRIVER,     /* database driver calls */
+  SB_PROF_STATS,      /* statistics and logging */
+  SB_PROF_OTHER,      /* CPU time elsewhere in worker threads */
+  SB_PROF_MAX
+} sb_prof_section_t;
+
+/* Non-zero when profiling is enabled for the current run */
+extern int sb_profile_enabled;
+
+/* Register command line options */
+int sb_profile_register(void);
+
+/* Print command line options */
+void sb_profile_print_help(void);
+
+/* Parse options and allocate per-thread counters */
+int sb_profile_init(void);
+
+/* Start and stop accounting for a worker thread */
+void sb_profile_thread_start(int thread_id);
+void sb_profile_thread_stop(int thread_id);
+
+/* Enter and leave a section. Sections may be nested */
+void sb_profile_enter(int thread_id, sb_prof_section_t section);
+void sb_profile_exit(int thread_id);
+
+/* Print the time breakdown */
+void sb_profile_print_stats(void);
+
+/* Free per-thread counters */
+void sb_profile_done(void);
+
+#endif /* SB_PROFILE_H */
@@ -0,0 +1,867 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Result files are plain text, one record per line:
+
+    sysbench-result <format version>
+    test <test name>
+    option <name> <value>
+    time <total time in seconds>
+    counter <name> <value>
+    hist <response time in ns> <number of events>
+    interval <end time in seconds> <events/s> <avg latency in ms>
+
+  Lines starting with '#' and unknown records are ignored, so newer versions
+  can add records without breaking older ones.
+
+  Throughput regressions are only reported when they are statistically
+  significant according to the Mann-Whitney U test on per-interval throughput
+  (when both runs have enough intervals to perform the test). Latency
+  percentiles are compared directly.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#ifdef _WIN32
+# include "sb_win.h"
+#endif
+
+#ifdef STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+#endif
+#ifdef HAVE_MATH_H
+# include <math.h>
+#endif
+
+#include "sysbench.h"
+#include "sb_metrics.h"
+#include "sb_series.h"
+#include "sb_result.h"
+
+/* Result file format version */
+#define RESULT_VERSION 1
+
+/* Maximum length of a result file line */
+#define RESULT_LINE_MAX 4096
+
+/* Minimum number of intervals in each run for the Mann-Whitney test */
+#define RESULT_MIN_INTERVALS 5
+
+/* Significance level for throughput regressions */
+#define RESULT_ALPHA 0.05
+
+typedef struct
+{
+  char *name;
+  char *value;
+} result_option_t;
+
+typedef struct
+{
+  double             value;  /* response time in ns */
+  unsigned long long count;
+} result_bucket_t;
+
+typedef struct
+{
+  char               *test;
+  result_option_t    *options;
+  unsigned int       noptions;
+  unsigned int       options_size;
+  double             time;
+  unsigned long long events;
+  unsigned long long event_time;
+  unsigned long long counters[SB_CNT_MAX];
+  result_bucket_t    *buckets;
+  unsigned int       nbuckets;
+  unsigned int       buckets_size;
+  sb_series_point_t  *intervals;
+  unsigned int       nintervals;
+  unsigned int       intervals_size;
+} result_t;
+
+/* Result options */
+
+static sb_arg_t result_args[] =
+{
+  {"save-result", "save options, counters, the response time histogram and "
+   "per-interval throughput of the test to the specified file",
+   SB_ARG_TYPE_STRING, NULL},
+  {"compare-to", "compare the test result with a baseline saved with "
+   "--save-result", SB_ARG_TYPE_STRING, NULL},
+  {"regression-threshold", "with --compare-to, exit with code 3 if "
+   "throughput drops or the --percentile response time grows by more than "
+   "the specified percentage. 0 disables the check",
+   SB_ARG_TYPE_FLOAT, "0"},
+  {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
+};
+
+int sb_result_enabled;
+int sb_result_regression;
+
+static char            *save_path;
+static char            *compare_path;
+static double          threshold;
+
+static sb_percentile_t hist;
+static int             hist_initialized;
+static int             finished;
+
+static result_t        baseline;
+static result_t        current;
+
+static const char *counter_names[SB_CNT_MAX] =
+{
+  "reads", "writes", "other", "transactions", "errors", "reconnects"
+};
+
+/* Percentiles shown in comparisons */
+static const double compare_percentiles[] = {50, 90, 95, 99, 99.9};
+
+/* Options that do not affect the result */
+static const char *ignored_options[] =
+{
+  "save_result", "compare_to", "regression_threshold", NULL
+};
+
+
+/* Register command line options */
+
+
+int sb_result_register(void)
+{
+  return sb_register_arg_set(result_args);
+}
+
+
+/* Print command line options */
+
+
+void sb_result_print_help(void)
+{
+  printf("Result comparison options:\n");
+  sb_print_options(result_args);
+}
+
+
+/* Make room for one more element in a dynamic array */
+
+
+static int grow(void **array, unsigned int n, unsigned int *size,
+                size_t elem_size)
+{
+  void         *tmp;
+  unsigned int new_size;
+
+  if (n < *size)
+    return 0;
+
+  new_size = *size > 0 ? *size * 2 : 64;
+  tmp = realloc(*array, new_size * elem_size);
+  if (tmp == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure");
+    return 1;
+  }
+
+  *array = tmp;
+  *size = new_size;
+
+  return 0;
+}
+
+
+static int result_add_option(result_t *r, const char *name,
+                             const char *value)
+{
+  if (grow((void **) &r->options, r->noptions, &r->options_size,
+           sizeof(result_option_t)))
+    return 1;
+
+  r->options[r->noptions].name = strdup(name);
+  r->options[r->noptions].value = strdup(value);
+  r->noptions++;
+
+  return 0;
+}
+
+
+static int result_add_bucket(result_t *r, double value,
+                             unsigned long long count)
+{
+  if (grow((void **) &r->buckets, r->nbuckets, &r->buckets_size,
+           sizeof(result_bucket_t)))
+    return 1;
+
+  r->buckets[r->nbuckets].value = value;
+  r->buckets[r->nbuckets].count = count;
+  r->nbuckets++;
+
+  return 0;
+}
+
+
+static int result_add_interval(result_t *r, double time, double throughput,
+                               double latency)
+{
+  if (grow((void **) &r->intervals, r->nintervals, &r->intervals_size,
+           sizeof(sb_series_point_t)))
+    return 1;
+
+  r->intervals[r->nintervals].time = time;
+  r->intervals[r->nintervals].throughput = throughput;
+  r->intervals[r->nintervals].latency = latency;
+  r->nintervals++;
+
+  return 0;
+}
+
+
+static void free_result(result_t *r)
+{
+  unsigned int i;
+
+  for (i = 0; i < r->noptions; i++)
+  {
+    free(r->options[i].name);
+    free(r->options[i].value);
+  }
+  free(r->options);
+  free(r->buckets);
+  free(r->intervals);
+  free(r->test);
+
+  memset(r, 0, sizeof(result_t));
+}
+
+
+static int bucket_cmp(const void *a, const void *b)
+{
+  const result_bucket_t *x = (const result_bucket_t *) a;
+  const result_bucket_t *y = (const result_bucket_t *) b;
+
+  return x->value < y->value ? -1 : x->value > y->value;
+}
+
+
+/* Load a result file */
+
+
+static int load_result(const char *path, result_t *r)
+{
+  FILE               *fp;
+  char               buf[RESULT_LINE_MAX];
+  char               name[256];
+  char               *p;
+  unsigned int       line = 0;
+  unsigned int       version = 0;
+  unsigned int       i;
+  double             d1, d2, d3;
+  unsigned long long ull;
+  int                n;
+
+  if ((fp = fopen(path, "r")) == NULL)
+  {
+    log_errno(LOG_FATAL, "Cannot open result file '%s'", path);
+    return 1;
+  }
+
+  while (fgets(buf, sizeof(buf), fp) != NULL)
+  {
+    line++;
+
+    if ((p = strchr(buf, '\n')) != NULL)
+      *p = '\0';
+    if (buf[0] == '#' || buf[0] == '\0')
+      continue;
+
+    if (sscanf(buf, "sysbench-result %u", &version) == 1)
+      continue;
+
+    if (version == 0)
+      break;
+
+    if (!strncmp(buf, "test ", 5))
+    {
+      free(r->test);
+      r->test = strdup(buf + 5);
+    }
+    else if (sscanf(buf, "option %255s %n", name, &n) == 1)
+    {
+      if (result_add_option(r, name, buf + n))
+        goto error;
+    }
+    else if (sscanf(buf, "time %lf", &d1) == 1)
+      r->time = d1;
+    else if (sscanf(buf, "counter %255s %llu", name, &ull) == 2)
+    {
+      if (!strcmp(name, "events"))
+        r->events = ull;
+      else if (!strcmp(name, "event_time"))
+        r->event_time = ull;
+      else
+        for (i = 0; i < SB_CNT_MAX; i++)
+          if (!strcmp(name, counter_names[i]))
+            r->counters[i] = ull;
+    }
+    else if (sscanf(buf, "hist %lf %llu", &d1, &ull) == 2)
+    {
+      if (result_add_bucket(r, d1, ull))
+        goto error;
+    }
+    else if (sscanf(buf, "interval %lf %lf %lf", &d1, &d2, &d3) == 3)
+    {
+      if (result_add_interval(r, d1, d2, d3))
+        goto error;
+    }
+    else
+      log_text(LOG_DEBUG, "%s:%u: unknown record ignored", path, line);
+  }
+
+  if (version == 0)
+  {
+    log_text(LOG_FATAL, "'%s' is not a sysbench result file", path);
+    goto error;
+  }
+
+  if (version > RESULT_VERSION)
+    log_text(LOG_WARNING, "Result file '%s' has a newer format version (%u), "
+             "some data may be ignored", path, version);
+
+  qsort(r->buckets, r->nbuckets, sizeof(result_bucket_t), bucket_cmp);
+
+  fclose(fp);
+
+  return 0;
+
+ error:
+  fclose(fp);
+  free_result(r);
+
+  return 1;
+}
+
+
+/* Save a result file */
+
+
+static int save_result(const char *path, result_t *r)
+{
+  FILE         *fp;
+  unsigned int i;
+
+  if ((fp = fopen(path, "w")) == NULL)
+  {
+    log_errno(LOG_FATAL, "Cannot open result file '%s' for writing", path);
+    return 1;
+  }
+
+  fprintf(fp, "# %s %s result file\n", PACKAGE, PACKAGE_VERSION);
+  fprintf(fp, "sysbench-result %u\n", RESULT_VERSION);
+  fprintf(fp, "test %s\n", r->test != NULL ? r->test : "");
+
+  for (i = 0; i < r->noptions; i++)
+    fprintf(fp, "option %s %s\n", r->options[i].name, r->options[i].value);
+
+  fprintf(fp, "time %.6f\n", r->time);
+  fprintf(fp, "counter events %llu\n", r->events);
+  fprintf(fp, "counter event_time %llu\n", r->event_time);
+  for (i = 0; i < SB_CNT_MAX; i++)
+    fprintf(fp, "counter %s %llu\n", counter_names[i], r->counters[i]);
+
+  for (i = 0; i < r->nbuckets; i++)
+    fprintf(fp, "hist %.1f %llu\n", r->buckets[i].value, r->buckets[i].count);
+
+  for (i = 0; i < r->nintervals; i++)
+    fprintf(fp, "interval %.4f %.4f %.6f\n", r->intervals[i].time,
+            r->intervals[i].throughput, r->intervals[i].latency);
+
+  if (fclose(fp))
+  {
+    log_errno(LOG_FATAL, "Cannot write result file '%s'", path);
+    return 1;
+  }
+
+  log_text(LOG_NOTICE, "Result saved to '%s'\n", path);
+
+  return 0;
+}
+
+
+/* Parse options and load the baseline */
+
+
+int sb_result_init(void)
+{
+  if (sb_globals.command != SB_COMMAND_RUN)
+    return 0;
+
+  save_path = sb_get_value_string("save-result");
+  compare_path = sb_get_value_string("compare-to");
+  if (save_path != NULL && save_path[0] == '\0')
+    save_path = NULL;
+  if (compare_path != NULL && compare_path[0] == '\0')
+    compare_path = NULL;
+
+  if (save_path == NULL && compare_path == NULL)
+    return 0;
+
+  threshold = sb_get_value_float("regression-threshold");
+  if (threshold < 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for --regression-threshold: %f",
+             threshold);
+    return 1;
+  }
+
+  if (compare_path != NULL && load_result(compare_path, &baseline))
+    return 1;
+
+  if (sb_percentile_init(&hist, OPER_LOG_GRANULARITY, OPER_LOG_MIN_VALUE,
+                         OPER_LOG_MAX_VALUE))
+    return 1;
+  hist_initialized = 1;
+
+  /* Per-interval throughput is needed for significance tests */
+  sb_series_record();
+
+  sb_result_enabled = 1;
+
+  return 0;
+}
+
+
+/* Collect response times on report checkpoints */
+
+
+void sb_result_checkpoint(void)
+{
+  if (!sb_result_enabled || finished)
+    return;
+
+  oper_handler_merge_percentile(&hist);
+}
+
+
+static int is_ignored(const char *name)
+{
+  unsigned int i;
+
+  for (i = 0; ignored_options[i] != NULL; i++)
+    if (!strcmp(name, ignored_options[i]))
+      return 1;
+
+  return 0;
+}
+
+
+/* Collect command line options as strings */
+
+
+static int collect_options(result_t *r)
+{
+  sb_list_item_t *pos;
+  sb_list_item_t *vpos;
+  option_t       *opt;
+  value_t        *val;
+  char           buf[RESULT_LINE_MAX];
+  size_t         len;
+
+  pos = sb_options_enum_start();
+  while ((pos = sb_options_enum_next(pos, &opt)) != NULL)
+  {
+    if (opt->name == NULL || is_ignored(opt->name) ||
+        SB_LIST_IS_EMPTY(&opt->values))
+      continue;
+
+    buf[0] = '\0';
+    len = 0;
+    SB_LIST_FOR_EACH(vpos, &opt->values)
+    {
+      val = SB_LIST_ENTRY(vpos, value_t, listitem);
+      if (val->data == NULL)
+        continue;
+      len += snprintf(buf + len, len < sizeof(buf) ? sizeof(buf) - len : 0,
+                      "%s%s", len > 0 ? "," : "", val->data);
+    }
+
+    if (result_add_option(r, opt->name, buf))
+      return 1;
+  }
+
+  return 0;
+}
+
+
+/* Build the result of the current run */
+
+
+static int collect_result(sb_test_t *test, result_t *r)
+{
+  const sb_series_point_t *points;
+  unsigned int            npoints;
+  unsigned int            i, j;
+
+  r->test = strdup(test->sname);
+  r->time = NS2SEC(sb_timer_value(&sb_globals.exec_timer));
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    r->events += sb_thread_metrics[i].events;
+    r->event_time += sb_thread_metrics[i].event_time;
+    for (j = 0; j < SB_CNT_MAX; j++)
+      r->counters[j] += sb_thread_metrics[i].counters[j];
+  }
+
+  if (collect_options(r))
+    return 1;
+
+  oper_handler_merge_percentile(&hist);
+  for (i = 0; i < hist.size; i++)
+    if (hist.values[i] > 0 &&
+        result_add_bucket(r, sb_percentile_bucket_value(&hist, i),
+                          hist.values[i]))
+      return 1;
+
+  npoints = sb_series_get(&points);
+  for (i = 0; i < npoints; i++)
+    if (result_add_interval(r, points[i].time, points[i].throughput,
+                     points[i].latency))
+      return 1;
+
+  return 0;
+}
+
+
+/* Response time percentile in ns from a result histogram */
+
+
+static double result_percentile(result_t *r, double percent)
+{
+  unsigned long long total = 0;
+  unsigned long long target;
+  unsigned long long n = 0;
+  double             rank;
+  unsigned int       i;
+
+  for (i = 0; i < r->nbuckets; i++)
+    total += r->buckets[i].count;
+
+  if (total == 0)
+    return 0;
+
+  rank = ceil(total * percent / 100);
+  target = (unsigned long long) rank;
+  if (target == 0)
+    target = 1;
+
+  for (i = 0; i < r->nbuckets; i++)
+  {
+    n += r->buckets[i].count;
+    if (n >= target)
+      return r->buckets[i].value;
+  }
+
+  return r->buckets[r->nbuckets - 1].value;
+}
+
+
+static double result_throughput(result_t *r)
+{
+  return r->time > 0 ? r->events / r->time : 0;
+}
+
+
+static double result_latency(result_t *r)
+{
+  return r->events > 0 ? NS2MS((double) r->event_time) / r->events : 0;
+}
+
+
+/* Relative change in percent */
+
+
+static double change(double base, double cur)
+{
+  return base > 0 ? (cur - base) * 100 / base : 0;
+}
+
+
+static void print_row(const char *name, double base, double cur)
+{
+  if (base > 0)
+    log_text(LOG_NOTICE, "    %-28s %14.2f %14.2f %+9.2f%%", name, base, cur,
+             change(base, cur));
+  else
+    log_text(LOG_NOTICE, "    %-28s %14.2f %14.2f %10s", name, base, cur,
+             "n/a");
+}
+
+
+typedef struct
+{
+  double value;
+  int    group;
+} mw_value_t;
+
+
+static int mw_cmp(const void *a, const void *b)
+{
+  const mw_value_t *x = (const mw_value_t *) a;
+  const mw_value_t *y = (const mw_value_t *) b;
+
+  return x->value < y->value ? -1 : x->value > y->value;
+}
+
+
+/*
+  Two-sided Mann-Whitney U test using the normal approximation with tie
+  correction. Returns 1 if there is not enough data.
+*/
+
+
+static int mann_whitney(result_t *a, result_t *b, double *u, double *p)
+{
+  mw_value_t   *v;
+  unsigned int na = a->nintervals;
+  unsigned int nb = b->nintervals;
+  unsigned int n = na + nb;
+  unsigned int i, j, k;
+  double       r1 = 0;
+  double       ties = 0;
+  double       rank, t, u1, mu, sigma, z;
+
+  if (na < RESULT_MIN_INTERVALS || nb < RESULT_MIN_INTERVALS)
+    return 1;
+
+  v = (mw_value_t *) malloc(n * sizeof(mw_value_t));
+  if (v == NULL)
+    return 1;
+
+  for (i = 0; i < na; i++)
+  {
+    v[i].value = a->intervals[i].throughput;
+    v[i].group = 0;
+  }
+  for (i = 0; i < nb; i++)
+  {
+    v[na + i].value = b->intervals[i].throughput;
+    v[na + i].group = 1;
+  }
+
+  qsort(v, n, sizeof(mw_value_t), mw_cmp);
+
+  for (i = 0; i < n; i = j)
+  {
+    for (j = i + 1; j < n && v[j].value == v[i].value; j++)
+      /* nothing */ ;
+
+    rank = (i + 1 + j) / 2.0;
+    t = j - i;
+    ties += t * t * t - t;
+
+    for (k = i; k < j; k++)
+      if (v[k].group == 0)
+        r1 += rank;
+  }
+
+  free(v);
+
+  u1 = r1 - na * (na + 1) / 2.0;
+  mu = na * (double) nb / 2;
+  sigma = sqrt(na * (double) nb / 12 * ((n + 1) - ties / (n * (n - 1.0))));
+
+  *u = u1 < na * (double) nb - u1 ? u1 : na * (double) nb - u1;
+
+  if (sigma <= 0)
+  {
+    *p = 1;
+    return 0;
+  }
+
+  z = (fabs(u1 - mu) - 0.5) / sigma;
+  if (z < 0)
+    z = 0;
+  *p = erfc(z / sqrt(2.0));
+
+  return 0;
+}
+
+
+/* Print options which differ between the baseline and the current run */
+
+
+static void compare_options(result_t *base, result_t *cur)
+{
+  unsigned int i, j;
+  int          header = 0;
+  const char   *value;
+  char         name[256];
+  char         *p;
+
+  for (i = 0; i < cur->noptions; i++)
+  {
+    value = NULL;
+    for (j = 0; j < base->noptions; j++)
+      if (!strcmp(base->options[j].name, cur->options[i].name))
+      {
+        value = base->options[j].value;
+        break;
+      }
+
+    if (value != NULL && !strcmp(value, cur->options[i].value))
+      continue;
+
+    if (!header)
+    {
+      log_text(LOG_NOTICE, "    options changed:");
+      header = 1;
+    }
+    /* Options are stored with underscores, print them as on command line */
+    snprintf(name, sizeof(name), "%s", cur->options[i].name);
+    for (p = name; *p != '\0'; p++)
+      if (*p == '_')
+        *p = '-';
+
+    log_text(LOG_NOTICE, "        --%s: %s -> %s", name,
+             value != NULL ? value : "(not set)", cur->options[i].value);
+  }
+}
+
+
+/* Compare the current run with the baseline */
+
+
+static void compare_result(result_t *base, result_t *cur)
+{
+  char         name[64];
+  unsigned int i;
+  double       tput_change;
+  double       lat_base, lat_cur, lat_change;
+  double       u, p;
+  int          have_mw;
+
+  if (base->test != NULL && strcmp(base->test, cur->test))
+    log_text(LOG_WARNING, "Baseline was produced by a different test: '%s'",
+             base->test);
+
+  log_text(LOG_NOTICE, "Comparison with baseline '%s':", compare_path);
+  log_text(LOG_NOTICE, "    %-28s %14s %14s %10s", "", "baseline", "current",
+           "change");
+  print_row("events/s:", result_throughput(base), result_throughput(cur));
+  for (i = 0; i < SB_CNT_MAX; i++)
+    if (base->counters[i] > 0 || cur->counters[i] > 0)
+    {
+      snprintf(name, sizeof(name), "%s/s:", counter_names[i]);
+      print_row(name, base->time > 0 ? base->counters[i] / base->time : 0,
+                cur->time > 0 ? cur->counters[i] / cur->time : 0);
+    }
+  print_row("response time avg (ms):", result_latency(base),
+            result_latency(cur));
+  for (i = 0; i < sizeof(compare_percentiles) / sizeof(double); i++)
+  {
+    snprintf(name, sizeof(name), "response time %gth (ms):",
+             compare_percentiles[i]);
+    print_row(name, NS2MS(result_percentile(base, compare_percentiles[i])),
+              NS2MS(result_percentile(cur, compare_percentiles[i])));
+  }
+
+  have_mw = !mann_whitney(base, cur, &u, &p);
+  if (have_mw)
+    log_text(LOG_NOTICE, "    Mann-Whitney U test on interval throughput: "
+             "U = %.1f, p = %.4f (%s)", u, p,
+             p < RESULT_ALPHA ? "significant" : "not significant");
+  else
+    log_text(LOG_NOTICE, "    Mann-Whitney U test on interval throughput: "
+             "not enough intervals (need at least %u in each run)",
+             RESULT_MIN_INTERVALS);
+
+  compare_options(base, cur);
+  log_text(LOG_NOTICE, "");
+
+  if (threshold <= 0)
+    return;
+
+  tput_change = change(result_throughput(base), result_throughput(cur));
+  if (tput_change < -threshold)
+  {
+    if (have_mw && p >= RESULT_ALPHA)
+      log_text(LOG_NOTICE, "Throughput dropped by %.2f%%, but the change "
+               "is not statistically significant (p = %.4f)\n",
+               -tput_change, p);
+    else
+    {
+      log_text(LOG_ALERT, "Regression: throughput dropped by %.2f%% "
+               "(threshold: %.2f%%)\n", -tput_change, threshold);
+      sb_result_regression = 1;
+    }
+  }
+
+  lat_base = result_percentile(base, sb_globals.percentile_rank);
+  lat_cur = result_percentile(cur, sb_globals.percentile_rank);
+  lat_change = change(lat_base, lat_cur);
+  if (lat_change > threshold)
+  {
+    log_text(LOG_ALERT, "Regression: %u%% response time grew by %.2f%% "
+             "(threshold: %.2f%%)\n", sb_globals.percentile_rank, lat_change,
+             threshold);
+    sb_result_regression = 1;
+  }
+}
+
+
+/* Collect the result of a finished test, save and compare it */
+
+
+int sb_result_finish(sb_test_t *test)
+{
+  if (!sb_result_enabled || finished)
+    return 0;
+
+  if (collect_result(test, &current))
+    return 1;
+  finished = 1;
+
+  if (save_path != NULL && save_result(save_path, &current))
+    return 1;
+
+  if (compare_path != NULL)
+    compare_result(&baseline, &current);
+
+  return 0;
+}
+
+
+/* Free resources */
+
+
+void sb_result_done(void)
+{
+  free_result(&baseline);
+  free_result(&current);
+
+  if (hist_initialized)
+    sb_percentile_done(&hist);
+  hist_initialized = 0;
+
+  sb_result_enabled = 0;
+}
@@ -0,0 +1,59 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Saving test results to a file and comparing them with a saved baseline.
+*/
+
+#ifndef SB_RESULT_H
+#define SB_RESULT_H
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "sysbench.h"
+
+/* Exit code used when a regression against the baseline is detected */
+#define SB_RESULT_REGRESSION_EXIT 3
+
+/* Non-zero when results are saved or compared */
+extern int sb_result_enabled;
+
+/* Non-zero when a regression against the baseline has been detected */
+extern int sb_result_regression;
+
+/* Register command line options */
+int sb_result_register(void);
+
+/* Print command line options */
+void sb_result_print_help(void);
+
+/* Parse options and load the baseline */
+int sb_result_init(void);
+
+/* Collect response times on report checkpoints */
+void sb_result_checkpoint(void);
+
+/* Collect the result of a finished test, save and compare it */
+int sb_result_finish(sb_test_t *test);
+
+/* Free resources */
+void sb_result_done(void);
+
+#endif /* SB_RESULT_H */
@@ -0,0 +1,161 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  The sampling thread waits for the execution timer to start, then sleeps
+  until the nearest due callback and runs all callbacks that are due. Each
+  callback keeps its own schedule, so intervals that were overslept are
+  skipped rather than reported twice.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#ifdef _WIN32
+# include "sb_win.h"
+#endif
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "sysbench.h"
+#include "sb_sampler.h"
+
+typedef struct
+{
+  sb_sampler_fn_t    *fn;
+  unsigned long long interval_ns;
+  unsigned long long next_ns;
+} sampler_client_t;
+
+static sampler_client_t clients[SB_SAMPLER_MAX_CLIENTS];
+static unsigned int     nclients;
+
+static pthread_t        sampler_thread;
+static int              sampler_thread_created;
+
+
+/* Register a callback to be called every 'interval' seconds */
+
+
+int sb_sampler_add(unsigned int interval, sb_sampler_fn_t *fn)
+{
+  if (nclients == SB_SAMPLER_MAX_CLIENTS)
+  {
+    log_text(LOG_FATAL, "Too many interval sampler callbacks");
+    return 1;
+  }
+
+  clients[nclients].fn = fn;
+  clients[nclients].interval_ns = SEC2NS(interval);
+  nclients++;
+
+  return 0;
+}
+
+
+/* Sampling thread */
+
+
+static void *sampler_thread_proc(void *arg)
+{
+  unsigned long long curr_ns, next_ns;
+  unsigned int       i;
+
+  (void) arg; /* unused */
+
+  log_text(LOG_DEBUG, "Interval sampler thread started");
+
+  while (!sb_timer_running(&sb_globals.exec_timer))
+    usleep(1000);
+
+  curr_ns = sb_timer_value(&sb_globals.exec_timer);
+  for (i = 0; i < nclients; i++)
+    clients[i].next_ns = curr_ns + clients[i].interval_ns;
+
+  for (;;)
+  {
+    next_ns = clients[0].next_ns;
+    for (i = 1; i < nclients; i++)
+      if (clients[i].next_ns < next_ns)
+        next_ns = clients[i].next_ns;
+
+    curr_ns = sb_timer_value(&sb_globals.exec_timer);
+    if (next_ns > curr_ns)
+      usleep((next_ns - curr_ns) / 1000);
+
+    /* Do not let cancellation interrupt logging or memory allocation */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    for (i = 0; i < nclients; i++)
+    {
+      curr_ns = sb_timer_value(&sb_globals.exec_timer);
+      if (clients[i].next_ns > curr_ns)
+        continue;
+
+      clients[i].fn(curr_ns);
+
+      while (clients[i].next_ns <= curr_ns)
+        clients[i].next_ns += clients[i].interval_ns;
+    }
+
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+  }
+
+  return NULL;
+}
+
+
+/* Start the sampling thread if any callbacks are registered */
+
+
+int sb_sampler_start(void)
+{
+  if (nclients == 0)
+    return 0;
+
+  if (pthread_create(&sampler_thread, NULL, &sampler_thread_proc, NULL) != 0)
+  {
+    log_errno(LOG_FATAL,
+              "pthread_create() for the interval sampler thread failed.");
+    return 1;
+  }
+  sampler_thread_created = 1;
+
+  return 0;
+}
+
+
+/* Stop the sampling thread and remove all callbacks */
+
+
+void sb_sampler_stop(void)
+{
+  if (sampler_thread_created)
+  {
+    if (pthread_cancel(sampler_thread) || pthread_join(sampler_thread, NULL))
+      log_errno(LOG_FATAL, "Terminating the interval sampler thread failed.");
+    sampler_thread_created = 0;
+  }
+
+  nclients = 0;
+}
@@ -0,0 +1,50 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Shared interval sampler. Modules that need to look at per-thread counters
+  at fixed intervals register a callback, and a single thread calls it once
+  per interval while the test is running.
+*/
+
+#ifndef SB_SAMPLER_H
+#define SB_SAMPLER_H
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+/* Maximum number of registered callbacks */
+#define SB_SAMPLER_MAX_CLIENTS 8
+
+/*
+  Sampling callback, called with the value of sb_globals.exec_timer in
+  nanoseconds. Cancellation is disabled while the callback runs.
+*/
+typedef void sb_sampler_fn_t(unsigned long long now_ns);
+
+/* Register a callback to be called every 'interval' seconds */
+int sb_sampler_add(unsigned int interval, sb_sampler_fn_t *fn);
+
+/* Start the sampling thread if any callbacks are registered */
+int sb_sampler_start(void);
+
+/* Stop the sampling thread and remove all callbacks */
+void sb_sampler_stop(void);
+
+#endif /* SB_SAMPLER_H */
@@ -0,0 +1,485 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  The interval sampler reads cumulative per-thread counters from sb_metrics at
+  fixed intervals, so workers are not affected. Steady state is reached when
+  the coefficient of variation of both throughput and average latency over
+  the last --steady-window intervals is below --steady-cv. From then on, the
+  confidence interval for the mean throughput is computed over all steady
+  intervals using Student's t-distribution, and the test is stopped once its
+  half-width drops below --steady-ci percent of the mean.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#ifdef _WIN32
+# include "sb_win.h"
+#endif
+
+#ifdef STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+#endif
+#ifdef HAVE_MATH_H
+# include <math.h>
+#endif
+
+#include "sysbench.h"
+#include "sb_metrics.h"
+#include "sb_sampler.h"
+#include "sb_series.h"
+
+/* Number of degrees of freedom covered by the t-distribution tables */
+#define T_TABLE_SIZE 30
+
+/* Two-sided critical values of Student's t-distribution */
+static const double t_90[T_TABLE_SIZE] =
+{
+  6.314, 2.920, 2.353, 2.132, 2.015, 1.943, 1.895, 1.860, 1.833, 1.812,
+  1.796, 1.782, 1.771, 1.761, 1.753, 1.746, 1.740, 1.734, 1.729, 1.725,
+  1.721, 1.717, 1.714, 1.711, 1.708, 1.706, 1.703, 1.701, 1.699, 1.697
+};
+
+static const double t_95[T_TABLE_SIZE] =
+{
+  12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+  2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+  2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+static const double t_99[T_TABLE_SIZE] =
+{
+  63.657, 9.925, 5.841, 4.604, 4.032, 3.707, 3.499, 3.355, 3.250, 3.169,
+  3.106, 3.055, 3.012, 2.977, 2.947, 2.921, 2.898, 2.878, 2.861, 2.845,
+  2.831, 2.819, 2.807, 2.797, 2.787, 2.779, 2.771, 2.763, 2.756, 2.750
+};
+
+/* Series options */
+
+static sb_arg_t series_args[] =
+{
+  {"steady-state", "record per-interval throughput and latency, detect "
+   "steady state and report the mean throughput with a confidence interval",
+   SB_ARG_TYPE_FLAG, "off"},
+  {"steady-interval", "sampling interval in seconds", SB_ARG_TYPE_INT, "1"},
+  {"steady-window", "number of consecutive intervals used to detect steady "
+   "state", SB_ARG_TYPE_INT, "10"},
+  {"steady-cv", "maximum coefficient of variation (in percent) of throughput "
+   "and latency over the window for the test to be considered steady",
+   SB_ARG_TYPE_FLOAT, "5"},
+  {"steady-ci", "stop the test once the confidence interval half-width for "
+   "the mean throughput is below the specified percentage of the mean. "
+   "0 means run until other limits are reached", SB_ARG_TYPE_FLOAT, "0"},
+  {"steady-confidence", "confidence level in percent (90, 95 or 99)",
+   SB_ARG_TYPE_INT, "95"},
+  {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
+};
+
+int          sb_series_enabled;
+volatile int sb_series_stop_requested;
+
+static int               steady;
+
+static unsigned int      interval;
+static unsigned int      window;
+static double            max_cv;
+static double            ci_target;
+static unsigned int      confidence;
+static const double      *t_table;
+static double            t_inf;
+
+static sb_series_point_t *points;
+static unsigned int      npoints;
+static unsigned int      points_size;
+static int               steady_start;
+static double            steady_time;
+
+static unsigned long long prev_events;
+static unsigned long long prev_time;
+static unsigned long long prev_ns;
+
+
+/* Register command line options */
+
+
+int sb_series_register(void)
+{
+  return sb_register_arg_set(series_args);
+}
+
+
+/* Print command line options */
+
+
+void sb_series_print_help(void)
+{
+  printf("Steady state options:\n");
+  sb_print_options(series_args);
+}
+
+
+/* Parse options */
+
+
+int sb_series_init(void)
+{
+  int val;
+
+  if (sb_globals.command != SB_COMMAND_RUN)
+    return 0;
+
+  val = sb_get_value_int("steady-interval");
+  if (val <= 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for --steady-interval: %d", val);
+    return 1;
+  }
+  interval = (unsigned int) val;
+
+  steady = sb_get_value_flag("steady-state");
+  if (!steady)
+    return 0;
+
+  val = sb_get_value_int("steady-window");
+  if (val < 2)
+  {
+    log_text(LOG_FATAL, "Invalid value for --steady-window: %d", val);
+    return 1;
+  }
+  window = (unsigned int) val;
+
+  max_cv = sb_get_value_float("steady-cv");
+  if (max_cv <= 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for --steady-cv: %f", max_cv);
+    return 1;
+  }
+
+  ci_target = sb_get_value_float("steady-ci");
+  if (ci_target < 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for --steady-ci: %f", ci_target);
+    return 1;
+  }
+
+  confidence = sb_get_value_int("steady-confidence");
+  switch (confidence) {
+    case 90:
+      t_table = t_90;
+      t_inf = 1.645;
+      break;
+    case 95:
+      t_table = t_95;
+      t_inf = 1.960;
+      break;
+    case 99:
+      t_table = t_99;
+      t_inf = 2.576;
+      break;
+    default:
+      log_text(LOG_FATAL, "Invalid value for --steady-confidence: %u",
+               confidence);
+      return 1;
+  }
+
+  sb_series_enabled = 1;
+
+  return 0;
+}
+
+
+/* Record the interval series without steady state detection */
+
+
+void sb_series_record(void)
+{
+  if (sb_globals.command == SB_COMMAND_RUN)
+    sb_series_enabled = 1;
+}
+
+
+/* Critical value of the t-distribution for a given number of degrees of
+   freedom */
+
+
+static double t_value(unsigned int df)
+{
+  if (df == 0)
+    return 0;
+  if (df <= T_TABLE_SIZE)
+    return t_table[df - 1];
+
+  /* First-order Cornish-Fisher expansion around the normal quantile */
+  return t_inf + (t_inf * t_inf * t_inf + t_inf) / (4.0 * df);
+}
+
+
+/* Mean and standard deviation of a field over points [from, to) */
+
+
+static void series_stats(unsigned int from, unsigned int to, int latency,
+                         double *mean, double *stddev)
+{
+  unsigned int i;
+  double       sum = 0;
+  double       sq = 0;
+  double       v;
+  unsigned int n = to - from;
+
+  *mean = *stddev = 0;
+  if (n == 0)
+    return;
+
+  for (i = from; i < to; i++)
+    sum += latency ? points[i].latency : points[i].throughput;
+  *mean = sum / n;
+
+  if (n < 2)
+    return;
+
+  for (i = from; i < to; i++)
+  {
+    v = (latency ? points[i].latency : points[i].throughput) - *mean;
+    sq += v * v;
+  }
+  *stddev = sqrt(sq / (n - 1));
+}
+
+
+/* Coefficient of variation in percent */
+
+
+static double series_cv(unsigned int from, unsigned int to, int latency)
+{
+  double mean, stddev;
+
+  series_stats(from, to, latency, &mean, &stddev);
+
+  return mean > 0 ? stddev * 100 / mean : 0;
+}
+
+
+/* Confidence interval half-width for the mean throughput */
+
+
+static double series_ci(unsigned int from, unsigned int to, int latency,
+                        double *mean)
+{
+  double       stddev;
+  unsigned int n = to - from;
+
+  series_stats(from, to, latency, mean, &stddev);
+  if (n < 2)
+    return 0;
+
+  return t_value(n - 1) * stddev / sqrt(n);
+}
+
+
+/* Append a sample and check the steady state conditions */
+
+
+static void series_add(double time, double throughput, double latency)
+{
+  double cv_t, cv_l;
+  double mean, half;
+
+  if (npoints == points_size)
+  {
+    sb_series_point_t *tmp;
+    unsigned int      size = points_size > 0 ? points_size * 2 : 256;
+
+    tmp = (sb_series_point_t *) realloc(points, size * sizeof(*points));
+    if (tmp == NULL)
+      return;
+    points = tmp;
+    points_size = size;
+  }
+
+  points[npoints].time = time;
+  points[npoints].throughput = throughput;
+  points[npoints].latency = latency;
+  npoints++;
+
+  if (!steady)
+    return;
+
+  if (steady_start < 0 && npoints >= window)
+  {
+    cv_t = series_cv(npoints - window, npoints, 0);
+    cv_l = series_cv(npoints - window, npoints, 1);
+
+    if (cv_t <= max_cv && cv_l <= max_cv)
+    {
+      steady_start = npoints - window;
+      steady_time = steady_start > 0 ? points[steady_start - 1].time : 0;
+      log_timestamp(LOG_NOTICE, &sb_globals.exec_timer,
+                    "steady state reached (throughput CV: %.2f%%, "
+                    "latency CV: %.2f%%)", cv_t, cv_l);
+    }
+  }
+
+  if (steady_start >= 0 && ci_target > 0 && !sb_series_stop_requested)
+  {
+    half = series_ci(steady_start, npoints, 0, &mean);
+    if (npoints - steady_start >= window && mean > 0 &&
+        half * 100 / mean <= ci_target)
+    {
+      log_timestamp(LOG_NOTICE, &sb_globals.exec_timer,
+                    "throughput %.2f +/- %.2f (%u%% CI) is within %.2f%%, "
+                    "stopping the test", mean, half, confidence, ci_target);
+      sb_series_stop_requested = 1;
+    }
+  }
+}
+
+
+/* Sum event counters over all threads */
+
+
+static void series_totals(unsigned long long *events, unsigned long long *time)
+{
+  unsigned int i;
+
+  *events = *time = 0;
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    *events += sb_thread_metrics[i].events;
+    *time += sb_thread_metrics[i].event_time;
+  }
+}
+
+
+/* Take one sample, called by the interval sampler */
+
+
+static void series_sample(unsigned long long curr_ns)
+{
+  unsigned long long events, time;
+  double             seconds;
+
+  series_totals(&events, &time);
+
+  seconds = NS2SEC(curr_ns - prev_ns);
+  if (seconds > 0)
+    series_add(NS2SEC(curr_ns), (events - prev_events) / seconds,
+               events > prev_events ?
+               NS2MS((double) (time - prev_time)) / (events - prev_events) :
+               0);
+
+  prev_events = events;
+  prev_time = time;
+  prev_ns = curr_ns;
+}
+
+
+/* Register with the interval sampler */
+
+
+int sb_series_start(void)
+{
+  if (!sb_series_enabled)
+    return 0;
+
+  npoints = 0;
+  steady_start = -1;
+  sb_series_stop_requested = 0;
+  prev_events = prev_time = prev_ns = 0;
+
+  return sb_sampler_add(interval, &series_sample);
+}
+
+
+/* Get recorded samples */
+
+
+unsigned int sb_series_get(const sb_series_point_t **p)
+{
+  *p = points;
+
+  return npoints;
+}
+
+
+/* Print steady state statistics */
+
+
+void sb_series_print_stats(void)
+{
+  unsigned int from;
+  double       t_mean, t_half;
+  double       l_mean, l_half;
+
+  if (!sb_series_enabled || !steady)
+    return;
+
+  /* A CI over fewer intervals than the window would look more precise */
+  if (npoints < window)
+  {
+    log_text(LOG_WARNING, "Steady state statistics: not enough intervals for "
+             "steady-state detection (%u < %u), consider a longer test or a "
+             "shorter --steady-interval\n", npoints, window);
+    return;
+  }
+
+  from = steady_start >= 0 ? (unsigned int) steady_start : 0;
+
+  t_half = series_ci(from, npoints, 0, &t_mean);
+  l_half = series_ci(from, npoints, 1, &l_mean);
+
+  log_text(LOG_NOTICE, "Steady state statistics:");
+  log_text(LOG_NOTICE, "    intervals recorded:                  %u x %us",
+           npoints, interval);
+  if (steady_start >= 0)
+    log_text(LOG_NOTICE, "    steady state reached at:             %.1fs "
+             "(%u intervals used)", steady_time, npoints - from);
+  else
+    log_text(LOG_NOTICE, "    steady state reached at:             never "
+             "(all intervals used)");
+  log_text(LOG_NOTICE, "    throughput:                          "
+           "%.2f +/- %.2f events/s (%u%% CI, +/- %.2f%%)", t_mean, t_half,
+           confidence, t_mean > 0 ? t_half * 100 / t_mean : 0);
+  log_text(LOG_NOTICE, "    avg latency:                         "
+           "%.2f +/- %.2fms", l_mean, l_half);
+  log_text(LOG_NOTICE, "    throughput CV:                       %.2f%%\n",
+           series_cv(from, npoints, 0));
+
+  if (steady_start < 0)
+    log_text(LOG_WARNING, "The test never reached steady state: throughput "
+             "CV %.2f%%, latency CV %.2f%% over the last %u intervals "
+             "(--steady-cv=%.2f), results may not be reproducible\n",
+             series_cv(npoints - window, npoints, 0),
+             series_cv(npoints - window, npoints, 1), window, max_cv);
+}
+
+
+/* Free resources */
+
+
+void sb_series_done(void)
+{
+  free(points);
+  points = NULL;
+  npoints = points_size = 0;
+
+  sb_series_enabled = 0;
+  steady = 0;
+}
@@ -0,0 +1,71 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Per-interval throughput and latency series, steady state detection and
+  confidence intervals for the mean throughput.
+*/
+
+#ifndef SB_SERIES_H
+#define SB_SERIES_H
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+/* A single interval sample */
+
+typedef struct
+{
+  double             time;        /* end of the interval, seconds */
+  double             throughput;  /* events per second */
+  double             latency;     /* average event latency, ms */
+} sb_series_point_t;
+
+/* Non-zero when the interval series is being recorded */
+extern int sb_series_enabled;
+
+/* Register command line options */
+int sb_series_register(void);
+
+/* Print command line options */
+void sb_series_print_help(void);
+
+/* Parse options */
+int sb_series_init(void);
+
+/* Record the interval series without steady state detection */
+void sb_series_record(void);
+
+/* Register with the interval sampler */
+int sb_series_start(void);
+
+/* Non-zero when the test should be stopped because the result is precise
+   enough */
+extern volatile int sb_series_stop_requested;
+
+/* Get recorded samples, returns the number of samples */
+unsigned int sb_series_get(const sb_series_point_t **points);
+
+/* Print steady state statistics */
+void sb_series_print_stats(void);
+
+/* Free resources */
+void sb_series_done(void);
+
+#endif /* SB_SERIES_H */
@@ -0,0 +1,513 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Host statistics are read from /proc/stat, /proc/diskstats, /proc/meminfo
+  and /proc/self/stat by the reporting thread only, so sampling has no
+  effect on worker threads.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#ifdef _WIN32
+# include "sb_win.h"
+#endif
+
+#ifdef STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "sysbench.h"
+#include "sb_sysstat.h"
+
+/* Maximum number of block devices we keep track of */
+#define SYSSTAT_MAX_DEVICES 64
+
+/* Sectors in /proc/diskstats are always 512 bytes */
+#define SECTOR_SIZE 512
+
+#define MB (1024.0 * 1024.0)
+
+/* CPU statistics from /proc/stat */
+
+typedef struct
+{
+  unsigned long long user;
+  unsigned long long nice;
+  unsigned long long system;
+  unsigned long long idle;
+  unsigned long long iowait;
+  unsigned long long irq;
+  unsigned long long softirq;
+  unsigned long long steal;
+  unsigned long long ctxt;
+  unsigned long long procs_running;
+  unsigned long long procs_blocked;
+} cpu_stat_t;
+
+/* Block device statistics from /proc/diskstats */
+
+typedef struct
+{
+  char               name[32];
+  unsigned long long reads;
+  unsigned long long reads_merged;
+  unsigned long long sectors_read;
+  unsigned long long read_ms;
+  unsigned long long writes;
+  unsigned long long writes_merged;
+  unsigned long long sectors_written;
+  unsigned long long write_ms;
+  unsigned long long io_ms;
+  unsigned long long weighted_io_ms;
+  int                seen;
+} disk_stat_t;
+
+/* A full sample */
+
+typedef struct
+{
+  struct timespec    time;
+  cpu_stat_t         cpu;
+  disk_stat_t        disks[SYSSTAT_MAX_DEVICES];
+  unsigned int       ndisks;
+  unsigned long long dirty_kb;
+  unsigned long long writeback_kb;
+  unsigned long long proc_utime;   /* clock ticks */
+  unsigned long long proc_stime;   /* clock ticks */
+  unsigned long long proc_rss;     /* pages */
+} sysstat_sample_t;
+
+/* Sysstat options */
+
+static sb_arg_t sysstat_args[] =
+{
+  {"report-sysstat", "with --report-interval, also report host CPU, "
+   "disk, memory and sysbench process statistics for each interval",
+   SB_ARG_TYPE_FLAG, "off"},
+  {"report-sysstat-devices", "comma-separated list of block devices to "
+   "report. By default all whole disks with I/O in the interval are reported",
+   SB_ARG_TYPE_LIST, ""},
+  {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
+};
+
+int sb_sysstat_enabled;
+
+static sysstat_sample_t samples[2];
+static unsigned int     cur;
+static int              formatted;  /* appended to the interval report */
+static sb_list_t        *devices;
+static long             clk_tck;
+static long             page_size;
+
+
+/* Register command line options */
+
+
+int sb_sysstat_register(void)
+{
+  return sb_register_arg_set(sysstat_args);
+}
+
+
+/* Print command line options */
+
+
+void sb_sysstat_print_help(void)
+{
+  printf("Host statistics options:\n");
+  sb_print_options(sysstat_args);
+}
+
+
+/* Parse options and check that statistics sources are available */
+
+
+int sb_sysstat_init(void)
+{
+  if (!sb_get_value_flag("report-sysstat") ||
+      sb_globals.command != SB_COMMAND_RUN)
+    return 0;
+
+  if (sb_globals.report_interval == 0)
+    log_text(LOG_WARNING, "--report-sysstat has no effect without "
+             "--report-interval");
+
+  if (access("/proc/stat", R_OK))
+  {
+    log_text(LOG_FATAL, "--report-sysstat requires /proc/stat");
+    return 1;
+  }
+
+  devices = sb_get_value_list("report-sysstat-devices");
+
+  clk_tck = sysconf(_SC_CLK_TCK);
+  page_size = sysconf(_SC_PAGESIZE);
+  if (clk_tck <= 0)
+    clk_tck = 100;
+  if (page_size <= 0)
+    page_size = 4096;
+
+  sb_sysstat_enabled = 1;
+
+  return 0;
+}
+
+
+/*
+  fgets() that skips the rest of a line longer than the buffer, e.g. "intr"
+  in /proc/stat, so that its tail is not read as a line of its own
+*/
+
+
+static char *read_line(char *buf, int size, FILE *fp)
+{
+  size_t len;
+  int    c;
+
+  if (fgets(buf, size, fp) == NULL)
+    return NULL;
+
+  len = strlen(buf);
+  if (len > 0 && buf[len - 1] != '\n')
+    while ((c = getc(fp)) != EOF && c != '\n')
+      ;
+
+  return buf;
+}
+
+
+static void read_cpu_stat(cpu_stat_t *cpu)
+{
+  FILE *fp;
+  char buf[1024];
+
+  memset(cpu, 0, sizeof(cpu_stat_t));
+
+  if ((fp = fopen("/proc/stat", "r")) == NULL)
+    return;
+
+  while (read_line(buf, sizeof(buf), fp) != NULL)
+  {
+    if (!strncmp(buf, "cpu ", 4))
+      sscanf(buf + 4, "%llu %llu %llu %llu %llu %llu %llu %llu",
+             &cpu->user, &cpu->nice, &cpu->system, &cpu->idle, &cpu->iowait,
+             &cpu->irq, &cpu->softirq, &cpu->steal);
+    else if (!strncmp(buf, "ctxt ", 5))
+      sscanf(buf + 5, "%llu", &cpu->ctxt);
+    else if (!strncmp(buf, "procs_running ", 14))
+      sscanf(buf + 14, "%llu", &cpu->procs_running);
+    else if (!strncmp(buf, "procs_blocked ", 14))
+      sscanf(buf + 14, "%llu", &cpu->procs_blocked);
+  }
+
+  fclose(fp);
+}
+
+
+/* Check whether a device should be reported */
+
+
+static int device_wanted(const char *name)
+{
+  sb_list_item_t *pos;
+  value_t        *val;
+  char           path[64];
+  int            have_list = 0;
+
+  SB_LIST_FOR_EACH(pos, devices)
+  {
+    val = SB_LIST_ENTRY(pos, value_t, listitem);
+    if (val->data[0] == '\0')
+      continue;
+    have_list = 1;
+    if (!strcmp(val->data, name))
+      return 1;
+  }
+
+  if (have_list)
+    return 0;
+
+  if (!strncmp(name, "loop", 4) || !strncmp(name, "ram", 3))
+    return 0;
+
+  /* Skip partitions, only whole disks have entries in /sys/block */
+  snprintf(path, sizeof(path), "/sys/block/%s", name);
+  if (access("/sys/block", F_OK) == 0 && access(path, F_OK) != 0)
+    return 0;
+
+  return 1;
+}
+
+
+static void read_disk_stat(sysstat_sample_t *s)
+{
+  FILE        *fp;
+  char        buf[1024];
+  disk_stat_t d;
+
+  s->ndisks = 0;
+
+  if ((fp = fopen("/proc/diskstats", "r")) == NULL)
+    return;
+
+  while (read_line(buf, sizeof(buf), fp) != NULL &&
+         s->ndisks < SYSSTAT_MAX_DEVICES)
+  {
+    memset(&d, 0, sizeof(d));
+    if (sscanf(buf, "%*u %*u %31s %llu %llu %llu %llu %llu %llu %llu %llu "
+               "%*u %llu %llu", d.name, &d.reads, &d.reads_merged,
+               &d.sectors_read, &d.read_ms, &d.writes, &d.writes_merged,
+               &d.sectors_written, &d.write_ms, &d.io_ms,
+               &d.weighted_io_ms) != 11)
+      continue;
+
+    if (!device_wanted(d.name))
+      continue;
+
+    s->disks[s->ndisks++] = d;
+  }
+
+  fclose(fp);
+}
+
+
+static void read_meminfo(sysstat_sample_t *s)
+{
+  FILE *fp;
+  char buf[256];
+
+  s->dirty_kb = s->writeback_kb = 0;
+
+  if ((fp = fopen("/proc/meminfo", "r")) == NULL)
+    return;
+
+  while (read_line(buf, sizeof(buf), fp) != NULL)
+  {
+    if (!strncmp(buf, "Dirty:", 6))
+      sscanf(buf + 6, "%llu", &s->dirty_kb);
+    else if (!strncmp(buf, "Writeback:", 10))
+      sscanf(buf + 10, "%llu", &s->writeback_kb);
+  }
+
+  fclose(fp);
+}
+
+
+static void read_self_stat(sysstat_sample_t *s)
+{
+  FILE *fp;
+  char buf[1024];
+  char *p;
+
+  s->proc_utime = s->proc_stime = s->proc_rss = 0;
+
+  if ((fp = fopen("/proc/self/stat", "r")) == NULL)
+    return;
+
+  if (read_line(buf, sizeof(buf), fp) != NULL &&
+      (p = strrchr(buf, ')')) != NULL)
+  {
+    /* Fields after the command name, starting from field 3 (state) */
+    sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu "
+           "%*d %*d %*d %*d %*d %*d %*u %*u %llu",
+           &s->proc_utime, &s->proc_stime, &s->proc_rss);
+  }
+
+  fclose(fp);
+}
+
+
+static void take_sample(sysstat_sample_t *s)
+{
+  SB_GETTIME(&s->time);
+  read_cpu_stat(&s->cpu);
+  read_disk_stat(s);
+  read_meminfo(s);
+  read_self_stat(s);
+}
+
+
+/* Take the initial sample */
+
+
+void sb_sysstat_start(void)
+{
+  if (!sb_sysstat_enabled)
+    return;
+
+  cur = 0;
+  take_sample(&samples[cur]);
+}
+
+
+static disk_stat_t *find_disk(sysstat_sample_t *s, const char *name)
+{
+  unsigned int i;
+
+  for (i = 0; i < s->ndisks; i++)
+    if (!strcmp(s->disks[i].name, name))
+      return s->disks + i;
+
+  return NULL;
+}
+
+
+/* Take a sample and format differences since the previous one */
+
+
+void sb_sysstat_format(char *buf, size_t len)
+{
+  sysstat_sample_t   *prev;
+  sysstat_sample_t   *s;
+  cpu_stat_t         *c0, *c1;
+  unsigned long long total;
+  double             seconds;
+  double             ms;
+  unsigned int       i;
+  size_t             n;
+
+  buf[0] = '\0';
+
+  if (!sb_sysstat_enabled)
+    return;
+
+  formatted = 1;
+
+  prev = &samples[cur];
+  cur = !cur;
+  s = &samples[cur];
+
+  take_sample(s);
+
+  seconds = NS2SEC(TIMESPEC_DIFF(s->time, prev->time));
+  if (seconds <= 0)
+    return;
+  ms = seconds * 1000;
+
+  /* CPU */
+  c0 = &prev->cpu;
+  c1 = &s->cpu;
+  total = (c1->user + c1->nice + c1->system + c1->idle + c1->iowait +
+           c1->irq + c1->softirq + c1->steal) -
+    (c0->user + c0->nice + c0->system + c0->idle + c0->iowait +
+     c0->irq + c0->softirq + c0->steal);
+  if (total == 0)
+    total = 1;
+
+  n = snprintf(buf, len,
+               "; host cpu usr: %.1f%%, sys: %.1f%%, iowait: %.1f%%, "
+               "idle: %.1f%%, steal: %.1f%%, cs/s: %.0f, running: %llu, "
+               "blocked: %llu",
+               (c1->user + c1->nice - c0->user - c0->nice) * 100.0 / total,
+               (c1->system + c1->irq + c1->softirq - c0->system - c0->irq -
+                c0->softirq) * 100.0 / total,
+               (c1->iowait - c0->iowait) * 100.0 / total,
+               (c1->idle - c0->idle) * 100.0 / total,
+               (c1->steal - c0->steal) * 100.0 / total,
+               (c1->ctxt - c0->ctxt) / seconds, c1->procs_running,
+               c1->procs_blocked);
+
+  /* Disks */
+  for (i = 0; i < s->ndisks && n < len; i++)
+  {
+    disk_stat_t        *d1 = s->disks + i;
+    disk_stat_t        *d0 = find_disk(prev, d1->name);
+    unsigned long long ios;
+
+    if (d0 == NULL)
+      continue;
+
+    ios = (d1->reads - d0->reads) + (d1->writes - d0->writes);
+
+    /* Only show idle devices when they were explicitly requested */
+    if (ios == 0 && d1->io_ms == d0->io_ms &&
+        SB_LIST_IS_EMPTY(devices))
+      continue;
+
+    n += snprintf(buf + n, len - n,
+                  "; disk %s r/s: %.2f, w/s: %.2f, rMB/s: %.2f, "
+                  "wMB/s: %.2f, rrqm/s: %.2f, wrqm/s: %.2f, await: %.2fms, "
+                  "aqu-sz: %.2f, util: %.1f%%", d1->name,
+                  (d1->reads - d0->reads) / seconds,
+                  (d1->writes - d0->writes) / seconds,
+                  (d1->sectors_read - d0->sectors_read) * SECTOR_SIZE /
+                  MB / seconds,
+                  (d1->sectors_written - d0->sectors_written) * SECTOR_SIZE /
+                  MB / seconds,
+                  (d1->reads_merged - d0->reads_merged) / seconds,
+                  (d1->writes_merged - d0->writes_merged) / seconds,
+                  ios > 0 ? (double) ((d1->read_ms - d0->read_ms) +
+                                      (d1->write_ms - d0->write_ms)) / ios : 0,
+                  (d1->weighted_io_ms - d0->weighted_io_ms) / ms,
+                  (d1->io_ms - d0->io_ms) * 100.0 / ms);
+  }
+
+  /* Memory and the sysbench process */
+  if (n < len)
+    snprintf(buf + n, len - n,
+             "; mem dirty: %.2fMiB, writeback: %.2fMiB; sysbench rss: "
+             "%.2fMiB, cpu: %.1f%% (usr: %.1f%%, sys: %.1f%%)",
+             s->dirty_kb / 1024.0, s->writeback_kb / 1024.0,
+             (double) s->proc_rss * page_size / MB,
+             ((s->proc_utime + s->proc_stime) -
+              (prev->proc_utime + prev->proc_stime)) * 100.0 /
+             clk_tck / seconds,
+             (s->proc_utime - prev->proc_utime) * 100.0 / clk_tck / seconds,
+             (s->proc_stime - prev->proc_stime) * 100.0 / clk_tck /
+             seconds);
+}
+
+
+/*
+  Print statistics as a separate record, unless the test has already
+  appended them to its interval report
+*/
+
+
+void sb_sysstat_print(void)
+{
+  char buf[SB_SYSSTAT_MAX_LINE];
+
+  if (!sb_sysstat_enabled)
+    return;
+
+  if (!formatted)
+  {
+    sb_sysstat_format(buf, sizeof(buf));
+    if (buf[0] != '\0')
+      log_timestamp(LOG_NOTICE, &sb_globals.exec_timer, "%s", buf + 2);
+  }
+
+  formatted = 0;
+}
+
+
+/* Free resources */
+
+
+void sb_sysstat_done(void)
+{
+  sb_sysstat_enabled = 0;
+}
@@ -0,0 +1,61 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Host resource sampling (CPU, disks, memory, sysbench process) appended to
+  intermediate reports.
+*/
+
+#ifndef SB_SYSSTAT_H
+#define SB_SYSSTAT_H
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+/* Non-zero when host resource sampling is enabled */
+extern int sb_sysstat_enabled;
+
+/* Register command line options */
+int sb_sysstat_register(void);
+
+/* Print command line options */
+void sb_sysstat_print_help(void);
+
+/* Parse options and check that statistics sources are available */
+int sb_sysstat_init(void);
+
+/* Take the initial sample */
+void sb_sysstat_start(void);
+
+/* Maximum length of the text written by sb_sysstat_format() */
+#define SB_SYSSTAT_MAX_LINE 4096
+
+/*
+  Take a sample and write differences since the previous one to buf, to be
+  appended to the interval report line of a test. Empty when disabled.
+*/
+void sb_sysstat_format(char *buf, size_t len);
+
+/* Print statistics for tests that did not append them in the interval */
+void sb_sysstat_print(void);
+
+/* Free resources */
+void sb_sysstat_done(void);
+
+#endif /* SB_SYSSTAT_H */
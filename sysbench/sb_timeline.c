@@ -0,0 +1,402 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  The interval sampler reads per-thread event counters from sb_metrics at
+  fixed intervals and stores per-interval deltas as 32-bit values, one row of
+  --num-threads values per interval. A thread is considered starved when it
+  completes no events for --starvation-window consecutive intervals. With
+  --max-requests threads may finish at different times, so trailing idle
+  intervals are not counted as starvation in that case.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#ifdef _WIN32
+# include "sb_win.h"
+#endif
+
+#ifdef STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+#endif
+#ifdef HAVE_MATH_H
+# include <math.h>
+#endif
+
+#include "sysbench.h"
+#include "sb_metrics.h"
+#include "sb_sampler.h"
+#include "sb_timeline.h"
+
+/* Maximum number of starved threads listed in the final report */
+#define TIMELINE_MAX_LISTED 10
+
+/* Timeline options */
+
+static sb_arg_t timeline_args[] =
+{
+  {"thread-timeline", "record per-thread events per interval and report "
+   "thread fairness over time and starvation", SB_ARG_TYPE_FLAG, "off"},
+  {"thread-timeline-interval", "sampling interval in seconds",
+   SB_ARG_TYPE_INT, "1"},
+  {"starvation-window", "number of consecutive intervals without progress "
+   "after which a thread is considered starved", SB_ARG_TYPE_INT, "5"},
+  {"thread-heatmap", "write per-thread events per interval to the specified "
+   "CSV file (one row per interval, one column per thread)",
+   SB_ARG_TYPE_STRING, NULL},
+  {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
+};
+
+int sb_timeline_enabled;
+
+static unsigned int       interval;
+static unsigned int       window;
+static char               *heatmap_path;
+
+static unsigned int       *samples;      /* nintervals x num_threads */
+static unsigned int       nintervals;
+static unsigned int       intervals_size;
+static unsigned long long *prev_events;
+static unsigned int       *idle_run;     /* current run of idle intervals */
+static unsigned int       starved_now;   /* threads currently starved */
+
+
+/* Register command line options */
+
+
+int sb_timeline_register(void)
+{
+  return sb_register_arg_set(timeline_args);
+}
+
+
+/* Print command line options */
+
+
+void sb_timeline_print_help(void)
+{
+  printf("Thread timeline options:\n");
+  sb_print_options(timeline_args);
+}
+
+
+/* Parse options */
+
+
+int sb_timeline_init(void)
+{
+  int val;
+
+  if (!sb_get_value_flag("thread-timeline") ||
+      sb_globals.command != SB_COMMAND_RUN)
+    return 0;
+
+  val = sb_get_value_int("thread-timeline-interval");
+  if (val <= 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for --thread-timeline-interval: %d",
+             val);
+    return 1;
+  }
+  interval = (unsigned int) val;
+
+  val = sb_get_value_int("starvation-window");
+  if (val <= 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for --starvation-window: %d", val);
+    return 1;
+  }
+  window = (unsigned int) val;
+
+  heatmap_path = sb_get_value_string("thread-heatmap");
+  if (heatmap_path != NULL && heatmap_path[0] == '\0')
+    heatmap_path = NULL;
+
+  prev_events = (unsigned long long *)
+    calloc(sb_globals.num_threads, sizeof(unsigned long long));
+  idle_run = (unsigned int *) calloc(sb_globals.num_threads,
+                                     sizeof(unsigned int));
+  if (prev_events == NULL || idle_run == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure");
+    return 1;
+  }
+
+  sb_timeline_enabled = 1;
+
+  return 0;
+}
+
+
+/* Record one interval, called by the interval sampler */
+
+
+static void timeline_sample(unsigned long long curr_ns)
+{
+  unsigned int       *row;
+  unsigned long long events;
+  unsigned int       i;
+  unsigned int       starved = 0;
+
+  (void) curr_ns; /* unused */
+
+  if (nintervals == intervals_size)
+  {
+    unsigned int *tmp;
+    unsigned int size = intervals_size > 0 ? intervals_size * 2 : 64;
+
+    tmp = (unsigned int *) realloc(samples, (size_t) size *
+                                   sb_globals.num_threads *
+                                   sizeof(unsigned int));
+    if (tmp == NULL)
+      return;
+    samples = tmp;
+    intervals_size = size;
+  }
+
+  row = samples + (size_t) nintervals * sb_globals.num_threads;
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    events = sb_thread_metrics[i].events;
+    row[i] = (unsigned int) (events - prev_events[i]);
+    prev_events[i] = events;
+
+    if (row[i] > 0)
+      idle_run[i] = 0;
+    else if (++idle_run[i] >= window)
+      starved++;
+  }
+
+  nintervals++;
+
+  /* Report changes in the number of starved threads as they happen */
+  if (starved != starved_now && sb_globals.num_running > 0)
+  {
+    if (starved > 0)
+      log_timestamp(LOG_WARNING, &sb_globals.exec_timer,
+                    "%u of %u threads made no progress in the last %u "
+                    "intervals", starved, sb_globals.num_threads, window);
+    else
+      log_timestamp(LOG_NOTICE, &sb_globals.exec_timer,
+                    "all threads are making progress again");
+    starved_now = starved;
+  }
+}
+
+
+/* Register with the interval sampler */
+
+
+int sb_timeline_start(void)
+{
+  if (!sb_timeline_enabled)
+    return 0;
+
+  nintervals = 0;
+  starved_now = 0;
+
+  return sb_sampler_add(interval, &timeline_sample);
+}
+
+
+/* Write the heatmap CSV file */
+
+
+static void write_heatmap(void)
+{
+  FILE         *fp;
+  unsigned int i, j;
+  unsigned int *row;
+
+  if ((fp = fopen(heatmap_path, "w")) == NULL)
+  {
+    log_errno(LOG_FATAL, "Cannot open heatmap file '%s'", heatmap_path);
+    return;
+  }
+
+  fprintf(fp, "time");
+  for (j = 0; j < sb_globals.num_threads; j++)
+    fprintf(fp, ",thread%u", j);
+  fprintf(fp, "\n");
+
+  for (i = 0; i < nintervals; i++)
+  {
+    row = samples + (size_t) i * sb_globals.num_threads;
+    fprintf(fp, "%u", (i + 1) * interval);
+    for (j = 0; j < sb_globals.num_threads; j++)
+      fprintf(fp, ",%u", row[j]);
+    fprintf(fp, "\n");
+  }
+
+  if (fclose(fp))
+    log_errno(LOG_FATAL, "Cannot write heatmap file '%s'", heatmap_path);
+  else
+    log_text(LOG_NOTICE, "Thread heatmap written to '%s'\n", heatmap_path);
+}
+
+
+/* Print fairness and starvation statistics, write the heatmap file */
+
+
+void sb_timeline_print_stats(void)
+{
+  unsigned int  nthreads = sb_globals.num_threads;
+  unsigned int  i, j, k;
+  unsigned int  *row;
+  double        mean, sq, cv;
+  double        cv_sum = 0;
+  double        cv_max = 0;
+  unsigned int  cv_max_at = 0;
+  unsigned int  cv_n = 0;
+  unsigned int  *longest;
+  unsigned int  *episodes;
+  unsigned int  run, end;
+  unsigned int  starved_threads = 0;
+  unsigned int  total_episodes = 0;
+  unsigned int  listed = 0;
+  unsigned long long total;
+
+  if (!sb_timeline_enabled)
+    return;
+
+  if (nintervals == 0)
+  {
+    log_text(LOG_WARNING, "No thread timeline intervals were recorded, "
+             "consider a longer test or a shorter "
+             "--thread-timeline-interval\n");
+    return;
+  }
+
+  /* Fairness within each interval */
+  for (i = 0; i < nintervals; i++)
+  {
+    row = samples + (size_t) i * nthreads;
+
+    for (j = 0, total = 0; j < nthreads; j++)
+      total += row[j];
+    if (total == 0)
+      continue;
+
+    mean = (double) total / nthreads;
+    for (j = 0, sq = 0; j < nthreads; j++)
+      sq += (row[j] - mean) * (row[j] - mean);
+    cv = sqrt(sq / nthreads) * 100 / mean;
+
+    cv_sum += cv;
+    cv_n++;
+    if (cv > cv_max)
+    {
+      cv_max = cv;
+      cv_max_at = (i + 1) * interval;
+    }
+  }
+
+  /* Starvation episodes per thread */
+  longest = (unsigned int *) calloc(nthreads, sizeof(unsigned int));
+  episodes = (unsigned int *) calloc(nthreads, sizeof(unsigned int));
+  if (longest == NULL || episodes == NULL)
+  {
+    free(longest);
+    free(episodes);
+    return;
+  }
+
+  for (j = 0; j < nthreads; j++)
+  {
+    end = nintervals;
+
+    /* Ignore idle intervals after a thread has completed its requests */
+    if (sb_globals.max_requests > 0)
+      while (end > 0 && samples[(size_t) (end - 1) * nthreads + j] == 0)
+        end--;
+
+    for (i = 0, run = 0; i <= end; i++)
+    {
+      if (i < end && samples[(size_t) i * nthreads + j] == 0)
+      {
+        run++;
+        continue;
+      }
+
+      if (run >= window)
+        episodes[j]++;
+      if (run > longest[j])
+        longest[j] = run;
+      run = 0;
+    }
+
+    if (episodes[j] > 0)
+    {
+      starved_threads++;
+      total_episodes += episodes[j];
+    }
+  }
+
+  log_text(LOG_NOTICE, "Threads fairness over time:");
+  log_text(LOG_NOTICE, "    intervals recorded:            %u x %us",
+           nintervals, interval);
+  log_text(LOG_NOTICE, "    events CV across threads (avg/max): "
+           "%.2f%%/%.2f%% (max at %us)", cv_n > 0 ? cv_sum / cv_n : 0,
+           cv_max, cv_max_at);
+  log_text(LOG_NOTICE, "    starved threads:               %u of %u "
+           "(%u episodes of %u+ idle intervals)%s", starved_threads, nthreads,
+           total_episodes, window, starved_threads == 0 ? "\n" : "");
+
+  for (j = 0; j < nthreads && listed < TIMELINE_MAX_LISTED; j++)
+  {
+    if (episodes[j] == 0)
+      continue;
+
+    for (k = 0, total = 0; k < nintervals; k++)
+      total += samples[(size_t) k * nthreads + j];
+    listed++;
+
+    log_text(LOG_NOTICE, "        thread %u: %u episodes, longest %us, "
+             "%llu events total%s", j, episodes[j], longest[j] * interval,
+             total, listed == starved_threads ? "\n" : "");
+  }
+  if (listed < starved_threads)
+    log_text(LOG_NOTICE, "        ... %u more\n", starved_threads - listed);
+
+  free(longest);
+  free(episodes);
+
+  if (heatmap_path != NULL)
+    write_heatmap();
+}
+
+
+/* Free resources */
+
+
+void sb_timeline_done(void)
+{
+  free(samples);
+  free(prev_events);
+  free(idle_run);
+  samples = NULL;
+  prev_events = NULL;
+  idle_run = NULL;
+  nintervals = intervals_size = 0;
+
+  sb_timeline_enabled = 0;
+}
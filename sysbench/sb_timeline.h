@@ -0,0 +1,52 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Per-thread throughput timeline, fairness over time and starvation
+  detection.
+*/
+
+#ifndef SB_TIMELINE_H
+#define SB_TIMELINE_H
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+/* Non-zero when the per-thread timeline is recorded */
+extern int sb_timeline_enabled;
+
+/* Register command line options */
+int sb_timeline_register(void);
+
+/* Print command line options */
+void sb_timeline_print_help(void);
+
+/* Parse options */
+int sb_timeline_init(void);
+
+/* Register with the interval sampler */
+int sb_timeline_start(void);
+
+/* Print fairness and starvation statistics, write the heatmap file */
+void sb_timeline_print_stats(void);
+
+/* Free resources */
+void sb_timeline_done(void);
+
+#endif /* SB_TIMELINE_H */
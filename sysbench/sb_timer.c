@@ -27,10 +27,37 @@
 #ifdef HAVE_STRING_H
 # include <string.h>
 #endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_CPUID_H
+# include <cpuid.h>
+#endif
 
 #include "sb_logger.h"
 #include "sb_timer.h"
 
+/* Duration of a single TSC calibration round in microseconds */
+#define TSC_CALIBRATION_US 50000
+
+/* Maximum relative difference between TSC calibration rounds */
+#define TSC_MAX_DRIFT 0.001
+
+/* Number of calls used to measure the timer overhead */
+#define OVERHEAD_CALLS 100000
+
+sb_timer_source_t  sb_timer_source = SB_TIMER_MONOTONIC;
+unsigned long long sb_timer_overhead;
+
+#ifdef SB_HAVE_TSC
+unsigned long long sb_tsc_base;
+unsigned long long sb_tsc_base_ns;
+double             sb_tsc_ns_per_tick;
+#endif
+
+/* Whether the timer overhead is subtracted from measured event times */
+static int subtract_overhead;
+
 /* Some functions for simple time operations */
 
 static inline void sb_timer_update(sb_timer_t *t)
@@ -80,6 +107,18 @@ int sb_timer_running(sb_timer_t *t)
 
 
 void sb_timer_start(sb_timer_t *t)
+{
+  struct timespec now;
+
+  SB_GETTIME(&now);
+  sb_timer_start_at(t, &now);
+}
+
+
+/* start timer at the specified time in the past */
+
+
+void sb_timer_start_at(sb_timer_t *t, const struct timespec *start)
 {
   switch (t->state) {
     case TIMER_INITIALIZED:
@@ -92,17 +131,17 @@ void sb_timer_start(sb_timer_t *t)
       log_text(LOG_FATAL, "uninitialized timer started");
       abort();
   }
-  
-  SB_GETTIME(&t->time_start);
+
+  t->time_start = *start;
   t->time_split = t->time_start;
   t->state = TIMER_RUNNING;
 }
 
 
-/* stop timer */
+/* Stop timer, optionally subtracting the measured timer overhead */
 
 
-void sb_timer_stop(sb_timer_t *t)
+static void timer_stop(sb_timer_t *t, int subtract)
 {
   switch (t->state) {
     case TIMER_INITIALIZED:
@@ -119,6 +158,9 @@ void sb_timer_stop(sb_timer_t *t)
   }
 
   sb_timer_update(t);
+  if (subtract)
+    t->elapsed = t->elapsed > sb_timer_overhead ?
+      t->elapsed - sb_timer_overhead : 0;
   t->events++;
   t->sum_time += t->elapsed;
   if (t->elapsed < t->min_time)
@@ -130,6 +172,24 @@ void sb_timer_stop(sb_timer_t *t)
 }
 
 
+/* stop timer */
+
+
+void sb_timer_stop(sb_timer_t *t)
+{
+  timer_stop(t, 0);
+}
+
+
+/* stop event timer */
+
+
+void sb_timer_stop_event(sb_timer_t *t)
+{
+  timer_stop(t, subtract_overhead);
+}
+
+
 /* get the current timer value in nanoseconds */
 
 
@@ -287,3 +347,155 @@ void add_ns_to_timespec(struct timespec *dest, long long delta)
     dest->tv_nsec = x;
   }
 }
+
+
+#ifdef SB_HAVE_TSC
+
+/*
+  Read TSC and CLOCK_MONOTONIC as close to each other as possible. Several
+  attempts are made and the one with the shortest TSC window is used.
+*/
+
+static void tsc_sample(unsigned long long *tsc, unsigned long long *ns)
+{
+  struct timespec    ts;
+  unsigned long long a, b;
+  unsigned long long best = 0xffffffffffffffffULL;
+  unsigned int       i;
+
+  for (i = 0; i < 10; i++)
+  {
+    a = sb_rdtsc();
+    SB_CLOCK_GETTIME(&ts);
+    b = sb_rdtsc();
+
+    if (b - a < best)
+    {
+      best = b - a;
+      *tsc = a + (b - a) / 2;
+      *ns = SEC2NS((unsigned long long) ts.tv_sec) + ts.tv_nsec;
+    }
+  }
+}
+
+
+/* Measure the TSC period over a short sleep */
+
+
+static double tsc_calibrate(void)
+{
+  unsigned long long tsc0, tsc1, ns0, ns1;
+
+  tsc_sample(&tsc0, &ns0);
+  usleep(TSC_CALIBRATION_US);
+  tsc_sample(&tsc1, &ns1);
+
+  if (tsc1 <= tsc0)
+    return 0;
+
+  return (double) (ns1 - ns0) / (tsc1 - tsc0);
+}
+
+
+/* Check the CPU for an invariant (constant rate, non-stop) TSC */
+
+
+static int tsc_invariant(void)
+{
+#ifdef HAVE_CPUID_H
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+    return 0;
+
+  return (edx & (1U << 8)) != 0;
+#else
+  log_text(LOG_WARNING, "Cannot check for invariant TSC on this platform");
+  return 1;
+#endif
+}
+
+
+static int tsc_init(void)
+{
+  double r1, r2;
+
+  if (!tsc_invariant())
+  {
+    log_text(LOG_WARNING, "The CPU does not report an invariant TSC, "
+             "falling back to CLOCK_MONOTONIC");
+    return 1;
+  }
+
+  r1 = tsc_calibrate();
+  r2 = tsc_calibrate();
+
+  if (r1 <= 0 || r2 <= 0 ||
+      (r1 > r2 ? r1 - r2 : r2 - r1) / r1 > TSC_MAX_DRIFT)
+  {
+    log_text(LOG_WARNING, "TSC rate is not stable (%.6f vs %.6f ns per "
+             "tick), falling back to CLOCK_MONOTONIC", r1, r2);
+    return 1;
+  }
+
+  sb_tsc_ns_per_tick = (r1 + r2) / 2;
+  tsc_sample(&sb_tsc_base, &sb_tsc_base_ns);
+
+  return 0;
+}
+
+#endif /* SB_HAVE_TSC */
+
+
+/* Measure the average cost of a single SB_GETTIME() call */
+
+
+static unsigned long long measure_overhead(void)
+{
+  struct timespec    start, end, tmp;
+  unsigned int       i;
+
+  SB_CLOCK_GETTIME(&start);
+  for (i = 0; i < OVERHEAD_CALLS; i++)
+    SB_GETTIME(&tmp);
+  SB_CLOCK_GETTIME(&end);
+
+  return TIMESPEC_DIFF(end, start) / OVERHEAD_CALLS;
+}
+
+
+/*
+  Select the timestamp source, calibrating and checking the TSC if
+  requested, and measure the timer overhead.
+*/
+
+
+int sb_timer_select_source(sb_timer_source_t source, int subtract)
+{
+  sb_timer_source = SB_TIMER_MONOTONIC;
+
+  if (source == SB_TIMER_TSC)
+  {
+#ifdef SB_HAVE_TSC
+    if (!tsc_init())
+      sb_timer_source = SB_TIMER_TSC;
+#else
+    log_text(LOG_FATAL, "TSC timer is not supported on this platform");
+    return 1;
+#endif
+  }
+
+  sb_timer_overhead = measure_overhead();
+  subtract_overhead = subtract;
+
+  return 0;
+}
+
+
+/* Name of the current timestamp source */
+
+
+const char *sb_timer_source_name(void)
+{
+  return sb_timer_source == SB_TIMER_TSC ? "TSC" : "CLOCK_MONOTONIC";
+}
@@ -52,9 +52,9 @@
 
 /* Wrapper over various *gettime* functions */
 #ifdef HAVE_CLOCK_GETTIME
-# define SB_GETTIME(tsp) clock_gettime(CLOCK_MONOTONIC, tsp)
+# define SB_CLOCK_GETTIME(tsp) clock_gettime(CLOCK_MONOTONIC, tsp)
 #else
-# define SB_GETTIME(tsp)                        \
+# define SB_CLOCK_GETTIME(tsp)                  \
   do {                                          \
     struct timeval tv;                          \
     gettimeofday(&tv, NULL);                    \
@@ -63,6 +63,69 @@
   } while (0)
 #endif
 
+/* Timestamp sources */
+
+typedef enum
+{
+  SB_TIMER_MONOTONIC,  /* clock_gettime(CLOCK_MONOTONIC) */
+  SB_TIMER_TSC         /* invariant TSC calibrated against CLOCK_MONOTONIC */
+} sb_timer_source_t;
+
+/* Currently used timestamp source */
+extern sb_timer_source_t sb_timer_source;
+
+/* Measured cost of a single SB_GETTIME() call in nanoseconds */
+extern unsigned long long sb_timer_overhead;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+# define SB_HAVE_TSC 1
+
+/* TSC calibration data */
+extern unsigned long long sb_tsc_base;     /* TSC value at calibration */
+extern unsigned long long sb_tsc_base_ns;  /* CLOCK_MONOTONIC at calibration */
+extern double             sb_tsc_ns_per_tick;
+
+static inline unsigned long long sb_rdtsc(void)
+{
+  unsigned int lo, hi;
+
+  __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+
+  return ((unsigned long long) hi << 32) | lo;
+}
+
+/*
+  Convert the current TSC value to CLOCK_MONOTONIC time. TSC values below the
+  calibration base, e.g. read on a CPU whose TSC is behind the one used for
+  calibration, are clamped to the base.
+*/
+static inline void sb_tsc_gettime(struct timespec *tsp)
+{
+  unsigned long long tsc = sb_rdtsc();
+  unsigned long long ns = sb_tsc_base_ns;
+
+  if (tsc > sb_tsc_base)
+    ns += (unsigned long long) ((tsc - sb_tsc_base) * sb_tsc_ns_per_tick);
+
+  tsp->tv_sec = ns / 1000000000ULL;
+  tsp->tv_nsec = ns % 1000000000ULL;
+}
+
+# define SB_GETTIME(tsp)                        \
+  do {                                          \
+    if (sb_timer_source == SB_TIMER_TSC)        \
+      sb_tsc_gettime(tsp);                      \
+    else                                        \
+      SB_CLOCK_GETTIME(tsp);                    \
+  } while (0)
+
+#else /* no TSC support */
+
+# define SB_GETTIME(tsp) SB_CLOCK_GETTIME(tsp)
+
+#endif
+
 typedef enum {TIMER_UNINITIALIZED, TIMER_INITIALIZED, TIMER_STOPPED, \
               TIMER_RUNNING} timer_state_t;
 
@@ -100,9 +163,18 @@ int sb_timer_running(sb_timer_t *t);
 /* start timer */
 void sb_timer_start(sb_timer_t *);
 
+/* start timer at the specified time in the past */
+void sb_timer_start_at(sb_timer_t *, const struct timespec *);
+
 /* stop timer */
 void sb_timer_stop(sb_timer_t *);
 
+/*
+  stop event timer, subtracting the measured timer overhead from the event
+  time if requested with sb_timer_select_source()
+*/
+void sb_timer_stop_event(sb_timer_t *);
+
 /* get the current timer value in nanoseconds */
 unsigned long long sb_timer_value(sb_timer_t *);
 
@@ -128,6 +200,16 @@ unsigned long long  get_max_time(sb_timer_t *);
 /* sum data from two timers. used in summing data from multiple threads */
 sb_timer_t merge_timers(sb_timer_t *, sb_timer_t *);
 
+/*
+  Select the timestamp source, calibrating and checking the TSC if
+  requested, and measure the timer overhead. Must be called before any
+  timers are started. Only needed for the 'run' command.
+*/
+int sb_timer_select_source(sb_timer_source_t source, int subtract_overhead);
+
+/* Name of the current timestamp source */
+const char *sb_timer_source_name(void);
+
 /* add a number of nanoseconds to a struct timespec */
 void add_ns_to_timespec(struct timespec *dest, long long delta);
 
@@ -0,0 +1,804 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Each worker thread appends records for sampled events to its own
+  single-producer/single-consumer ring buffer. A background writer thread
+  drains the rings into the trace file. Workers never block: when a ring is
+  full, the record is dropped and accounted in the 'dropped' counter.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#ifdef _WIN32
+# include "sb_win.h"
+#endif
+
+#ifdef STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "sysbench.h"
+#include "sb_trace.h"
+#include "sb_metrics.h"
+
+/* Interval between ring buffer drains in microseconds */
+#define TRACE_FLUSH_INTERVAL 10000
+
+/* Full memory barrier to order ring buffer accesses */
+#if defined(__GNUC__)
+# define trace_barrier() __sync_synchronize()
+#elif defined(_WIN32)
+# define trace_barrier() MemoryBarrier()
+#else
+# define trace_barrier() do { } while (0)
+#endif
+
+/* Per-thread trace state */
+
+typedef struct
+{
+  sb_trace_event_t            *ring;    /* ring buffer */
+  volatile unsigned long long head;     /* next slot to write, worker-owned */
+  volatile unsigned long long tail;     /* next slot to read, writer-owned */
+  unsigned long long          dropped;  /* records dropped on full ring */
+  unsigned long long          nevents;  /* events seen, used for sampling */
+  unsigned long long          errors;   /* error counter at the event start */
+  struct timespec             start;    /* start time of the current event */
+  int                         sampled;  /* is the current event sampled? */
+  char                        pad[64];  /* avoid false sharing */
+} trace_thread_t;
+
+/* Trace options */
+
+static sb_arg_t trace_args[] =
+{
+  {"trace-file", "record every (sampled) event into the specified binary "
+   "file. With the 'trace' command, the file to analyze",
+   SB_ARG_TYPE_STRING, NULL},
+  {"trace-sample", "record only every N-th event of each thread",
+   SB_ARG_TYPE_INT, "1"},
+  {"trace-buffer-size", "per-thread trace ring buffer size in events",
+   SB_ARG_TYPE_INT, "65536"},
+  {"trace-format", "output format of the 'trace' command {summary,csv,chrome}",
+   SB_ARG_TYPE_STRING, "summary"},
+  {"trace-from", "start of the analyzed window in seconds since the test start",
+   SB_ARG_TYPE_FLOAT, "0"},
+  {"trace-to", "end of the analyzed window in seconds since the test start. "
+   "0 means until the end of the trace", SB_ARG_TYPE_FLOAT, "0"},
+  {"trace-interval", "with the summary format, also report percentiles for "
+   "each interval of the specified length in seconds. 0 disables per-interval "
+   "output", SB_ARG_TYPE_INT, "0"},
+  {"trace-percentiles", "comma-separated list of percentiles to report",
+   SB_ARG_TYPE_LIST, "50,95,99,99.9"},
+  {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
+};
+
+int sb_trace_enabled;
+
+static trace_thread_t      *trace_threads;
+static unsigned int        ring_size;
+static unsigned int        sample_rate;
+static char                *trace_file_name;
+static FILE                *trace_file;
+static pthread_t           writer_thread;
+static int                 writer_thread_created;
+static volatile int        writer_stop;
+static unsigned long long  events_written;
+
+/* Names of request types, see sb_request_type_t */
+static const char *type_names[] =
+{
+  "null", "cpu", "memory", "fileio", "sql", "threads", "mutex", "script"
+};
+
+static const char *get_type_name(unsigned int type)
+{
+  if (type < sizeof(type_names) / sizeof(type_names[0]))
+    return type_names[type];
+
+  return "unknown";
+}
+
+
+/* Register command line options */
+
+
+int sb_trace_register(void)
+{
+  return sb_register_arg_set(trace_args);
+}
+
+
+/* Print command line options */
+
+
+void sb_trace_print_help(void)
+{
+  printf("Trace options:\n");
+  sb_print_options(trace_args);
+}
+
+
+/* Parse options and allocate per-thread buffers */
+
+
+int sb_trace_init(void)
+{
+  unsigned int i;
+  int          size;
+
+  trace_file_name = sb_get_value_string("trace-file");
+  if (trace_file_name == NULL || trace_file_name[0] == '\0' ||
+      sb_globals.command != SB_COMMAND_RUN)
+    return 0;
+
+  if (sb_get_value_int("trace-sample") < 1)
+  {
+    log_text(LOG_FATAL, "Invalid value for --trace-sample: %d",
+             sb_get_value_int("trace-sample"));
+    return 1;
+  }
+  sample_rate = (unsigned int) sb_get_value_int("trace-sample");
+
+  size = sb_get_value_int("trace-buffer-size");
+  if (size < 2)
+  {
+    log_text(LOG_FATAL, "Invalid value for --trace-buffer-size: %d", size);
+    return 1;
+  }
+  /* Round up to a power of 2 so we can use a mask for indexing */
+  for (ring_size = 2; ring_size < (unsigned int) size; ring_size <<= 1)
+    /* nothing */ ;
+
+  trace_threads = (trace_thread_t *) calloc(sb_globals.num_threads,
+                                            sizeof(trace_thread_t));
+  if (trace_threads == NULL)
+    goto error;
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    trace_threads[i].ring = (sb_trace_event_t *)
+      malloc(ring_size * sizeof(sb_trace_event_t));
+    if (trace_threads[i].ring == NULL)
+      goto error;
+  }
+
+  sb_trace_enabled = 1;
+
+  return 0;
+
+ error:
+  log_text(LOG_FATAL, "Memory allocation failure");
+  sb_trace_done();
+
+  return 1;
+}
+
+
+/* Write all pending records from per-thread rings */
+
+
+static void trace_drain(void)
+{
+  trace_thread_t     *t;
+  unsigned long long head;
+  unsigned long long tail;
+  unsigned int       i;
+  size_t             idx;
+  size_t             n;
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    t = &trace_threads[i];
+
+    head = t->head;
+    trace_barrier();
+    tail = t->tail;
+
+    while (tail < head)
+    {
+      idx = tail & (ring_size - 1);
+      n = head - tail;
+      if (n > ring_size - idx)
+        n = ring_size - idx;
+
+      if (fwrite(t->ring + idx, sizeof(sb_trace_event_t), n, trace_file) != n)
+      {
+        log_errno(LOG_FATAL, "Failed to write to the trace file '%s'",
+                  trace_file_name);
+        sb_globals.error = 1;
+      }
+
+      tail += n;
+      events_written += n;
+    }
+
+    trace_barrier();
+    t->tail = tail;
+  }
+}
+
+
+/* Background writer thread */
+
+
+static void *trace_writer_proc(void *arg)
+{
+  (void) arg; /* unused */
+
+  log_text(LOG_DEBUG, "Trace writer thread started");
+
+  while (!writer_stop)
+  {
+    trace_drain();
+    usleep(TRACE_FLUSH_INTERVAL);
+  }
+
+  return NULL;
+}
+
+
+/* Write the trace file header */
+
+
+static int write_header(unsigned long long start_time)
+{
+  sb_trace_header_t hdr;
+
+  memset(&hdr, 0, sizeof(hdr));
+  strncpy(hdr.magic, SB_TRACE_MAGIC, sizeof(hdr.magic));
+  hdr.version = SB_TRACE_VERSION;
+  hdr.record_size = sizeof(sb_trace_event_t);
+  hdr.num_threads = sb_globals.num_threads;
+  hdr.sample = sample_rate;
+  hdr.start_time = start_time;
+
+  if (fwrite(&hdr, sizeof(hdr), 1, trace_file) != 1)
+  {
+    log_errno(LOG_FATAL, "Failed to write to the trace file '%s'",
+              trace_file_name);
+    return 1;
+  }
+
+  return 0;
+}
+
+
+/* Open the trace file and start the writer thread */
+
+
+int sb_trace_start(void)
+{
+  if (!sb_trace_enabled)
+    return 0;
+
+  trace_file = fopen(trace_file_name, "wb");
+  if (trace_file == NULL)
+  {
+    log_errno(LOG_FATAL, "Cannot open the trace file '%s'", trace_file_name);
+    return 1;
+  }
+
+  /* The start time is not known yet, it is updated in sb_trace_stop() */
+  if (write_header(0))
+    return 1;
+
+  writer_stop = 0;
+  events_written = 0;
+
+  if (pthread_create(&writer_thread, NULL, &trace_writer_proc, NULL) != 0)
+  {
+    log_errno(LOG_FATAL, "pthread_create() for the trace writer failed.");
+    return 1;
+  }
+  writer_thread_created = 1;
+
+  return 0;
+}
+
+
+/* Called by a worker thread before executing a request */
+
+
+void sb_trace_event_start(int thread_id)
+{
+  trace_thread_t *t = &trace_threads[thread_id];
+
+  t->sampled = (t->nevents++ % sample_rate) == 0;
+  if (!t->sampled)
+    return;
+
+  if (sb_thread_metrics != NULL)
+    t->errors = sb_thread_metrics[thread_id].counters[SB_CNT_ERROR] +
+      sb_thread_metrics[thread_id].counters[SB_CNT_RECONNECT];
+
+  SB_GETTIME(&t->start);
+}
+
+
+/* Called by a worker thread after executing a request */
+
+
+void sb_trace_event_stop(int thread_id, int type, int rc)
+{
+  trace_thread_t     *t = &trace_threads[thread_id];
+  sb_trace_event_t   *rec;
+  struct timespec    now;
+  unsigned long long errors = 0;
+  unsigned long long head;
+
+  if (!t->sampled)
+    return;
+
+  SB_GETTIME(&now);
+
+  head = t->head;
+  if (head - t->tail >= ring_size)
+  {
+    t->dropped++;
+    return;
+  }
+
+  if (sb_thread_metrics != NULL)
+    errors = sb_thread_metrics[thread_id].counters[SB_CNT_ERROR] +
+      sb_thread_metrics[thread_id].counters[SB_CNT_RECONNECT] - t->errors;
+
+  rec = &t->ring[head & (ring_size - 1)];
+
+  rec->start = TIMESPEC_DIFF(t->start, sb_globals.exec_timer.time_start);
+  rec->duration = TIMESPEC_DIFF(now, t->start);
+  rec->thread_id = (unsigned int) thread_id;
+  rec->type = (unsigned short) type;
+  rec->errors = errors > 0xffff ? 0xffff : (unsigned short) errors;
+  rec->rc = rc;
+  rec->reserved = 0;
+
+  /* Make the record visible before publishing the new head */
+  trace_barrier();
+  t->head = head + 1;
+}
+
+
+/* Flush remaining events, stop the writer thread and close the file */
+
+
+void sb_trace_stop(void)
+{
+  struct timespec    mono;
+  struct timespec    wall;
+  unsigned long long dropped = 0;
+  unsigned long long start_time = 0;
+  unsigned int       i;
+
+  if (!sb_trace_enabled || trace_file == NULL)
+    return;
+
+  if (writer_thread_created)
+  {
+    writer_stop = 1;
+    if (pthread_join(writer_thread, NULL))
+      log_errno(LOG_FATAL, "Terminating the trace writer thread failed.");
+    writer_thread_created = 0;
+  }
+
+  /* Worker threads are done at this point, write whatever is left */
+  trace_drain();
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+    dropped += trace_threads[i].dropped;
+
+  /* Convert the monotonic test start time to wall clock time */
+  SB_GETTIME(&mono);
+#ifdef HAVE_CLOCK_GETTIME
+  clock_gettime(CLOCK_REALTIME, &wall);
+#else
+  {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    wall.tv_sec = tv.tv_sec;
+    wall.tv_nsec = tv.tv_usec * 1000;
+  }
+#endif
+  if (sb_timer_initialized(&sb_globals.exec_timer))
+    start_time = SEC2NS((unsigned long long) wall.tv_sec) + wall.tv_nsec -
+      TIMESPEC_DIFF(mono, sb_globals.exec_timer.time_start);
+
+  if (fseek(trace_file, 0, SEEK_SET) == 0)
+    write_header(start_time);
+
+  if (fclose(trace_file))
+    log_errno(LOG_FATAL, "Failed to close the trace file '%s'",
+              trace_file_name);
+  trace_file = NULL;
+
+  log_text(LOG_NOTICE, "Trace: %llu events written to '%s', %llu dropped\n",
+           events_written, trace_file_name, dropped);
+}
+
+
+/* Free per-thread buffers */
+
+
+void sb_trace_done(void)
+{
+  unsigned int i;
+
+  if (trace_threads != NULL)
+  {
+    for (i = 0; i < sb_globals.num_threads; i++)
+      free(trace_threads[i].ring);
+    free(trace_threads);
+    trace_threads = NULL;
+  }
+
+  sb_trace_enabled = 0;
+}
+
+
+/* Analysis */
+
+
+static int cmp_start(const void *a, const void *b)
+{
+  const sb_trace_event_t *e1 = (const sb_trace_event_t *) a;
+  const sb_trace_event_t *e2 = (const sb_trace_event_t *) b;
+
+  if (e1->start < e2->start)
+    return -1;
+  return e1->start > e2->start;
+}
+
+
+static int cmp_ull(const void *a, const void *b)
+{
+  unsigned long long v1 = *(const unsigned long long *) a;
+  unsigned long long v2 = *(const unsigned long long *) b;
+
+  if (v1 < v2)
+    return -1;
+  return v1 > v2;
+}
+
+
+/* Read all records within [from, to) from the trace file */
+
+
+static sb_trace_event_t *read_trace(const char *name, sb_trace_header_t *hdr,
+                                    unsigned long long from,
+                                    unsigned long long to, size_t *nevents)
+{
+  FILE             *fp;
+  sb_trace_event_t *events = NULL;
+  sb_trace_event_t *tmp;
+  sb_trace_event_t rec;
+  size_t           n = 0;
+  size_t           size = 0;
+
+  fp = fopen(name, "rb");
+  if (fp == NULL)
+  {
+    log_errno(LOG_FATAL, "Cannot open the trace file '%s'", name);
+    return NULL;
+  }
+
+  if (fread(hdr, sizeof(*hdr), 1, fp) != 1 ||
+      strncmp(hdr->magic, SB_TRACE_MAGIC, sizeof(hdr->magic)))
+  {
+    log_text(LOG_FATAL, "'%s' is not a sysbench trace file", name);
+    goto error;
+  }
+
+  if (hdr->version != SB_TRACE_VERSION ||
+      hdr->record_size != sizeof(sb_trace_event_t))
+  {
+    log_text(LOG_FATAL, "Unsupported trace file version %u (record size %u)",
+             hdr->version, hdr->record_size);
+    goto error;
+  }
+
+  while (fread(&rec, sizeof(rec), 1, fp) == 1)
+  {
+    if (rec.start < from || (to > 0 && rec.start >= to))
+      continue;
+
+    if (n == size)
+    {
+      size = size > 0 ? size * 2 : 65536;
+      tmp = (sb_trace_event_t *) realloc(events, size * sizeof(rec));
+      if (tmp == NULL)
+      {
+        log_text(LOG_FATAL, "Memory allocation failure");
+        goto error;
+      }
+      events = tmp;
+    }
+    events[n++] = rec;
+  }
+
+  fclose(fp);
+
+  /* Records are grouped by thread in the file, order them by start time */
+  if (n > 0)
+    qsort(events, n, sizeof(sb_trace_event_t), cmp_start);
+
+  *nevents = n;
+
+  /* Return a non-NULL pointer for an empty window */
+  return events != NULL ? events : (sb_trace_event_t *) malloc(1);
+
+ error:
+  free(events);
+  fclose(fp);
+
+  return NULL;
+}
+
+
+/* Print percentiles for a set of events */
+
+
+static int print_percentiles(sb_trace_event_t *events, size_t n,
+                             double *pcts, unsigned int npcts)
+{
+  unsigned long long *durations;
+  unsigned long long sum = 0;
+  size_t             i;
+  size_t             idx;
+  double             rank;
+
+  if (n == 0)
+  {
+    printf("    no events\n");
+    return 0;
+  }
+
+  durations = (unsigned long long *) malloc(n * sizeof(unsigned long long));
+  if (durations == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure");
+    return 1;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    durations[i] = events[i].duration;
+    sum += durations[i];
+  }
+
+  qsort(durations, n, sizeof(unsigned long long), cmp_ull);
+
+  printf("    min:                           %10.2fms\n",
+         NS2MS(durations[0]));
+  printf("    avg:                           %10.2fms\n", NS2MS(sum / n));
+  printf("    max:                           %10.2fms\n",
+         NS2MS(durations[n - 1]));
+
+  for (i = 0; i < npcts; i++)
+  {
+    /* Nearest-rank method */
+    rank = pcts[i] / 100 * n;
+    idx = (size_t) rank;
+    if (idx < rank)
+      idx++;
+    if (idx > 0)
+      idx--;
+    if (idx >= n)
+      idx = n - 1;
+
+    printf("    %6.2f percentile:             %10.2fms\n", pcts[i],
+           NS2MS(durations[idx]));
+  }
+
+  free(durations);
+
+  return 0;
+}
+
+
+/* Print summary and optional per-interval statistics */
+
+
+static int print_summary(sb_trace_header_t *hdr, sb_trace_event_t *events,
+                         size_t n, double *pcts, unsigned int npcts)
+{
+  unsigned long long interval;
+  unsigned long long errors = 0;
+  unsigned long long window;
+  size_t             i, j;
+
+  printf("Trace: %u threads, 1-in-%u sampling\n", hdr->num_threads,
+         hdr->sample);
+  if (hdr->start_time > 0)
+    printf("Test start: %llu.%09llu (seconds since epoch)\n",
+           hdr->start_time / 1000000000ULL, hdr->start_time % 1000000000ULL);
+
+  for (i = 0; i < n; i++)
+    errors += events[i].errors;
+
+  printf("\nEvents in window:                  %lu\n", (unsigned long) n);
+  if (n > 0)
+  {
+    window = events[n - 1].start + events[n - 1].duration - events[0].start;
+    printf("    from:                          %10.4fs\n",
+           NS2SEC(events[0].start));
+    printf("    to:                            %10.4fs\n",
+           NS2SEC(events[0].start + window));
+    if (window > 0)
+      printf("    events/s:                      %10.2f\n",
+             n * (double) hdr->sample / NS2SEC(window));
+  }
+  printf("    errors:                        %10llu\n", errors);
+  printf("Event execution time:\n");
+
+  if (print_percentiles(events, n, pcts, npcts))
+    return 1;
+
+  interval = SEC2NS((unsigned long long) sb_get_value_int("trace-interval"));
+  if (interval == 0 || n == 0)
+    return 0;
+
+  printf("\n");
+
+  for (i = 0; i < n; i = j)
+  {
+    unsigned long long istart = events[i].start / interval * interval;
+
+    for (j = i; j < n && events[j].start < istart + interval; j++)
+      /* nothing */ ;
+
+    printf("[%6.1fs - %6.1fs] events: %lu\n", NS2SEC(istart),
+           NS2SEC(istart + interval), (unsigned long) (j - i));
+    if (print_percentiles(events + i, j - i, pcts, npcts))
+      return 1;
+  }
+
+  return 0;
+}
+
+
+/* Print events in CSV format */
+
+
+static void print_csv(sb_trace_event_t *events, size_t n)
+{
+  size_t i;
+
+  printf("thread,start_ns,duration_ns,type,errors,rc\n");
+
+  for (i = 0; i < n; i++)
+    printf("%u,%llu,%llu,%s,%u,%d\n", events[i].thread_id, events[i].start,
+           events[i].duration, get_type_name(events[i].type),
+           (unsigned int) events[i].errors, events[i].rc);
+}
+
+
+/* Print events in Chrome trace event format */
+
+
+static void print_chrome(sb_trace_event_t *events, size_t n)
+{
+  size_t i;
+
+  printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+  for (i = 0; i < n; i++)
+    printf("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,"
+           "\"ts\":%.3f,\"dur\":%.3f,"
+           "\"args\":{\"errors\":%u,\"rc\":%d}}%s\n",
+           get_type_name(events[i].type), events[i].thread_id,
+           events[i].start / 1000., events[i].duration / 1000.,
+           (unsigned int) events[i].errors, events[i].rc,
+           i + 1 < n ? "," : "");
+
+  printf("]}\n");
+}
+
+
+/* Implementation of the 'trace' command */
+
+
+int sb_trace_analyze(void)
+{
+  sb_trace_header_t hdr;
+  sb_trace_event_t  *events;
+  sb_list_t         *pct_list;
+  sb_list_item_t    *pos;
+  value_t           *val;
+  double            pcts[64];
+  unsigned int      npcts = 0;
+  size_t            n = 0;
+  char              *name;
+  char              *format;
+  double            from;
+  double            to;
+  int               rc = 0;
+
+  name = sb_get_value_string("trace-file");
+  if (name == NULL || name[0] == '\0')
+  {
+    log_text(LOG_FATAL, "Missing required argument: --trace-file.");
+    return 1;
+  }
+
+  format = sb_get_value_string("trace-format");
+  if (strcmp(format, "summary") && strcmp(format, "csv") &&
+      strcmp(format, "chrome"))
+  {
+    log_text(LOG_FATAL, "Invalid value for --trace-format: '%s'", format);
+    return 1;
+  }
+
+  from = sb_get_value_float("trace-from");
+  to = sb_get_value_float("trace-to");
+  if (from < 0 || to < 0 || (to > 0 && to <= from))
+  {
+    log_text(LOG_FATAL, "Invalid trace window: [%f, %f)", from, to);
+    return 1;
+  }
+
+  if (sb_get_value_int("trace-interval") < 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for --trace-interval: %d",
+             sb_get_value_int("trace-interval"));
+    return 1;
+  }
+
+  pct_list = sb_get_value_list("trace-percentiles");
+  SB_LIST_FOR_EACH(pos, pct_list)
+  {
+    char *endptr;
+
+    val = SB_LIST_ENTRY(pos, value_t, listitem);
+    if (npcts >= sizeof(pcts) / sizeof(pcts[0]))
+    {
+      log_text(LOG_FATAL, "Too many values in --trace-percentiles");
+      return 1;
+    }
+    pcts[npcts] = strtod(val->data, &endptr);
+    if (*endptr != '\0' || pcts[npcts] <= 0 || pcts[npcts] > 100)
+    {
+      log_text(LOG_FATAL, "Invalid value for --trace-percentiles: '%s'",
+               val->data);
+      return 1;
+    }
+    npcts++;
+  }
+
+  events = read_trace(name, &hdr, (unsigned long long) (from * 1e9),
+                      (unsigned long long) (to * 1e9), &n);
+  if (events == NULL)
+    return 1;
+
+  if (!strcmp(format, "csv"))
+    print_csv(events, n);
+  else if (!strcmp(format, "chrome"))
+    print_chrome(events, n);
+  else
+    rc = print_summary(&hdr, events, n, pcts, npcts);
+
+  free(events);
+
+  return rc;
+}
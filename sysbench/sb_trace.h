@@ -0,0 +1,89 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Per-event latency trace: recording into a binary file during 'run' and
+  offline analysis with the 'trace' command.
+*/
+
+#ifndef SB_TRACE_H
+#define SB_TRACE_H
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#define SB_TRACE_MAGIC "SBTRACE"
+#define SB_TRACE_VERSION 1
+
+/* Trace file header */
+
+typedef struct
+{
+  char               magic[8];     /* SB_TRACE_MAGIC */
+  unsigned int       version;      /* SB_TRACE_VERSION */
+  unsigned int       record_size;  /* sizeof(sb_trace_event_t) */
+  unsigned int       num_threads;  /* number of worker threads */
+  unsigned int       sample;       /* 1-in-N sampling rate */
+  unsigned long long start_time;   /* wall clock test start, ns since epoch */
+} sb_trace_header_t;
+
+/* Trace record, one per sampled event */
+
+typedef struct
+{
+  unsigned long long start;     /* ns since the test start */
+  unsigned long long duration;  /* event execution time in ns */
+  unsigned int       thread_id; /* worker thread */
+  unsigned short     type;      /* request type, see sb_request_type_t */
+  unsigned short     errors;    /* errors and reconnects during the event */
+  int                rc;        /* execute_request() return code */
+  unsigned int       reserved;
+} sb_trace_event_t;
+
+/* Non-zero when tracing is enabled for the current run */
+extern int sb_trace_enabled;
+
+/* Register command line options */
+int sb_trace_register(void);
+
+/* Print command line options */
+void sb_trace_print_help(void);
+
+/* Parse options and allocate per-thread buffers */
+int sb_trace_init(void);
+
+/* Open the trace file and start the writer thread */
+int sb_trace_start(void);
+
+/* Called by a worker thread before executing a request */
+void sb_trace_event_start(int thread_id);
+
+/* Called by a worker thread after executing a request */
+void sb_trace_event_stop(int thread_id, int type, int rc);
+
+/* Flush remaining events, stop the writer thread and close the file */
+void sb_trace_stop(void);
+
+/* Free per-thread buffers */
+void sb_trace_done(void);
+
+/* Implementation of the 'trace' command */
+int sb_trace_analyze(void);
+
+#endif /* SB_TRACE_H */
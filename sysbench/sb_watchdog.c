@@ -0,0 +1,536 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Workers publish what they are doing (current event start, time spent in the
+  driver, current query) in per-thread slots. The watchdog thread polls the
+  slots and logs threads stuck in a single event, as well as global stalls
+  when the total number of completed events does not change. Stall
+  statistics for the final report are accumulated by workers themselves, so
+  they are exact rather than limited by the polling interval.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#ifdef _WIN32
+# include "sb_win.h"
+#endif
+
+#ifdef STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "sysbench.h"
+#include "sb_watchdog.h"
+#include "sb_metrics.h"
+
+/* Maximum length of the query text kept for each thread */
+#define WATCHDOG_QUERY_LEN 256
+
+/* Per-thread state */
+
+typedef struct
+{
+  volatile unsigned long long seq;          /* sequence number of the event */
+  volatile int                in_event;     /* executing an event? */
+  volatile unsigned long long event_start;  /* ns since the test start */
+  volatile int                in_driver;    /* inside a driver call? */
+  volatile unsigned long long driver_start; /* driver call start */
+  volatile unsigned long long driver_time;  /* ns in driver in this event */
+  char                        query[WATCHDOG_QUERY_LEN];
+  unsigned long long          reported_seq; /* last reported event */
+  /* stall statistics, updated by the worker */
+  unsigned long long          stalls;
+  unsigned long long          stall_time;
+  unsigned long long          stall_max;
+  char                        pad[64];      /* avoid false sharing */
+} watchdog_thread_t;
+
+/* Watchdog options */
+
+static sb_arg_t watchdog_args[] =
+{
+  {"stall-threshold", "report events that run longer than the specified "
+   "number of milliseconds. 0 disables per-event stall detection",
+   SB_ARG_TYPE_INT, "0"},
+  {"global-stall-threshold", "report periods when no events complete for the "
+   "specified number of milliseconds. 0 disables global stall detection",
+   SB_ARG_TYPE_INT, "0"},
+  {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
+};
+
+int sb_watchdog_enabled;
+
+static watchdog_thread_t  *watchdog_threads;
+static unsigned long long stall_threshold;
+static unsigned long long global_threshold;
+static unsigned long long poll_interval;
+static pthread_t          watchdog_thread;
+static int                watchdog_thread_created;
+
+/* Global stall state and statistics, owned by the watchdog thread */
+static unsigned long long last_events;
+static unsigned long long last_progress;
+static int                in_global_stall;
+static unsigned long long global_stalls;
+static unsigned long long global_stall_time;
+static unsigned long long global_stall_max;
+
+
+/* Current time in ns since the test start */
+
+
+static unsigned long long watchdog_now(void)
+{
+  struct timespec now;
+
+  SB_GETTIME(&now);
+
+  return TIMESPEC_DIFF(now, sb_globals.exec_timer.time_start);
+}
+
+
+/* Register command line options */
+
+
+int sb_watchdog_register(void)
+{
+  return sb_register_arg_set(watchdog_args);
+}
+
+
+/* Print command line options */
+
+
+void sb_watchdog_print_help(void)
+{
+  printf("Stall detection options:\n");
+  sb_print_options(watchdog_args);
+}
+
+
+/* Parse options and allocate per-thread state */
+
+
+int sb_watchdog_init(void)
+{
+  int stall_ms = sb_get_value_int("stall-threshold");
+  int global_ms = sb_get_value_int("global-stall-threshold");
+
+  if (stall_ms < 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for --stall-threshold: %d", stall_ms);
+    return 1;
+  }
+  if (global_ms < 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for --global-stall-threshold: %d",
+             global_ms);
+    return 1;
+  }
+
+  if ((stall_ms == 0 && global_ms == 0) ||
+      sb_globals.command != SB_COMMAND_RUN)
+    return 0;
+
+  stall_threshold = MS2NS((unsigned long long) stall_ms);
+  global_threshold = MS2NS((unsigned long long) global_ms);
+
+  /* Poll at least twice per the smallest threshold */
+  if (stall_threshold > 0 &&
+      (global_threshold == 0 || stall_threshold < global_threshold))
+    poll_interval = stall_threshold / 2;
+  else
+    poll_interval = global_threshold / 2;
+  if (poll_interval < MS2NS(1ULL))
+    poll_interval = MS2NS(1ULL);
+
+  watchdog_threads = (watchdog_thread_t *)
+    calloc(sb_globals.num_threads, sizeof(watchdog_thread_t));
+  if (watchdog_threads == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure");
+    return 1;
+  }
+
+  sb_watchdog_enabled = 1;
+
+  return 0;
+}
+
+
+/* Log the state of a single thread */
+
+
+static void log_thread_state(unsigned int i, unsigned long long now)
+{
+  watchdog_thread_t  *t = &watchdog_threads[i];
+  unsigned long long elapsed;
+  unsigned long long driver;
+  unsigned long long reconnects = 0;
+  char               query[WATCHDOG_QUERY_LEN];
+
+  elapsed = now > t->event_start ? now - t->event_start : 0;
+  driver = t->driver_time;
+  if (t->in_driver && now > t->driver_start)
+    driver += now - t->driver_start;
+  if (driver > elapsed)
+    driver = elapsed;
+
+  if (sb_thread_metrics != NULL)
+    reconnects = sb_thread_metrics[i].counters[SB_CNT_RECONNECT];
+
+  /* The worker may be updating the text, take a terminated copy */
+  memcpy(query, t->query, sizeof(query));
+  query[sizeof(query) - 1] = '\0';
+
+  log_text(LOG_WARNING, "    thread %u: event running for %.2fms "
+           "(driver: %.2fms, script: %.2fms), %s, reconnects: %llu%s%s",
+           i, NS2MS(elapsed), NS2MS(driver), NS2MS(elapsed - driver),
+           t->in_driver ? "in driver" : "in script", reconnects,
+           query[0] != '\0' ? ", query: " : "", query);
+}
+
+
+/* Check for threads stuck in a single event */
+
+
+static void check_threads(unsigned long long now)
+{
+  watchdog_thread_t *t;
+  unsigned int      i;
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    t = &watchdog_threads[i];
+
+    if (!t->in_event || t->reported_seq == t->seq ||
+        now < t->event_start || now - t->event_start < stall_threshold)
+      continue;
+
+    t->reported_seq = t->seq;
+
+    log_timestamp(LOG_WARNING, &sb_globals.exec_timer,
+                  "stall detected: event exceeded %llums",
+                  (unsigned long long) NS2MS(stall_threshold));
+    log_thread_state(i, now);
+  }
+}
+
+
+/* Check for periods without any completed events */
+
+
+static void check_global(unsigned long long now)
+{
+  unsigned long long events = sb_metrics_total_events();
+  unsigned long long duration;
+
+  if (events != last_events)
+  {
+    if (in_global_stall)
+    {
+      duration = now - last_progress;
+      global_stalls++;
+      global_stall_time += duration;
+      if (duration > global_stall_max)
+        global_stall_max = duration;
+
+      log_timestamp(LOG_WARNING, &sb_globals.exec_timer,
+                    "global stall ended after %.2fms", NS2MS(duration));
+      in_global_stall = 0;
+    }
+
+    last_events = events;
+    last_progress = now;
+
+    return;
+  }
+
+  if (!in_global_stall && sb_globals.num_running > 0 &&
+      now - last_progress >= global_threshold)
+  {
+    unsigned int i;
+
+    in_global_stall = 1;
+
+    log_timestamp(LOG_WARNING, &sb_globals.exec_timer,
+                  "global stall: no events completed in the last %.2fms",
+                  NS2MS(now - last_progress));
+
+    for (i = 0; i < sb_globals.num_threads; i++)
+      if (watchdog_threads[i].in_event)
+        log_thread_state(i, now);
+  }
+}
+
+
+/* Watchdog thread */
+
+
+static void *watchdog_thread_proc(void *arg)
+{
+  unsigned long long now;
+
+  (void) arg; /* unused */
+
+  log_text(LOG_DEBUG, "Watchdog thread started");
+
+  for (;;)
+  {
+    usleep(poll_interval / 1000);
+
+    if (!sb_timer_running(&sb_globals.exec_timer))
+      continue;
+
+    now = watchdog_now();
+
+    if (stall_threshold > 0)
+      check_threads(now);
+
+    if (global_threshold > 0)
+      check_global(now);
+  }
+
+  return NULL;
+}
+
+
+/* Start the watchdog thread */
+
+
+int sb_watchdog_start(void)
+{
+  if (!sb_watchdog_enabled)
+    return 0;
+
+  last_events = 0;
+  last_progress = 0;
+  in_global_stall = 0;
+
+  if (pthread_create(&watchdog_thread, NULL, &watchdog_thread_proc, NULL) != 0)
+  {
+    log_errno(LOG_FATAL, "pthread_create() for the watchdog thread failed.");
+    return 1;
+  }
+  watchdog_thread_created = 1;
+
+  return 0;
+}
+
+
+/* Stop the watchdog thread */
+
+
+void sb_watchdog_stop(void)
+{
+  if (!watchdog_thread_created)
+    return;
+
+  if (pthread_cancel(watchdog_thread) || pthread_join(watchdog_thread, NULL))
+    log_errno(LOG_FATAL, "Terminating the watchdog thread failed.");
+  watchdog_thread_created = 0;
+
+  /* Account a global stall that lasted until the end of the test */
+  if (in_global_stall)
+  {
+    unsigned long long duration = 0;
+
+    if (sb_globals.exec_timer.elapsed > last_progress)
+      duration = sb_globals.exec_timer.elapsed - last_progress;
+
+    global_stalls++;
+    global_stall_time += duration;
+    if (duration > global_stall_max)
+      global_stall_max = duration;
+    in_global_stall = 0;
+  }
+}
+
+
+/* Non-zero when events running longer than --stall-threshold are reported */
+
+
+int sb_watchdog_event_stalls(void)
+{
+  return sb_watchdog_enabled && stall_threshold > 0;
+}
+
+
+/* Called by a worker thread before executing a request */
+
+
+void sb_watchdog_event_start(int thread_id)
+{
+  watchdog_thread_t *t = &watchdog_threads[thread_id];
+
+  t->driver_time = 0;
+  t->query[0] = '\0';
+  t->event_start = watchdog_now();
+  t->seq++;
+  t->in_event = 1;
+}
+
+
+/* Called by a worker thread after executing a request */
+
+
+void sb_watchdog_event_stop(int thread_id)
+{
+  watchdog_thread_t  *t = &watchdog_threads[thread_id];
+  unsigned long long duration;
+
+  t->in_event = 0;
+
+  if (stall_threshold == 0)
+    return;
+
+  duration = watchdog_now() - t->event_start;
+  if (duration >= stall_threshold)
+  {
+    t->stalls++;
+    t->stall_time += duration;
+    if (duration > t->stall_max)
+      t->stall_max = duration;
+  }
+}
+
+
+/* Called by the DB layer before a driver call */
+
+
+void sb_watchdog_driver_enter(int thread_id, const char *query)
+{
+  watchdog_thread_t *t;
+
+  if (thread_id < 0)
+    return;
+
+  t = &watchdog_threads[thread_id];
+
+  if (query != NULL)
+  {
+    strncpy(t->query, query, sizeof(t->query) - 1);
+    t->query[sizeof(t->query) - 1] = '\0';
+  }
+
+  t->driver_start = watchdog_now();
+  t->in_driver = 1;
+}
+
+
+/* Called by the DB layer after a driver call */
+
+
+void sb_watchdog_driver_exit(int thread_id)
+{
+  watchdog_thread_t *t;
+
+  if (thread_id < 0)
+    return;
+
+  t = &watchdog_threads[thread_id];
+
+  t->in_driver = 0;
+  t->driver_time += watchdog_now() - t->driver_start;
+}
+
+
+/* Log the state of threads that are currently executing an event */
+
+
+void sb_watchdog_dump_threads(void)
+{
+  unsigned long long now;
+  unsigned int       i;
+
+  if (!sb_watchdog_enabled)
+    return;
+
+  now = watchdog_now();
+
+  log_text(LOG_NOTICE, "Threads in progress:");
+  for (i = 0; i < sb_globals.num_threads; i++)
+    if (watchdog_threads[i].in_event)
+      log_thread_state(i, now);
+}
+
+
+/* Print stall statistics */
+
+
+void sb_watchdog_print_stats(void)
+{
+  unsigned long long stalls = 0;
+  unsigned long long stall_time = 0;
+  unsigned long long stall_max = 0;
+  unsigned int       i;
+
+  if (!sb_watchdog_enabled)
+    return;
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    stalls += watchdog_threads[i].stalls;
+    stall_time += watchdog_threads[i].stall_time;
+    if (watchdog_threads[i].stall_max > stall_max)
+      stall_max = watchdog_threads[i].stall_max;
+  }
+
+  log_text(LOG_NOTICE, "Stall statistics:");
+  if (stall_threshold > 0)
+  {
+    log_text(LOG_NOTICE, "    event stalls (threshold %llums):",
+             (unsigned long long) NS2MS(stall_threshold));
+    log_text(LOG_NOTICE, "         count:                          %llu",
+             stalls);
+    log_text(LOG_NOTICE, "         total time:                     %.4fs",
+             NS2SEC(stall_time));
+    log_text(LOG_NOTICE, "         max time:                       %.4fs%s",
+             NS2SEC(stall_max), global_threshold > 0 ? "" : "\n");
+  }
+  if (global_threshold > 0)
+  {
+    log_text(LOG_NOTICE, "    global stalls (threshold %llums):",
+             (unsigned long long) NS2MS(global_threshold));
+    log_text(LOG_NOTICE, "         count:                          %llu",
+             global_stalls);
+    log_text(LOG_NOTICE, "         total time:                     %.4fs",
+             NS2SEC(global_stall_time));
+    log_text(LOG_NOTICE, "         max time:                       %.4fs\n",
+             NS2SEC(global_stall_max));
+  }
+}
+
+
+/* Free per-thread state */
+
+
+void sb_watchdog_done(void)
+{
+  free(watchdog_threads);
+  watchdog_threads = NULL;
+
+  sb_watchdog_enabled = 0;
+}
@@ -0,0 +1,74 @@
+/*
+   Copyright (C) 2016 Alexey Kopytov <akopytov@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+  Stall detector: a watchdog thread reporting events that run longer than a
+  threshold and periods when no events complete at all.
+*/
+
+#ifndef SB_WATCHDOG_H
+#define SB_WATCHDOG_H
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+/* Non-zero when the watchdog is enabled for the current run */
+extern int sb_watchdog_enabled;
+
+/* Register command line options */
+int sb_watchdog_register(void);
+
+/* Print command line options */
+void sb_watchdog_print_help(void);
+
+/* Parse options and allocate per-thread state */
+int sb_watchdog_init(void);
+
+/* Start the watchdog thread */
+int sb_watchdog_start(void);
+
+/* Stop the watchdog thread */
+void sb_watchdog_stop(void);
+
+/* Non-zero when events running longer than --stall-threshold are reported */
+int sb_watchdog_event_stalls(void);
+
+/* Called by a worker thread before executing a request */
+void sb_watchdog_event_start(int thread_id);
+
+/* Called by a worker thread after executing a request */
+void sb_watchdog_event_stop(int thread_id);
+
+/*
+  Called by the DB layer around driver calls. 'query' may be NULL to keep
+  the previously recorded query text.
+*/
+void sb_watchdog_driver_enter(int thread_id, const char *query);
+void sb_watchdog_driver_exit(int thread_id);
+
+/* Log the state of threads that are currently executing an event */
+void sb_watchdog_dump_threads(void);
+
+/* Print stall statistics */
+void sb_watchdog_print_stats(void);
+
+/* Free per-thread state */
+void sb_watchdog_done(void);
+
+#endif /* SB_WATCHDOG_H */
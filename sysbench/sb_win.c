@@ -254,6 +254,30 @@ int pthread_once(pthread_once_t *once_control,
   return 0;
 }
 
+/* Thread-specific data. Destructors are not supported */
+int pthread_key_create(pthread_key_t *key, void (*destructor)(void *))
+{
+  (void) destructor;
+
+  *key = TlsAlloc();
+  return *key == TLS_OUT_OF_INDEXES;
+}
+
+int pthread_key_delete(pthread_key_t key)
+{
+  return !TlsFree(key);
+}
+
+void *pthread_getspecific(pthread_key_t key)
+{
+  return TlsGetValue(key);
+}
+
+int pthread_setspecific(pthread_key_t key, const void *value)
+{
+  return !TlsSetValue(key, (LPVOID) value);
+}
+
 #include <time.h>
 int gettimeofday(struct timeval * tp, void * tzp)
 {
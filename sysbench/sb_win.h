@@ -84,6 +84,12 @@ extern int pthread_once(pthread_once_t *once_control,
 #define PTHREAD_ONCE_INPROGRESS 1
 #define PTHREAD_ONCE_DONE 2
 
+typedef DWORD pthread_key_t;
+extern int pthread_key_create(pthread_key_t *key, void (*destructor)(void *));
+extern int pthread_key_delete(pthread_key_t key);
+extern void *pthread_getspecific(pthread_key_t key);
+extern int pthread_setspecific(pthread_key_t key, const void *value);
+
 
 extern int pthread_attr_init(pthread_attr_t *attr);
 extern int pthread_cond_destroy(pthread_cond_t *cond);
@@ -21,21 +21,40 @@
 #endif
 
 #include "script_lua.h"
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+#ifdef HAVE_ERRNO_H
+# include <errno.h>
+#endif
+
 #include "lua.h"
 #include "lualib.h"
 #include "lauxlib.h"
 
 #include "sb_script.h"
+#include "sb_client.h"
 
 #include "db_driver.h"
 
 #define EVENT_FUNC "event"
 #define PREPARE_FUNC "prepare"
+#define PREPARE_PLAN_FUNC "prepare_plan"
+#define PREPARE_TABLE_FUNC "prepare_table"
+#define PREPARE_ROWS_FUNC "prepare_rows"
+#define PREPARE_CHECK_FUNC "prepare_check"
+#define PREPARE_DONE_FUNC "prepare_done"
 #define CLEANUP_FUNC "cleanup"
 #define THREAD_INIT_FUNC "thread_init"
 #define THREAD_DONE_FUNC "thread_done"
 #define HELP_FUNC "help"
 
+/* Maximum number of ready sessions handled per event loop iteration */
+#define MAX_READY_SESSIONS 64
+
+/* Maximum number of values in a row passed to db_bulk_insert_row() */
+#define MAX_BULK_COLUMNS 64
+
 /* Macros to call Lua functions */
 #define CALL_ERROR(L, name)           \
   do { \
@@ -50,11 +69,28 @@
       luaL_error(L, "Uninitialized database connection"); \
   } while(0);
 
+/* Database session multiplexed by a thread with --db-sessions */
+
+typedef struct {
+  db_conn_t       *con;      /* Session connection */
+  int             fd;        /* Descriptor returned by db_socket() */
+  unsigned int    events;    /* epoll events the descriptor is waited for */
+  lua_State       *co;       /* Coroutine executing the current event */
+  int             co_ref;    /* Registry reference to the coroutine */
+  struct timespec start;     /* When the current event was started */
+} sb_lua_session_t;
+
 /* Interpreter context */
 
 typedef struct {
-  int       thread_id; /* SysBench thread ID */
-  db_conn_t *con;      /* Database connection */
+  int              thread_id; /* SysBench thread ID */
+  db_conn_t        *con;      /* Database connection */
+  sb_lua_session_t *sessions; /* Sessions multiplexed by the event loop */
+  unsigned int     nsessions;
+  sb_lua_session_t **idle;    /* Sessions not executing an event */
+  unsigned int     nidle;
+  sb_lua_session_t *session;  /* Session whose event is being resumed */
+  int              epfd;      /* epoll descriptor of the event loop */
 } sb_lua_ctxt_t;
 
 typedef struct {
@@ -78,8 +114,35 @@ typedef struct {
   int            param_ref;
   int            result_ref;
   sb_lua_db_rs_t *rs;
+  char           rebind;    /* bound params were replaced by execute_many() */
 } sb_lua_db_stmt_t;
 
+/* Table states of a parallel prepare */
+
+#define PREPARE_TABLE_NEW      0
+#define PREPARE_TABLE_CREATING 1
+#define PREPARE_TABLE_CREATED  2
+
+/* Parallel prepare work shared by the prepare threads */
+
+typedef struct {
+  unsigned int       tables;      /* Number of tables */
+  unsigned long long rows;        /* Rows per table */
+  unsigned long long chunk;       /* Rows per range */
+  unsigned long long nranges;     /* Ranges in all tables */
+  unsigned long long next;        /* Next range to be prepared */
+  char               *created;    /* Table states */
+  char               *done;       /* Ranges recorded in the state file */
+  FILE               *fp;         /* State file */
+  unsigned long long rows_done;   /* Rows prepared so far */
+  unsigned long long rows_report; /* Rows prepared at the last report */
+  unsigned long long last_report; /* Time of the last report */
+  sb_timer_t         timer;
+  int                error;
+  pthread_mutex_t    mutex;
+  pthread_cond_t     cond;
+} sb_lua_prepare_t;
+
 /* Lua interpreter states */
 
 static lua_State **states;
@@ -95,6 +158,7 @@ static sb_request_t sb_lua_get_request(int thread_id);
 static int sb_lua_op_execute_request(sb_request_t *, int);
 static int sb_lua_op_thread_init(int);
 static int sb_lua_op_thread_done(int);
+static int sb_lua_op_thread_drain(int);
 static void sb_lua_op_print_stats(sb_stat_t type);
 
 static sb_operations_t lua_ops = {
@@ -107,7 +171,8 @@ static sb_operations_t lua_ops = {
    NULL,
    NULL,
    NULL,
-   &sb_lua_done
+   &sb_lua_done,
+   &sb_lua_op_thread_drain
 };
 
 /* Main (global) interpreter state */
@@ -122,6 +187,26 @@ static const char sb_lua_ctxt_key = 0;
 /* Control variable for sb_lua_db_init_once() */
 static pthread_once_t db_init_control = PTHREAD_ONCE_INIT;
 
+#ifdef HAVE_SYS_EPOLL_H
+/* Event loop multiplexing database sessions */
+static int sb_lua_sessions_init(lua_State *, sb_lua_ctxt_t *);
+static void sb_lua_sessions_done(lua_State *, sb_lua_ctxt_t *);
+static int sb_lua_sessions_execute(lua_State *, sb_lua_ctxt_t *);
+static int sb_lua_sessions_wait(lua_State *, sb_lua_ctxt_t *);
+static int sb_lua_session_run(lua_State *, sb_lua_ctxt_t *,
+                              sb_lua_session_t *);
+static int sb_lua_session_wait_for(sb_lua_ctxt_t *, sb_lua_session_t *,
+                                   unsigned int);
+static void sb_lua_session_end(lua_State *, sb_lua_session_t *);
+#endif
+
+/* Parallel prepare */
+static int sb_lua_prepare_ranges(void);
+static int sb_lua_prepare_load(sb_lua_prepare_t *, const char *);
+static int sb_lua_prepare_check(sb_lua_prepare_t *, const char *);
+static int sb_lua_prepare_done(void);
+static void *sb_lua_prepare_thread(void *);
+
 /* Lua test commands */
 static int sb_lua_cmd_prepare(void);
 static int sb_lua_cmd_cleanup(void);
@@ -139,11 +224,16 @@ static int sb_lua_db_disconnect(lua_State *);
 static int sb_lua_db_query(lua_State *);
 static int sb_lua_db_bulk_insert_init(lua_State *);
 static int sb_lua_db_bulk_insert_next(lua_State *);
+static int sb_lua_db_bulk_insert_row(lua_State *);
 static int sb_lua_db_bulk_insert_done(lua_State *);
 static int sb_lua_db_prepare(lua_State *);
 static int sb_lua_db_bind_param(lua_State *);
 static int sb_lua_db_bind_result(lua_State *);
 static int sb_lua_db_execute(lua_State *);
+static int sb_lua_db_execute_many(lua_State *);
+static int sb_lua_db_send_query(lua_State *);
+static int sb_lua_db_send_execute(lua_State *);
+static int sb_lua_db_get_result(lua_State *);
 static int sb_lua_db_close(lua_State *);
 static int sb_lua_db_store_results(lua_State *);
 static int sb_lua_db_free_results(lua_State *);
@@ -154,6 +244,8 @@ static int sb_lua_rand_gaussian(lua_State *);
 static int sb_lua_rand_special(lua_State *);
 static int sb_lua_rnd(lua_State *);
 static int sb_lua_rand_str(lua_State *);
+static int sb_lua_row_rand(lua_State *);
+static int sb_lua_row_str(lua_State *);
 
 /* Get a per-state interpreter context */
 static sb_lua_ctxt_t *sb_lua_get_context(lua_State *);
@@ -176,9 +268,10 @@ int script_load_lua(const char *testname, sb_test_t *test)
 
   /* Test commands */
   lua_getglobal(gstate, PREPARE_FUNC);
-  if (!lua_isnil(gstate, -1))
+  lua_getglobal(gstate, PREPARE_ROWS_FUNC);
+  if (!lua_isnil(gstate, -1) || !lua_isnil(gstate, -2))
     test->cmds.prepare = &sb_lua_cmd_prepare;
-  lua_pop(gstate, 1);
+  lua_pop(gstate, 2);
 
   lua_getglobal(gstate, CLEANUP_FUNC);
   if (!lua_isnil(gstate, -1))
@@ -195,8 +288,10 @@ int script_load_lua(const char *testname, sb_test_t *test)
   if (!lua_isnil(gstate, -1))
     test->ops.thread_init = &sb_lua_op_thread_init;
 
+  /* Also needed to account the state heap and to free DB sessions */
   lua_getglobal(gstate, THREAD_DONE_FUNC);
-  if (!lua_isnil(gstate, -1))
+  if (!lua_isnil(gstate, -1) || sb_client_enabled ||
+      sb_get_value_int("db-sessions") > 0)
     test->ops.thread_done = &sb_lua_op_thread_done;
 
 
@@ -259,8 +354,16 @@ int sb_lua_op_execute_request(sb_request_t *sb_req, int thread_id)
   log_msg_oper_t      op_msg;
   unsigned int         restart;
   lua_State           *L = states[thread_id];
+  sb_lua_ctxt_t       *ctxt;
 
   (void)sb_req; /* unused */
+
+#ifdef HAVE_SYS_EPOLL_H
+  ctxt = sb_lua_get_context(L);
+  lua_pop(L, 1);
+  if (ctxt->sessions != NULL)
+    return sb_lua_sessions_execute(L, ctxt);
+#endif
   
   /* Prepare log message */
   msg.type = LOG_MSG_TYPE_OPER;
@@ -284,6 +387,12 @@ int sb_lua_op_execute_request(sb_request_t *sb_req, int thread_id)
         log_text(LOG_DEBUG,
                  "Ignored error encountered, restarting transaction");
         restart = 1;
+
+        /* Queries sent asynchronously before the error are discarded */
+        ctxt = sb_lua_get_context(L);
+        lua_pop(L, 1);
+        if (ctxt->con != NULL)
+          db_discard_results(ctxt->con);
       }
       else
       {
@@ -321,13 +430,63 @@ int sb_lua_op_thread_init(int thread_id)
     CALL_ERROR(states[thread_id], THREAD_INIT_FUNC);
     return 1;
   }
+
+  if (db_globals.sessions > 0 && sb_globals.command == SB_COMMAND_RUN)
+  {
+#ifdef HAVE_SYS_EPOLL_H
+    return sb_lua_sessions_init(states[thread_id], ctxt);
+#else
+    log_text(LOG_FATAL, "--db-sessions is not supported on this platform");
+    return 1;
+#endif
+  }
   
   return 0;
 }
 
+/* Complete events still executed by sessions */
+
+int sb_lua_op_thread_drain(int thread_id)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  sb_lua_ctxt_t *ctxt;
+
+  ctxt = sb_lua_get_context(states[thread_id]);
+  lua_pop(states[thread_id], 1);
+  if (ctxt->sessions != NULL)
+    while (ctxt->nidle < ctxt->nsessions && !sb_globals.error)
+      if (sb_lua_sessions_wait(states[thread_id], ctxt))
+        return 1;
+#else
+  (void) thread_id; /* unused */
+#endif
+
+  return 0;
+}
+
 int sb_lua_op_thread_done(int thread_id)
 {
+#ifdef HAVE_SYS_EPOLL_H
+  sb_lua_ctxt_t *ctxt;
+
+  /* Events still in progress after an error are abandoned */
+  ctxt = sb_lua_get_context(states[thread_id]);
+  lua_pop(states[thread_id], 1);
+  if (ctxt->sessions != NULL)
+    sb_lua_sessions_done(states[thread_id], ctxt);
+#endif
+
+  if (sb_client_enabled)
+    sb_client_script_heap(thread_id,
+      (unsigned long long) lua_gc(states[thread_id], LUA_GCCOUNT, 0) * 1024 +
+      lua_gc(states[thread_id], LUA_GCCOUNTB, 0));
+
   lua_getglobal(states[thread_id], THREAD_DONE_FUNC);
+  if (lua_isnil(states[thread_id], -1))
+  {
+    lua_pop(states[thread_id], 1);
+    return 0;
+  }
   lua_pushnumber(states[thread_id], (double)thread_id);
 
   if (lua_pcall(states[thread_id], 1, 1, 0))
@@ -433,6 +592,12 @@ lua_State *sb_lua_new_state(const char *scriptname, int thread_id)
   lua_pushcfunction(state, sb_lua_rand_special);
   lua_setglobal(state, "sb_rand_special");
 
+  lua_pushcfunction(state, sb_lua_row_rand);
+  lua_setglobal(state, "sb_row_rand");
+
+  lua_pushcfunction(state, sb_lua_row_str);
+  lua_setglobal(state, "sb_row_str");
+
   lua_pushcfunction(state, sb_lua_db_connect);
   lua_setglobal(state, "db_connect");
   
@@ -448,6 +613,9 @@ lua_State *sb_lua_new_state(const char *scriptname, int thread_id)
   lua_pushcfunction(state, sb_lua_db_bulk_insert_next);
   lua_setglobal(state, "db_bulk_insert_next");
   
+  lua_pushcfunction(state, sb_lua_db_bulk_insert_row);
+  lua_setglobal(state, "db_bulk_insert_row");
+  
   lua_pushcfunction(state, sb_lua_db_bulk_insert_done);
   lua_setglobal(state, "db_bulk_insert_done");
 
@@ -462,6 +630,18 @@ lua_State *sb_lua_new_state(const char *scriptname, int thread_id)
 
   lua_pushcfunction(state, sb_lua_db_execute);
   lua_setglobal(state, "db_execute");
+
+  lua_pushcfunction(state, sb_lua_db_execute_many);
+  lua_setglobal(state, "db_execute_many");
+
+  lua_pushcfunction(state, sb_lua_db_send_query);
+  lua_setglobal(state, "db_send_query");
+
+  lua_pushcfunction(state, sb_lua_db_send_execute);
+  lua_setglobal(state, "db_send_execute");
+
+  lua_pushcfunction(state, sb_lua_db_get_result);
+  lua_setglobal(state, "db_get_result");
   
   lua_pushcfunction(state, sb_lua_db_close);
   lua_setglobal(state, "db_close");
@@ -481,6 +661,22 @@ lua_State *sb_lua_new_state(const char *scriptname, int thread_id)
 
   luaL_newmetatable(state, "sysbench.stmt");
 
+  /* Allow stmt:execute_many(rows) and friends */
+  lua_newtable(state);
+  lua_pushcfunction(state, sb_lua_db_bind_param);
+  lua_setfield(state, -2, "bind_param");
+  lua_pushcfunction(state, sb_lua_db_bind_result);
+  lua_setfield(state, -2, "bind_result");
+  lua_pushcfunction(state, sb_lua_db_execute);
+  lua_setfield(state, -2, "execute");
+  lua_pushcfunction(state, sb_lua_db_execute_many);
+  lua_setfield(state, -2, "execute_many");
+  lua_pushcfunction(state, sb_lua_db_send_execute);
+  lua_setfield(state, -2, "send_execute");
+  lua_pushcfunction(state, sb_lua_db_close);
+  lua_setfield(state, -2, "close");
+  lua_setfield(state, -2, "__index");
+
   luaL_newmetatable(state, "sysbench.rs");
   
   if (luaL_loadfile(state, scriptname) || lua_pcall(state, 0, 0, 0))
@@ -494,25 +690,738 @@ lua_State *sb_lua_new_state(const char *scriptname, int thread_id)
   if (ctxt == NULL)
     return NULL;
   ctxt->thread_id = thread_id;
+  ctxt->epfd = -1;
   sb_lua_set_context(state, ctxt);
   
   return state;
 }
 
-/* Close interpreter state */
+/* Close interpreter state */
+
+int sb_lua_close_state(lua_State *state)
+{
+  if (state != NULL)
+    lua_close(state);
+
+  return 0;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+
+/*
+  With --db-sessions each thread executes events in many database sessions
+  at once. An event runs in a coroutine that yields when db_query() has sent
+  a query, and is resumed once the result is received. Only db_query() is
+  multiplexed, other database calls block on the thread connection.
+*/
+
+int sb_lua_sessions_init(lua_State *L, sb_lua_ctxt_t *ctxt)
+{
+  sb_lua_session_t   *sess;
+  struct epoll_event ev;
+  unsigned int       i;
+
+  ctxt->sessions = (sb_lua_session_t *)calloc(db_globals.sessions,
+                                              sizeof(sb_lua_session_t));
+  ctxt->idle = (sb_lua_session_t **)malloc(db_globals.sessions *
+                                           sizeof(sb_lua_session_t *));
+  if (ctxt->sessions == NULL || ctxt->idle == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure");
+    return 1;
+  }
+
+  ctxt->epfd = epoll_create(db_globals.sessions);
+  if (ctxt->epfd < 0)
+  {
+    log_text(LOG_FATAL, "epoll_create() failed: %s", strerror(errno));
+    sb_lua_sessions_done(L, ctxt);
+    return 1;
+  }
+
+  for (i = 0; i < db_globals.sessions; i++)
+  {
+    sess = ctxt->sessions + i;
+
+    sess->con = db_connect(db_driver);
+    if (sess->con == NULL)
+    {
+      log_text(LOG_FATAL, "Failed to connect to the database");
+      sb_lua_sessions_done(L, ctxt);
+      return 1;
+    }
+    db_set_thread(sess->con, ctxt->thread_id);
+    ctxt->nsessions++;
+
+    sess->fd = db_socket(sess->con);
+    if (sess->fd < 0)
+    {
+      log_text(LOG_FATAL, "'%s' driver cannot execute queries without "
+               "blocking, which is required by --db-sessions",
+               db_driver->sname);
+      sb_lua_sessions_done(L, ctxt);
+      return 1;
+    }
+
+    ev.events = 0;
+    ev.data.ptr = sess;
+    if (epoll_ctl(ctxt->epfd, EPOLL_CTL_ADD, sess->fd, &ev))
+    {
+      log_text(LOG_FATAL, "epoll_ctl() failed: %s", strerror(errno));
+      sb_lua_sessions_done(L, ctxt);
+      return 1;
+    }
+
+    ctxt->idle[ctxt->nidle++] = sess;
+  }
+
+  return 0;
+}
+
+/* Disconnect sessions, abandoning events they execute */
+
+void sb_lua_sessions_done(lua_State *L, sb_lua_ctxt_t *ctxt)
+{
+  sb_lua_session_t *sess;
+  unsigned int     i;
+
+  for (i = 0; i < ctxt->nsessions; i++)
+  {
+    sess = ctxt->sessions + i;
+    if (sess->co != NULL)
+      luaL_unref(L, LUA_REGISTRYINDEX, sess->co_ref);
+    db_discard_results(sess->con);
+    db_disconnect(sess->con);
+  }
+
+  if (ctxt->epfd >= 0)
+    close(ctxt->epfd);
+
+  free(ctxt->sessions);
+  free(ctxt->idle);
+
+  ctxt->sessions = NULL;
+  ctxt->idle = NULL;
+  ctxt->nsessions = 0;
+  ctxt->nidle = 0;
+  ctxt->epfd = -1;
+}
+
+/* Start an event in an idle session, waiting for one if necessary */
+
+int sb_lua_sessions_execute(lua_State *L, sb_lua_ctxt_t *ctxt)
+{
+  sb_lua_session_t *sess;
+
+  while (ctxt->nidle == 0)
+    if (sb_lua_sessions_wait(L, ctxt))
+      return 1;
+
+  sess = ctxt->idle[--ctxt->nidle];
+  SB_GETTIME(&sess->start);
+
+  return sb_lua_session_run(L, ctxt, sess);
+}
+
+/* Wait for results and resume sessions that received them */
+
+int sb_lua_sessions_wait(lua_State *L, sb_lua_ctxt_t *ctxt)
+{
+  struct epoll_event events[MAX_READY_SESSIONS];
+  sb_lua_session_t   *sess;
+  int                i;
+  int                n;
+
+  n = epoll_wait(ctxt->epfd, events, MAX_READY_SESSIONS, -1);
+  if (n < 0)
+  {
+    if (errno == EINTR)
+      return 0;
+    log_text(LOG_FATAL, "epoll_wait() failed: %s", strerror(errno));
+    sb_globals.error = 1;
+    return 1;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    sess = (sb_lua_session_t *)events[i].data.ptr;
+    if (sess->co != NULL && sb_lua_session_run(L, ctxt, sess))
+      return 1;
+  }
+
+  return 0;
+}
+
+/* Change the events a session descriptor is waited for */
+
+int sb_lua_session_wait_for(sb_lua_ctxt_t *ctxt, sb_lua_session_t *sess,
+                            unsigned int events)
+{
+  struct epoll_event ev;
+
+  if (sess->events == events)
+    return 0;
+
+  ev.events = events;
+  ev.data.ptr = sess;
+  if (epoll_ctl(ctxt->epfd, EPOLL_CTL_MOD, sess->fd, &ev))
+  {
+    log_text(LOG_FATAL, "epoll_ctl() failed: %s", strerror(errno));
+    sb_globals.error = 1;
+    return 1;
+  }
+  sess->events = events;
+
+  return 0;
+}
+
+/* Finish the event coroutine of a session */
+
+void sb_lua_session_end(lua_State *L, sb_lua_session_t *sess)
+{
+  luaL_unref(L, LUA_REGISTRYINDEX, sess->co_ref);
+  sess->co = NULL;
+  db_discard_results(sess->con);
+}
+
+/*
+  Run the event of a session until it waits for a result that has not
+  arrived yet or completes. Response time is measured from the start of the
+  event, which also covers time spent waiting for the thread to resume it.
+*/
+
+int sb_lua_session_run(lua_State *L, sb_lua_ctxt_t *ctxt,
+                       sb_lua_session_t *sess)
+{
+  log_msg_t       msg;
+  log_msg_oper_t  op_msg;
+  db_result_set_t *rs;
+  int             thread_id = ctxt->thread_id;
+  int             nargs;
+  int             rc;
+
+  for (;;)
+  {
+    nargs = 0;
+
+    if (sess->co == NULL)
+    {
+      /* Start or restart the event */
+      sess->co = lua_newthread(L);
+      sess->co_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+      lua_getglobal(sess->co, EVENT_FUNC);
+      lua_pushnumber(sess->co, thread_id);
+      nargs = 1;
+    }
+    else if (sess->con->pending_cnt > 0)
+    {
+      switch (db_poll(sess->con)) {
+        case DB_POLL_READ:
+          return sb_lua_session_wait_for(ctxt, sess, EPOLLIN);
+        case DB_POLL_WRITE:
+          /* The server may not read queries until its results are read */
+          return sb_lua_session_wait_for(ctxt, sess, EPOLLIN | EPOLLOUT);
+        default:
+          break;
+      }
+
+      rs = db_get_result(sess->con);
+      if (rs == NULL)
+      {
+        if (sess->con->db_errno == SB_DB_ERROR_RESTART_TRANSACTION)
+        {
+          log_text(LOG_DEBUG,
+                   "Ignored error encountered, restarting transaction");
+          sb_lua_session_end(L, sess);
+          continue;
+        }
+        log_text(LOG_FATAL, "failed to execute function `%s': %d",
+                 EVENT_FUNC, sess->con->db_errno);
+        sb_lua_session_end(L, sess);
+        sb_globals.error = 1;
+        return 1;
+      }
+      if (rs->ptr != NULL)
+        db_store_results(rs);
+      /* Returned by db_query() in the coroutine */
+      lua_pushnumber(sess->co, rs->nrows);
+      nargs = 1;
+      if (rs->ptr != NULL)
+        db_free_results(rs);
+    }
+
+    ctxt->session = sess;
+    rc = lua_resume(sess->co, nargs);
+    ctxt->session = NULL;
+
+    if (rc == LUA_YIELD)
+      continue;
+
+    if (rc != 0)
+    {
+      if (lua_isnumber(sess->co, -1) &&
+          lua_tonumber(sess->co, -1) == SB_DB_ERROR_RESTART_TRANSACTION)
+      {
+        log_text(LOG_DEBUG,
+                 "Ignored error encountered, restarting transaction");
+        sb_lua_session_end(L, sess);
+        continue;
+      }
+      CALL_ERROR(sess->co, EVENT_FUNC);
+      sb_lua_session_end(L, sess);
+      sb_globals.error = 1;
+      return 1;
+    }
+
+    break;
+  }
+
+  sb_lua_session_end(L, sess);
+  ctxt->idle[ctxt->nidle++] = sess;
+
+  /* Do not wake up for an idle session */
+  if (sb_lua_session_wait_for(ctxt, sess, 0))
+    return 1;
+
+  msg.type = LOG_MSG_TYPE_OPER;
+  msg.data = &op_msg;
+
+  LOG_EVENT_DONE(msg, thread_id, sess->start);
+
+  sb_percentile_update(&local_percentile, sb_timer_value(&timers[thread_id]));
+
+  return 0;
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
+
+/*
+  Parallel prepare. The dataset of a script defining prepare_rows() is split
+  into ranges of --prepare-chunk-size rows of each table, which are prepared
+  by --num-threads threads. Ranges of different tables are interleaved, so
+  threads work on separate tables while there are enough of them.
+
+    prepare_plan()                      returns the number of tables and rows
+                                        per table, called first in every
+                                        interpreter state
+    prepare_table(table_id)             optional, creates a table before its
+                                        first range is prepared
+    prepare_rows(table_id, first, last) inserts rows with IDs first..last,
+                                        replacing any rows of the range left
+                                        by an interrupted prepare
+    prepare_check(table_id, first, last)
+                                        optional, returns whether a range
+                                        recorded in the state file is still
+                                        in the database
+    prepare_done()                      optional, called once after all
+                                        ranges are prepared
+
+  With --prepare-state created tables and completed ranges are appended to a
+  file. A prepare with the same file then only does what is not recorded, so
+  it resumes an interrupted prepare or tops up tables when more tables or
+  rows are requested. Recorded ranges that prepare_check() does not find,
+  e.g. after the tables were dropped, are prepared again.
+*/
+
+static sb_lua_prepare_t prepare;
+
+int sb_lua_prepare_ranges(void)
+{
+  sb_lua_prepare_t   *p = &prepare;
+  pthread_t          *threads;
+  unsigned int       nthreads;
+  unsigned int       i;
+  long long          rows;
+  long long          chunk;
+  char               *path;
+  double             seconds;
+
+  lua_getglobal(gstate, PREPARE_PLAN_FUNC);
+  if (lua_pcall(gstate, 0, 2, 0) != 0)
+  {
+    CALL_ERROR(gstate, PREPARE_PLAN_FUNC);
+    return 1;
+  }
+  if (!lua_isnumber(gstate, -2) || !lua_isnumber(gstate, -1) ||
+      lua_tonumber(gstate, -2) < 0 || lua_tonumber(gstate, -1) < 0)
+  {
+    log_text(LOG_FATAL, "`"PREPARE_PLAN_FUNC"' must return the number of "
+             "tables and rows per table");
+    return 1;
+  }
+  rows = (long long) lua_tonumber(gstate, -1);
+  p->tables = (unsigned int) lua_tonumber(gstate, -2);
+  lua_pop(gstate, 2);
+
+  chunk = sb_get_value_int("prepare-chunk-size");
+  if (chunk <= 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for --prepare-chunk-size: %lld",
+             chunk);
+    return 1;
+  }
+
+  p->rows = rows;
+  p->chunk = chunk;
+  p->nranges = p->tables * ((p->rows + p->chunk - 1) / p->chunk);
+  p->created = (char *)calloc(p->tables + 1, 1);
+  p->done = (char *)calloc(p->nranges + 1, 1);
+  if (p->created == NULL || p->done == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure");
+    return 1;
+  }
+
+  path = sb_get_value_string("prepare-state");
+  if (path != NULL && *path != '\0' &&
+      (sb_lua_prepare_load(p, path) || sb_lua_prepare_check(p, path)))
+    return 1;
+
+  nthreads = sb_globals.num_threads;
+  if (nthreads > p->nranges && p->nranges > 0)
+    nthreads = p->nranges;
+
+  log_text(LOG_NOTICE, "Preparing %u table(s) of %llu rows in ranges of %llu "
+           "rows using %u thread(s)", p->tables, p->rows, p->chunk, nthreads);
+
+  threads = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+  if (threads == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure");
+    return 1;
+  }
+
+  pthread_mutex_init(&p->mutex, NULL);
+  pthread_cond_init(&p->cond, NULL);
+  sb_timer_init(&p->timer);
+  sb_timer_start(&p->timer);
+
+  for (i = 0; i < nthreads; i++)
+  {
+    if (pthread_create(&threads[i], NULL, sb_lua_prepare_thread,
+                       (void *)(size_t) i))
+    {
+      log_text(LOG_FATAL, "pthread_create() failed");
+      pthread_mutex_lock(&p->mutex);
+      p->error = 1;
+      pthread_mutex_unlock(&p->mutex);
+      nthreads = i;
+      break;
+    }
+  }
+
+  for (i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+
+  if (!p->error && sb_lua_prepare_done())
+    p->error = 1;
+
+  sb_timer_stop(&p->timer);
+  seconds = NS2SEC(sb_timer_value(&p->timer));
+
+  log_text(LOG_NOTICE, "%s %llu rows in %.2fs (%.2f rows/s)",
+           p->error ? "Failed after preparing" : "Prepared", p->rows_done,
+           seconds, seconds > 0 ? p->rows_done / seconds : 0);
+
+  if (p->fp != NULL)
+    fclose(p->fp);
+  pthread_cond_destroy(&p->cond);
+  pthread_mutex_destroy(&p->mutex);
+  free(threads);
+  free(p->created);
+  free(p->done);
+
+  return p->error;
+}
+
+/* Mark tables and ranges recorded in the state file as done */
+
+int sb_lua_prepare_load(sb_lua_prepare_t *p, const char *path)
+{
+  FILE               *fp;
+  char               kind[16];
+  unsigned int       table_id;
+  unsigned long long first;
+  unsigned long long last;
+  unsigned long long ntables = 0;
+  unsigned long long nranges = 0;
+
+  if ((fp = fopen(path, "r")) != NULL)
+  {
+    while (fscanf(fp, "%15s %u", kind, &table_id) == 2)
+    {
+      if (!strcmp(kind, "table"))
+      {
+        if (table_id >= 1 && table_id <= p->tables)
+        {
+          p->created[table_id - 1] = PREPARE_TABLE_CREATED;
+          ntables++;
+        }
+        continue;
+      }
+      if (strcmp(kind, "rows") || fscanf(fp, "%llu %llu", &first, &last) != 2)
+      {
+        log_text(LOG_FATAL, "Invalid record in prepare state file '%s'",
+                 path);
+        fclose(fp);
+        return 1;
+      }
+      /* Ranges of a different chunk or table size are prepared again */
+      if (table_id >= 1 && table_id <= p->tables && first >= 1 &&
+          (first - 1) % p->chunk == 0 &&
+          (last == first + p->chunk - 1 || last == p->rows) &&
+          last <= p->rows)
+      {
+        p->done[(first - 1) / p->chunk * p->tables + table_id - 1] = 1;
+        nranges++;
+      }
+    }
+    fclose(fp);
+
+    log_text(LOG_NOTICE, "Resuming from '%s': %llu table(s) and %llu "
+             "range(s) already prepared", path, ntables, nranges);
+  }
+
+  if ((p->fp = fopen(path, "a")) == NULL)
+  {
+    log_text(LOG_FATAL, "Cannot open prepare state file '%s': %s", path,
+             strerror(errno));
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Forget recorded ranges that prepare_check() does not find */
+
+int sb_lua_prepare_check(sb_lua_prepare_t *p, const char *path)
+{
+  sb_lua_ctxt_t      *ctxt;
+  unsigned long long r;
+  unsigned long long first;
+  unsigned long long last;
+  unsigned long long nmissing = 0;
+  int                rc = 0;
+
+  lua_getglobal(gstate, PREPARE_CHECK_FUNC);
+  if (lua_isnil(gstate, -1))
+  {
+    lua_pop(gstate, 1);
+    return 0;
+  }
+  lua_pop(gstate, 1);
+
+  for (r = 0; r < p->nranges; r++)
+  {
+    if (!p->done[r])
+      continue;
+
+    first = r / p->tables * p->chunk + 1;
+    last = first + p->chunk - 1;
+    if (last > p->rows)
+      last = p->rows;
+
+    lua_getglobal(gstate, PREPARE_CHECK_FUNC);
+    lua_pushnumber(gstate, r % p->tables + 1);
+    lua_pushnumber(gstate, first);
+    lua_pushnumber(gstate, last);
+    if (lua_pcall(gstate, 3, 1, 0) != 0)
+    {
+      CALL_ERROR(gstate, PREPARE_CHECK_FUNC);
+      log_text(LOG_FATAL, "Cannot check the ranges recorded in '%s', remove "
+               "it to prepare all tables again", path);
+      rc = 1;
+      break;
+    }
+    if (!lua_toboolean(gstate, -1))
+    {
+      p->done[r] = 0;
+      nmissing++;
+    }
+    lua_pop(gstate, 1);
+  }
+
+  ctxt = sb_lua_get_context(gstate);
+  lua_pop(gstate, 1);
+  if (ctxt->con != NULL)
+  {
+    db_disconnect(ctxt->con);
+    ctxt->con = NULL;
+  }
+
+  if (nmissing > 0)
+    log_text(LOG_NOTICE, "%llu recorded range(s) not found in the database, "
+             "preparing them again", nmissing);
+
+  return rc;
+}
+
+/* Call prepare_done() once all ranges are prepared */
+
+int sb_lua_prepare_done(void)
+{
+  sb_lua_ctxt_t      *ctxt;
+  int                rc = 0;
+
+  lua_getglobal(gstate, PREPARE_DONE_FUNC);
+  if (lua_isnil(gstate, -1))
+  {
+    lua_pop(gstate, 1);
+    return 0;
+  }
+  if (lua_pcall(gstate, 0, 0, 0) != 0)
+  {
+    CALL_ERROR(gstate, PREPARE_DONE_FUNC);
+    rc = 1;
+  }
+
+  ctxt = sb_lua_get_context(gstate);
+  lua_pop(gstate, 1);
+  if (ctxt->con != NULL)
+  {
+    db_disconnect(ctxt->con);
+    ctxt->con = NULL;
+  }
+
+  return rc;
+}
+
+/* Prepare thread, takes the next range not prepared yet until none is left */
 
-int sb_lua_close_state(lua_State *state)
+void *sb_lua_prepare_thread(void *arg)
 {
-  if (state != NULL)
-    lua_close(state);
+  sb_lua_prepare_t   *p = &prepare;
+  lua_State          *L = states[(size_t) arg];
+  sb_lua_ctxt_t      *ctxt;
+  unsigned long long r;
+  unsigned long long first;
+  unsigned long long last;
+  unsigned long long now;
+  unsigned int       t;
+  int                rc;
+
+  lua_getglobal(L, PREPARE_PLAN_FUNC);
+  if (lua_pcall(L, 0, 0, 0) != 0)
+  {
+    CALL_ERROR(L, PREPARE_PLAN_FUNC);
+    pthread_mutex_lock(&p->mutex);
+    p->error = 1;
+    pthread_mutex_unlock(&p->mutex);
+    return NULL;
+  }
 
-  return 0;
+  for (;;)
+  {
+    pthread_mutex_lock(&p->mutex);
+    while (p->next < p->nranges && p->done[p->next])
+      p->next++;
+    if (p->error || p->next >= p->nranges)
+    {
+      pthread_mutex_unlock(&p->mutex);
+      break;
+    }
+    r = p->next++;
+    t = r % p->tables;
+    first = r / p->tables * p->chunk + 1;
+    last = first + p->chunk - 1;
+    if (last > p->rows)
+      last = p->rows;
+
+    /* The first thread to get a range of a new table creates it */
+    if (p->created[t] == PREPARE_TABLE_NEW)
+    {
+      p->created[t] = PREPARE_TABLE_CREATING;
+      pthread_mutex_unlock(&p->mutex);
+
+      rc = 0;
+      lua_getglobal(L, PREPARE_TABLE_FUNC);
+      if (lua_isnil(L, -1))
+        lua_pop(L, 1);
+      else
+      {
+        lua_pushnumber(L, t + 1);
+        if ((rc = lua_pcall(L, 1, 0, 0)) != 0)
+          CALL_ERROR(L, PREPARE_TABLE_FUNC);
+      }
+
+      pthread_mutex_lock(&p->mutex);
+      p->created[t] = PREPARE_TABLE_CREATED;
+      if (rc)
+        p->error = 1;
+      else if (p->fp != NULL)
+      {
+        fprintf(p->fp, "table %u\n", t + 1);
+        fflush(p->fp);
+      }
+      pthread_cond_broadcast(&p->cond);
+    }
+    while (p->created[t] == PREPARE_TABLE_CREATING && !p->error)
+      pthread_cond_wait(&p->cond, &p->mutex);
+    rc = p->error;
+    pthread_mutex_unlock(&p->mutex);
+
+    if (rc)
+      break;
+
+    lua_getglobal(L, PREPARE_ROWS_FUNC);
+    lua_pushnumber(L, t + 1);
+    lua_pushnumber(L, first);
+    lua_pushnumber(L, last);
+    rc = lua_pcall(L, 3, 0, 0);
+    if (rc)
+      CALL_ERROR(L, PREPARE_ROWS_FUNC);
+
+    pthread_mutex_lock(&p->mutex);
+    if (rc)
+    {
+      p->error = 1;
+      pthread_cond_broadcast(&p->cond);
+      pthread_mutex_unlock(&p->mutex);
+      break;
+    }
+    if (p->fp != NULL)
+    {
+      fprintf(p->fp, "rows %u %llu %llu\n", t + 1, first, last);
+      fflush(p->fp);
+    }
+    p->rows_done += last - first + 1;
+
+    now = sb_timer_value(&p->timer);
+    if (sb_globals.report_interval > 0 &&
+        now - p->last_report >= SEC2NS(sb_globals.report_interval))
+    {
+      log_timestamp(LOG_NOTICE, &p->timer, "rows: %llu, rows/s: %.2f",
+                    p->rows_done, (p->rows_done - p->rows_report) /
+                    NS2SEC(now - p->last_report));
+      p->last_report = now;
+      p->rows_report = p->rows_done;
+    }
+    pthread_mutex_unlock(&p->mutex);
+  }
+
+  ctxt = sb_lua_get_context(L);
+  lua_pop(L, 1);
+  if (ctxt->con != NULL)
+  {
+    db_disconnect(ctxt->con);
+    ctxt->con = NULL;
+  }
+
+  return NULL;
 }
 
 /* Prepare command */
 
 int sb_lua_cmd_prepare(void)
 {
+  lua_getglobal(gstate, PREPARE_ROWS_FUNC);
+  if (!lua_isnil(gstate, -1))
+  {
+    lua_pop(gstate, 1);
+    return sb_lua_prepare_ranges();
+  }
+  lua_pop(gstate, 1);
+
   lua_getglobal(gstate, PREPARE_FUNC);
 
   if (lua_pcall(gstate, 0, 1, 0) != 0)
@@ -614,6 +1523,18 @@ int sb_lua_db_query(lua_State *L)
     sb_lua_db_connect(L);
   
   query = luaL_checkstring(L, 1);
+
+  /* Let the event loop run other sessions until the result arrives */
+  if (ctxt->session != NULL)
+  {
+    if (db_send_query(ctxt->session->con, query))
+    {
+      lua_pushnumber(L, ctxt->session->con->db_errno);
+      lua_error(L);
+    }
+    return lua_yield(L, 0);
+  }
+
   rs = db_query(ctxt->con, query);
   if (rs == NULL)
   {
@@ -622,9 +1543,11 @@ int sb_lua_db_query(lua_State *L)
   }
 
   db_store_results(rs);
+  /* Return the number of rows, e.g. to validate row contents in queries */
+  lua_pushnumber(L, rs->nrows);
   db_free_results(rs);
   
-  return 0;
+  return 1;
 }
 
 int sb_lua_db_bulk_insert_init(lua_State *L)
@@ -668,11 +1591,85 @@ int sb_lua_db_bulk_insert_done(lua_State *L)
 
   CHECK_CONNECTION(L, ctxt);
     
-  db_bulk_insert_done(ctxt->con);
+  if (db_bulk_insert_done(ctxt->con))
+    luaL_error(L, "db_bulk_insert_done() failed");
   
   return 0;
 }
 
+/*
+  Add a row to a bulk insert: db_bulk_insert_row(v1, v2, ...). Values are
+  numbers, strings or nil for NULL and are passed to the driver without
+  building the row text in Lua.
+*/
+
+int sb_lua_db_bulk_insert_row(lua_State *L)
+{
+  sb_lua_ctxt_t *ctxt;
+  db_bind_t     values[MAX_BULK_COLUMNS];
+  long long     ints[MAX_BULK_COLUMNS];
+  double        doubles[MAX_BULK_COLUMNS];
+  unsigned long lens[MAX_BULK_COLUMNS];
+  char          nulls[MAX_BULK_COLUMNS];
+  lua_Number    n;
+  size_t        len;
+  int           nvalues;
+  int           i;
+
+  nvalues = lua_gettop(L);
+  luaL_argcheck(L, nvalues > 0, 1, "value expected");
+  luaL_argcheck(L, nvalues <= MAX_BULK_COLUMNS, MAX_BULK_COLUMNS + 1,
+                "too many values");
+
+  ctxt = sb_lua_get_context(L);
+
+  CHECK_CONNECTION(L, ctxt);
+
+  for (i = 0; i < nvalues; i++)
+  {
+    nulls[i] = 0;
+    values[i].is_null = nulls + i;
+    values[i].data_len = NULL;
+    values[i].max_len = 0;
+
+    switch (lua_type(L, i + 1)) {
+      case LUA_TNUMBER:
+        n = lua_tonumber(L, i + 1);
+        if ((lua_Number)(long long)n == n)
+        {
+          ints[i] = (long long)n;
+          values[i].type = DB_TYPE_BIGINT;
+          values[i].buffer = ints + i;
+        }
+        else
+        {
+          doubles[i] = (double)n;
+          values[i].type = DB_TYPE_DOUBLE;
+          values[i].buffer = doubles + i;
+        }
+        break;
+      case LUA_TSTRING:
+        values[i].type = DB_TYPE_VARCHAR;
+        values[i].buffer = (void *)lua_tolstring(L, i + 1, &len);
+        lens[i] = len;
+        values[i].data_len = lens + i;
+        break;
+      case LUA_TNIL:
+        nulls[i] = 1;
+        values[i].type = DB_TYPE_VARCHAR;
+        values[i].buffer = NULL;
+        break;
+      default:
+        luaL_typerror(L, i + 1, "number, string or nil");
+    }
+  }
+
+  if (db_bulk_insert_row(ctxt->con, values, nvalues))
+    luaL_error(L, "db_bulk_insert_row() failed");
+
+  return 0;
+}
+
 int sb_lua_db_prepare(lua_State *L)
 {
   sb_lua_ctxt_t *ctxt;
@@ -849,25 +1846,19 @@ int sb_lua_db_bind_result(lua_State *L)
   return 0;
 }
 
-int sb_lua_db_execute(lua_State *L)
+/* Copy values of bound parameters from the params table of a statement */
+
+static void sb_lua_db_update_params(lua_State *L, sb_lua_db_stmt_t *stmt)
 {
-  sb_lua_ctxt_t    *ctxt;
-  sb_lua_db_stmt_t *stmt;
-  db_result_set_t  *ptr;
-  sb_lua_db_rs_t   *rs;
   unsigned int     i;
-  char             needs_rebind = 0;
+  char             needs_rebind;
   db_bind_t        *binds;
   size_t           length;
   const char       *str;
   sb_lua_bind_t    *param;
 
-  ctxt = sb_lua_get_context(L);
-
-  CHECK_CONNECTION(L, ctxt);
-
-  stmt = (sb_lua_db_stmt_t *)luaL_checkudata(L, 1, "sysbench.stmt");
-  luaL_argcheck(L, stmt != NULL, 1, "prepared statement expected");
+  needs_rebind = stmt->rebind;
+  stmt->rebind = 0;
 
   /* Get params table */
   lua_rawgeti(L, LUA_REGISTRYINDEX, stmt->param_ref);
@@ -940,6 +1931,24 @@ int sb_lua_db_execute(lua_State *L)
       luaL_error(L, "db_bind_param() failed");
     free(binds);
   }
+  lua_pop(L, 1);
+}
+
+int sb_lua_db_execute(lua_State *L)
+{
+  sb_lua_ctxt_t    *ctxt;
+  sb_lua_db_stmt_t *stmt;
+  db_result_set_t  *ptr;
+  sb_lua_db_rs_t   *rs;
+
+  ctxt = sb_lua_get_context(L);
+
+  CHECK_CONNECTION(L, ctxt);
+
+  stmt = (sb_lua_db_stmt_t *)luaL_checkudata(L, 1, "sysbench.stmt");
+  luaL_argcheck(L, stmt != NULL, 1, "prepared statement expected");
+
+  sb_lua_db_update_params(L, stmt);
 
   ptr = db_execute(stmt->ptr);
   if (ptr == NULL)
@@ -960,6 +1969,242 @@ int sb_lua_db_execute(lua_State *L)
   return 1;
 }
 
+/*
+  Execute prepared statement for each row of a table of rows in a single
+  batch. Each row is an array of parameter values, with types determined by
+  the first non-nil value in each column.
+*/
+
+int sb_lua_db_execute_many(lua_State *L)
+{
+  sb_lua_ctxt_t    *ctxt;
+  sb_lua_db_stmt_t *stmt;
+  db_bind_t        *binds;
+  int              *ints;
+  unsigned long    *lens;
+  char             *nulls;
+  unsigned int     nrows, nparams;
+  unsigned int     i, j, k;
+  size_t           length;
+  int              rc;
+
+  ctxt = sb_lua_get_context(L);
+
+  CHECK_CONNECTION(L, ctxt);
+
+  stmt = (sb_lua_db_stmt_t *)luaL_checkudata(L, 1, "sysbench.stmt");
+  luaL_argcheck(L, stmt != NULL, 1, "prepared statement expected");
+  luaL_checktype(L, 2, LUA_TTABLE);
+
+  nrows = lua_objlen(L, 2);
+  if (nrows == 0)
+  {
+    lua_pushnumber(L, 0);
+    return 1;
+  }
+
+  lua_rawgeti(L, 2, 1);
+  if (!lua_istable(L, -1))
+    luaL_error(L, "table of rows was expected");
+  nparams = lua_objlen(L, -1);
+  lua_pop(L, 1);
+
+  k = nrows * (nparams > 0 ? nparams : 1);
+  binds = (db_bind_t *)calloc(k, sizeof(db_bind_t));
+  ints = (int *)calloc(k, sizeof(int));
+  lens = (unsigned long *)calloc(k, sizeof(unsigned long));
+  nulls = (char *)calloc(k, sizeof(char));
+  if (binds == NULL || ints == NULL || lens == NULL || nulls == NULL)
+  {
+    lua_pushstring(L, "memory allocation failure");
+    goto error;
+  }
+
+  /* Column types are taken from the first non-nil value */
+  for (j = 0; j < nparams; j++)
+  {
+    binds[j].type = DB_TYPE_CHAR;
+    for (i = 0; i < nrows; lua_pop(L, 1), i++)
+    {
+      lua_rawgeti(L, 2, i + 1);
+      if (!lua_istable(L, -1))
+        continue;
+      lua_rawgeti(L, -1, j + 1);
+      switch (lua_type(L, -1))
+      {
+        case LUA_TNIL:
+          lua_pop(L, 1);
+          continue;
+        case LUA_TNUMBER:
+          binds[j].type = DB_TYPE_INT;
+          break;
+        case LUA_TSTRING:
+          break;
+        default:
+          lua_pushfstring(L, "Unsupported variable type: %s",
+                          lua_typename(L, lua_type(L, -1)));
+          goto error;
+      }
+      lua_pop(L, 2);
+      break;
+    }
+  }
+
+  /*
+    String values point directly to Lua strings which are kept alive by the
+    rows table for the duration of the call
+  */
+  for (i = 0, k = 0; i < nrows; lua_pop(L, 1), i++)
+  {
+    lua_rawgeti(L, 2, i + 1);
+    if (!lua_istable(L, -1) || lua_objlen(L, -1) > nparams)
+    {
+      lua_pushfstring(L, "row %d: %d values expected", i + 1, nparams);
+      goto error;
+    }
+
+    for (j = 0; j < nparams; lua_pop(L, 1), j++, k++)
+    {
+      binds[k].type = binds[j].type;
+      binds[k].is_null = nulls + k;
+
+      lua_rawgeti(L, -1, j + 1);
+      if (lua_isnil(L, -1))
+      {
+        nulls[k] = 1;
+        continue;
+      }
+
+      if (binds[k].type == DB_TYPE_INT)
+      {
+        if (!lua_isnumber(L, -1))
+        {
+          lua_pushfstring(L, "row %d: number expected in column %d",
+                          i + 1, j + 1);
+          goto error;
+        }
+        ints[k] = lua_tonumber(L, -1);
+        binds[k].buffer = ints + k;
+      }
+      else
+      {
+        if (lua_type(L, -1) != LUA_TSTRING)
+        {
+          lua_pushfstring(L, "row %d: string expected in column %d",
+                          i + 1, j + 1);
+          goto error;
+        }
+        binds[k].buffer = (void *)lua_tolstring(L, -1, &length);
+        lens[k] = length;
+        binds[k].data_len = lens + k;
+        binds[k].max_len = length + 1;
+      }
+    }
+  }
+
+  rc = db_execute_batch(stmt->ptr, binds, nparams, nrows);
+
+  /* Driver-side bindings now refer to the buffers freed below */
+  if (stmt->nparams > 0)
+    stmt->rebind = 1;
+
+  free(binds);
+  free(ints);
+  free(lens);
+  free(nulls);
+
+  if (rc != SB_DB_ERROR_NONE)
+  {
+    lua_pushnumber(L, ctxt->con->db_errno);
+    lua_error(L);
+  }
+
+  lua_pushnumber(L, nrows);
+
+  return 1;
+
+ error:
+
+  free(binds);
+  free(ints);
+  free(lens);
+  free(nulls);
+  lua_error(L);
+
+  return 0;
+}
+
+int sb_lua_db_send_query(lua_State *L)
+{
+  sb_lua_ctxt_t *ctxt;
+  const char *query;
+
+  ctxt = sb_lua_get_context(L);
+
+  if (ctxt->con == NULL)
+    sb_lua_db_connect(L);
+
+  query = luaL_checkstring(L, 1);
+  if (db_send_query(ctxt->con, query))
+  {
+    lua_pushnumber(L, ctxt->con->db_errno);
+    lua_error(L);
+  }
+
+  return 0;
+}
+
+int sb_lua_db_send_execute(lua_State *L)
+{
+  sb_lua_ctxt_t    *ctxt;
+  sb_lua_db_stmt_t *stmt;
+
+  ctxt = sb_lua_get_context(L);
+
+  CHECK_CONNECTION(L, ctxt);
+
+  stmt = (sb_lua_db_stmt_t *)luaL_checkudata(L, 1, "sysbench.stmt");
+  luaL_argcheck(L, stmt != NULL, 1, "prepared statement expected");
+
+  sb_lua_db_update_params(L, stmt);
+
+  if (db_send_execute(stmt->ptr))
+  {
+    lua_pushnumber(L, ctxt->con->db_errno);
+    lua_error(L);
+  }
+
+  return 0;
+}
+
+/* Collect the result of the oldest query sent with db_send_*() */
+
+int sb_lua_db_get_result(lua_State *L)
+{
+  sb_lua_ctxt_t   *ctxt;
+  db_result_set_t *rs;
+
+  ctxt = sb_lua_get_context(L);
+
+  CHECK_CONNECTION(L, ctxt);
+
+  rs = db_get_result(ctxt->con);
+  if (rs == NULL)
+  {
+    lua_pushnumber(L, ctxt->con->db_errno);
+    lua_error(L);
+  }
+
+  /* Results of synchronously emulated queries are already discarded */
+  if (rs->ptr != NULL)
+    db_store_results(rs);
+  lua_pushnumber(L, rs->nrows);
+  if (rs->ptr != NULL)
+    db_free_results(rs);
+
+  return 1;
+}
+
 int sb_lua_db_close(lua_State *L)
 {
   sb_lua_ctxt_t    *ctxt;
@@ -1104,6 +2349,46 @@ int sb_lua_rand_str(lua_State *L)
   return 1;
 }
 
+/* sb_row_rand(a, b, table_id, id, column) */
+
+int sb_lua_row_rand(lua_State *L)
+{
+  unsigned long long a, b;
+
+  a = (unsigned long long) luaL_checknumber(L, 1);
+  b = (unsigned long long) luaL_checknumber(L, 2);
+  luaL_argcheck(L, a <= b, 2, "empty range");
+
+  lua_pushnumber(L, sb_row_rand(a, b, (unsigned int) luaL_checknumber(L, 3),
+                                (unsigned long long) luaL_checknumber(L, 4),
+                                (unsigned int) luaL_checknumber(L, 5)));
+
+  return 1;
+}
+
+/* sb_row_str(format, table_id, id, column) */
+
+int sb_lua_row_str(lua_State *L)
+{
+  const char         *fmt = luaL_checkstring(L, 1);
+  unsigned int       table_id = (unsigned int) luaL_checknumber(L, 2);
+  unsigned long long id = (unsigned long long) luaL_checknumber(L, 3);
+  unsigned int       column = (unsigned int) luaL_checknumber(L, 4);
+  size_t             len = strlen(fmt);
+  char               *buf;
+
+  buf = (char *)malloc(len + 1);
+  if (buf == NULL)
+    luaL_error(L, "memory allocation failure");
+
+  sb_row_str(fmt, buf, table_id, id, column);
+  lua_pushlstring(L, buf, len);
+
+  free(buf);
+
+  return 1;
+}
+
 /* Get a per-state interpreter context */
 
 sb_lua_ctxt_t *sb_lua_get_context(lua_State *L)
@@ -69,6 +69,18 @@
 #include "scripting/sb_script.h"
 #include "db_driver.h"
 #include "sb_barrier.h"
+#include "sb_metrics.h"
+#include "sb_trace.h"
+#include "sb_outliers.h"
+#include "sb_watchdog.h"
+#include "sb_profile.h"
+#include "sb_perf.h"
+#include "sb_sysstat.h"
+#include "sb_series.h"
+#include "sb_sampler.h"
+#include "sb_result.h"
+#include "sb_timeline.h"
+#include "sb_client.h"
 
 #define VERSION_STRING PACKAGE" "PACKAGE_VERSION
 
@@ -137,6 +149,20 @@ sb_arg_t general_args[] =
    "representing the amount of time in seconds elapsed from start of test "
    "when report checkpoint(s) must be performed. Report checkpoints are off by "
    "default.", SB_ARG_TYPE_LIST, ""},
+  {"timer", "timestamp source for response time measurements, one of "
+   "monotonic (clock_gettime(CLOCK_MONOTONIC)) or tsc (invariant TSC "
+   "calibrated against CLOCK_MONOTONIC, x86 only)", SB_ARG_TYPE_STRING,
+   "monotonic"},
+  {"timer-subtract-overhead", "subtract the measured timer overhead from "
+   "event execution times", SB_ARG_TYPE_FLAG, "off"},
+  {"report-windows", "with --report-interval, also report response time "
+   "percentiles over sliding windows of the specified lengths in seconds, "
+   "e.g. --report-windows=10,60", SB_ARG_TYPE_LIST, ""},
+  {"prepare-chunk-size", "number of rows per range a table is split into by "
+   "parallel prepare", SB_ARG_TYPE_INT, "10000"},
+  {"prepare-state", "file recording tables and ranges completed by parallel "
+   "prepare, used to resume or top up a previous prepare",
+   SB_ARG_TYPE_STRING, ""},
   {"test", "test to run", SB_ARG_TYPE_STRING, NULL},
   {"debug", "print more debugging info", SB_ARG_TYPE_FLAG, "off"},
   {"validate", "perform validation checks where possible", SB_ARG_TYPE_FLAG, "off"},
@@ -216,6 +242,9 @@ static void sigalrm_forced_shutdown_handler(int sig)
   if (current_test && current_test->ops.print_stats)
     current_test->ops.print_stats(SB_STAT_CUMULATIVE);
 
+  sb_watchdog_dump_threads();
+  sb_watchdog_print_stats();
+
   log_done();
 
   exit(2);
@@ -296,12 +325,34 @@ void print_help(void)
   
   printf("Usage:\n");
   printf("  sysbench --test=<test-name> [options]... <command>\n\n");
-  printf("Commands: prepare run cleanup help version\n\n");
+  printf("Commands: prepare run cleanup help version trace\n\n");
   printf("General options:\n");
   sb_print_options(general_args);
 
   log_print_help();
 
+  sb_metrics_print_help();
+
+  sb_trace_print_help();
+
+  sb_outliers_print_help();
+
+  sb_watchdog_print_help();
+
+  sb_profile_print_help();
+
+  sb_perf_print_help();
+
+  sb_sysstat_print_help();
+
+  sb_series_print_help();
+
+  sb_result_print_help();
+
+  sb_timeline_print_help();
+
+  sb_client_print_help();
+
   db_print_help();
 
   printf("Compiled-in tests:\n");
@@ -327,6 +378,8 @@ static sb_cmd_t parse_command(char *cmd)
     return SB_COMMAND_CLEANUP;
   else if (!strcmp(cmd, "version"))
     return SB_COMMAND_VERSION;
+  else if (!strcmp(cmd, "trace"))
+    return SB_COMMAND_TRACE;
 
   return SB_COMMAND_NULL;
 }
@@ -440,6 +493,11 @@ void print_run_mode(sb_test_t *test)
              list_str);
   }
 
+  log_text(LOG_NOTICE, "Timer: %s, overhead: %lluns per call%s",
+           sb_timer_source_name(), sb_timer_overhead,
+           sb_get_value_flag("timer-subtract-overhead") ?
+           " (subtracted from event times)" : "");
+
   if (sb_globals.debug)
     log_text(LOG_NOTICE, "Debug mode enabled.\n");
   
@@ -482,6 +540,7 @@ static void *worker_thread(void *arg)
   sb_thread_ctxt_t   *ctxt;
   sb_test_t          *test;
   unsigned int        thread_id;
+  int                 rc;
   unsigned long long  queue_start_time = 0;
   sb_list_item_t     *pos;
   event_queue_elem_t *event;
@@ -505,6 +564,15 @@ static void *worker_thread(void *arg)
   if (sb_barrier_wait(&thread_start_barrier) < 0)
     return NULL;
 
+  if (sb_profile_enabled)
+    sb_profile_thread_start(thread_id);
+
+  if (sb_perf_mode != SB_PERF_OFF)
+    sb_perf_thread_start(thread_id);
+
+  if (sb_client_enabled)
+    sb_client_thread_start(thread_id);
+
   do
   {
 
@@ -539,12 +607,38 @@ static void *worker_thread(void *arg)
 
     }
 
+    if (sb_profile_enabled)
+      sb_profile_enter(thread_id, SB_PROF_REQUEST);
+
     request = get_request(test, thread_id);
 
+    if (sb_profile_enabled)
+      sb_profile_exit(thread_id);
+
     /* check if we shall execute it */
     if (request.type != SB_REQ_TYPE_NULL)
     {
-      if (execute_request(test, &request, thread_id))
+      if (sb_trace_enabled)
+        sb_trace_event_start(thread_id);
+      if (sb_watchdog_enabled)
+        sb_watchdog_event_start(thread_id);
+      if (sb_profile_enabled)
+        sb_profile_enter(thread_id, SB_PROF_EVENT);
+      if (sb_perf_mode == SB_PERF_EVENT)
+        sb_perf_event_start(thread_id);
+
+      rc = execute_request(test, &request, thread_id);
+
+      if (sb_perf_mode == SB_PERF_EVENT)
+        sb_perf_event_stop(thread_id);
+      if (sb_profile_enabled)
+        sb_profile_exit(thread_id);
+      if (sb_watchdog_enabled)
+        sb_watchdog_event_stop(thread_id);
+      if (sb_trace_enabled)
+        sb_trace_event_stop(thread_id, request.type, rc);
+
+      if (rc)
         break; /* break if error returned (terminates only one thread) */
     }
 
@@ -563,8 +657,31 @@ static void *worker_thread(void *arg)
       break;
     }
 
+    /* Check if the result is already precise enough */
+    if (sb_series_stop_requested)
+      break;
+
   } while ((request.type != SB_REQ_TYPE_NULL) && (!sb_globals.error) );
 
+  /* Complete events still in progress, e.g. in multiplexed DB sessions */
+  if (test->ops.thread_drain != NULL)
+  {
+    if (sb_profile_enabled)
+      sb_profile_enter(thread_id, SB_PROF_EVENT);
+
+    if (test->ops.thread_drain(thread_id))
+      sb_globals.error = 1;
+
+    if (sb_profile_enabled)
+      sb_profile_exit(thread_id);
+  }
+
+  if (sb_profile_enabled)
+    sb_profile_thread_stop(thread_id);
+
+  if (sb_client_enabled)
+    sb_client_thread_stop(thread_id);
+
   if (test->ops.thread_done != NULL)
     test->ops.thread_done(thread_id);
 
@@ -658,13 +775,16 @@ static void *report_thread_proc(void *arg)
   if (sb_barrier_wait(&thread_start_barrier) < 0)
     return NULL;
 
-  if (current_test->ops.print_stats == NULL)
+  if (current_test->ops.print_stats == NULL && !sb_outliers_enabled &&
+      sb_perf_mode == SB_PERF_OFF && !sb_sysstat_enabled)
   {
     log_text(LOG_DEBUG, "Reporting not supported by the current test, ",
              "terminating the reporting thread");
     return NULL;
   }
 
+  sb_sysstat_start();
+
   pause_ns = interval_ns;
   prev_ns = sb_timer_value(&sb_globals.exec_timer) + interval_ns;
   for (;;)
@@ -676,7 +796,13 @@ static void *report_thread_proc(void *arg)
     */
     pthread_mutex_lock(&report_interval_mutex);
     if (sb_globals.report_interval > 0)
-      current_test->ops.print_stats(SB_STAT_INTERMEDIATE);
+    {
+      if (current_test->ops.print_stats != NULL)
+        current_test->ops.print_stats(SB_STAT_INTERMEDIATE);
+      sb_outliers_print(SB_STAT_INTERMEDIATE);
+      sb_perf_print(SB_STAT_INTERMEDIATE);
+      sb_sysstat_print();
+    }
     pthread_mutex_unlock(&report_interval_mutex);
 
     curr_ns = sb_timer_value(&sb_globals.exec_timer);
@@ -730,11 +856,14 @@ static void *checkpoints_thread_proc(void *arg)
     */
     curr_ns = sb_timer_value(&sb_globals.exec_timer);
 
-    SB_THREAD_MUTEX_LOCK();
+    /*
+      No global lock here: fileio and memory snapshot their counters under
+      the execution mutex, the DB driver uses per-thread locks, and
+      print_global_stats() switches workers to a new stats epoch.
+    */
     log_timestamp(LOG_NOTICE, &sb_globals.exec_timer, "Checkpoint report:");
     current_test->ops.print_stats(SB_STAT_CUMULATIVE);
     print_global_stats();
-    SB_THREAD_MUTEX_UNLOCK();
   }
 
   return NULL;
@@ -837,6 +966,34 @@ static int run_test(sb_test_t *test)
     return 1;
   }
 
+  /* Start serving metrics, if requested */
+  if (sb_metrics_start())
+    return 1;
+
+  /* Start recording the event trace, if requested */
+  if (sb_trace_start())
+    return 1;
+
+  /* Start the stall detector, if requested */
+  if (sb_watchdog_start())
+    return 1;
+
+  /* Start steady state sampling, if requested */
+  if (sb_series_start())
+    return 1;
+
+  /* Start per-thread timeline sampling, if requested */
+  if (sb_timeline_start())
+    return 1;
+
+  /* Start the interval sampler used by the two above */
+  if (sb_sampler_start())
+    return 1;
+
+  /* Take the client resource usage baseline, if requested */
+  if (sb_client_start())
+    return 1;
+
   if (sb_globals.report_interval > 0)
   {
     /* Create a thread for intermediate statistic reports */
@@ -925,6 +1082,12 @@ static int run_test(sb_test_t *test)
   sb_timer_stop(&sb_globals.cumulative_timer1);
   sb_timer_stop(&sb_globals.cumulative_timer2);
 
+  sb_trace_stop();
+
+  sb_watchdog_stop();
+
+  sb_sampler_stop();
+
   /* Silence periodic reports if they were on */
   pthread_mutex_lock(&report_interval_mutex);
   sb_globals.report_interval = 0;
@@ -944,6 +1107,21 @@ static int run_test(sb_test_t *test)
   if (test->ops.print_stats != NULL && !sb_globals.error)
     test->ops.print_stats(SB_STAT_CUMULATIVE);
 
+  if (!sb_globals.error)
+  {
+    sb_outliers_print(SB_STAT_CUMULATIVE);
+    sb_watchdog_print_stats();
+    sb_profile_print_stats();
+    sb_perf_print(SB_STAT_CUMULATIVE);
+    sb_series_print_stats();
+    sb_timeline_print_stats();
+    sb_client_print_stats();
+
+    /* Save and compare the result */
+    if (sb_result_finish(test))
+      return 1;
+  }
+
   pthread_mutex_destroy(&rnd_mutex);
 
   pthread_mutex_destroy(&sb_globals.exec_mutex);
@@ -974,6 +1152,8 @@ static int run_test(sb_test_t *test)
       log_errno(LOG_FATAL, "Terminating the checkpoint thread failed.");
   }
 
+  sb_metrics_stop();
+
   return sb_globals.error != 0;
 }
 
@@ -1009,6 +1189,8 @@ static int init(void)
   char     *s;
   char     *tmp;
   sb_list_t         *checkpoints_list;
+  sb_list_t         *windows_list;
+  sb_timer_source_t timer_source;
   sb_list_item_t    *pos_val;
   value_t           *val;
   long              res;
@@ -1152,6 +1334,52 @@ static int init(void)
           sizeof(unsigned int), checkpoint_cmp);
   }
 
+  sb_globals.n_report_windows = 0;
+  windows_list = sb_get_value_list("report-windows");
+  SB_LIST_FOR_EACH(pos_val, windows_list)
+  {
+    char *endptr;
+
+    val = SB_LIST_ENTRY(pos_val, value_t, listitem);
+    if (val->data[0] == '\0')
+      continue;
+    res = strtol(val->data, &endptr, 10);
+    if (*endptr != '\0' || res <= 0 || res > UINT_MAX)
+    {
+      log_text(LOG_FATAL, "Invalid value for --report-windows: '%s'",
+               val->data);
+      return 1;
+    }
+    if (++sb_globals.n_report_windows > MAX_REPORT_WINDOWS)
+    {
+      log_text(LOG_FATAL, "Too many windows in --report-windows "
+               "(up to %d can be defined)", MAX_REPORT_WINDOWS);
+      return 1;
+    }
+    sb_globals.report_windows[sb_globals.n_report_windows-1] =
+      (unsigned int) res;
+  }
+
+  s = sb_get_value_string("timer");
+  if (!strcmp(s, "monotonic"))
+    timer_source = SB_TIMER_MONOTONIC;
+  else if (!strcmp(s, "tsc"))
+    timer_source = SB_TIMER_TSC;
+  else
+  {
+    log_text(LOG_FATAL, "Invalid value for --timer: '%s'", s);
+    return 1;
+  }
+  /* Calibration and overhead measurement are only useful for 'run' */
+  if (sb_globals.command == SB_COMMAND_RUN &&
+      sb_timer_select_source(timer_source,
+                             sb_get_value_flag("timer-subtract-overhead")))
+    return 1;
+
+  if (sb_globals.n_report_windows > 0 && sb_globals.report_interval == 0)
+    log_text(LOG_WARNING, "--report-windows has no effect without "
+             "--report-interval");
+
   return 0;
 }
 
@@ -1168,6 +1396,50 @@ int main(int argc, char *argv[])
   if (log_register())
     exit(1);
 
+  /* Register metrics options */
+  if (sb_metrics_register())
+    exit(1);
+
+  /* Register trace options */
+  if (sb_trace_register())
+    exit(1);
+
+  /* Register outliers options */
+  if (sb_outliers_register())
+    exit(1);
+
+  /* Register stall detection options */
+  if (sb_watchdog_register())
+    exit(1);
+
+  /* Register profiling options */
+  if (sb_profile_register())
+    exit(1);
+
+  /* Register performance counters options */
+  if (sb_perf_register())
+    exit(1);
+
+  /* Register host statistics options */
+  if (sb_sysstat_register())
+    exit(1);
+
+  /* Register steady state options */
+  if (sb_series_register())
+    exit(1);
+
+  /* Register result comparison options */
+  if (sb_result_register())
+    exit(1);
+
+  /* Register thread timeline options */
+  if (sb_timeline_register())
+    exit(1);
+
+  /* Register client resource usage options */
+  if (sb_client_register())
+    exit(1);
+
   /* Register available tests */
   if (register_tests())
   {
@@ -1196,8 +1468,16 @@ int main(int argc, char *argv[])
   }
 
   /* Initialize global variables and logger */
-  if (init() || log_init())
+  if (init() || log_init() || sb_metrics_init() || sb_trace_init() ||
+      sb_outliers_init() || sb_watchdog_init() || sb_profile_init() ||
+      sb_perf_init() || sb_sysstat_init() ||
+      sb_series_init() || sb_result_init() || sb_timeline_init() ||
+      sb_client_init())
     exit(1);
+
+  /* 'trace' command does not need a test and prints its own output */
+  if (sb_globals.command == SB_COMMAND_TRACE)
+    exit(sb_trace_analyze());
   
   print_header();
 
@@ -1276,10 +1556,32 @@ int main(int argc, char *argv[])
   if (run_test(test))
     exit(1);
 
+  sb_client_done();
+
+  sb_timeline_done();
+
+  sb_result_done();
+
+  sb_series_done();
+
+  sb_sysstat_done();
+
+  sb_perf_done();
+
+  sb_profile_done();
+
+  sb_watchdog_done();
+
+  sb_outliers_done();
+
+  sb_trace_done();
+
+  sb_metrics_done();
+
   /* Uninitialize logger */
   log_done();
   
-  exit(0);
+  exit(sb_result_regression ? SB_RESULT_REGRESSION_EXIT : 0);
 }
 
 /*
@@ -1398,3 +1700,81 @@ void sb_rand_str(const char *fmt, char *buf)
       buf[i] = fmt[i];
   }
 }
+
+/*
+  Row values are generated by a counter-based PRNG (splitmix64) keyed by
+  --rand-seed, table, row ID and column instead of the global generator,
+  so the contents of any row can be regenerated to validate it.
+*/
+
+static unsigned long long sb_row_mix(unsigned long long x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+
+  return x;
+}
+
+/* Generator state for the value of a column of a row */
+
+static unsigned long long sb_row_key(unsigned int table_id,
+                                     unsigned long long id,
+                                     unsigned int column)
+{
+  unsigned long long key;
+
+  key = sb_row_mix((unsigned long long) (unsigned int) rand_seed << 32 |
+                   table_id);
+  key = sb_row_mix(key ^ id);
+
+  return sb_row_mix(key ^ column);
+}
+
+/* Number in the range [a, b] for a column of a row */
+
+unsigned long long sb_row_rand(unsigned long long a, unsigned long long b,
+                               unsigned int table_id, unsigned long long id,
+                               unsigned int column)
+{
+  return a + sb_row_key(table_id, id, column) % (b - a + 1);
+}
+
+/* String generated like sb_rand_str() for a column of a row */
+
+void sb_row_str(const char *fmt, char *buf, unsigned int table_id,
+                unsigned long long id, unsigned int column)
+{
+  unsigned long long state = sb_row_key(table_id, id, column);
+  unsigned long long r = 0;
+  unsigned int       i;
+
+  for (i = 0; fmt[i] != '\0'; i++)
+  {
+    if (fmt[i] != '#' && fmt[i] != '@')
+    {
+      buf[i] = fmt[i];
+      continue;
+    }
+
+    /* A 64-bit output supplies 13 or more characters */
+    if (r < 26)
+    {
+      state += 0x9e3779b97f4a7c15ULL;
+      r = sb_row_mix(state);
+    }
+
+    if (fmt[i] == '#')
+    {
+      buf[i] = '0' + r % 10;
+      r /= 10;
+    }
+    else
+    {
+      buf[i] = 'a' + r % 26;
+      r /= 26;
+    }
+  }
+}
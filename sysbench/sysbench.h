@@ -56,6 +56,9 @@
 /* Maximum number of elements in --report-checkpoints list */
 #define MAX_CHECKPOINTS 256
 
+/* Maximum number of sliding windows for intermediate percentiles */
+#define MAX_REPORT_WINDOWS 8
+
 /* random() is not thread-safe on most platforms, use lrand48() if available */
 #ifdef HAVE_LRAND48
 # define sb_rnd() (lrand48() % SB_MAX_RND)
@@ -78,7 +81,8 @@ typedef enum
   SB_COMMAND_RUN,
   SB_COMMAND_CLEANUP,
   SB_COMMAND_HELP,
-  SB_COMMAND_VERSION
+  SB_COMMAND_VERSION,
+  SB_COMMAND_TRACE
 } sb_cmd_t;
 
 /* Request types definition */
@@ -140,6 +144,7 @@ typedef void sb_op_print_stats(sb_stat_t);
 typedef int sb_op_thread_done(int);
 typedef int sb_op_cleanup(void);
 typedef int sb_op_done(void);
+typedef int sb_op_thread_drain(int);
 
 /* Test commands structure definitions */
 
@@ -168,6 +173,9 @@ typedef struct
   sb_op_cleanup         *cleanup;         /* called after exit from thread,
                                              but before timers stop */ 
   sb_op_done            *done;            /* finalize function */
+  sb_op_thread_drain    *thread_drain;    /* complete events still in
+                                             progress before the thread
+                                             stops being accounted */
 } sb_operations_t;
 
 /* Test structure definition */
@@ -211,6 +219,9 @@ typedef struct
   /* array of report checkpoints */
   unsigned int    checkpoints[MAX_CHECKPOINTS];
   unsigned int    n_checkpoints; /* number of checkpoints */
+  /* sliding windows for intermediate percentiles, in seconds */
+  unsigned int    report_windows[MAX_REPORT_WINDOWS];
+  unsigned int    n_report_windows; /* number of sliding windows */
   unsigned int    tx_rate;      /* target transaction rate */
   unsigned int    max_requests; /* maximum number of requests */
   unsigned int    max_time;     /* total execution time limit */
@@ -239,4 +250,10 @@ int sb_rand_pareto(int, int);
 int sb_rand_uniq(int a, int b);
 void sb_rand_str(const char *, char *);
 
+/* Row value generators, see sb_row_str() */
+unsigned long long sb_row_rand(unsigned long long, unsigned long long,
+                               unsigned int, unsigned long long, unsigned int);
+void sb_row_str(const char *, char *, unsigned int, unsigned long long,
+                unsigned int);
+
 #endif
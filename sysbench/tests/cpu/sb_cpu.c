@@ -57,7 +57,8 @@ static sb_test_t cpu_test =
     NULL,
     NULL,
     NULL,
-    cpu_done
+    cpu_done,
+    NULL
   },
   {
     NULL,NULL,NULL,NULL
@@ -2,13 +2,73 @@
 -- oltp-tables-count - number of tables to create
 -- oltp-secondary - use secondary key instead PRIMARY key for id column
 --
+-- prepare uses the parallel prepare hooks below, so it can be run with
+-- --num-threads and resumed with --prepare-state
 --
+-- Row contents are generated from the table, row ID and --rand-seed, so rows
+-- read by a test can be checked with --validate. prepare and run must use the
+-- same --rand-seed. Tests that rewrite rows, like oltp.lua, rely on other
+-- threads never seeing a row in the middle of a transaction, so validation
+-- needs a transactional storage engine with at least READ COMMITTED
+-- isolation.
+--
+
+c_template = "###########-###########-###########-###########-###########-###########-###########-###########-###########-###########"
+pad_template = "###########-###########-###########-###########-###########"
+
+function row_k(table_id, id)
+   return sb_row_rand(1, oltp_table_size, table_id, id, 1)
+end
+
+function row_c(table_id, id)
+   return sb_row_str(c_template, table_id, id, 2)
+end
+
+function row_pad(table_id, id)
+   return sb_row_str(pad_template, table_id, id, 3)
+end
+
+-- Point select that only returns the row if it has its generated contents
+-- with --validate
+function row_select(column, table_id, id)
+   local query = "SELECT " .. column .. " FROM sbtest" .. table_id ..
+      " WHERE id=" .. id
+
+   if validate then
+      query = query .. " AND c='" .. row_c(table_id, id) .. "' AND pad='" ..
+         row_pad(table_id, id) .. "'"
+   end
+
+   return query
+end
+
+-- Fail if a query built by row_select() did not return the row
+function row_check(table_id, id, nrows)
+   if validate and nrows ~= 1 then
+      error("Validation failed on row " .. id .. " of table 'sbtest" ..
+               table_id .. "'")
+   end
+end
+
 
 function create_insert(table_id)
+   prepare_table(table_id)
+   print("Inserting " .. oltp_table_size .. " records into 'sbtest" ..
+            table_id .. "'")
+   prepare_rows(table_id, 1, oltp_table_size)
+   restart_sequence(table_id)
+end
+
+function prepare_plan()
+   set_vars()
+
+   return oltp_tables_count, oltp_table_size
+end
+
+function prepare_table(table_id)
 
    local index_name
    local i
-   local j
    local query
 
    if (oltp_secondary) then
@@ -41,6 +101,18 @@ k INTEGER DEFAULT '0' NOT NULL,
 c CHAR(120) DEFAULT '' NOT NULL,
 pad CHAR(60) DEFAULT '' NOT NULL,
 ]] .. index_name .. [[ (id)
+) ]]
+
+   elseif ((db_driver == "sqlite") or (db_driver == "mock")) then
+      -- INTEGER PRIMARY KEY is an alias for rowid and is auto-assigned
+      query = [[
+CREATE TABLE sbtest]] .. i .. [[ (
+id INTEGER NOT NULL,
+k INTEGER DEFAULT '0' NOT NULL,
+c CHAR(120) DEFAULT '' NOT NULL,
+pad CHAR(60) DEFAULT '' NOT NULL]] ..
+((oltp_secondary and "") or [[,
+PRIMARY KEY (id)]]) .. [[
 ) ]]
 
    elseif (db_driver == "drizzle") then
@@ -59,50 +131,72 @@ pad CHAR(60) DEFAULT '' NOT NULL,
 
    db_query(query)
 
+   if (db_driver == "sqlite" and oltp_secondary) then
+      db_query("CREATE INDEX xid_" .. i .. " on sbtest" .. i .. "(id)")
+   end
+
    db_query("CREATE INDEX k_" .. i .. " on sbtest" .. i .. "(k)")
 
-   print("Inserting " .. oltp_table_size .. " records into 'sbtest" .. i .. "'")
+end
 
-   if (oltp_auto_inc) then
-      db_bulk_insert_init("INSERT INTO sbtest" .. i .. "(k, c, pad) VALUES")
-   else
-      db_bulk_insert_init("INSERT INTO sbtest" .. i .. "(id, k, c, pad) VALUES")
+function prepare_rows(table_id, first, last)
+
+   local j
+
+   -- Remove rows left by an interrupted prepare
+   if (prepare_state ~= "") then
+      db_query("DELETE FROM sbtest" .. table_id .. " WHERE id BETWEEN " ..
+                  first .. " AND " .. last)
    end
 
-   local c_val
-   local pad_val
+   db_bulk_insert_init("INSERT INTO sbtest" .. table_id ..
+                          "(id, k, c, pad) VALUES")
 
+   for j = first,last do
+      db_bulk_insert_row(j, row_k(table_id, j), row_c(table_id, j),
+                         row_pad(table_id, j))
+   end
 
-   for j = 1,oltp_table_size do
+   db_bulk_insert_done()
 
-   c_val = sb_rand_str([[
-###########-###########-###########-###########-###########-###########-###########-###########-###########-###########]])
-   pad_val = sb_rand_str([[
-###########-###########-###########-###########-###########]])
+end
+
+-- A range recorded by an earlier prepare is kept if all its rows are there
+function prepare_check(table_id, first, last)
+   return db_query("SELECT id FROM sbtest" .. table_id .. " WHERE id " ..
+                      "BETWEEN " .. first .. " AND " .. last) ==
+      last - first + 1
+end
 
-      if (oltp_auto_inc) then
-	 db_bulk_insert_next("(" .. sb_rand(1, oltp_table_size) .. ", '".. c_val .."', '" .. pad_val .. "')")
-      else
-	 db_bulk_insert_next("("..j.."," .. sb_rand(1, oltp_table_size) .. ",'".. c_val .."', '" .. pad_val .. "'  )")
-      end
+-- Rows are inserted with explicit IDs, start the sequence after them
+function restart_sequence(table_id)
+   if (db_driver == "pgsql" and oltp_auto_inc) then
+      db_query("ALTER SEQUENCE sbtest" .. table_id .. "_id_seq RESTART WITH " ..
+                  oltp_table_size + 1)
    end
+end
 
-   db_bulk_insert_done()
+-- Sequences are restarted once all rows are prepared, this also covers
+-- tables created by an earlier prepare and topped up later
+function prepare_done()
+   local i
 
+   db_connect()
+
+   for i = 1, oltp_tables_count do
+      restart_sequence(i)
+   end
 
 end
 
 
 function prepare()
-   local query
    local i
-   local j
 
    set_vars()
 
    db_connect()
 
-
    for i = 1,oltp_tables_count do
      create_insert(i)
    end
@@ -119,6 +213,11 @@ function cleanup()
    print("Dropping table 'sbtest" .. i .. "'...")
    db_query("DROP TABLE sbtest".. i )
    end
+
+   -- Nothing recorded by an earlier prepare is left
+   if (prepare_state ~= "") then
+      os.remove(prepare_state)
+   end
 end
 
 function set_vars()
@@ -151,4 +250,10 @@ function set_vars()
       oltp_skip_trx = false
    end
 
+   if (oltp_pipeline == 'on') then
+      oltp_pipeline = true
+   else
+      oltp_pipeline = false
+   end
+
 end
@@ -21,7 +21,7 @@ function event(thread_id)
    pad_val = sb_rand_str([[
 ###########-###########-###########-###########-###########]])
 
-   if (db_driver == "pgsql" and oltp_auto_inc) then
+   if ((db_driver == "pgsql" or db_driver == "sqlite") and oltp_auto_inc) then
       rs = db_query("INSERT INTO " .. table_name .. " (k, c, pad) VALUES " ..
                        string.format("(%d, '%s', '%s')", k_val, c_val, pad_val))
    else
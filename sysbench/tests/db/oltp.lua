@@ -13,44 +13,77 @@ function thread_init(thread_id)
       commit_query = "COMMIT"
    end
 
+   -- Rows are deleted and re-inserted, without a transaction other threads
+   -- may find them missing
+   if validate and oltp_skip_trx and not oltp_read_only then
+      error("--validate cannot be used with --oltp-skip-trx=on")
+   end
+
 end
 
 function event(thread_id)
    local rs
    local i
+   local table_id
    local table_name
+   local id
+   local ids = {}
    local range_start
    local c_val
    local pad_val
    local query
+   local select_query
 
-   table_name = "sbtest".. sb_rand_uniform(1, oltp_tables_count)
+   -- With --oltp-pipeline=on all selects are sent before collecting results
+   if oltp_pipeline then
+      select_query = db_send_query
+   else
+      select_query = db_query
+   end
+
+   table_id = sb_rand_uniform(1, oltp_tables_count)
+   table_name = "sbtest".. table_id
    if not oltp_skip_trx then
       db_query(begin_query)
    end
 
    for i=1, oltp_point_selects do
-      rs = db_query("SELECT c FROM ".. table_name .." WHERE id=" .. sb_rand(1, oltp_table_size))
+      ids[i] = sb_rand(1, oltp_table_size)
+      rs = select_query(row_select("c", table_id, ids[i]))
+      if not oltp_pipeline then
+         row_check(table_id, ids[i], rs)
+      end
    end
 
    for i=1, oltp_simple_ranges do
       range_start = sb_rand(1, oltp_table_size)
-      rs = db_query("SELECT c FROM ".. table_name .." WHERE id BETWEEN " .. range_start .. " AND " .. range_start .. "+" .. oltp_range_size - 1)
+      rs = select_query("SELECT c FROM ".. table_name .." WHERE id BETWEEN " .. range_start .. " AND " .. range_start .. "+" .. oltp_range_size - 1)
    end
   
    for i=1, oltp_sum_ranges do
       range_start = sb_rand(1, oltp_table_size)
-      rs = db_query("SELECT SUM(K) FROM ".. table_name .." WHERE id BETWEEN " .. range_start .. " AND " .. range_start .. "+" .. oltp_range_size - 1)
+      rs = select_query("SELECT SUM(K) FROM ".. table_name .." WHERE id BETWEEN " .. range_start .. " AND " .. range_start .. "+" .. oltp_range_size - 1)
    end
    
    for i=1, oltp_order_ranges do
       range_start = sb_rand(1, oltp_table_size)
-      rs = db_query("SELECT c FROM ".. table_name .." WHERE id BETWEEN " .. range_start .. " AND " .. range_start .. "+" .. oltp_range_size - 1 .. " ORDER BY c")
+      rs = select_query("SELECT c FROM ".. table_name .." WHERE id BETWEEN " .. range_start .. " AND " .. range_start .. "+" .. oltp_range_size - 1 .. " ORDER BY c")
    end
 
    for i=1, oltp_distinct_ranges do
       range_start = sb_rand(1, oltp_table_size)
-      rs = db_query("SELECT DISTINCT c FROM ".. table_name .." WHERE id BETWEEN " .. range_start .. " AND " .. range_start .. "+" .. oltp_range_size - 1 .. " ORDER BY c")
+      rs = select_query("SELECT DISTINCT c FROM ".. table_name .." WHERE id BETWEEN " .. range_start .. " AND " .. range_start .. "+" .. oltp_range_size - 1 .. " ORDER BY c")
+   end
+
+   if oltp_pipeline then
+      for i=1, oltp_point_selects + oltp_simple_ranges + oltp_sum_ranges +
+         oltp_order_ranges + oltp_distinct_ranges do
+         rs = db_get_result()
+         -- Results of point selects come first
+         if i <= tonumber(oltp_point_selects) then
+            row_check(table_id, ids[i], rs)
+         end
+      end
    end
 
    if not oltp_read_only then
@@ -59,23 +92,29 @@ function event(thread_id)
       rs = db_query("UPDATE " .. table_name .. " SET k=k+1 WHERE id=" .. sb_rand(1, oltp_table_size))
    end
 
+   -- With --validate rows are written with their generated contents
    for i=1, oltp_non_index_updates do
-      c_val = sb_rand_str("###########-###########-###########-###########-###########-###########-###########-###########-###########-###########")
-      query = "UPDATE " .. table_name .. " SET c='" .. c_val .. "' WHERE id=" .. sb_rand(1, oltp_table_size)
-      rs = db_query(query)
-      if rs then
-        print(query)
+      id = sb_rand(1, oltp_table_size)
+      if validate then
+         c_val = row_c(table_id, id)
+      else
+         c_val = sb_rand_str(c_template)
       end
+      query = "UPDATE " .. table_name .. " SET c='" .. c_val .. "' WHERE id=" .. id
+      rs = db_query(query)
    end
 
    i = sb_rand(1, oltp_table_size)
 
    rs = db_query("DELETE FROM " .. table_name .. " WHERE id=" .. i)
    
-   c_val = sb_rand_str([[
-###########-###########-###########-###########-###########-###########-###########-###########-###########-###########]])
-   pad_val = sb_rand_str([[
-###########-###########-###########-###########-###########]])
+   if validate then
+      c_val = row_c(table_id, i)
+      pad_val = row_pad(table_id, i)
+   else
+      c_val = sb_rand_str(c_template)
+      pad_val = sb_rand_str(pad_template)
+   end
 
    rs = db_query("INSERT INTO " .. table_name ..  " (id, k, c, pad) VALUES " .. string.format("(%d, %d, '%s', '%s')",i, sb_rand(1, oltp_table_size) , c_val, pad_val))
 
@@ -8,8 +8,11 @@ function thread_init(thread_id)
 end
 
 function event(thread_id)
-   local table_name
-   table_name = "sbtest".. sb_rand_uniform(1, oltp_tables_count)
+   local table_id
+   local id
+   table_id = sb_rand_uniform(1, oltp_tables_count)
+   id = sb_rand(1, oltp_table_size)
 
-   rs = db_query("SELECT c FROM ".. table_name .." WHERE id=" .. sb_rand(1, oltp_table_size))
+   rs = db_query(row_select("c", table_id, id))
+   row_check(table_id, id, rs)
 end
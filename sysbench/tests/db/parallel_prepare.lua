@@ -1,5 +1,8 @@
 -- for proper initialization use --max-requests = N, where N is --num-threads
 --
+-- the prepare command of the tests using common.lua runs in parallel with
+-- --num-threads itself, this script is kept for compatibility
+--
 pathtest = string.match(test, "(.*/)") or ""
 
 dofile(pathtest .. "common.lua")
@@ -45,6 +45,16 @@ function prepare()
           PRIMARY KEY (id)
         ) ]]
 
+   elseif ((db_driver == "sqlite") or (db_driver == "mock")) then
+      query = [[
+        CREATE TABLE sbtest (
+          id INTEGER NOT NULL,
+          k INTEGER DEFAULT '0' NOT NULL,
+          c CHAR(120) DEFAULT '' NOT NULL,
+          pad CHAR(60) DEFAULT '' NOT NULL,
+          PRIMARY KEY (id)
+        ) ]]
+
    elseif (db_driver == "drizzle") then
       query = [[
         CREATE TABLE sbtest (
@@ -7,11 +7,18 @@ function thread_init(thread_id)
 end
 
 function event(thread_id)
-   local table_name
+   local table_id
+   local id
    local c_val
    local query
-   table_name = "sbtest".. sb_rand_uniform(1, oltp_tables_count)
-   c_val = sb_rand_str("###########-###########-###########-###########-###########-###########-###########-###########-###########-###########")
-   query = "UPDATE " .. table_name .. " SET c='" .. c_val .. "' WHERE id=" .. sb_rand(1, oltp_table_size)
+   table_id = sb_rand_uniform(1, oltp_tables_count)
+   id = sb_rand(1, oltp_table_size)
+   -- Keep rows valid for --validate
+   if validate then
+      c_val = row_c(table_id, id)
+   else
+      c_val = sb_rand_str(c_template)
+   end
+   query = "UPDATE sbtest" .. table_id .. " SET c='" .. c_val .. "' WHERE id=" .. id
    rs = db_query(query)
 end
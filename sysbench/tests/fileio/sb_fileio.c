@@ -60,6 +60,7 @@
 #include "sysbench.h"
 #include "crc32.h"
 #include "sb_percentile.h"
+#include "sb_sysstat.h"
 
 /* Lengths of the checksum and the offset fields in a block */
 #define FILE_CHECKSUM_LENGTH sizeof(int)
@@ -202,6 +203,7 @@ static sb_file_request_t prev_req;
 
 /* Percentile stats for --report-interval */
 static sb_percentile_t local_percentile;
+static sb_percentile_windows_t local_windows;
 
 static sb_arg_t fileio_args[] = {
   {"file-num", "number of files to create", SB_ARG_TYPE_INT, "128"},
@@ -262,7 +264,8 @@ static sb_test_t fileio_test =
      NULL,
 #endif
     NULL,
-    file_done
+    file_done,
+    NULL
   },
   {
    NULL,
@@ -341,6 +344,12 @@ int file_init(void)
   if (sb_percentile_init(&local_percentile, 100000, 1.0, 1e13))
     return 1;
 
+  if (sb_percentile_windows_init(&local_windows, &local_percentile,
+                                 sb_globals.report_windows,
+                                 sb_globals.n_report_windows,
+                                 sb_globals.report_interval))
+    return 1;
+
   return 0;
 }
 
@@ -404,6 +413,7 @@ int file_done(void)
 
   free(per_thread);
 
+  sb_percentile_windows_done(&local_windows);
   sb_percentile_done(&local_percentile);
 
   return 0;
@@ -849,6 +859,8 @@ void file_print_stats(sb_stat_t type)
 {
   double seconds;
   char   s1[16], s2[16], s3[16], s4[16];
+  char   windows[256];
+  char   sysstat[SB_SYSSTAT_MAX_LINE];
   unsigned long long diff_read;
   unsigned long long diff_written;
   unsigned long long diff_other_ops;
@@ -870,15 +882,20 @@ void file_print_stats(sb_stat_t type)
 
       SB_THREAD_MUTEX_UNLOCK();
 
+      sb_percentile_windows_update(&local_windows, &local_percentile);
+      sb_percentile_windows_format(&local_windows, sb_globals.percentile_rank,
+                                   3, windows, sizeof(windows));
+      sb_sysstat_format(sysstat, sizeof(sysstat));
+
       log_timestamp(LOG_NOTICE, &sb_globals.exec_timer,
                     "reads: %4.2f MB/s writes: %4.2f MB/s fsyncs: %4.2f/s "
-                    "response time: %4.3fms (%u%%)",
+                    "response time: %4.3fms (%u%%)%s%s",
                     diff_read / megabyte / seconds,
                     diff_written / megabyte / seconds,
                     diff_other_ops / seconds,
                     NS2MS(sb_percentile_calculate(&local_percentile,
                                                   sb_globals.percentile_rank)),
-                    sb_globals.percentile_rank);
+                    sb_globals.percentile_rank, windows, sysstat);
 
       sb_percentile_reset(&local_percentile);
 
@@ -886,23 +903,45 @@ void file_print_stats(sb_stat_t type)
     }
 
   case SB_STAT_CUMULATIVE:
-    seconds = NS2SEC(sb_timer_split(&sb_globals.cumulative_timer1));
+    {
+      int                nread, nwritten, nother;
+      unsigned long long nbytes_read, nbytes_written;
 
-    log_text(LOG_NOTICE,
-             "Operations performed:  %d reads, %d writes, %d Other = %d Total",
-             read_ops, write_ops, other_ops, read_ops + write_ops + other_ops);
-    log_text(LOG_NOTICE, "Read %sb  Written %sb  Total transferred %sb  "
-             "(%sb/sec)",
-             sb_print_value_size(s1, sizeof(s1), bytes_read),
-             sb_print_value_size(s2, sizeof(s2), bytes_written),
-             sb_print_value_size(s3, sizeof(s3), bytes_read + bytes_written),
-             sb_print_value_size(s4, sizeof(s4),
-                                 (bytes_read + bytes_written) / seconds));
-    log_text(LOG_NOTICE, "%8.2f Requests/sec executed",
-             (read_ops + write_ops) / seconds);
-    clear_stats();
+      /*
+        Take a consistent snapshot, workers may still be running. Locking is
+        skipped on forced shutdown, which runs from a signal handler.
+      */
+      if (!sb_globals.forced_shutdown_in_progress)
+        SB_THREAD_MUTEX_LOCK();
 
-    break;
+      seconds = NS2SEC(sb_timer_split(&sb_globals.cumulative_timer1));
+
+      nread = read_ops;
+      nwritten = write_ops;
+      nother = other_ops;
+      nbytes_read = bytes_read;
+      nbytes_written = bytes_written;
+      clear_stats();
+
+      if (!sb_globals.forced_shutdown_in_progress)
+        SB_THREAD_MUTEX_UNLOCK();
+
+      log_text(LOG_NOTICE,
+               "Operations performed:  %d reads, %d writes, %d Other = "
+               "%d Total", nread, nwritten, nother, nread + nwritten + nother);
+      log_text(LOG_NOTICE, "Read %sb  Written %sb  Total transferred %sb  "
+               "(%sb/sec)",
+               sb_print_value_size(s1, sizeof(s1), nbytes_read),
+               sb_print_value_size(s2, sizeof(s2), nbytes_written),
+               sb_print_value_size(s3, sizeof(s3),
+                                   nbytes_read + nbytes_written),
+               sb_print_value_size(s4, sizeof(s4),
+                                   (nbytes_read + nbytes_written) / seconds));
+      log_text(LOG_NOTICE, "%8.2f Requests/sec executed",
+               (nread + nwritten) / seconds);
+
+      break;
+    }
   }
 }
 
@@ -24,6 +24,7 @@
 #endif
 
 #include "sysbench.h"
+#include "sb_sysstat.h"
 
 #ifdef HAVE_SYS_IPC_H
 # include <sys/ipc.h>
@@ -74,6 +75,7 @@ static sb_test_t memory_test =
     memory_print_stats,
     NULL,
     NULL,
+    NULL,
     NULL
   },
   {
@@ -365,31 +367,54 @@ void memory_print_stats(sb_stat_t type)
 {
   double       seconds;
   const double megabyte = 1024.0 * 1024.0;
+  char         sysstat[SB_SYSSTAT_MAX_LINE];
 
   switch (type) {
   case SB_STAT_INTERMEDIATE:
+    sb_sysstat_format(sysstat, sizeof(sysstat));
+
     SB_THREAD_MUTEX_LOCK();
     seconds = NS2SEC(sb_timer_split(&sb_globals.exec_timer));
 
     log_timestamp(LOG_NOTICE, &sb_globals.exec_timer,
-                  "%4.2f MB/sec,",
-                  (double)(total_bytes - last_bytes) / megabyte / seconds);
+                  "%4.2f MB/sec,%s",
+                  (double)(total_bytes - last_bytes) / megabyte / seconds,
+                  /* Keep the original line, which already ends with ',' */
+                  sysstat[0] != '\0' ? sysstat + 1 : "");
     last_bytes = total_bytes;
     SB_THREAD_MUTEX_UNLOCK();
 
     break;
 
   case SB_STAT_CUMULATIVE:
-    seconds = NS2SEC(sb_timer_split(&sb_globals.cumulative_timer1));
-
-    log_text(LOG_NOTICE, "Operations performed: %d (%8.2f ops/sec)\n",
-             total_ops, total_ops / seconds);
-    if (memory_oper != SB_MEM_OP_NONE)
-      log_text(LOG_NOTICE, "%4.2f MB transferred (%4.2f MB/sec)\n",
-               total_bytes / megabyte,
-               total_bytes / megabyte / seconds);
-    total_ops = 0;
-    total_bytes = 0;
+    {
+      unsigned int nops;
+      long long    nbytes;
+
+      /*
+        Take a consistent snapshot, workers may still be running. Locking is
+        skipped on forced shutdown, which runs from a signal handler.
+      */
+      if (!sb_globals.forced_shutdown_in_progress)
+        SB_THREAD_MUTEX_LOCK();
+
+      seconds = NS2SEC(sb_timer_split(&sb_globals.cumulative_timer1));
+
+      nops = total_ops;
+      nbytes = total_bytes;
+      total_ops = 0;
+      total_bytes = 0;
+      last_bytes = 0;
+
+      if (!sb_globals.forced_shutdown_in_progress)
+        SB_THREAD_MUTEX_UNLOCK();
+
+      log_text(LOG_NOTICE, "Operations performed: %d (%8.2f ops/sec)\n",
+               nops, nops / seconds);
+      if (memory_oper != SB_MEM_OP_NONE)
+        log_text(LOG_NOTICE, "%4.2f MB transferred (%4.2f MB/sec)\n",
+                 nbytes / megabyte, nbytes / megabyte / seconds);
+    }
     /*
       So that intermediate stats are calculated from the current moment
       rather than from the previous intermediate report
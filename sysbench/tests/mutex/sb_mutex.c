@@ -69,7 +69,8 @@ static sb_test_t mutex_test =
      NULL,
      NULL,
      NULL,
-     mutex_done
+     mutex_done,
+     NULL
   },
   {
      NULL,
@@ -73,6 +73,7 @@ static sb_test_t threads_test =
     NULL,
     NULL,
     threads_cleanup,
+    NULL
   },
   {
     NULL,